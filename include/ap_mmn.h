@@ -316,6 +316,31 @@
  *                         Axe mpm_note_child_killed hook, change
  *                         ap_reclaim_child_process and ap_recover_child_process
  *                         interfaces.
+ * 20110329.1 (2.3.12-dev) Add latency to proxy_worker_shared
+ * 20110329.2 (2.3.12-dev) Change proxy_worker_shared.busy to apr_uint32_t, add
+ *                         lockfree to proxy_balancer_shared and choose() to
+ *                         proxy_balancer_method
+ * 20110329.3 (2.3.12-dev) Add hashkey to proxy_balancer_shared
+ * 20110329.4 (2.3.12-dev) Add health check fields to proxy_worker_shared,
+ *                         PROXY_WORKER_HC_FAIL status flag
+ * 20110329.5 (2.3.12-dev) Add spool_dir to proxy_server_conf
+ * 20110329.6 (2.3.12-dev) Add ap_vhost_lookup_name()
+ * 20110329.7 (2.3.12-dev) Add CONN_STATE_HANDSHAKE to conn_state_e
+ * 20110329.8 (2.3.12-dev) Add adaptive thresholds and syscall counters to
+ *                         core_output_filter_ctx_t, add conn_writev,
+ *                         conn_sendfile, conn_eagain and conn_written to
+ *                         worker_score
+ * 20110329.9 (2.3.12-dev) Add histogram_key, histogram_score, histogram_keys and
+ *                         histograms to scoreboard, ap_get_scoreboard_histogram_key(),
+ *                         ap_get_scoreboard_histogram(), ap_histogram_bucket() and
+ *                         ap_histogram_bucket_max()
+ * 20110329.10 (2.3.12-dev) Add ready, busy, access_count and kbytes_served to
+ *                         process_score, add counted_as to worker_score
+ * 20110329.11 (2.3.12-dev) Add elected_recent and elected_sec to proxy_worker_shared
+ * 20110329.12 (2.3.12-dev) Add ap_proxy_random()
+ * 20110329.13 (2.3.12-dev) Add AP_HISTOGRAM_VHOST_KEYS and
+ *                         AP_HISTOGRAM_HANDLER_KEYS, raise AP_HISTOGRAM_STRIPES,
+ *                         add histogram_overflow to global_score
  */
 
 #define MODULE_MAGIC_COOKIE 0x41503234UL /* "AP24" */
@@ -323,7 +348,7 @@
 #ifndef MODULE_MAGIC_NUMBER_MAJOR
 #define MODULE_MAGIC_NUMBER_MAJOR 20110329
 #endif
-#define MODULE_MAGIC_NUMBER_MINOR 0                    /* 0...n */
+#define MODULE_MAGIC_NUMBER_MINOR 13                   /* 0...n */
 
 /**
  * Determine if the server's current MODULE_MAGIC_NUMBER is at least a
@@ -86,6 +86,18 @@ AP_DECLARE(int) ap_vhost_iterate_given_conn(conn_rec *conn,
                                             ap_vhost_iterate_conn_cb func_cb,
                                             void* baton);
 
+/**
+ * Find the first name-based virtual host on this connection whose
+ * ServerName or ServerAlias matches the given name, as iterating them
+ * with ap_vhost_iterate_given_conn() would, but using the name index
+ * built at configuration time.
+ * @param conn The current connection
+ * @param host The host name to look up (e.g. from TLS SNI)
+ * @return The matching server, or NULL if none matches
+ */
+AP_DECLARE(server_rec *) ap_vhost_lookup_name(conn_rec *conn,
+                                              const char *host);
+
 /**
  * given an ip address only, give our best guess as to what vhost it is 
  * @param conn The current connection
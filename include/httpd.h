@@ -1133,7 +1133,10 @@ typedef enum  {
     CONN_STATE_HANDLER,
     CONN_STATE_WRITE_COMPLETION,
     CONN_STATE_SUSPENDED,
-    CONN_STATE_LINGER
+    CONN_STATE_LINGER,
+    CONN_STATE_HANDSHAKE        /* connection-level filters (e.g. TLS)
+                                 * still initializing; async MPMs park
+                                 * the socket until it is readable */
 } conn_state_e;
 
 /** 
@@ -1277,6 +1280,16 @@ typedef struct core_output_filter_ctx {
     apr_pool_t *deferred_write_pool;
     apr_size_t bytes_in;
     apr_size_t bytes_written;
+    /** write thresholds of the connection, adapted to its throughput */
+    apr_size_t min_write;
+    apr_size_t max_buffer;
+    /** bytes_written when the thresholds were last adapted */
+    apr_size_t sampled_at;
+    /** number of writev() and sendfile() calls, and of those which
+     *  returned EAGAIN */
+    apr_uint32_t writev_calls;
+    apr_uint32_t sendfile_calls;
+    apr_uint32_t eagain_count;
 } core_output_filter_ctx_t;
  
 typedef struct core_filter_ctx {
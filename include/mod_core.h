@@ -61,6 +61,10 @@ apr_status_t ap_http_outerror_filter(ap_filter_t *f,
 
 char *ap_response_code_string(request_rec *r, int error_index);
 
+/* Whether date is the Last-Modified date of the file of a request, from
+ * the validator cache of http_etag.c. */
+int ap_is_file_last_modified(request_rec *r, const char *date);
+
 /**
  * Send the minimal part of an HTTP response header.
  * @param r The current request
@@ -116,6 +116,13 @@ struct worker_score {
     char client[32];		/* Keep 'em small... */
     char request[64];		/* We just want an idea... */
     char vhost[32];	        /* What virtual host is being accessed? */
+    /* output system calls of the current connection */
+    apr_uint32_t  conn_writev;
+    apr_uint32_t  conn_sendfile;
+    apr_uint32_t  conn_eagain;      /* calls which returned EAGAIN */
+    apr_off_t     conn_written;     /* bytes written by those calls */
+    /* whether the worker is counted as ready or busy by its process */
+    volatile apr_uint32_t counted_as;
 };
 
 typedef struct {
@@ -126,6 +133,9 @@ typedef struct {
                                          * should still be serving requests.
                                          */
     apr_time_t restart_time;
+    /* requests left out of the histograms of a kind for lack of room,
+     * since the last restart, by AP_HISTOGRAM_VHOST or _HANDLER - 1 */
+    volatile apr_uint32_t histogram_overflow[2];
 } global_score;
 
 /* stuff which the parent generally writes and the children rarely read */
@@ -136,8 +146,55 @@ struct process_score {
     int quiescing;          /* the process whose pid is stored above is
                              * going down gracefully
                              */
+    /* Kept up to date by the workers of the slot, so that the totals of
+     * the server can be had without walking every worker_score.  The
+     * counters wrap around; access_count and kbytes_served are only
+     * maintained with ExtendedStatus.
+     */
+    volatile apr_uint32_t ready;        /* workers ready for a connection */
+    volatile apr_uint32_t busy;         /* workers serving one */
+    volatile apr_uint32_t access_count;
+    volatile apr_uint32_t kbytes_served;
 };
 
+/* Request histograms: the latency and the response size of the requests
+ * are counted per virtual host and per handler, in fixed log-linear
+ * buckets of a quarter of a power of two (values below 4 have a bucket
+ * each, the last bucket takes everything from 2^32 * 1.75 up).  Each
+ * histogram_key names one virtual host ("host:port") or handler and owns
+ * AP_HISTOGRAM_STRIPES histogram_scores; the threads and processes of the
+ * server increment the stripe of their slot with atomic operations and
+ * readers sum up the stripes.
+ *
+ * The keys of the virtual hosts come first, the AP_HISTOGRAM_HANDLER_KEYS
+ * of the handlers follow; each kind is a hash table of its own, so that
+ * many names of one kind cannot take the room of the other.  The requests
+ * of a name that finds no room within a few entries of its hash are
+ * counted in histogram_overflow of the global_score instead.
+ */
+#define AP_HISTOGRAM_BUCKETS        128
+#define AP_HISTOGRAM_VHOST_KEYS     128
+#define AP_HISTOGRAM_HANDLER_KEYS   32
+#define AP_HISTOGRAM_KEYS           (AP_HISTOGRAM_VHOST_KEYS \
+                                     + AP_HISTOGRAM_HANDLER_KEYS)
+#define AP_HISTOGRAM_STRIPES        16
+#define AP_HISTOGRAM_NAME_LEN       48
+
+#define AP_HISTOGRAM_VHOST      1
+#define AP_HISTOGRAM_HANDLER    2
+
+typedef struct {
+    volatile apr_uint32_t state;    /* free, being claimed or in use */
+    apr_uint32_t hash;
+    int kind;                       /* AP_HISTOGRAM_VHOST or _HANDLER */
+    char name[AP_HISTOGRAM_NAME_LEN];
+} histogram_key;
+
+typedef struct {
+    volatile apr_uint32_t time[AP_HISTOGRAM_BUCKETS];   /* microseconds */
+    volatile apr_uint32_t size[AP_HISTOGRAM_BUCKETS];   /* bytes sent */
+} histogram_score;
+
 /* Scoreboard is now in 'local' memory, since it isn't updated once created,
  * even in forked architectures.  Child created-processes (non-fork) will
  * set up these indicies into the (possibly relocated) shmem records.
@@ -146,6 +203,8 @@ typedef struct {
     global_score *global;
     process_score *parent;
     worker_score **servers;
+    histogram_key *histogram_keys;      /* AP_HISTOGRAM_KEYS */
+    histogram_score *histograms;        /* AP_HISTOGRAM_STRIPES per key */
 } scoreboard;
 
 typedef struct ap_sb_handle_t ap_sb_handle_t;
@@ -175,6 +234,32 @@ AP_DECLARE(worker_score *) ap_get_scoreboard_worker_from_indexes(int child_num,
 AP_DECLARE(process_score *) ap_get_scoreboard_process(int x);
 AP_DECLARE(global_score *) ap_get_scoreboard_global(void);
 
+/**
+ * Get the key of a request histogram
+ * @param key The index of the key, 0 to AP_HISTOGRAM_KEYS - 1
+ * @return The key, or NULL if it is not in use
+ */
+AP_DECLARE(histogram_key *) ap_get_scoreboard_histogram_key(int key);
+
+/**
+ * Get one stripe of the counters of a request histogram
+ * @param key The index of the key
+ * @param stripe The stripe, 0 to AP_HISTOGRAM_STRIPES - 1
+ */
+AP_DECLARE(histogram_score *) ap_get_scoreboard_histogram(int key, int stripe);
+
+/**
+ * Get the histogram bucket which counts a value
+ * @param value The latency in microseconds or the size in bytes
+ */
+AP_DECLARE(int) ap_histogram_bucket(apr_uint64_t value);
+
+/**
+ * Get the largest value counted in a histogram bucket
+ * @param bucket The bucket, 0 to AP_HISTOGRAM_BUCKETS - 1
+ */
+AP_DECLARE(apr_uint64_t) ap_histogram_bucket_max(int bucket);
+
 AP_DECLARE_DATA extern scoreboard *ap_scoreboard_image;
 AP_DECLARE_DATA extern const char *ap_scoreboard_fname;
 AP_DECLARE_DATA extern int ap_extended_status;
@@ -196,7 +196,8 @@ static apr_status_t reqtimeout_filter(ap_filter_t *f,
     if (block == APR_NONBLOCK_READ || mode == AP_MODE_INIT
         || mode == AP_MODE_EATCRLF) {
         rv = ap_get_brigade(f->next, bb, mode, block, readbytes);
-        if (ccfg->min_rate > 0 && rv == APR_SUCCESS) {
+        if (ccfg->min_rate > 0 && rv == APR_SUCCESS
+            && mode != AP_MODE_SPECULATIVE) {
             extend_timeout(ccfg, bb);
         }
         return rv;
@@ -288,7 +289,10 @@ static apr_status_t reqtimeout_filter(ap_filter_t *f,
     else {
         /* mode != AP_MODE_GETLINE */
         rv = ap_get_brigade(f->next, bb, mode, block, readbytes);
-        if (ccfg->min_rate > 0 && rv == APR_SUCCESS) {
+        /* Data peeked at with AP_MODE_SPECULATIVE stays in the input
+         * and is counted when it is actually read */
+        if (ccfg->min_rate > 0 && rv == APR_SUCCESS
+            && mode != AP_MODE_SPECULATIVE) {
             extend_timeout(ccfg, bb);
         }
     }
@@ -33,6 +33,9 @@
  * /server-status?refresh - Returns page with 1 second refresh
  * /server-status?refresh=6 - Returns page with refresh every 6 seconds
  * /server-status?auto - Returns page with data for automatic parsing
+ * /server-status?histograms - Returns the buckets of the request histograms
+ * /server-status?metrics - Returns the totals in the Prometheus text format
+ * /server-status?metrics=slots - Adds the state of every worker
  *
  * Mark Cox, mark@ukweb.com, November 1995
  *
@@ -71,6 +74,7 @@
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 #include "apr_strings.h"
+#include "apr_atomic.h"
 
 #define STATUS_MAXLINE 64
 
@@ -157,6 +161,8 @@ static void show_time(request_rec *r, apr_interval_time_t tsecs)
 #define STAT_OPT_REFRESH  0
 #define STAT_OPT_NOTABLE  1
 #define STAT_OPT_AUTO     2
+#define STAT_OPT_HISTOGRAMS 3
+#define STAT_OPT_METRICS  4
 
 struct stat_opt {
     int id;
@@ -169,6 +175,8 @@ static const struct stat_opt status_options[] = /* see #defines above */
     {STAT_OPT_REFRESH, "refresh", "Refresh"},
     {STAT_OPT_NOTABLE, "notable", NULL},
     {STAT_OPT_AUTO, "auto", NULL},
+    {STAT_OPT_HISTOGRAMS, "histograms", NULL},
+    {STAT_OPT_METRICS, "metrics", NULL},
     {STAT_OPT_END, NULL, NULL}
 };
 
@@ -178,6 +186,453 @@ static const struct stat_opt status_options[] = /* see #defines above */
 
 static char status_flags[MOD_STATUS_NUM_STATUS];
 
+/* A request histogram of the scoreboard summed up over its stripes, and
+ * over the keys of the same name */
+typedef struct {
+    int kind;
+    const char *name;
+    apr_uint64_t count;
+    apr_uint64_t time[AP_HISTOGRAM_BUCKETS];
+    apr_uint64_t size[AP_HISTOGRAM_BUCKETS];
+} status_histogram;
+
+static int histogram_cmp(const void *a, const void *b)
+{
+    const status_histogram *ha = a, *hb = b;
+
+    if (ha->kind != hb->kind) {
+        return ha->kind - hb->kind;
+    }
+    return strcmp(ha->name, hb->name);
+}
+
+static apr_array_header_t *collect_histograms(apr_pool_t *p)
+{
+    apr_array_header_t *hists = apr_array_make(p, 16,
+                                               sizeof(status_histogram));
+    int i, j, k;
+
+    for (i = 0; i < AP_HISTOGRAM_KEYS; i++) {
+        histogram_key *key = ap_get_scoreboard_histogram_key(i);
+        status_histogram *h = NULL;
+
+        if (!key) {
+            continue;
+        }
+        for (j = 0; j < hists->nelts; j++) {
+            status_histogram *o = &APR_ARRAY_IDX(hists, j, status_histogram);
+
+            if (o->kind == key->kind
+                && !strncmp(o->name, key->name, sizeof(key->name))) {
+                h = o;
+                break;
+            }
+        }
+        if (!h) {
+            h = apr_array_push(hists);
+            h->kind = key->kind;
+            h->name = apr_pstrndup(p, key->name, sizeof(key->name));
+        }
+
+        for (j = 0; j < AP_HISTOGRAM_STRIPES; j++) {
+            histogram_score *hs = ap_get_scoreboard_histogram(i, j);
+
+            for (k = 0; k < AP_HISTOGRAM_BUCKETS; k++) {
+                h->count += hs->time[k];
+                h->time[k] += hs->time[k];
+                h->size[k] += hs->size[k];
+            }
+        }
+    }
+
+    qsort(hists->elts, hists->nelts, hists->elt_size, histogram_cmp);
+    return hists;
+}
+
+/* The largest value of the bucket which holds the q quantile; the last
+ * bucket, which has no upper end, reports where it starts. */
+static apr_uint64_t histogram_quantile(const apr_uint64_t *buckets,
+                                       apr_uint64_t count, double q)
+{
+    apr_uint64_t rank = count - (apr_uint64_t)((1.0 - q) * count);
+    apr_uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < AP_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return ap_histogram_bucket_max(i);
+        }
+    }
+    return ap_histogram_bucket_max(AP_HISTOGRAM_BUCKETS - 2) + 1;
+}
+
+static const char *histogram_kind(int kind)
+{
+    return kind == AP_HISTOGRAM_VHOST ? "vhost" : "handler";
+}
+
+static void show_histograms(request_rec *r, int short_report,
+                            int no_table_report)
+{
+    apr_array_header_t *hists = collect_histograms(r->pool);
+    global_score *gs = ap_get_scoreboard_global();
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    apr_uint32_t vhost_overflow, handler_overflow;
+    int i, q;
+
+    vhost_overflow = apr_atomic_read32(&gs->histogram_overflow[0]);
+    handler_overflow = apr_atomic_read32(&gs->histogram_overflow[1]);
+
+    if (hists->nelts == 0 && !vhost_overflow && !handler_overflow) {
+        return;
+    }
+
+    if (short_report) {
+        if (vhost_overflow || handler_overflow) {
+            ap_rprintf(r, "HistogramOverflowVHost: %u\n"
+                          "HistogramOverflowHandler: %u\n",
+                       vhost_overflow, handler_overflow);
+        }
+        for (i = 0; i < hists->nelts; i++) {
+            status_histogram *h = &APR_ARRAY_IDX(hists, i, status_histogram);
+            const char *kind = h->kind == AP_HISTOGRAM_VHOST ? "VHost"
+                                                             : "Handler";
+
+            ap_rprintf(r, "%sLatency: %s %" APR_UINT64_T_FMT,
+                       kind, h->name, h->count);
+            for (q = 0; q < 4; q++) {
+                ap_rprintf(r, " %" APR_UINT64_T_FMT,
+                           histogram_quantile(h->time, h->count,
+                                              quantiles[q]));
+            }
+            ap_rprintf(r, "\n%sSize: %s %" APR_UINT64_T_FMT,
+                       kind, h->name, h->count);
+            for (q = 0; q < 4; q++) {
+                ap_rprintf(r, " %" APR_UINT64_T_FMT,
+                           histogram_quantile(h->size, h->count,
+                                              quantiles[q]));
+            }
+            ap_rputs("\n", r);
+        }
+        return;
+    }
+
+    ap_rputs("<hr /><h2>Request Latency</h2>\n\n", r);
+    if (!no_table_report) {
+        ap_rputs("<table border=\"0\"><tr><th></th><th>Name</th>"
+                 "<th>Req</th><th>50%</th><th>90%</th><th>99%</th>"
+                 "<th>99.9%</th><th>Size 50%</th><th>Size 99%</th>"
+                 "</tr>\n", r);
+    }
+    for (i = 0; i < hists->nelts; i++) {
+        status_histogram *h = &APR_ARRAY_IDX(hists, i, status_histogram);
+
+        if (no_table_report) {
+            ap_rprintf(r, "<b>%s %s</b>: %" APR_UINT64_T_FMT " requests,",
+                       histogram_kind(h->kind),
+                       ap_escape_html(r->pool, h->name), h->count);
+        }
+        else {
+            ap_rprintf(r, "<tr><td>%s</td><td nowrap>%s</td><td>%"
+                       APR_UINT64_T_FMT "</td>",
+                       histogram_kind(h->kind),
+                       ap_escape_html(r->pool, h->name), h->count);
+        }
+        for (q = 0; q < 4; q++) {
+            ap_rprintf(r, no_table_report ? " %.3f" : "<td>%.3f</td>",
+                       histogram_quantile(h->time, h->count,
+                                          quantiles[q]) / 1000.);
+        }
+        ap_rputs(no_table_report ? " ms, size " : "<td>", r);
+        format_byte_out(r, histogram_quantile(h->size, h->count, 0.5));
+        ap_rputs(no_table_report ? " / " : "</td><td>", r);
+        format_byte_out(r, histogram_quantile(h->size, h->count, 0.99));
+        ap_rputs(no_table_report ? "<br />\n" : "</td></tr>\n", r);
+    }
+    if (!no_table_report) {
+        ap_rputs("</table>\n<p>Milliseconds taken by 50, 90, 99 and 99.9 "
+                 "percent of the requests since the last restart, and the "
+                 "response sizes of 50 and 99 percent of them</p>\n", r);
+    }
+    if (vhost_overflow || handler_overflow) {
+        ap_rprintf(r, "<p>%u requests of virtual hosts and %u of handlers "
+                   "found no room in the histograms and are not counted "
+                   "there</p>\n", vhost_overflow, handler_overflow);
+    }
+}
+
+/* Label values of the Prometheus text format escape backslashes, double
+ * quotes and newlines */
+static const char *metrics_escape(apr_pool_t *p, const char *s)
+{
+    const char *c;
+    char *escaped, *e;
+
+    for (c = s; *c && *c != '\\' && *c != '"' && *c != '\n'; c++)
+        ;
+    if (!*c) {
+        return s;
+    }
+
+    e = escaped = apr_palloc(p, 2 * strlen(s) + 1);
+    for (c = s; *c; c++) {
+        if (*c == '\\' || *c == '"') {
+            *e++ = '\\';
+            *e++ = *c;
+        }
+        else if (*c == '\n') {
+            *e++ = '\\';
+            *e++ = 'n';
+        }
+        else {
+            *e++ = *c;
+        }
+    }
+    *e = '\0';
+    return escaped;
+}
+
+static void metrics_histogram(request_rec *r, const char *metric,
+                              const char *labels,
+                              const apr_uint64_t *buckets,
+                              apr_uint64_t count, double scale)
+{
+    apr_uint64_t seen = 0;
+    int k;
+
+    /* the same bounds in every scrape and series: the last of every four
+     * buckets ends at a power of two less one */
+    for (k = 0; k < AP_HISTOGRAM_BUCKETS - 1; k++) {
+        seen += buckets[k];
+        if ((k & 3) != 3 || k + 4 > AP_HISTOGRAM_BUCKETS - 1) {
+            continue;
+        }
+        ap_rprintf(r, "%s_bucket{%s,le=\"%.10g\"} %" APR_UINT64_T_FMT "\n",
+                   metric, labels,
+                   (double)ap_histogram_bucket_max(k) * scale, seen);
+    }
+    ap_rprintf(r, "%s_bucket{%s,le=\"+Inf\"} %" APR_UINT64_T_FMT "\n"
+                  "%s_count{%s} %" APR_UINT64_T_FMT "\n",
+               metric, labels, count, metric, labels, count);
+}
+
+/*
+ * The histograms of one kind, each kind under metrics of its own since
+ * every request is counted once per kind.
+ */
+static void metrics_histograms(request_rec *r, apr_array_header_t *hists,
+                               int kind)
+{
+    const char *name = histogram_kind(kind);
+    const char *time_metric = apr_psprintf(r->pool,
+                                           "apache_%s_request_duration_seconds",
+                                           name);
+    const char *size_metric = apr_psprintf(r->pool,
+                                           "apache_%s_response_size_bytes",
+                                           name);
+    int i, found = 0;
+
+    for (i = 0; i < hists->nelts && !found; i++) {
+        found = APR_ARRAY_IDX(hists, i, status_histogram).kind == kind;
+    }
+    if (!found) {
+        return;
+    }
+
+    ap_rprintf(r, "# HELP %s Time taken by the requests, by %s\n"
+                  "# TYPE %s histogram\n", time_metric, name, time_metric);
+    for (i = 0; i < hists->nelts; i++) {
+        status_histogram *h = &APR_ARRAY_IDX(hists, i, status_histogram);
+
+        if (h->kind != kind) {
+            continue;
+        }
+        metrics_histogram(r, time_metric,
+                          apr_psprintf(r->pool, "%s=\"%s\"", name,
+                                       metrics_escape(r->pool, h->name)),
+                          h->time, h->count, 1e-6);
+    }
+    ap_rprintf(r, "# HELP %s Bytes sent in response to the requests, by %s\n"
+                  "# TYPE %s histogram\n", size_metric, name, size_metric);
+    for (i = 0; i < hists->nelts; i++) {
+        status_histogram *h = &APR_ARRAY_IDX(hists, i, status_histogram);
+
+        if (h->kind != kind) {
+            continue;
+        }
+        metrics_histogram(r, size_metric,
+                          apr_psprintf(r->pool, "%s=\"%s\"", name,
+                                       metrics_escape(r->pool, h->name)),
+                          h->size, h->count, 1);
+    }
+}
+
+/*
+ * The Prometheus text exposition of the scoreboard.  The totals are
+ * read from the counters the workers keep in their process_score, so a
+ * scrape costs one record per process rather than one per worker, which
+ * is only walked when the slots are asked for.
+ */
+static void export_metrics(request_rec *r, int slots)
+{
+    global_score *global = ap_get_scoreboard_global();
+    apr_array_header_t *hists;
+    ap_generation_t mpm_generation;
+    int busy = 0, ready = 0, serving = 0, quiescing = 0;
+    int i, j;
+
+    ap_mpm_query(AP_MPMQ_GENERATION, &mpm_generation);
+
+    for (i = 0; i < server_limit; ++i) {
+        process_score *ps_record = ap_get_scoreboard_process(i);
+        apr_int32_t n;
+
+        if (!ps_record->pid) {
+            continue;
+        }
+        if (ps_record->quiescing) {
+            quiescing++;
+            continue;
+        }
+        serving++;
+        /* the parent may clear the scoreboard under a worker going from
+         * one state to another on a restart, so skip what went below 0 */
+        n = (apr_int32_t)ps_record->busy;
+        if (n > 0) {
+            busy += n;
+        }
+        /* as on the status page, the ready workers of an older
+         * generation are on their way out and counted as busy */
+        n = (apr_int32_t)ps_record->ready;
+        if (n > 0) {
+            if (ps_record->generation == mpm_generation) {
+                ready += n;
+            }
+            else {
+                busy += n;
+            }
+        }
+    }
+
+    ap_rprintf(r, "# HELP apache_uptime_seconds Time since the last restart\n"
+                  "# TYPE apache_uptime_seconds gauge\n"
+                  "apache_uptime_seconds %" APR_TIME_T_FMT "\n",
+               apr_time_sec(apr_time_now()
+                            - ap_scoreboard_image->global->restart_time));
+    ap_rprintf(r, "# HELP apache_generation Generation of the configuration "
+                  "and of the children\n"
+                  "# TYPE apache_generation gauge\n"
+                  "apache_generation{type=\"config\"} %d\n"
+                  "apache_generation{type=\"mpm\"} %d\n",
+               ap_state_query(AP_SQ_CONFIG_GEN), (int)mpm_generation);
+    ap_rprintf(r, "# HELP apache_processes Child processes\n"
+                  "# TYPE apache_processes gauge\n"
+                  "apache_processes{state=\"serving\"} %d\n"
+                  "apache_processes{state=\"quiescing\"} %d\n",
+               serving, quiescing);
+    ap_rprintf(r, "# HELP apache_workers Workers of the serving processes\n"
+                  "# TYPE apache_workers gauge\n"
+                  "apache_workers{state=\"busy\"} %d\n"
+                  "apache_workers{state=\"idle\"} %d\n",
+               busy, ready);
+
+    if (!ap_extended_status) {
+        return;
+    }
+
+    ap_rputs("# HELP apache_accesses_total Requests served by the "
+             "processes of a slot\n"
+             "# TYPE apache_accesses_total counter\n", r);
+    for (i = 0; i < server_limit; ++i) {
+        process_score *ps_record = ap_get_scoreboard_process(i);
+
+        if (ps_record->pid || ps_record->access_count) {
+            ap_rprintf(r, "apache_accesses_total{slot=\"%d\"} %u\n",
+                       i, ps_record->access_count);
+        }
+    }
+    ap_rputs("# HELP apache_sent_kilobytes_total Kilobytes sent by the "
+             "processes of a slot\n"
+             "# TYPE apache_sent_kilobytes_total counter\n", r);
+    for (i = 0; i < server_limit; ++i) {
+        process_score *ps_record = ap_get_scoreboard_process(i);
+
+        if (ps_record->pid || ps_record->access_count) {
+            ap_rprintf(r, "apache_sent_kilobytes_total{slot=\"%d\"} %u\n",
+                       i, ps_record->kbytes_served);
+        }
+    }
+
+    hists = collect_histograms(r->pool);
+    metrics_histograms(r, hists, AP_HISTOGRAM_VHOST);
+    metrics_histograms(r, hists, AP_HISTOGRAM_HANDLER);
+    ap_rprintf(r, "# HELP apache_histogram_overflow_total Requests not "
+                  "counted in the histograms for lack of room\n"
+                  "# TYPE apache_histogram_overflow_total counter\n"
+                  "apache_histogram_overflow_total{kind=\"vhost\"} %u\n"
+                  "apache_histogram_overflow_total{kind=\"handler\"} %u\n",
+               apr_atomic_read32(&global->histogram_overflow[0]),
+               apr_atomic_read32(&global->histogram_overflow[1]));
+
+    if (!slots) {
+        return;
+    }
+
+    ap_rputs("# HELP apache_worker_accesses_total Requests served by a "
+             "worker, by its current state\n"
+             "# TYPE apache_worker_accesses_total counter\n", r);
+    for (i = 0; i < server_limit; ++i) {
+        for (j = 0; j < thread_limit; ++j) {
+            worker_score *ws_record =
+                ap_get_scoreboard_worker_from_indexes(i, j);
+
+            if (ws_record->access_count == 0
+                && (ws_record->status == SERVER_READY
+                    || ws_record->status == SERVER_DEAD)) {
+                continue;
+            }
+            ap_rprintf(r, "apache_worker_accesses_total{slot=\"%d\","
+                          "thread=\"%d\",state=\"%c\"} %lu\n",
+                       i, j, status_flags[ws_record->status],
+                       ws_record->access_count);
+        }
+    }
+}
+
+/* The raw buckets of the histograms, one line per bucket in use */
+static void export_histograms(request_rec *r)
+{
+    apr_array_header_t *hists = collect_histograms(r->pool);
+    int i, k;
+
+    ap_rputs("# kind\tname\tmetric\tmax\tcount\n", r);
+    for (i = 0; i < hists->nelts; i++) {
+        status_histogram *h = &APR_ARRAY_IDX(hists, i, status_histogram);
+        int metric;
+
+        for (metric = 0; metric < 2; metric++) {
+            apr_uint64_t *buckets = metric ? h->size : h->time;
+
+            for (k = 0; k < AP_HISTOGRAM_BUCKETS; k++) {
+                if (!buckets[k]) {
+                    continue;
+                }
+                ap_rprintf(r, "%s\t%s\t%s\t", histogram_kind(h->kind),
+                           h->name, metric ? "size" : "time");
+                if (k == AP_HISTOGRAM_BUCKETS - 1) {
+                    ap_rputs("inf", r);
+                }
+                else {
+                    ap_rprintf(r, "%" APR_UINT64_T_FMT,
+                               ap_histogram_bucket_max(k));
+                }
+                ap_rprintf(r, "\t%" APR_UINT64_T_FMT "\n", buckets[k]);
+            }
+        }
+    }
+}
+
 static int status_handler(request_rec *r)
 {
     const char *loc;
@@ -189,10 +644,14 @@ static int status_handler(request_rec *r)
     unsigned long count;
     unsigned long lres, my_lres, conn_lres;
     apr_off_t bytes, my_bytes, conn_bytes;
+    apr_uint32_t conn_syscalls;
+    apr_off_t conn_syscall_bytes;
     apr_off_t bcount, kbcount;
     long req_time;
     int short_report;
     int no_table_report;
+    int histogram_report;
+    int metrics_report;
     worker_score *ws_record;
     process_score *ps_record;
     char *stat_buffer;
@@ -230,6 +689,8 @@ static int status_handler(request_rec *r)
     kbcount = 0;
     short_report = 0;
     no_table_report = 0;
+    histogram_report = 0;
+    metrics_report = 0;
 
     pid_buffer = apr_palloc(r->pool, server_limit * sizeof(pid_t));
     stat_buffer = apr_palloc(r->pool, server_limit * thread_limit * sizeof(char));
@@ -278,6 +739,18 @@ static int status_handler(request_rec *r)
                     ap_set_content_type(r, "text/plain; charset=ISO-8859-1");
                     short_report = 1;
                     break;
+                case STAT_OPT_HISTOGRAMS:
+                    histogram_report = 1;
+                    break;
+                case STAT_OPT_METRICS: {
+                    apr_size_t len = strlen(status_options[i].form_data_str);
+
+                    metrics_report = 1;
+                    if (!strncmp(loc + len, "=slots", 6)) {
+                        metrics_report = 2;
+                    }
+                    break;
+                }
                 }
             }
 
@@ -285,6 +758,20 @@ static int status_handler(request_rec *r)
         }
     }
 
+    if (histogram_report) {
+        ap_set_content_type(r, "text/plain; charset=ISO-8859-1");
+        if (ap_extended_status) {
+            export_histograms(r);
+        }
+        return OK;
+    }
+
+    if (metrics_report) {
+        ap_set_content_type(r, "text/plain; version=0.0.4");
+        export_metrics(r, metrics_report == 2);
+        return OK;
+    }
+
     for (i = 0; i < server_limit; ++i) {
 #ifdef HAVE_TIMES
         clock_t proc_tu = 0, proc_ts = 0, proc_tcu = 0, proc_tcs = 0;
@@ -538,6 +1025,7 @@ static int status_handler(request_rec *r)
 #endif
                      "<th>SS</th><th>Req</th>"
                      "<th>Conn</th><th>Child</th><th>Slot</th>"
+                     "<th>Sys</th><th>B/Sys</th>"
                      "<th>Client</th><th>VHost</th>"
                      "<th>Request</th></tr>\n\n", r);
 
@@ -568,6 +1056,11 @@ static int status_handler(request_rec *r)
                 bytes = ws_record->bytes_served;
                 my_bytes = ws_record->my_bytes_served;
                 conn_bytes = ws_record->conn_bytes;
+                conn_syscalls = ws_record->conn_writev
+                                + ws_record->conn_sendfile;
+                conn_syscall_bytes = conn_syscalls
+                                     ? ws_record->conn_written / conn_syscalls
+                                     : 0;
                 if (ws_record->pid) { /* MPM sets per-worker pid and generation */
                     worker_pid = ws_record->pid;
                     worker_generation = ws_record->generation;
@@ -650,7 +1143,11 @@ static int status_handler(request_rec *r)
                     format_byte_out(r, my_bytes);
                     ap_rputs("|", r);
                     format_byte_out(r, bytes);
-                    ap_rputs(")\n", r);
+                    ap_rprintf(r, ") %u|%u|%u %" APR_OFF_T_FMT "\n",
+                               ws_record->conn_writev,
+                               ws_record->conn_sendfile,
+                               ws_record->conn_eagain,
+                               conn_syscall_bytes);
                     ap_rprintf(r,
                                " <i>%s {%s}</i> <b>[%s]</b><br />\n\n",
                                ap_escape_html(r->pool,
@@ -736,6 +1233,12 @@ static int status_handler(request_rec *r)
                                (float)conn_bytes / KBYTE, (float) my_bytes / MBYTE,
                                (float)bytes / MBYTE);
 
+                    ap_rprintf(r, "</td><td>%u/%u/%u</td><td>%" APR_OFF_T_FMT "\n",
+                               ws_record->conn_writev,
+                               ws_record->conn_sendfile,
+                               ws_record->conn_eagain,
+                               conn_syscall_bytes);
+
                     ap_rprintf(r, "</td><td>%s</td><td nowrap>%s</td>"
                                   "<td nowrap>%s</td></tr>\n\n",
                                ap_escape_html(r->pool,
@@ -767,6 +1270,8 @@ static int status_handler(request_rec *r)
 <tr><th>Conn</th><td>Kilobytes transferred this connection</td></tr>\n \
 <tr><th>Child</th><td>Megabytes transferred this child</td></tr>\n \
 <tr><th>Slot</th><td>Total megabytes transferred this slot</td></tr>\n \
+<tr><th>Sys</th><td>Number of writev / sendfile calls this connection, and of those which would have blocked</td></tr>\n \
+<tr><th>B/Sys</th><td>Average bytes written per call this connection</td></tr>\n \
 </table>\n", r);
         }
     } /* if (ap_extended_status && !short_report) */
@@ -779,6 +1284,10 @@ static int status_handler(request_rec *r)
         }
     }
 
+    if (ap_extended_status) {
+        show_histograms(r, short_report, no_table_report);
+    }
+
     {
         /* Run extension hooks to insert extra content. */
         int flags =
@@ -134,6 +134,49 @@ static int use_range_x(request_rec *r)
                 && ap_strstr_c(ua, "MSIE 3")));
 }
 
+/*
+ * A body consisting of FILE buckets of a single file, at consecutive
+ * offsets, as sent by the default handler or by mod_cache_disk for a
+ * cached entity, is a slice of that file.  Return the file and the
+ * offset of the body in it, so that the ranges can be sent as FILE
+ * buckets of their own rather than by partitioning and copying the
+ * buckets of the body; NULL otherwise.
+ */
+static apr_file_t *body_file(apr_bucket_brigade *bb, apr_off_t *offset,
+                             int *can_mmap)
+{
+    apr_bucket *e;
+    apr_file_t *fd = NULL;
+    apr_off_t next = 0;
+
+    *can_mmap = 1;
+    for (e = APR_BRIGADE_FIRST(bb);
+         e != APR_BRIGADE_SENTINEL(bb) && !APR_BUCKET_IS_EOS(e);
+         e = APR_BUCKET_NEXT(e)) {
+        apr_bucket_file *a;
+
+        if (!APR_BUCKET_IS_FILE(e)) {
+            return NULL;
+        }
+        a = e->data;
+        if (!fd) {
+            fd = a->fd;
+            *offset = e->start;
+        }
+        else if (a->fd != fd || e->start != next) {
+            return NULL;
+        }
+        next = e->start + e->length;
+#if APR_HAS_MMAP
+        if (!a->can_mmap) {
+            *can_mmap = 0;
+        }
+#endif
+    }
+
+    return fd;
+}
+
 #define BYTERANGE_FMT "%" APR_OFF_T_FMT "-%" APR_OFF_T_FMT "/%" APR_OFF_T_FMT
 #define PARTITION_ERR_FMT "apr_brigade_partition() failed " \
                           "[%" APR_OFF_T_FMT ",%" APR_OFF_T_FMT "]"
@@ -151,6 +194,10 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
     apr_off_t range_end;
     char *current;
     apr_off_t clength = 0;
+    apr_off_t bodylength = 0;
+    apr_file_t *fd;
+    apr_off_t fd_offset = 0;
+    int fd_can_mmap;
     apr_status_t rv;
     int found = 0;
     int num_ranges;
@@ -218,6 +265,8 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
     /* this brigade holds what we will be sending */
     bsend = apr_brigade_create(r->pool, c->bucket_alloc);
 
+    fd = body_file(bb, &fd_offset, &fd_can_mmap);
+
     while ((current = ap_getword(r->pool, &r->range, ','))
            && (rv = parse_byterange(current, clength, &range_start,
                                     &range_end))) {
@@ -231,15 +280,17 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
         /* These calls to apr_brigage_partition should only fail in
          * pathological cases, e.g. a file being truncated whilst
          * being served. */
-        if ((rv = apr_brigade_partition(bb, range_start, &ec)) != APR_SUCCESS) {
-            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
-                          PARTITION_ERR_FMT, range_start, clength);
-            continue;
-        }
-        if ((rv = apr_brigade_partition(bb, range_end+1, &e2)) != APR_SUCCESS) {
-            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
-                          PARTITION_ERR_FMT, range_end+1, clength);
-            continue;
+        if (!fd) {
+            if ((rv = apr_brigade_partition(bb, range_start, &ec)) != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                              PARTITION_ERR_FMT, range_start, clength);
+                continue;
+            }
+            if ((rv = apr_brigade_partition(bb, range_end+1, &e2)) != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                              PARTITION_ERR_FMT, range_end+1, clength);
+                continue;
+            }
         }
 
         found = 1;
@@ -258,6 +309,7 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
             e = apr_bucket_pool_create(ctx->bound_head, strlen(ctx->bound_head),
                                        r->pool, c->bucket_alloc);
             APR_BRIGADE_INSERT_TAIL(bsend, e);
+            bodylength += e->length;
 
             ts = apr_psprintf(r->pool, BYTERANGE_FMT CRLF CRLF,
                               range_start, range_end, clength);
@@ -265,6 +317,21 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
             e = apr_bucket_pool_create(ts, strlen(ts), r->pool,
                                        c->bucket_alloc);
             APR_BRIGADE_INSERT_TAIL(bsend, e);
+            bodylength += e->length;
+        }
+        bodylength += range_end - range_start + 1;
+
+        if (fd) {
+            /* a slice of the file, keeping it eligible for sendfile */
+            e = apr_brigade_insert_file(bsend, fd, fd_offset + range_start,
+                                        range_end - range_start + 1,
+                                        r->pool);
+#if APR_HAS_MMAP
+            if (!fd_can_mmap) {
+                apr_bucket_file_enable_mmap(e, 0);
+            }
+#endif
+            continue;
         }
 
         do {
@@ -306,8 +373,12 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
         ap_xlate_proto_to_ascii(end, strlen(end));
         e = apr_bucket_pool_create(end, strlen(end), r->pool, c->bucket_alloc);
         APR_BRIGADE_INSERT_TAIL(bsend, e);
+        bodylength += e->length;
     }
 
+    /* the length of the (multipart) body is known from the ranges */
+    ap_set_content_length(r, bodylength);
+
     e = apr_bucket_eos_create(c->bucket_alloc);
     APR_BRIGADE_INSERT_TAIL(bsend, e);
 
@@ -16,6 +16,7 @@
 
 #include "apr_strings.h"
 #include "apr_thread_proc.h"    /* for RLIMIT stuff */
+#include "apr_date.h"
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -27,6 +28,8 @@
 #include "http_protocol.h"   /* For index_of_response().  Grump. */
 #include "http_request.h"
 
+#include "mod_core.h"
+
 /* Generate the human-readable hex representation of an apr_uint64_t
  * (basically a faster version of 'sprintf("%llx")')
  */
@@ -53,6 +56,139 @@ static char *etag_uint64_to_hex(char *next, apr_uint64_t u)
 
 #define ETAG_WEAK "W/"
 #define CHARS_PER_UINT64 (sizeof(apr_uint64_t) * 2)
+#define ETAG_MAX_LEN (sizeof("\"--\"") + 3 * CHARS_PER_UINT64 + 1)
+
+static etag_components_t get_etag_bits(request_rec *r)
+{
+    core_dir_config *cfg;
+    etag_components_t etag_bits;
+
+    cfg = (core_dir_config *)ap_get_module_config(r->per_dir_config,
+                                                  &core_module);
+    etag_bits = (cfg->etag_bits & (~ cfg->etag_remove)) | cfg->etag_add;
+
+    if (etag_bits == ETAG_UNSET) {
+        etag_bits = ETAG_BACKWARD;
+    }
+    return etag_bits;
+}
+
+/*
+ * Format the strong ETag "inode-size-mtime" of the file of a request,
+ * modulo any FileETag keywords.
+ */
+static void make_file_etag(char *etag, request_rec *r,
+                           etag_components_t etag_bits)
+{
+    char *next = etag;
+    etag_components_t bits_added = 0;
+
+    *next++ = '"';
+    if (etag_bits & ETAG_INODE) {
+        next = etag_uint64_to_hex(next, r->finfo.inode);
+        bits_added |= ETAG_INODE;
+    }
+    if (etag_bits & ETAG_SIZE) {
+        if (bits_added != 0) {
+            *next++ = '-';
+        }
+        next = etag_uint64_to_hex(next, r->finfo.size);
+        bits_added |= ETAG_SIZE;
+    }
+    if (etag_bits & ETAG_MTIME) {
+        if (bits_added != 0) {
+            *next++ = '-';
+        }
+        next = etag_uint64_to_hex(next, r->mtime);
+    }
+    *next++ = '"';
+    *next = '\0';
+}
+
+/* Cache of the validators of recently served files
+ *
+ * The strong ETag and the Last-Modified date of a file only change with
+ * the file, so they are formatted once and kept in a direct-mapped
+ * table indexed by a hash of the identity of the file (device, inode,
+ * size, mtime and the FileETag components in effect).  As with the
+ * exploded time cache of util_time.c, the table is shared by the
+ * threads of a process without locks: the key is stored at both ends
+ * of an element, a writer invalidates the trailing copy first and sets
+ * it last, and a reader uses a snapshot of the element only if both
+ * copies match the identity it is looking for.  Colliding writers write
+ * the same values.
+ */
+
+struct validator_cache_element {
+    apr_uint64_t key;
+    apr_dev_t device;
+    apr_ino_t inode;
+    apr_off_t size;
+    apr_time_t mtime;
+    etag_components_t etag_bits;
+    char etag[ETAG_MAX_LEN];
+    char last_modified[APR_RFC822_DATE_LEN];
+    apr_uint64_t key_validate;
+};
+
+/* must be a power of two */
+#define VALIDATOR_CACHE_SIZE 256
+#define VALIDATOR_CACHE_MASK (VALIDATOR_CACHE_SIZE - 1)
+
+static struct validator_cache_element validator_cache[VALIDATOR_CACHE_SIZE];
+
+static void cached_validators(request_rec *r, etag_components_t etag_bits,
+                              struct validator_cache_element *v)
+{
+    struct validator_cache_element *cache_element;
+    apr_uint64_t key;
+
+    key = (apr_uint64_t)r->finfo.inode * APR_UINT64_C(0x9e3779b97f4a7c15);
+    key ^= (apr_uint64_t)r->finfo.device ^ (apr_uint64_t)r->finfo.size;
+    key ^= (apr_uint64_t)r->mtime ^ ((apr_uint64_t)etag_bits << 56);
+    key |= 1;   /* zero is the empty element */
+    cache_element = &validator_cache[(key ^ (key >> 32))
+                                     & VALIDATOR_CACHE_MASK];
+
+    memcpy(v, cache_element, sizeof(*v));
+    if (v->key == key && v->key_validate == key
+        && v->device == r->finfo.device && v->inode == r->finfo.inode
+        && v->size == r->finfo.size && v->mtime == r->mtime
+        && v->etag_bits == etag_bits) {
+        return;
+    }
+
+    v->key = key;
+    v->device = r->finfo.device;
+    v->inode = r->finfo.inode;
+    v->size = r->finfo.size;
+    v->mtime = r->mtime;
+    v->etag_bits = etag_bits;
+    make_file_etag(v->etag, r, etag_bits);
+    apr_rfc822_date(v->last_modified, r->mtime);
+    v->key_validate = key;
+
+    cache_element->key_validate = 0;
+    memcpy(cache_element, v, sizeof(*v) - sizeof(v->key_validate));
+    cache_element->key_validate = key;
+}
+
+/*
+ * Whether date is the Last-Modified date of the file of a request, as
+ * ap_set_last_modified() formats an mtime that is not in the future.
+ */
+int ap_is_file_last_modified(request_rec *r, const char *date)
+{
+    struct validator_cache_element v;
+
+    if (r->finfo.filetype == APR_NOFILE || !r->mtime
+        || r->mtime > r->request_time) {
+        return 0;
+    }
+    cached_validators(r, get_etag_bits(r), &v);
+    return !strcmp(date, v.last_modified);
+}
+
 /*
  * Construct an entity tag (ETag) from resource information.  If it's a real
  * file, build in some of the file characteristics.  If the modification time
@@ -66,13 +202,9 @@ AP_DECLARE(char *) ap_make_etag(request_rec *r, int force_weak)
     apr_size_t weak_len;
     char *etag;
     char *next;
-    core_dir_config *cfg;
     etag_components_t etag_bits;
-    etag_components_t bits_added;
 
-    cfg = (core_dir_config *)ap_get_module_config(r->per_dir_config,
-                                                  &core_module);
-    etag_bits = (cfg->etag_bits & (~ cfg->etag_remove)) | cfg->etag_add;
+    etag_bits = get_etag_bits(r);
 
     /*
      * If it's a file (or we wouldn't be here) and no ETags
@@ -84,9 +216,6 @@ AP_DECLARE(char *) ap_make_etag(request_rec *r, int force_weak)
         return "";
     }
 
-    if (etag_bits == ETAG_UNSET) {
-        etag_bits = ETAG_BACKWARD;
-    }
     /*
      * Make an ETag header out of various pieces of information. We use
      * the last-modified date and, if we have a real file, the
@@ -112,37 +241,13 @@ AP_DECLARE(char *) ap_make_etag(request_rec *r, int force_weak)
     if (r->finfo.filetype != APR_NOFILE) {
         /*
          * ETag gets set to [W/]"inode-size-mtime", modulo any
-         * FileETag keywords.
+         * FileETag keywords.  The strong part comes from the
+         * validator cache.
          */
-        etag = apr_palloc(r->pool, weak_len + sizeof("\"--\"") +
-                          3 * CHARS_PER_UINT64 + 1);
-        next = etag;
-        if (weak) {
-            while (*weak) {
-                *next++ = *weak++;
-            }
-        }
-        *next++ = '"';
-        bits_added = 0;
-        if (etag_bits & ETAG_INODE) {
-            next = etag_uint64_to_hex(next, r->finfo.inode);
-            bits_added |= ETAG_INODE;
-        }
-        if (etag_bits & ETAG_SIZE) {
-            if (bits_added != 0) {
-                *next++ = '-';
-            }
-            next = etag_uint64_to_hex(next, r->finfo.size);
-            bits_added |= ETAG_SIZE;
-        }
-        if (etag_bits & ETAG_MTIME) {
-            if (bits_added != 0) {
-                *next++ = '-';
-            }
-            next = etag_uint64_to_hex(next, r->mtime);
-        }
-        *next++ = '"';
-        *next = '\0';
+        struct validator_cache_element v;
+
+        cached_validators(r, etag_bits, &v);
+        etag = apr_pstrcat(r->pool, weak ? weak : "", v.etag, NULL);
     }
     else {
         /*
@@ -57,10 +57,6 @@
 
 APLOG_USE_MODULE(http);
 
-#define INVALID_CHAR -2
-
-static long get_chunk_size(char *);
-
 typedef struct http_filter_ctx {
     apr_off_t remaining;
     apr_off_t limit;
@@ -68,12 +64,14 @@ typedef struct http_filter_ctx {
     enum {
         BODY_NONE,
         BODY_LENGTH,
-        BODY_CHUNK,
-        BODY_CHUNK_PART
+        BODY_CHUNK,             /* start of a chunk-size line */
+        BODY_CHUNK_PART,        /* within the chunk-size */
+        BODY_CHUNK_EXT,         /* rest of the chunk-size line */
+        BODY_CHUNK_DATA,        /* chunk-data */
+        BODY_CHUNK_END          /* the line ending the chunk-data */
     } state;
     int eos_sent;
-    char chunk_ln[32];
-    char *pos;
+    int chunkbits;
     apr_off_t linesize;
     apr_bucket_brigade *bb;
 } http_ctx_t;
@@ -96,117 +94,292 @@ static apr_status_t bail_out_on_error(http_ctx_t *ctx,
     return ap_pass_brigade(f->r->output_filters, bb);
 }
 
-static apr_status_t get_remaining_chunk_line(http_ctx_t *ctx,
-                                             apr_bucket_brigade *b,
-                                             int linelimit)
+/* Account for totalread bytes of body against LimitRequestBody. */
+static int limit_exceeded(http_ctx_t *ctx, ap_filter_t *f,
+                          apr_off_t totalread)
 {
-    apr_status_t rv;
-    apr_off_t brigade_length;
-    apr_bucket *e;
-    const char *lineend;
-    apr_size_t len = 0;
-
-    /*
-     * As the brigade b should have been requested in mode AP_MODE_GETLINE
-     * all buckets in this brigade are already some type of memory
-     * buckets (due to the needed scanning for LF in mode AP_MODE_GETLINE)
-     * or META buckets.
-     */
-    rv = apr_brigade_length(b, 0, &brigade_length);
-    if (rv != APR_SUCCESS) {
-        return rv;
-    }
-    /* Sanity check. Should never happen. See above. */
-    if (brigade_length == -1) {
-        return APR_EGENERAL;
+    if (!ctx->limit) {
+        return 0;
     }
-    if (!brigade_length) {
-        return APR_EAGAIN;
+    ctx->limit_used += totalread;
+    if (ctx->limit < ctx->limit_used) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, f->r,
+                      "Read content-length of %" APR_OFF_T_FMT
+                      " is larger than the configured limit"
+                      " of %" APR_OFF_T_FMT, ctx->limit_used, ctx->limit);
+        return 1;
     }
-    ctx->linesize += brigade_length;
-    if (ctx->linesize > linelimit) {
-        return APR_ENOSPC;
+    return 0;
+}
+
+static void new_chunk(http_ctx_t *ctx)
+{
+    ctx->state = BODY_CHUNK;
+    ctx->remaining = 0;
+    ctx->chunkbits = sizeof(apr_off_t) * 8;
+    ctx->linesize = 0;
+}
+
+/*
+ * Run the chunk framing over the len bytes at buf, up to the start of the
+ * chunk-data, the end of the last-chunk line or the end of buf, and set
+ * *used to the number of bytes consumed.  The chunk-size is parsed as it
+ * arrives; chunk-extensions and anything after the chunk-data up to the
+ * LF are ignored, as long as the line fits in linelimit.  Returns
+ * APR_EINVAL for a chunk-size line not starting with a hex digit, and
+ * APR_ENOSPC for a chunk-size overflow or an overlong line.
+ */
+static apr_status_t parse_chunk_framing(http_ctx_t *ctx, const char *buf,
+                                        apr_size_t len, apr_size_t *used,
+                                        int linelimit)
+{
+    apr_size_t i = 0;
+
+    while (i < len
+           && ctx->state != BODY_CHUNK_DATA && ctx->state != BODY_NONE) {
+        char c = buf[i++];
+
+        if (++ctx->linesize > linelimit) {
+            return APR_ENOSPC;
+        }
+
+        if (c == APR_ASCII_LF) {
+            if (ctx->state == BODY_CHUNK_END) {
+                new_chunk(ctx);
+            }
+            else if (ctx->state == BODY_CHUNK) {
+                /* empty chunk-size line */
+                return APR_EINVAL;
+            }
+            else {
+                ctx->linesize = 0;
+                ctx->state = ctx->remaining ? BODY_CHUNK_DATA : BODY_NONE;
+            }
+            continue;
+        }
+
+        if (ctx->state == BODY_CHUNK || ctx->state == BODY_CHUNK_PART) {
+            int xvalue;
+
+            ap_xlate_proto_from_ascii(&c, 1);
+            if (c >= '0' && c <= '9') {
+                xvalue = c - '0';
+            }
+            else if (c >= 'A' && c <= 'F') {
+                xvalue = c - 'A' + 0xa;
+            }
+            else if (c >= 'a' && c <= 'f') {
+                xvalue = c - 'a' + 0xa;
+            }
+            else if (ctx->state == BODY_CHUNK) {
+                return APR_EINVAL;
+            }
+            else {
+                ctx->state = BODY_CHUNK_EXT;
+                continue;
+            }
+
+            /* leading zeros do not count */
+            if (ctx->remaining || xvalue) {
+                if (ctx->chunkbits <= 0) {
+                    return APR_ENOSPC;
+                }
+                ctx->remaining = (ctx->remaining << 4) | xvalue;
+                ctx->chunkbits -= 4;
+                if (ctx->remaining < 0) {
+                    return APR_ENOSPC;
+                }
+            }
+            ctx->state = BODY_CHUNK_PART;
+        }
     }
-    /*
-     * As all buckets are already some type of memory buckets or META buckets
-     * (see above), we only need to check the last byte in the last data bucket.
-     */
-    for (e = APR_BRIGADE_LAST(b);
-         e != APR_BRIGADE_SENTINEL(b);
-         e = APR_BUCKET_PREV(e)) {
+
+    *used = i;
+    return APR_SUCCESS;
+}
+
+/*
+ * Decode the chunked data in bb, up to want bytes of chunk-data (or the
+ * first LF in it for AP_MODE_GETLINE) or the end of the last-chunk line,
+ * whichever comes first.  The chunk-data buckets are moved to out, when
+ * given, and the framing is deleted; *used is the number of bytes of bb
+ * consumed.
+ */
+static apr_status_t decode_chunks(http_ctx_t *ctx, apr_bucket_brigade *bb,
+                                  apr_bucket_brigade *out,
+                                  ap_input_mode_t mode, apr_off_t want,
+                                  apr_off_t *used, int linelimit)
+{
+    apr_bucket *e = APR_BRIGADE_FIRST(bb);
+
+    *used = 0;
+    while (e != APR_BRIGADE_SENTINEL(bb)
+           && ctx->state != BODY_NONE && want > 0) {
+        apr_bucket *next;
+        const char *buf;
+        apr_size_t len, n;
+        apr_status_t rv;
 
         if (APR_BUCKET_IS_METADATA(e)) {
+            e = APR_BUCKET_NEXT(e);
             continue;
         }
-        rv = apr_bucket_read(e, &lineend, &len, APR_BLOCK_READ);
+
+        rv = apr_bucket_read(e, &buf, &len, APR_BLOCK_READ);
         if (rv != APR_SUCCESS) {
             return rv;
         }
-        if (len > 0) {
-            break;  /* we got the data we want */
+
+        if (ctx->state != BODY_CHUNK_DATA) {
+            rv = parse_chunk_framing(ctx, buf, len, &n, linelimit);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+            if (n < len) {
+                apr_bucket_split(e, n);
+            }
+            next = APR_BUCKET_NEXT(e);
+            apr_bucket_delete(e);
+            e = next;
+            *used += n;
+            continue;
+        }
+
+        n = len;
+        if ((apr_off_t)n > ctx->remaining) {
+            n = (apr_size_t)ctx->remaining;
+        }
+        if ((apr_off_t)n > want) {
+            n = (apr_size_t)want;
+        }
+        if (mode == AP_MODE_GETLINE) {
+            const char *lf = memchr(buf, APR_ASCII_LF, n);
+
+            if (lf) {
+                n = lf - buf + 1;
+                want = n;
+            }
+        }
+        if (n < len) {
+            apr_bucket_split(e, n);
+        }
+        next = APR_BUCKET_NEXT(e);
+        if (out) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+        }
+        else {
+            apr_bucket_delete(e);
+        }
+        e = next;
+
+        ctx->remaining -= n;
+        want -= n;
+        *used += n;
+        if (!ctx->remaining) {
+            ctx->state = BODY_CHUNK_END;
         }
-        /* If we got a zero-length data bucket, we try the next one */
-    }
-    /* We had no data in this brigade */
-    if (!len || e == APR_BRIGADE_SENTINEL(b)) {
-        return APR_EAGAIN;
-    }
-    if (lineend[len - 1] != APR_ASCII_LF) {
-        return APR_EAGAIN;
     }
-    /* Line is complete. So reset ctx for next round. */
-    ctx->linesize = 0;
-    ctx->pos = ctx->chunk_ln;
+
     return APR_SUCCESS;
 }
 
-static apr_status_t get_chunk_line(http_ctx_t *ctx, apr_bucket_brigade *b,
-                                   int linelimit)
+/*
+ * Read the next readbytes (at most) of a chunked body into b, spanning as
+ * many chunks as the connection has buffered.  What is buffered is first
+ * peeked at with AP_MODE_SPECULATIVE and run through the chunk framing on
+ * a copy of the context, to find how many bytes make up that chunk-data;
+ * exactly that many are then read and decoded for real.  This way
+ * nothing past the end of the body, such as a pipelined request, is
+ * consumed, and small chunks cost no filter round trip each.
+ */
+static apr_status_t read_chunked(ap_filter_t *f, http_ctx_t *ctx,
+                                 apr_bucket_brigade *b,
+                                 ap_input_mode_t mode,
+                                 apr_read_type_e block,
+                                 apr_off_t readbytes)
 {
-    apr_size_t len;
-    int tmp_len;
+    int linelimit = f->r->server->limit_req_line;
+    apr_bucket_brigade *bb = ctx->bb;
+    apr_bucket *e;
+    apr_off_t used, totalread;
     apr_status_t rv;
 
-    tmp_len = sizeof(ctx->chunk_ln) - (ctx->pos - ctx->chunk_ln) - 1;
-    /* Saveguard ourselves against underflows */
-    if (tmp_len < 0) {
-        len = 0;
+    if (mode == AP_MODE_GETLINE) {
+        readbytes = HUGE_STRING_LEN;
     }
-    else {
-        len = (apr_size_t) tmp_len;
-    }
-    /*
-     * Check if there is space left in ctx->chunk_ln. If not, then either
-     * the chunk size is insane or we have chunk-extensions. Ignore both
-     * by discarding the remaining part of the line via
-     * get_remaining_chunk_line. Only bail out if the line is too long.
-     */
-    if (len > 0) {
-        rv = apr_brigade_flatten(b, ctx->pos, &len);
-        if (rv != APR_SUCCESS) {
+
+    do {
+        http_ctx_t scan = *ctx;
+
+        apr_brigade_cleanup(bb);
+        rv = ap_get_brigade(f->next, bb, AP_MODE_SPECULATIVE, block,
+                            readbytes < AP_IOBUFSIZE ? AP_IOBUFSIZE
+                                                     : readbytes);
+        if (block == APR_NONBLOCK_READ &&
+            ( (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)) ||
+              (APR_STATUS_IS_EAGAIN(rv)) )) {
+            apr_brigade_cleanup(bb);
+            return APR_EAGAIN;
+        }
+        if (rv == APR_SUCCESS) {
+            rv = decode_chunks(&scan, bb, NULL, mode, readbytes, &used,
+                               linelimit);
+            if (rv == APR_SUCCESS && !used) {
+                /* the connection was closed in the middle of the body */
+                rv = APR_EOF;
+            }
+        }
+        apr_brigade_cleanup(bb);
+
+        if (rv == APR_SUCCESS) {
+            rv = ap_get_brigade(f->next, bb, AP_MODE_READBYTES, block, used);
+            if (rv == APR_SUCCESS) {
+                rv = decode_chunks(ctx, bb, b, mode, readbytes, &used,
+                                   linelimit);
+                if (rv == APR_SUCCESS && !used) {
+                    rv = APR_EOF;
+                }
+            }
+            apr_brigade_cleanup(bb);
+        }
+
+        if (APR_STATUS_IS_EOF(rv) || APR_STATUS_IS_EAGAIN(rv)) {
             return rv;
         }
-        ctx->pos += len;
-        ctx->linesize += len;
-        *(ctx->pos) = '\0';
-        /*
-         * Check if we really got a full line. If yes the
-         * last char in the just read buffer must be LF.
-         * If not advance the buffer and return APR_EAGAIN.
-         * We do not start processing until we have the
-         * full line.
-         */
-        if (ctx->pos[-1] != APR_ASCII_LF) {
-            /* Check if the remaining data in the brigade has the LF */
-            return get_remaining_chunk_line(ctx, b, linelimit);
+        if (rv != APR_SUCCESS) {
+            int http_error = HTTP_REQUEST_ENTITY_TOO_LARGE;
+
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, f->r,
+                          "Error reading chunk %s ",
+                          (rv == APR_ENOSPC) ? "(overflow)" : "");
+            if (APR_STATUS_IS_TIMEUP(rv)) {
+                http_error = HTTP_REQUEST_TIME_OUT;
+            }
+            else if (rv == APR_EINVAL) {
+                http_error = HTTP_BAD_REQUEST;
+            }
+            ctx->remaining = 0; /* Reset it in case we have to
+                                 * come back here later */
+            return bail_out_on_error(ctx, f, http_error);
         }
-        /* Line is complete. So reset ctx->pos for next round. */
-        ctx->pos = ctx->chunk_ln;
-        return APR_SUCCESS;
+    } while (APR_BRIGADE_EMPTY(b) && ctx->state != BODY_NONE);
+
+    apr_brigade_length(b, 0, &totalread);
+    if (limit_exceeded(ctx, f, totalread)) {
+        return bail_out_on_error(ctx, f, HTTP_REQUEST_ENTITY_TOO_LARGE);
     }
-    return get_remaining_chunk_line(ctx, b, linelimit);
-}
 
+    if (ctx->state == BODY_NONE) {
+        /* Handle trailers by calling ap_get_mime_headers again! */
+        ap_get_mime_headers(f->r);
+        e = apr_bucket_eos_create(f->c->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(b, e);
+        ctx->eos_sent = 1;
+    }
+
+    return APR_SUCCESS;
+}
 
 /* This is the HTTP_INPUT filter for HTTP requests and responses from
  * proxied servers (mod_proxy).  It handles chunked and content-length
@@ -221,7 +394,6 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
     http_ctx_t *ctx = f->ctx;
     apr_status_t rv;
     apr_off_t totalread;
-    int http_error = HTTP_REQUEST_ENTITY_TOO_LARGE;
     apr_bucket_brigade *bb;
 
     /* just get out of the way of things we don't want. */
@@ -233,7 +405,6 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
         const char *tenc, *lenp;
         f->ctx = ctx = apr_pcalloc(f->r->pool, sizeof(*ctx));
         ctx->state = BODY_NONE;
-        ctx->pos = ctx->chunk_ln;
         ctx->bb = apr_brigade_create(f->r->pool, f->c->bucket_alloc);
         bb = ctx->bb;
 
@@ -254,7 +425,7 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
 
         if (tenc) {
             if (!strcasecmp(tenc, "chunked")) {
-                ctx->state = BODY_CHUNK;
+                new_chunk(ctx);
             }
             /* test lenp, because it gives another case we can handle */
             else if (!lenp) {
@@ -351,64 +522,6 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
                 ap_pass_brigade(f->c->output_filters, bb);
             }
         }
-
-        /* We can't read the chunk until after sending 100 if required. */
-        if (ctx->state == BODY_CHUNK) {
-            apr_brigade_cleanup(bb);
-
-            rv = ap_get_brigade(f->next, bb, AP_MODE_GETLINE,
-                                block, 0);
-
-            /* for timeout */
-            if (block == APR_NONBLOCK_READ &&
-                ( (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)) ||
-                  (APR_STATUS_IS_EAGAIN(rv)) )) {
-                ctx->state = BODY_CHUNK_PART;
-                return APR_EAGAIN;
-            }
-
-            if (rv == APR_SUCCESS) {
-                rv = get_chunk_line(ctx, bb, f->r->server->limit_req_line);
-                if (APR_STATUS_IS_EAGAIN(rv)) {
-                    apr_brigade_cleanup(bb);
-                    ctx->state = BODY_CHUNK_PART;
-                    return rv;
-                }
-                if (rv == APR_SUCCESS) {
-                    ctx->remaining = get_chunk_size(ctx->chunk_ln);
-                    if (ctx->remaining == INVALID_CHAR) {
-                        rv = APR_EGENERAL;
-                        http_error = HTTP_BAD_REQUEST;
-                    }
-                }
-            }
-            apr_brigade_cleanup(bb);
-
-            /* Detect chunksize error (such as overflow) */
-            if (rv != APR_SUCCESS || ctx->remaining < 0) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, f->r, "Error reading first chunk %s ", 
-                              (ctx->remaining < 0) ? "(overflow)" : "");
-                ctx->remaining = 0; /* Reset it in case we have to
-                                     * come back here later */
-                if (APR_STATUS_IS_TIMEUP(rv)) { 
-                    http_error = HTTP_REQUEST_TIME_OUT;
-                }
-                return bail_out_on_error(ctx, f, http_error);
-            }
-
-            if (!ctx->remaining) {
-                /* Handle trailers by calling ap_get_mime_headers again! */
-                ctx->state = BODY_NONE;
-                ap_get_mime_headers(f->r);
-                e = apr_bucket_eos_create(f->c->bucket_alloc);
-                APR_BRIGADE_INSERT_TAIL(b, e);
-                ctx->eos_sent = 1;
-                return APR_SUCCESS;
-            }
-        }
-    }
-    else {
-        bb = ctx->bb;
     }
 
     if (ctx->eos_sent) {
@@ -417,107 +530,19 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
         return APR_SUCCESS;
     }
 
-    if (!ctx->remaining) {
-        switch (ctx->state) {
-        case BODY_NONE:
-            break;
-        case BODY_LENGTH:
-            e = apr_bucket_eos_create(f->c->bucket_alloc);
-            APR_BRIGADE_INSERT_TAIL(b, e);
-            ctx->eos_sent = 1;
-            return APR_SUCCESS;
-        case BODY_CHUNK:
-        case BODY_CHUNK_PART:
-            {
-                apr_brigade_cleanup(bb);
-
-                /* We need to read the CRLF after the chunk.  */
-                if (ctx->state == BODY_CHUNK) {
-                    rv = ap_get_brigade(f->next, bb, AP_MODE_GETLINE,
-                                        block, 0);
-                    if (block == APR_NONBLOCK_READ &&
-                        ( (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)) ||
-                          (APR_STATUS_IS_EAGAIN(rv)) )) {
-                        return APR_EAGAIN;
-                    }
-                    /* If we get an error, then leave */
-                    if (rv != APR_SUCCESS) {
-                        return rv;
-                    }
-                    /*
-                     * We really don't care whats on this line. If it is RFC
-                     * compliant it should be only \r\n. If there is more
-                     * before we just ignore it as long as we do not get over
-                     * the limit for request lines.
-                     */
-                    rv = get_remaining_chunk_line(ctx, bb,
-                                                  f->r->server->limit_req_line);
-                    apr_brigade_cleanup(bb);
-                    if (APR_STATUS_IS_EAGAIN(rv)) {
-                        return rv;
-                    }
-                } else {
-                    rv = APR_SUCCESS;
-                }
-
-                if (rv == APR_SUCCESS) {
-                    /* Read the real chunk line. */
-                    rv = ap_get_brigade(f->next, bb, AP_MODE_GETLINE,
-                                        block, 0);
-                    /* Test timeout */
-                    if (block == APR_NONBLOCK_READ &&
-                        ( (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)) ||
-                          (APR_STATUS_IS_EAGAIN(rv)) )) {
-                        ctx->state = BODY_CHUNK_PART;
-                        return APR_EAGAIN;
-                    }
-                    ctx->state = BODY_CHUNK;
-                    if (rv == APR_SUCCESS) {
-                        rv = get_chunk_line(ctx, bb, f->r->server->limit_req_line);
-                        if (APR_STATUS_IS_EAGAIN(rv)) {
-                            ctx->state = BODY_CHUNK_PART;
-                            apr_brigade_cleanup(bb);
-                            return rv;
-                        }
-                        if (rv == APR_SUCCESS) {
-                            ctx->remaining = get_chunk_size(ctx->chunk_ln);
-                            if (ctx->remaining == INVALID_CHAR) {
-                                rv = APR_EGENERAL;
-                                http_error = HTTP_BAD_REQUEST;
-                            }
-                        }
-                    }
-                    apr_brigade_cleanup(bb);
-                }
-
-                /* Detect chunksize error (such as overflow) */
-                if (rv != APR_SUCCESS || ctx->remaining < 0) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, f->r, "Error reading chunk %s ", 
-                                  (ctx->remaining < 0) ? "(overflow)" : "");
-                    ctx->remaining = 0; /* Reset it in case we have to
-                                         * come back here later */
-                    if (APR_STATUS_IS_TIMEUP(rv)) { 
-                        http_error = HTTP_REQUEST_TIME_OUT;
-                    }
-                    return bail_out_on_error(ctx, f, http_error);
-                }
+    if (ctx->state != BODY_NONE && ctx->state != BODY_LENGTH) {
+        return read_chunked(f, ctx, b, mode, block, readbytes);
+    }
 
-                if (!ctx->remaining) {
-                    /* Handle trailers by calling ap_get_mime_headers again! */
-                    ctx->state = BODY_NONE;
-                    ap_get_mime_headers(f->r);
-                    e = apr_bucket_eos_create(f->c->bucket_alloc);
-                    APR_BRIGADE_INSERT_TAIL(b, e);
-                    ctx->eos_sent = 1;
-                    return APR_SUCCESS;
-                }
-            }
-            break;
-        }
+    if (ctx->state == BODY_LENGTH && !ctx->remaining) {
+        e = apr_bucket_eos_create(f->c->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(b, e);
+        ctx->eos_sent = 1;
+        return APR_SUCCESS;
     }
 
     /* Ensure that the caller can not go over our boundary point. */
-    if (ctx->state == BODY_LENGTH || ctx->state == BODY_CHUNK) {
+    if (ctx->state == BODY_LENGTH) {
         if (ctx->remaining < readbytes) {
             readbytes = ctx->remaining;
         }
@@ -555,84 +580,13 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
     }
 
     /* We have a limit in effect. */
-    if (ctx->limit) {
-        /* FIXME: Note that we might get slightly confused on chunked inputs
-         * as we'd need to compensate for the chunk lengths which may not
-         * really count.  This seems to be up for interpretation.  */
-        ctx->limit_used += totalread;
-        if (ctx->limit < ctx->limit_used) {
-            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, f->r,
-                          "Read content-length of %" APR_OFF_T_FMT
-                          " is larger than the configured limit"
-                          " of %" APR_OFF_T_FMT, ctx->limit_used, ctx->limit);
-            apr_brigade_cleanup(bb);
-            e = ap_bucket_error_create(HTTP_REQUEST_ENTITY_TOO_LARGE, NULL,
-                                       f->r->pool,
-                                       f->c->bucket_alloc);
-            APR_BRIGADE_INSERT_TAIL(bb, e);
-            e = apr_bucket_eos_create(f->c->bucket_alloc);
-            APR_BRIGADE_INSERT_TAIL(bb, e);
-            ctx->eos_sent = 1;
-            return ap_pass_brigade(f->r->output_filters, bb);
-        }
+    if (limit_exceeded(ctx, f, totalread)) {
+        return bail_out_on_error(ctx, f, HTTP_REQUEST_ENTITY_TOO_LARGE);
     }
 
     return APR_SUCCESS;
 }
 
-/**
- * Parse a chunk extension, detect overflow.
- * There are two error cases:
- *  1) If the conversion would require too many bits, a -1 is returned.
- *  2) If the conversion used the correct number of bits, but an overflow
- *     caused only the sign bit to flip, then that negative number is
- *     returned.
- * In general, any negative number can be considered an overflow error.
- */
-static long get_chunk_size(char *b)
-{
-    long chunksize = 0;
-    size_t chunkbits = sizeof(long) * 8;
-
-    ap_xlate_proto_from_ascii(b, strlen(b));
-
-    if (!apr_isxdigit(*b)) {
-        /*
-         * Detect invalid character at beginning. This also works for empty
-         * chunk size lines.
-         */
-        return INVALID_CHAR;
-    }
-    /* Skip leading zeros */
-    while (*b == '0') {
-        ++b;
-    }
-
-    while (apr_isxdigit(*b) && (chunkbits > 0)) {
-        int xvalue = 0;
-
-        if (*b >= '0' && *b <= '9') {
-            xvalue = *b - '0';
-        }
-        else if (*b >= 'A' && *b <= 'F') {
-            xvalue = *b - 'A' + 0xa;
-        }
-        else if (*b >= 'a' && *b <= 'f') {
-            xvalue = *b - 'a' + 0xa;
-        }
-
-        chunksize = (chunksize << 4) | xvalue;
-        chunkbits -= 4;
-        ++b;
-    }
-    if (apr_isxdigit(*b) && (chunkbits <= 0)) {
-        /* overflow */
-        return -1;
-    }
-
-    return chunksize;
-}
-
 typedef struct header_struct {
     apr_pool_t *pool;
     apr_bucket_brigade *bb;
@@ -739,6 +693,38 @@ static int uniq_field_values(void *d, const char *key, const char *val)
     return 1;
 }
 
+/* Whether a comma/space-separated list of tokens names one of them
+ * more than once.
+ */
+static int has_duplicate_tokens(const char *val)
+{
+    const char *s, *e, *t, *u;
+
+    for (s = val; *s; s = e) {
+        while (*s == ',' || apr_isspace(*s)) {
+            ++s;
+        }
+        for (e = s; *e && *e != ',' && !apr_isspace(*e); ++e)
+            ;
+        if (e == s) {
+            break;
+        }
+        /* compare with the tokens which follow it */
+        for (t = e; *t; t = u) {
+            while (*t == ',' || apr_isspace(*t)) {
+                ++t;
+            }
+            for (u = t; *u && *u != ',' && !apr_isspace(*u); ++u)
+                ;
+            if (u - t == e - s && !strncasecmp(s, t, e - s)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
 /*
  * Since some clients choke violently on multiple Vary fields, or
  * Vary fields with duplicate tokens, combine any multiples and remove
@@ -747,6 +733,24 @@ static int uniq_field_values(void *d, const char *key, const char *val)
 static void fixup_vary(request_rec *r)
 {
     apr_array_header_t *varies;
+    const apr_array_header_t *elts = apr_table_elts(r->headers_out);
+    const apr_table_entry_t *t_elt = (const apr_table_entry_t *)elts->elts;
+    const apr_table_entry_t *t_end = t_elt + elts->nelts;
+    const char *vary = NULL;
+    int count = 0;
+
+    /* Most responses have no Vary field or a single one without
+     * duplicates, which need not be rebuilt.
+     */
+    for (; t_elt < t_end; ++t_elt) {
+        if (t_elt->key && !strcasecmp(t_elt->key, "Vary")) {
+            vary = t_elt->val;
+            ++count;
+        }
+    }
+    if (count == 0 || (count == 1 && !has_duplicate_tokens(vary))) {
+        return;
+    }
 
     varies = apr_array_make(r->pool, 5, sizeof(char *));
 
@@ -765,68 +769,6 @@ static void fixup_vary(request_rec *r)
     }
 }
 
-/* Send a request's HTTP response headers to the client.
- */
-static apr_status_t send_all_header_fields(header_struct *h,
-                                           const request_rec *r)
-{
-    const apr_array_header_t *elts;
-    const apr_table_entry_t *t_elt;
-    const apr_table_entry_t *t_end;
-    struct iovec *vec;
-    struct iovec *vec_next;
-
-    elts = apr_table_elts(r->headers_out);
-    if (elts->nelts == 0) {
-        return APR_SUCCESS;
-    }
-    t_elt = (const apr_table_entry_t *)(elts->elts);
-    t_end = t_elt + elts->nelts;
-    vec = (struct iovec *)apr_palloc(h->pool, 4 * elts->nelts *
-                                     sizeof(struct iovec));
-    vec_next = vec;
-
-    /* For each field, generate
-     *    name ": " value CRLF
-     */
-    do {
-        vec_next->iov_base = (void*)(t_elt->key);
-        vec_next->iov_len = strlen(t_elt->key);
-        vec_next++;
-        vec_next->iov_base = ": ";
-        vec_next->iov_len = sizeof(": ") - 1;
-        vec_next++;
-        vec_next->iov_base = (void*)(t_elt->val);
-        vec_next->iov_len = strlen(t_elt->val);
-        vec_next++;
-        vec_next->iov_base = CRLF;
-        vec_next->iov_len = sizeof(CRLF) - 1;
-        vec_next++;
-        t_elt++;
-    } while (t_elt < t_end);
-
-    if (APLOGrtrace4(r)) {
-        t_elt = (const apr_table_entry_t *)(elts->elts);
-        do {
-            ap_log_rerror(APLOG_MARK, APLOG_TRACE4, 0, r, "  %s: %s",
-                          ap_escape_logitem(r->pool, t_elt->key),
-                          ap_escape_logitem(r->pool, t_elt->val));
-            t_elt++;
-        } while (t_elt < t_end);
-    }
-
-#if APR_CHARSET_EBCDIC
-    {
-        apr_size_t len;
-        char *tmp = apr_pstrcatv(r->pool, vec, vec_next - vec, &len);
-        ap_xlate_proto_to_ascii(tmp, len);
-        return apr_brigade_write(h->bb, NULL, NULL, tmp, len);
-    }
-#else
-    return apr_brigade_writev(h->bb, NULL, NULL, vec, vec_next - vec);
-#endif
-}
-
 /* Confirm that the status line is well-formed and matches r->status.
  * If they don't match, a filter may have negated the status line set by a
  * handler.
@@ -893,14 +835,67 @@ static void basic_http_header_check(request_rec *r,
 
 }
 
-/* fill "bb" with a barebones/initial HTTP response header */
-static void basic_http_header(request_rec *r, apr_bucket_brigade *bb,
-                              const char *protocol)
+/* Determine the Date and Server fields of a response, and remove them
+ * from headers_out.  date must have room for APR_RFC822_DATE_LEN
+ * characters; it is used unless a proxied response has its own Date.
+ */
+static void basic_http_header_fields(request_rec *r, char *date,
+                                     const char **date_field,
+                                     const char **server_field)
 {
-    char *date = NULL;
     const char *proxy_date = NULL;
     const char *server = NULL;
     const char *us = ap_get_server_banner();
+
+    /*
+     * keep the set-by-proxy server and date headers, otherwise
+     * generate a new server header / date header
+     */
+    if (r->proxyreq != PROXYREQ_NONE) {
+        proxy_date = apr_table_get(r->headers_out, "Date");
+        server = apr_table_get(r->headers_out, "Server");
+    }
+    if (!proxy_date) {
+        ap_recent_rfc822_date(date, r->request_time);
+    }
+
+    if (!server && *us)
+        server = us;
+
+    *date_field = proxy_date ? proxy_date : date;
+    *server_field = server;
+
+    if (APLOGrtrace3(r)) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0, r,
+                      "Response sent with status %d%s",
+                      r->status,
+                      APLOGrtrace4(r) ? ", headers:" : "");
+
+        /*
+         * Date and Server are less interesting, use TRACE5 for them while
+         * using TRACE4 for the other headers.
+         */
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE5, 0, r, "  %s: %s", "Date",
+                      *date_field);
+        if (server)
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE5, 0, r, "  %s: %s", "Server",
+                          server);
+    }
+
+    /* unset so we don't send them again */
+    apr_table_unset(r->headers_out, "Date");        /* Avoid bogosity */
+    if (server) {
+        apr_table_unset(r->headers_out, "Server");
+    }
+}
+
+/* fill "bb" with a barebones/initial HTTP response header */
+static void basic_http_header(request_rec *r, apr_bucket_brigade *bb,
+                              const char *protocol)
+{
+    char date[APR_RFC822_DATE_LEN];
+    const char *date_field;
+    const char *server;
     header_struct h;
     struct iovec vec[4];
 
@@ -934,58 +929,132 @@ static void basic_http_header(request_rec *r, apr_bucket_brigade *bb,
     h.pool = r->pool;
     h.bb = bb;
 
-    /*
-     * keep the set-by-proxy server and date headers, otherwise
-     * generate a new server header / date header
-     */
-    if (r->proxyreq != PROXYREQ_NONE) {
-        proxy_date = apr_table_get(r->headers_out, "Date");
-        if (!proxy_date) {
-            /*
-             * proxy_date needs to be const. So use date for the creation of
-             * our own Date header and pass it over to proxy_date later to
-             * avoid a compiler warning.
-             */
-            date = apr_palloc(r->pool, APR_RFC822_DATE_LEN);
-            ap_recent_rfc822_date(date, r->request_time);
+    basic_http_header_fields(r, date, &date_field, &server);
+
+    form_header_field(&h, "Date", date_field);
+    if (server)
+        form_header_field(&h, "Server", server);
+}
+
+/* The header fields which may be sent with a 304 Not Modified response */
+static const char *const not_modified_fields[] = {
+    "Connection",
+    "Keep-Alive",
+    "ETag",
+    "Content-Location",
+    "Expires",
+    "Cache-Control",
+    "Vary",
+    "Warning",
+    "WWW-Authenticate",
+    "Proxy-Authenticate",
+    "Set-Cookie",
+    "Set-Cookie2",
+    NULL
+};
+
+static int is_not_modified_field(const char *key)
+{
+    const char *const *field;
+
+    for (field = not_modified_fields; *field; ++field) {
+        if (!strcasecmp(key, *field)) {
+            return 1;
         }
-        server = apr_table_get(r->headers_out, "Server");
-    }
-    else {
-        date = apr_palloc(r->pool, APR_RFC822_DATE_LEN);
-        ap_recent_rfc822_date(date, r->request_time);
     }
+    return 0;
+}
 
-    form_header_field(&h, "Date", proxy_date ? proxy_date : date );
+#define HEADER_FIELD_LEN(name_len, val_len) \
+    ((name_len) + sizeof(": ") - 1 + (val_len) + sizeof(CRLF) - 1)
 
-    if (!server && *us)
-        server = us;
-    if (server)
-        form_header_field(&h, "Server", server);
+#define HEADER_APPEND(p, str, len) \
+    do { memcpy(p, str, len); p += len; } while (0)
 
-    if (APLOGrtrace3(r)) {
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0, r,
-                      "Response sent with status %d%s",
-		      r->status,
-		      APLOGrtrace4(r) ? ", headers:" : "");
+/*
+ * Serialize the whole response header: the Status-Line, the Date and
+ * Server fields, the fields of headers_out (only those allowed with a 304
+ * response) and the final CRLF.  The size is computed first so that it
+ * is written into a single buffer, passed on as one heap bucket, rather
+ * than as a write to the brigade for each field.
+ */
+static apr_bucket *http_header_bucket(request_rec *r, const char *protocol,
+                                      apr_bucket_alloc_t *list)
+{
+    char date[APR_RFC822_DATE_LEN];
+    const char *date_field;
+    const char *server;
+    const apr_array_header_t *elts;
+    const apr_table_entry_t *t_elt;
+    const apr_table_entry_t *t_end;
+    apr_size_t protocol_len, status_len, date_len, server_len = 0;
+    apr_size_t len;
+    int not_modified = (r->status == HTTP_NOT_MODIFIED);
+    char *buf, *p;
 
-        /*
-         * Date and Server are less interesting, use TRACE5 for them while
-         * using TRACE4 for the other headers.
-         */
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE5, 0, r, "  %s: %s", "Date",
-                      proxy_date ? proxy_date : date );
-        if (server)
-            ap_log_rerror(APLOG_MARK, APLOG_TRACE5, 0, r, "  %s: %s", "Server",
-                          server);
+    basic_http_header_fields(r, date, &date_field, &server);
+
+    protocol_len = strlen(protocol);
+    status_len = strlen(r->status_line);
+    date_len = strlen(date_field);
+    len = protocol_len + 1 + status_len + sizeof(CRLF) - 1
+          + HEADER_FIELD_LEN(sizeof("Date") - 1, date_len)
+          + sizeof(CRLF) - 1;
+    if (server) {
+        server_len = strlen(server);
+        len += HEADER_FIELD_LEN(sizeof("Server") - 1, server_len);
     }
 
+    elts = apr_table_elts(r->headers_out);
+    t_elt = (const apr_table_entry_t *)(elts->elts);
+    t_end = t_elt + elts->nelts;
+    for (; t_elt < t_end; ++t_elt) {
+        if (!t_elt->key
+            || (not_modified && !is_not_modified_field(t_elt->key))) {
+            continue;
+        }
+        len += HEADER_FIELD_LEN(strlen(t_elt->key), strlen(t_elt->val));
+    }
 
-    /* unset so we don't send them again */
-    apr_table_unset(r->headers_out, "Date");        /* Avoid bogosity */
+    p = buf = apr_bucket_alloc(len, list);
+
+    HEADER_APPEND(p, protocol, protocol_len);
+    *p++ = ' ';
+    HEADER_APPEND(p, r->status_line, status_len);
+    HEADER_APPEND(p, CRLF "Date: ", sizeof(CRLF "Date: ") - 1);
+    HEADER_APPEND(p, date_field, date_len);
+    HEADER_APPEND(p, CRLF, sizeof(CRLF) - 1);
     if (server) {
-        apr_table_unset(r->headers_out, "Server");
+        HEADER_APPEND(p, "Server: ", sizeof("Server: ") - 1);
+        HEADER_APPEND(p, server, server_len);
+        HEADER_APPEND(p, CRLF, sizeof(CRLF) - 1);
+    }
+
+    for (t_elt = (const apr_table_entry_t *)(elts->elts); t_elt < t_end;
+         ++t_elt) {
+        if (!t_elt->key
+            || (not_modified && !is_not_modified_field(t_elt->key))) {
+            continue;
+        }
+        HEADER_APPEND(p, t_elt->key, strlen(t_elt->key));
+        *p++ = ':';
+        *p++ = ' ';
+        HEADER_APPEND(p, t_elt->val, strlen(t_elt->val));
+        HEADER_APPEND(p, CRLF, sizeof(CRLF) - 1);
+
+        if (APLOGrtrace4(r)) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE4, 0, r, "  %s: %s",
+                          ap_escape_logitem(r->pool, t_elt->key),
+                          ap_escape_logitem(r->pool, t_elt->val));
+        }
     }
+
+    HEADER_APPEND(p, CRLF, sizeof(CRLF) - 1);
+    AP_DEBUG_ASSERT(p == buf + len);
+
+    ap_xlate_proto_to_ascii(buf, len);
+
+    return apr_bucket_heap_create(buf, len, apr_bucket_free, list);
 }
 
 AP_DECLARE(void) ap_basic_http_header(request_rec *r, apr_bucket_brigade *bb)
@@ -996,16 +1065,6 @@ AP_DECLARE(void) ap_basic_http_header(request_rec *r, apr_bucket_brigade *bb)
     basic_http_header(r, bb, protocol);
 }
 
-static void terminate_header(apr_bucket_brigade *bb)
-{
-    char crlf[] = CRLF;
-    apr_size_t buflen;
-
-    buflen = strlen(crlf);
-    ap_xlate_proto_to_ascii(crlf, buflen);
-    apr_brigade_write(bb, NULL, NULL, crlf, buflen);
-}
-
 AP_DECLARE_NONSTD(int) ap_send_http_trace(request_rec *r)
 {
     core_server_config *conf;
@@ -1136,7 +1195,6 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_http_header_filter(ap_filter_t *f,
     const char *protocol;
     apr_bucket *e;
     apr_bucket_brigade *b2;
-    header_struct h;
     header_filter_ctx *ctx = f->ctx;
     const char *ctype;
     ap_bucket_error *eb = NULL;
@@ -1288,33 +1346,8 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_http_header_filter(ap_filter_t *f,
     }
 
     b2 = apr_brigade_create(r->pool, c->bucket_alloc);
-    basic_http_header(r, b2, protocol);
-
-    h.pool = r->pool;
-    h.bb = b2;
-
-    if (r->status == HTTP_NOT_MODIFIED) {
-        apr_table_do((int (*)(void *, const char *, const char *)) form_header_field,
-                     (void *) &h, r->headers_out,
-                     "Connection",
-                     "Keep-Alive",
-                     "ETag",
-                     "Content-Location",
-                     "Expires",
-                     "Cache-Control",
-                     "Vary",
-                     "Warning",
-                     "WWW-Authenticate",
-                     "Proxy-Authenticate",
-                     "Set-Cookie",
-                     "Set-Cookie2",
-                     NULL);
-    }
-    else {
-        send_all_header_fields(&h, r);
-    }
-
-    terminate_header(b2);
+    e = http_header_bucket(r, protocol, c->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(b2, e);
 
     ap_pass_brigade(f->next, b2);
 
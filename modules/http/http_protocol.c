@@ -319,7 +319,8 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
     if ((if_match = apr_table_get(r->headers_in, "If-Match")) != NULL) {
         if (if_match[0] != '*'
             && (etag == NULL || etag[0] == 'W'
-                || !ap_find_list_item(r->pool, if_match, etag))) {
+                || (strcmp(if_match, etag)
+                    && !ap_find_list_item(r->pool, if_match, etag)))) {
             return HTTP_PRECONDITION_FAILED;
         }
     }
@@ -350,6 +351,9 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
      *
      * GET or HEAD allow weak etag comparison, all other methods require
      * strong comparison.  We can only use weak if it's not a range request.
+     *
+     * Clients mostly send back the one ETag they were given, which is
+     * checked for before parsing the field as a list.
      */
     if_nonematch = apr_table_get(r->headers_in, "If-None-Match");
     if (if_nonematch != NULL) {
@@ -358,20 +362,19 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
                 not_modified = 1;
             }
             else if (etag != NULL) {
-                if (apr_table_get(r->headers_in, "Range")) {
-                    not_modified = etag[0] != 'W'
-                                   && ap_find_list_item(r->pool,
-                                                        if_nonematch, etag);
-                }
-                else {
-                    not_modified = ap_find_list_item(r->pool,
-                                                     if_nonematch, etag);
+                not_modified = !strcmp(if_nonematch, etag)
+                               || ap_find_list_item(r->pool,
+                                                    if_nonematch, etag);
+                if (etag[0] == 'W'
+                    && apr_table_get(r->headers_in, "Range")) {
+                    not_modified = 0;
                 }
             }
         }
         else if (if_nonematch[0] == '*'
                  || (etag != NULL
-                     && ap_find_list_item(r->pool, if_nonematch, etag))) {
+                     && (!strcmp(if_nonematch, etag)
+                         || ap_find_list_item(r->pool, if_nonematch, etag)))) {
             return HTTP_PRECONDITION_FAILED;
         }
     }
@@ -382,6 +385,10 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
      * specified in this field, then the server MUST
      *    respond with a status of 304 (Not Modified).
      * A date later than the server's current request time is invalid.
+     *
+     * When the date is the Last-Modified date we sent for a file, as it
+     * usually is, it is recognized from the validator cache without
+     * being parsed.
      */
     if (r->method_number == M_GET
         && (not_modified || !if_nonematch)
@@ -391,11 +398,16 @@ AP_DECLARE(int) ap_meets_conditions(request_rec *r)
         apr_time_t ims_time;
         apr_int64_t ims, reqtime;
 
-        ims_time = apr_date_parse_http(if_modified_since);
-        ims = apr_time_sec(ims_time);
-        reqtime = apr_time_sec(r->request_time);
+        if (ap_is_file_last_modified(r, if_modified_since)) {
+            not_modified = 1;
+        }
+        else {
+            ims_time = apr_date_parse_http(if_modified_since);
+            ims = apr_time_sec(ims_time);
+            reqtime = apr_time_sec(r->request_time);
 
-        not_modified = ims >= mtime && ims <= reqtime;
+            not_modified = ims >= mtime && ims <= reqtime;
+        }
     }
 
     if (not_modified) {
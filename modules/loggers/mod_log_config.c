@@ -151,8 +151,12 @@
 #include "apr_hash.h"
 #include "apr_optional.h"
 #include "apr_anylock.h"
+#include "apr_atomic.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_cond.h"
 
 #define APR_WANT_STRFUNC
+#define APR_WANT_IOVEC
 #include "apr_want.h"
 
 #include "ap_config.h"
@@ -203,6 +207,8 @@ static ap_log_writer *log_writer = ap_default_log_writer;
 static ap_log_writer_init *log_writer_init = ap_default_log_writer_init;
 static int buffered_logs = 0; /* default unbuffered */
 static apr_array_header_t *all_buffered_logs = NULL;
+static apr_size_t buffered_logs_size = 0; /* default LOG_BUFSIZE */
+static int buffered_logs_drop = 0; /* default write on overflow */
 
 /* POSIX.1 defines PIPE_BUF as the maximum number of bytes that is
  * guaranteed to be atomic when writing a pipe.  And PIPE_BUF >= 512
@@ -234,12 +240,18 @@ static apr_array_header_t *all_buffered_logs = NULL;
  * which might be empty.
  */
 
+#define LOG_RECORD_UNSET   -1
+#define LOG_RECORD_TEXT     0
+#define LOG_RECORD_JSON     1
+#define LOG_RECORD_BINARY   2
+
 typedef struct {
     const char *default_format_string;
     apr_array_header_t *default_format;
     apr_array_header_t *config_logs;
     apr_array_header_t *server_config_logs;
     apr_table_t *formats;
+    int record_format;
 } multi_log_state;
 
 /*
@@ -252,11 +264,18 @@ typedef struct {
  * set to a opaque structure (usually a fd) after it is opened.
 
  */
+typedef struct log_slot log_slot;
+
 typedef struct {
     apr_file_t *handle;
     apr_size_t outcnt;
     char outbuf[LOG_BUFSIZE];
     apr_anylock_t mutex;
+    const char *fname;
+    int piped;
+    apr_size_t chunk_size;          /* of the per-thread buffers */
+    log_slot *slots;                /* per thread, with the writer thread */
+    volatile apr_uint32_t dropped;
 } buffered_log;
 
 typedef struct {
@@ -266,6 +285,8 @@ typedef struct {
     void *log_writer;
     char *condition_var;
     ap_expr_info_t *condition_expr;
+    int record_format;
+    apr_array_header_t *schemas;    /* log_schema_sent, of a binary log */
 } config_log_state;
 
 /*
@@ -279,7 +300,32 @@ typedef struct {
 /*
  * Format items...
  * Note that many of these could have ap_sprintfs replaced with static buffers.
+ *
+ * When a format is parsed, adjacent constant strings are merged and the
+ * items that have a fixed maximum width (numbers and the CLF time) are
+ * given an op, so that config_log_transaction() can render them straight
+ * into one buffer instead of calling their handler.  Everything else
+ * (LOG_OP_HANDLER) goes through its handler.
+ */
+
+#define LOG_OP_HANDLER          0
+#define LOG_OP_CONSTANT         1
+#define LOG_OP_STATUS           2
+#define LOG_OP_BYTES_CLF        3
+#define LOG_OP_BYTES            4
+#define LOG_OP_TIME_BEGIN       5
+#define LOG_OP_TIME_END         6
+#define LOG_OP_DURATION         7
+#define LOG_OP_DURATION_USEC    8
+#define LOG_OP_KEEPALIVES       9
+
+/*
+ * With LogRecordFormat JSON or Binary, the constant items only separate
+ * the fields in text logs and are left out.  Each other item is a field,
+ * named after its format letter (plus its argument) and typed from it.
  */
+#define LOG_FIELD_STRING        0
+#define LOG_FIELD_NUMBER        1
 
 typedef struct {
     ap_log_handler_fn_t *func;
@@ -287,8 +333,100 @@ typedef struct {
     int condition_sense;
     int want_orig;
     apr_array_header_t *conditions;
+    int op;
+    int arg_len;                /* of a LOG_OP_CONSTANT */
+    const char *name;           /* of the field */
+    int type;
+    const char *key;            /* the name as JSON object key, with ':' */
+    int key_len;
 } log_format_item;
 
+/*
+ * Binary records start with their length (4 bytes, big endian, not
+ * counting itself) and their kind.  A schema record lists the type
+ * and name of the fields of a format, under an id; the row records that
+ * follow name the id of their schema, followed by the fields:
+ *
+ *   schema:  'S' id(4) nfields(2) { type(1) namelen(2) name } ...
+ *   row:     'R' id(4) { field } ...
+ *   string field: len(4) bytes, or 0xffffffff for "-"
+ *   number field: 1 and the value (8 bytes, two's complement), or 0
+ *
+ * Each process writes a schema once to the log handle, before the first
+ * row of that schema (see write_log_schema()), so a file has the schemas
+ * of each child that logged to it.  The records can be read with
+ * support/logdecode.
+ */
+#define LOG_BINARY_SCHEMA   'S'
+#define LOG_BINARY_ROW      'R'
+#define LOG_BINARY_NULL     0xffffffff
+
+typedef struct {
+    apr_uint32_t id;
+    const char *record;
+    apr_size_t len;
+} log_schema;
+
+/* A format a binary log is written with (its own, or the default format
+ * of a server that shares the log), and whether the schema of that format
+ * has been written to the log by this process.  A log has an array of
+ * them, set up with the log and then only read, except for sent, which is
+ * set under the lock of the buffered log or log_schema_mutex.
+ */
+typedef struct {
+    apr_array_header_t *format;
+    log_schema *schema;
+    volatile apr_uint32_t sent;
+} log_schema_sent;
+
+static apr_hash_t *log_schemas; /* of the formats in use, by address */
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *log_schema_mutex;
+#endif
+
+typedef struct {
+    char tag;
+    const char *name;
+    int type;
+} log_field;
+
+static const log_field log_fields[] = {
+    { 'a', "remote_addr",       LOG_FIELD_STRING },
+    { 'A', "local_addr",        LOG_FIELD_STRING },
+    { 'b', "bytes_sent_clf",    LOG_FIELD_NUMBER },
+    { 'B', "bytes_sent",        LOG_FIELD_NUMBER },
+    { 'C', "cookie",            LOG_FIELD_STRING },
+    { 'D', "duration_usec",     LOG_FIELD_NUMBER },
+    { 'e', "env",               LOG_FIELD_STRING },
+    { 'f', "filename",          LOG_FIELD_STRING },
+    { 'h', "remote_host",       LOG_FIELD_STRING },
+    { 'H', "protocol",          LOG_FIELD_STRING },
+    { 'i', "request_header",    LOG_FIELD_STRING },
+    { 'I', "bytes_in",          LOG_FIELD_NUMBER },
+    { 'k', "keepalives",        LOG_FIELD_NUMBER },
+    { 'l', "remote_logname",    LOG_FIELD_STRING },
+    { 'L', "log_id",            LOG_FIELD_STRING },
+    { 'm', "method",            LOG_FIELD_STRING },
+    { 'n', "note",              LOG_FIELD_STRING },
+    { 'o', "response_header",   LOG_FIELD_STRING },
+    { 'O', "bytes_out",         LOG_FIELD_NUMBER },
+    { 'p', "port",              LOG_FIELD_NUMBER },
+    { 'P', "pid",               LOG_FIELD_NUMBER },
+    { 'q', "query",             LOG_FIELD_STRING },
+    { 'r', "request",           LOG_FIELD_STRING },
+    { 'R', "handler",           LOG_FIELD_STRING },
+    { 's', "status",            LOG_FIELD_NUMBER },
+    { 'S', "bytes_transferred", LOG_FIELD_NUMBER },
+    { 't', "time",              LOG_FIELD_STRING },
+    { 'T', "duration",          LOG_FIELD_NUMBER },
+    { 'u', "remote_user",       LOG_FIELD_STRING },
+    { 'U', "uri",               LOG_FIELD_STRING },
+    { 'v', "virtual_host",      LOG_FIELD_STRING },
+    { 'V', "server_name",       LOG_FIELD_STRING },
+    { 'X', "connection_status", LOG_FIELD_STRING },
+    { '\0', NULL,               LOG_FIELD_STRING }
+};
+
 static char *pfmt(apr_pool_t *p, int i)
 {
     if (i <= 0) {
@@ -598,6 +736,56 @@ static apr_time_t get_request_end_time(request_rec *r)
 }
 
 
+/*
+ * Render the CLF time of request_time into buf, which must have room for
+ * DEFAULT_REQUEST_TIME_SIZE bytes, and return its length.
+ */
+static int render_request_time_clf(char *buf, apr_time_t request_time)
+{
+    /* This code uses the same technique as ap_explode_recent_localtime():
+     * optimistic caching with logic to detect and correct race conditions.
+     * See the comments in server/util_time.c for more information.
+     */
+    cached_request_time cached_time;
+    unsigned t_seconds = (unsigned)apr_time_sec(request_time);
+    unsigned i = t_seconds & TIME_CACHE_MASK;
+    int len;
+
+    cached_time = request_time_cache[i];
+    if ((t_seconds != cached_time.t) ||
+        (t_seconds != cached_time.t_validate)) {
+
+        /* Invalid or old snapshot, so compute the proper time string
+         * and store it in the cache
+         */
+        apr_time_exp_t xt;
+        char sign;
+        int timz;
+
+        ap_explode_recent_localtime(&xt, request_time);
+        timz = xt.tm_gmtoff;
+        if (timz < 0) {
+            timz = -timz;
+            sign = '-';
+        }
+        else {
+            sign = '+';
+        }
+        cached_time.t = t_seconds;
+        apr_snprintf(cached_time.timestr, DEFAULT_REQUEST_TIME_SIZE,
+                     "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
+                     xt.tm_mday, apr_month_snames[xt.tm_mon],
+                     xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
+                     sign, timz / (60*60), (timz % (60*60)) / 60);
+        cached_time.t_validate = t_seconds;
+        request_time_cache[i] = cached_time;
+    }
+
+    len = strlen(cached_time.timestr);
+    memcpy(buf, cached_time.timestr, len + 1);
+    return len;
+}
+
 static const char *log_request_time(request_rec *r, char *a)
 {
     apr_time_exp_t xt;
@@ -693,43 +881,10 @@ static const char *log_request_time(request_rec *r, char *a)
         return log_request_time_custom(r, a, &xt);
     }
     else {                                   /* CLF format */
-        /* This code uses the same technique as ap_explode_recent_localtime():
-         * optimistic caching with logic to detect and correct race conditions.
-         * See the comments in server/util_time.c for more information.
-         */
-        cached_request_time* cached_time = apr_palloc(r->pool,
-                                                      sizeof(*cached_time));
-        unsigned t_seconds = (unsigned)apr_time_sec(request_time);
-        unsigned i = t_seconds & TIME_CACHE_MASK;
-        *cached_time = request_time_cache[i];
-        if ((t_seconds != cached_time->t) ||
-            (t_seconds != cached_time->t_validate)) {
-
-            /* Invalid or old snapshot, so compute the proper time string
-             * and store it in the cache
-             */
-            char sign;
-            int timz;
-
-            ap_explode_recent_localtime(&xt, request_time);
-            timz = xt.tm_gmtoff;
-            if (timz < 0) {
-                timz = -timz;
-                sign = '-';
-            }
-            else {
-                sign = '+';
-            }
-            cached_time->t = t_seconds;
-            apr_snprintf(cached_time->timestr, DEFAULT_REQUEST_TIME_SIZE,
-                         "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
-                         xt.tm_mday, apr_month_snames[xt.tm_mon],
-                         xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
-                         sign, timz / (60*60), (timz % (60*60)) / 60);
-            cached_time->t_validate = t_seconds;
-            request_time_cache[i] = *cached_time;
-        }
-        return cached_time->timestr;
+        char *buf = apr_palloc(r->pool, DEFAULT_REQUEST_TIME_SIZE);
+
+        render_request_time_clf(buf, request_time);
+        return buf;
     }
 }
 
@@ -830,6 +985,97 @@ static const char *log_requests_on_connection(request_rec *r, char *a)
  * Parsing the log format string
  */
 
+/* The length of s escaped as the contents of a JSON string; the values
+ * are kept as in text logs (with their escapes), so that only quotes,
+ * backslashes and the control and non-ASCII bytes have to be escaped.
+ */
+static apr_size_t json_escaped_len(const char *s, apr_size_t len)
+{
+    apr_size_t n = len;
+    const unsigned char *c = (const unsigned char *)s;
+
+    for (; len; --len, ++c) {
+        if (*c == '"' || *c == '\\') {
+            n += 1;
+        }
+        else if (*c < 0x20 || *c >= 0x7f) {
+            n += 5;
+        }
+    }
+    return n;
+}
+
+static char *json_escape(char *d, const char *s, apr_size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *c = (const unsigned char *)s;
+
+    for (; len; --len, ++c) {
+        if (*c == '"' || *c == '\\') {
+            *d++ = '\\';
+            *d++ = *c;
+        }
+        else if (*c < 0x20 || *c >= 0x7f) {
+            *d++ = '\\';
+            *d++ = 'u';
+            *d++ = '0';
+            *d++ = '0';
+            *d++ = hex[*c >> 4];
+            *d++ = hex[*c & 0xf];
+        }
+        else {
+            *d++ = *c;
+        }
+    }
+    return d;
+}
+
+static void set_log_field(apr_pool_t *p, log_format_item *it, char tag)
+{
+    const log_field *f;
+    char *key;
+    apr_size_t len;
+
+    for (f = log_fields; f->tag && f->tag != tag; f++)
+        ;
+    it->name = f->tag ? f->name : apr_pstrndup(p, &tag, 1);
+    it->type = f->type;
+    if (tag == 's' && it->want_orig) {
+        it->name = "original_status";
+    }
+
+    if (*it->arg) {
+        const char *a = it->arg;
+
+        it->name = apr_pstrcat(p, it->name, ".", a, NULL);
+        if (tag == 't') {
+            if (!strncmp(a, "begin:", 6)) {
+                a += 6;
+            }
+            else if (!strncmp(a, "end:", 4)) {
+                a += 4;
+            }
+            if (!strcmp(a, "sec") || !strcmp(a, "msec")
+                || !strcmp(a, "usec") || !strcmp(a, "msec_frac")
+                || !strcmp(a, "usec_frac")) {
+                it->type = LOG_FIELD_NUMBER;
+            }
+        }
+        else if (tag == 'P' && strcasecmp(a, "pid") && strcasecmp(a, "tid")) {
+            it->type = LOG_FIELD_STRING;
+        }
+    }
+
+    len = strlen(it->name);
+    it->key_len = json_escaped_len(it->name, len) + 3;
+    it->key = key = apr_palloc(p, it->key_len + 1);
+    *key++ = '"';
+    key = json_escape(key, it->name, len);
+    *key++ = '"';
+    *key++ = ':';
+    *key = '\0';
+}
+
 static char *parse_log_misc_string(apr_pool_t *p, log_format_item *it,
                                    const char **sa)
 {
@@ -838,6 +1084,7 @@ static char *parse_log_misc_string(apr_pool_t *p, log_format_item *it,
 
     it->func = constant_item;
     it->conditions = NULL;
+    it->op = LOG_OP_CONSTANT;
 
     s = *sa;
     while (*s && *s != '%') {
@@ -887,11 +1134,44 @@ static char *parse_log_misc_string(apr_pool_t *p, log_format_item *it,
         }
     }
     *d = '\0';
+    it->arg_len = d - it->arg;
 
     *sa = s;
     return NULL;
 }
 
+/* Give the items that can be rendered without their handler an op. */
+static int compile_log_item(log_format_item *it)
+{
+    if (it->func == log_status) {
+        return LOG_OP_STATUS;
+    }
+    if (it->func == clf_log_bytes_sent) {
+        return LOG_OP_BYTES_CLF;
+    }
+    if (it->func == log_bytes_sent) {
+        return LOG_OP_BYTES;
+    }
+    if (it->func == log_request_time) {
+        if (!*it->arg || !strcmp(it->arg, "begin")) {
+            return LOG_OP_TIME_BEGIN;
+        }
+        if (!strcmp(it->arg, "end")) {
+            return LOG_OP_TIME_END;
+        }
+    }
+    if (it->func == log_request_duration) {
+        return LOG_OP_DURATION;
+    }
+    if (it->func == log_request_duration_microseconds) {
+        return LOG_OP_DURATION_USEC;
+    }
+    if (it->func == log_requests_on_connection) {
+        return LOG_OP_KEEPALIVES;
+    }
+    return LOG_OP_HANDLER;
+}
+
 static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
 {
     const char *s = *sa;
@@ -907,7 +1187,9 @@ static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
 
     if (*s == '%') {
         it->arg = "%";
+        it->arg_len = 1;
         it->func = constant_item;
+        it->op = LOG_OP_CONSTANT;
         *sa = ++s;
 
         return NULL;
@@ -978,6 +1260,8 @@ static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
             if (it->want_orig == -1) {
                 it->want_orig = handler->want_orig_default;
             }
+            it->op = compile_log_item(it);
+            set_log_field(p, it, s[-1]);
             *sa = s;
             return NULL;
         }
@@ -986,6 +1270,19 @@ static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
     return "Ran off end of LogFormat parsing args to some directive";
 }
 
+/* Merge the constant item just parsed into a preceding one. */
+static void merge_log_constant(apr_pool_t *p, apr_array_header_t *a)
+{
+    log_format_item *it = (log_format_item *) a->elts + a->nelts - 1;
+
+    if (a->nelts > 1 && it->op == LOG_OP_CONSTANT
+        && it[-1].op == LOG_OP_CONSTANT) {
+        it[-1].arg = apr_pstrcat(p, it[-1].arg, it->arg, NULL);
+        it[-1].arg_len += it->arg_len;
+        a->nelts--;
+    }
+}
+
 static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const char **err)
 {
     apr_array_header_t *a = apr_array_make(p, 30, sizeof(log_format_item));
@@ -996,10 +1293,12 @@ static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const
             *err = res;
             return NULL;
         }
+        merge_log_constant(p, a);
     }
 
     s = APR_EOL_STR;
     parse_log_item(p, (log_format_item *) apr_array_push(a), &s);
+    merge_log_constant(p, a);
     return a;
 }
 
@@ -1008,13 +1307,8 @@ static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const
  * Actually logging.
  */
 
-static const char *process_item(request_rec *r, request_rec *orig,
-                          log_format_item *item)
+static int item_excluded(request_rec *r, log_format_item *item)
 {
-    const char *cp;
-
-    /* First, see if we need to process this thing at all... */
-
     if (item->conditions && item->conditions->nelts != 0) {
         int i;
         int *conds = (int *) item->conditions->elts;
@@ -1029,9 +1323,22 @@ static const char *process_item(request_rec *r, request_rec *orig,
 
         if ((item->condition_sense && in_list)
             || (!item->condition_sense && !in_list)) {
-            return "-";
+            return 1;
         }
     }
+    return 0;
+}
+
+static const char *process_item(request_rec *r, request_rec *orig,
+                          log_format_item *item)
+{
+    const char *cp;
+
+    /* First, see if we need to process this thing at all... */
+
+    if (item_excluded(r, item)) {
+        return "-";
+    }
 
     /* We do.  Do it... */
 
@@ -1039,6 +1346,352 @@ static const char *process_item(request_rec *r, request_rec *orig,
     return cp ? cp : "-";
 }
 
+/* The widest an op renders: the CLF time, or a signed 64 bit number */
+#define LOG_OP_MAX_WIDTH DEFAULT_REQUEST_TIME_SIZE
+
+static int render_number(char *buf, apr_int64_t n)
+{
+    char digits[20];
+    apr_uint64_t u = n < 0 ? -(apr_uint64_t)n : (apr_uint64_t)n;
+    int i = 0, len = 0;
+
+    do {
+        digits[i++] = '0' + (char)(u % 10);
+        u /= 10;
+    } while (u);
+
+    if (n < 0) {
+        buf[len++] = '-';
+    }
+    while (i) {
+        buf[len++] = digits[--i];
+    }
+    return len;
+}
+
+/*
+ * Render an item with an op into buf, which has room for LOG_OP_MAX_WIDTH
+ * bytes, as its handler would, and return the length.
+ */
+static int render_item(request_rec *r, log_format_item *item, char *buf)
+{
+    switch (item->op) {
+    case LOG_OP_STATUS:
+        if (r->status > 0) {
+            return render_number(buf, r->status);
+        }
+        break;
+    case LOG_OP_BYTES_CLF:
+    case LOG_OP_BYTES:
+        if (r->sent_bodyct && r->bytes_sent) {
+            return render_number(buf, r->bytes_sent);
+        }
+        if (item->op == LOG_OP_BYTES) {
+            *buf = '0';
+            return 1;
+        }
+        break;
+    case LOG_OP_TIME_BEGIN:
+        return render_request_time_clf(buf, r->request_time);
+    case LOG_OP_TIME_END:
+        return render_request_time_clf(buf, get_request_end_time(r));
+    case LOG_OP_DURATION:
+        return render_number(buf, apr_time_sec(get_request_end_time(r)
+                                               - r->request_time));
+    case LOG_OP_DURATION_USEC:
+        return render_number(buf, get_request_end_time(r) - r->request_time);
+    case LOG_OP_KEEPALIVES:
+        return render_number(buf, r->connection->keepalives
+                                  ? r->connection->keepalives - 1 : 0);
+    }
+
+    *buf = '-';
+    return 1;
+}
+
+static int log_field_null(const char *s, int len)
+{
+    return len == 0 || (len == 1 && *s == '-');
+}
+
+static int log_field_number(const char *s, int len, apr_int64_t *n)
+{
+    apr_int64_t v = 0;
+    int i = 0;
+
+    if (len && *s == '-') {
+        i++;
+    }
+    if (i == len || len - i > 18) {
+        return 0;
+    }
+    for (; i < len; i++) {
+        if (!apr_isdigit(s[i])) {
+            return 0;
+        }
+        v = v * 10 + (s[i] - '0');
+    }
+    *n = (*s == '-') ? -v : v;
+    return 1;
+}
+
+static char *log_put16(char *d, apr_uint32_t v)
+{
+    *d++ = (char)(v >> 8);
+    *d++ = (char)v;
+    return d;
+}
+
+static char *log_put32(char *d, apr_uint32_t v)
+{
+    *d++ = (char)(v >> 24);
+    *d++ = (char)(v >> 16);
+    *d++ = (char)(v >> 8);
+    *d++ = (char)v;
+    return d;
+}
+
+static log_schema *make_log_schema(apr_pool_t *p, apr_array_header_t *format)
+{
+    log_format_item *items = (log_format_item *) format->elts;
+    log_schema *schema = apr_palloc(p, sizeof(*schema));
+    apr_size_t len = 4 + 1 + 4 + 2;
+    apr_uint32_t id = 2166136261U;
+    char *record, *d;
+    int i, n = 0;
+
+    for (i = 0; i < format->nelts; ++i) {
+        if (items[i].op != LOG_OP_CONSTANT) {
+            len += 1 + 2 + strlen(items[i].name);
+            n++;
+        }
+    }
+
+    record = apr_palloc(p, len);
+    d = log_put32(record, len - 4);
+    *d++ = LOG_BINARY_SCHEMA;
+    d += 4;
+    d = log_put16(d, n);
+    for (i = 0; i < format->nelts; ++i) {
+        if (items[i].op != LOG_OP_CONSTANT) {
+            apr_size_t l = strlen(items[i].name);
+
+            *d++ = (char)items[i].type;
+            d = log_put16(d, l);
+            memcpy(d, items[i].name, l);
+            d += l;
+        }
+    }
+
+    /* FNV-1a of the fields */
+    for (d = record + 9; d < record + len; d++) {
+        id = (id ^ (unsigned char)*d) * 16777619U;
+    }
+    log_put32(record + 5, id);
+
+    schema->id = id;
+    schema->record = record;
+    schema->len = len;
+    return schema;
+}
+
+static log_schema *log_schema_of(request_rec *r, apr_array_header_t *format)
+{
+    log_schema *schema = apr_hash_get(log_schemas, &format, sizeof(format));
+
+    return schema ? schema : make_log_schema(r->pool, format);
+}
+
+/*
+ * Write the schema of a binary log entry before the first row of that
+ * schema this process writes to the log.  With the buffered writer the
+ * rows of the threads go through buffers of their own, which reach the
+ * file in no particular order, so the schema is written straight to the
+ * file under the lock of the buffers; a thread that sees it sent can
+ * only have its rows written after it.
+ */
+static apr_status_t write_log_schema(request_rec *r, config_log_state *cls,
+                                     apr_array_header_t *format)
+{
+    log_schema_sent *state = NULL;
+    log_schema *schema;
+    apr_size_t len;
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    if (cls->schemas) {
+        log_schema_sent *states = (log_schema_sent *)cls->schemas->elts;
+
+        for (i = 0; i < cls->schemas->nelts; ++i) {
+            if (states[i].format == format) {
+                state = &states[i];
+                break;
+            }
+        }
+    }
+    if (state && apr_atomic_read32(&state->sent)) {
+        return APR_SUCCESS;
+    }
+    schema = state ? state->schema : log_schema_of(r, format);
+    len = schema->len;
+
+    if (log_writer == ap_buffered_log_writer) {
+        buffered_log *buf = cls->log_writer;
+
+        if ((rv = APR_ANYLOCK_LOCK(&buf->mutex)) != APR_SUCCESS) {
+            return rv;
+        }
+        if (!state || !apr_atomic_read32(&state->sent)) {
+            rv = apr_file_write(buf->handle, schema->record, &len);
+            if (state) {
+                apr_atomic_set32(&state->sent, 1);
+            }
+        }
+        APR_ANYLOCK_UNLOCK(&buf->mutex);
+        return rv;
+    }
+
+#if APR_HAS_THREADS
+    if (log_schema_mutex) {
+        apr_thread_mutex_lock(log_schema_mutex);
+    }
+#endif
+    if (!state || !apr_atomic_read32(&state->sent)) {
+        const char *str = schema->record;
+        int strl = len;
+
+        rv = log_writer(r, cls->log_writer, &str, &strl, 1, len);
+        if (state) {
+            apr_atomic_set32(&state->sent, 1);
+        }
+    }
+#if APR_HAS_THREADS
+    if (log_schema_mutex) {
+        apr_thread_mutex_unlock(log_schema_mutex);
+    }
+#endif
+    return rv;
+}
+
+/*
+ * Encode the fields rendered for a log entry as one JSON object or
+ * binary row.
+ */
+static char *encode_log_record(request_rec *r, config_log_state *cls,
+                               apr_array_header_t *format,
+                               const char **strs, int *strl,
+                               apr_size_t *len)
+{
+    log_format_item *items = (log_format_item *) format->elts;
+    char num[LOG_OP_MAX_WIDTH];
+    log_schema *schema;
+    apr_int64_t n;
+    apr_size_t size;
+    char *buf, *d;
+    int i, first = 1;
+
+    if (cls->record_format == LOG_RECORD_JSON) {
+        size = 3;
+        for (i = 0; i < format->nelts; ++i) {
+            if (items[i].op == LOG_OP_CONSTANT) {
+                continue;
+            }
+            size += items[i].key_len + 1;
+            if (log_field_null(strs[i], strl[i])) {
+                size += 4;
+            }
+            else if (items[i].type == LOG_FIELD_NUMBER
+                     && log_field_number(strs[i], strl[i], &n)) {
+                size += render_number(num, n);
+            }
+            else {
+                size += json_escaped_len(strs[i], strl[i]) + 2;
+            }
+        }
+
+        d = buf = apr_palloc(r->pool, size);
+        *d++ = '{';
+        for (i = 0; i < format->nelts; ++i) {
+            if (items[i].op == LOG_OP_CONSTANT) {
+                continue;
+            }
+            if (!first) {
+                *d++ = ',';
+            }
+            first = 0;
+            memcpy(d, items[i].key, items[i].key_len);
+            d += items[i].key_len;
+            if (log_field_null(strs[i], strl[i])) {
+                memcpy(d, "null", 4);
+                d += 4;
+            }
+            else if (items[i].type == LOG_FIELD_NUMBER
+                     && log_field_number(strs[i], strl[i], &n)) {
+                d += render_number(d, n);
+            }
+            else {
+                *d++ = '"';
+                d = json_escape(d, strs[i], strl[i]);
+                *d++ = '"';
+            }
+        }
+        *d++ = '}';
+        *d++ = '\n';
+        *len = d - buf;
+        return buf;
+    }
+
+    schema = log_schema_of(r, format);
+    size = 4 + 1 + 4;
+    for (i = 0; i < format->nelts; ++i) {
+        if (items[i].op == LOG_OP_CONSTANT) {
+            continue;
+        }
+        if (items[i].type == LOG_FIELD_NUMBER) {
+            size += 1 + 8;
+        }
+        else if (log_field_null(strs[i], strl[i])) {
+            size += 4;
+        }
+        else {
+            size += 4 + strl[i];
+        }
+    }
+
+    d = buf = apr_palloc(r->pool, size);
+    d = log_put32(d, size - 4);
+    *d++ = LOG_BINARY_ROW;
+    d = log_put32(d, schema->id);
+    for (i = 0; i < format->nelts; ++i) {
+        if (items[i].op == LOG_OP_CONSTANT) {
+            continue;
+        }
+        if (items[i].type == LOG_FIELD_NUMBER) {
+            if (log_field_number(strs[i], strl[i], &n)) {
+                *d++ = 1;
+                d = log_put32(d, (apr_uint32_t)((apr_uint64_t)n >> 32));
+                d = log_put32(d, (apr_uint32_t)n);
+            }
+            else {
+                *d++ = 0;
+                memset(d, 0, 8);
+                d += 8;
+            }
+        }
+        else if (log_field_null(strs[i], strl[i])) {
+            d = log_put32(d, LOG_BINARY_NULL);
+        }
+        else {
+            d = log_put32(d, strl[i]);
+            memcpy(d, strs[i], strl[i]);
+            d += strl[i];
+        }
+    }
+
+    *len = size;
+    return buf;
+}
+
 static void flush_log(buffered_log *buf)
 {
     if (buf->outcnt && buf->handle != NULL) {
@@ -1047,6 +1700,345 @@ static void flush_log(buffered_log *buf)
     }
 }
 
+#if APR_HAS_THREADS
+/*
+ * With a writer thread (started in every child when BufferedLogs is on),
+ * each worker thread fills log buffers of its own, two per log file, of
+ * BufferedLogsSize bytes, without taking any lock.  A full buffer is
+ * handed over to the writer thread through a lock-free ring and the
+ * thread goes on with the other one; the writer writes the buffers with
+ * writev() and hands them back.  Only when both buffers of a thread are
+ * still waiting for the writer does the request see the log: the entry
+ * is then written directly, or dropped with BufferedLogsOverflow Drop.
+ */
+typedef struct {
+    buffered_log *log;
+    char *outbuf;
+    apr_size_t outcnt;
+    volatile apr_uint32_t queued;   /* handed over to the writer thread */
+} log_chunk;
+
+struct log_slot {
+    log_chunk *cur;
+    log_chunk chunk[2];
+};
+
+/* The ring is a bounded queue after Dmitry Vyukov's: the sequence number
+ * of a cell tells whether it is free for the position being pushed or
+ * holds the one being popped.  It has room for all the chunks there are,
+ * so pushing never finds it full.
+ */
+typedef struct {
+    volatile apr_uint32_t seq;
+    log_chunk *volatile chunk;
+} log_ring_cell;
+
+static log_ring_cell *log_ring;
+static apr_uint32_t log_ring_mask;
+static volatile apr_uint32_t log_ring_head;
+static apr_uint32_t log_ring_tail;      /* writer thread only */
+
+static apr_threadkey_t *log_slot_key;
+static apr_uint32_t log_slots;
+static volatile apr_uint32_t log_slots_used;
+
+static server_rec *log_server;
+static apr_thread_t *log_writer;
+static apr_thread_mutex_t *log_writer_mutex;
+static apr_thread_cond_t *log_writer_cond;
+static volatile apr_uint32_t log_writer_idle;
+static volatile int log_writer_stop;
+
+#define LOG_WRITER_IOVECS 64
+
+static void log_ring_push(log_chunk *chunk)
+{
+    apr_uint32_t pos = apr_atomic_read32(&log_ring_head);
+
+    for (;;) {
+        log_ring_cell *cell = &log_ring[pos & log_ring_mask];
+        apr_uint32_t prev;
+
+        if (apr_atomic_read32(&cell->seq) != pos) {
+            /* another thread took this position */
+            pos = apr_atomic_read32(&log_ring_head);
+            continue;
+        }
+        prev = apr_atomic_cas32(&log_ring_head, pos + 1, pos);
+        if (prev == pos) {
+            cell->chunk = chunk;
+            /* publish, the cas being a full barrier */
+            apr_atomic_cas32(&cell->seq, pos + 1, pos);
+            return;
+        }
+        pos = prev;
+    }
+}
+
+static log_chunk *log_ring_pop(void)
+{
+    log_ring_cell *cell = &log_ring[log_ring_tail & log_ring_mask];
+    log_chunk *chunk;
+
+    if (apr_atomic_read32(&cell->seq) != log_ring_tail + 1) {
+        return NULL;
+    }
+    chunk = cell->chunk;
+    apr_atomic_cas32(&cell->seq, log_ring_tail + log_ring_mask + 1,
+                     log_ring_tail + 1);
+    log_ring_tail++;
+    return chunk;
+}
+
+static int log_ring_empty(void)
+{
+    log_ring_cell *cell = &log_ring[log_ring_tail & log_ring_mask];
+
+    return apr_atomic_read32(&cell->seq) != log_ring_tail + 1;
+}
+
+static void write_log_chunks(log_chunk **batch, struct iovec *vec, int n)
+{
+    buffered_log *buf = batch[0]->log;
+    apr_uint32_t dropped;
+    apr_size_t amt;
+    int i;
+
+    apr_file_writev_full(buf->handle, vec, n, &amt);
+
+    for (i = 0; i < n; i++) {
+        batch[i]->outcnt = 0;
+        apr_atomic_cas32(&batch[i]->queued, 0, 1);
+    }
+
+    dropped = apr_atomic_xchg32(&buf->dropped, 0);
+    if (dropped) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, log_server,
+                     "BufferedLogs: dropped %u entries of %s, the log "
+                     "writer thread is behind", dropped, buf->fname);
+    }
+}
+
+/* Write what is in the ring, batching the buffers of a log file (but not
+ * of a piped log, where only writes of up to PIPE_BUF bytes are atomic).
+ */
+static int drain_log_ring(void)
+{
+    struct iovec vec[LOG_WRITER_IOVECS];
+    log_chunk *batch[LOG_WRITER_IOVECS];
+    log_chunk *chunk;
+    int n = 0, total = 0;
+
+    while ((chunk = log_ring_pop()) != NULL) {
+        if (n == LOG_WRITER_IOVECS
+            || (n && (chunk->log != batch[0]->log || chunk->log->piped))) {
+            write_log_chunks(batch, vec, n);
+            n = 0;
+        }
+        batch[n] = chunk;
+        vec[n].iov_base = chunk->outbuf;
+        vec[n].iov_len = chunk->outcnt;
+        n++;
+        total++;
+    }
+    if (n) {
+        write_log_chunks(batch, vec, n);
+    }
+    return total;
+}
+
+static void * APR_THREAD_FUNC log_writer_thread(apr_thread_t *thd, void *data)
+{
+    while (!log_writer_stop) {
+        if (drain_log_ring()) {
+            continue;
+        }
+
+        /* The workers only signal us when we are idle: set that (with a
+         * full barrier) before looking at the ring a last time. */
+        apr_thread_mutex_lock(log_writer_mutex);
+        apr_atomic_xchg32(&log_writer_idle, 1);
+        if (!log_writer_stop && log_ring_empty()) {
+            apr_thread_cond_timedwait(log_writer_cond, log_writer_mutex,
+                                      apr_time_from_sec(1));
+        }
+        apr_atomic_set32(&log_writer_idle, 0);
+        apr_thread_mutex_unlock(log_writer_mutex);
+    }
+    drain_log_ring();
+
+    return NULL;
+}
+
+static void wake_log_writer(void)
+{
+    if (apr_atomic_read32(&log_writer_idle)) {
+        apr_thread_mutex_lock(log_writer_mutex);
+        apr_thread_cond_signal(log_writer_cond);
+        apr_thread_mutex_unlock(log_writer_mutex);
+    }
+}
+
+static log_slot *get_log_slot(buffered_log *buf)
+{
+    void *val;
+    apr_uint32_t i;
+
+    if (!buf->slots
+        || apr_threadkey_private_get(&val, log_slot_key) != APR_SUCCESS) {
+        return NULL;
+    }
+    if (val) {
+        i = (apr_uint32_t)(apr_uintptr_t)val - 1;
+    }
+    else {
+        i = apr_atomic_inc32(&log_slots_used);
+        apr_threadkey_private_set((void *)(apr_uintptr_t)(i + 1),
+                                  log_slot_key);
+    }
+
+    /* more threads than the MPM told us about use the shared buffer */
+    return i < log_slots ? &buf->slots[i] : NULL;
+}
+
+static apr_status_t log_slot_write(request_rec *r, buffered_log *buf,
+                                   log_slot *slot, const char **strs,
+                                   int *strl, int nelts, apr_size_t len)
+{
+    log_chunk *chunk = slot->cur;
+    char *str;
+    char *s;
+    int i;
+
+    if (len + chunk->outcnt > buf->chunk_size && chunk->outcnt
+        && !apr_atomic_read32(&chunk->queued)) {
+        apr_atomic_set32(&chunk->queued, 1);
+        log_ring_push(chunk);
+        wake_log_writer();
+
+        chunk = (chunk == &slot->chunk[0]) ? &slot->chunk[1]
+                                           : &slot->chunk[0];
+        slot->cur = chunk;
+    }
+
+    if (len > buf->chunk_size || apr_atomic_read32(&chunk->queued)) {
+        apr_size_t w;
+
+        /* Too long for the buffers, or both of them are waiting for the
+         * writer thread. */
+        if (buffered_logs_drop && len <= buf->chunk_size) {
+            apr_atomic_inc32(&buf->dropped);
+            return APR_SUCCESS;
+        }
+
+        str = apr_palloc(r->pool, len + 1);
+        for (i = 0, s = str; i < nelts; ++i) {
+            memcpy(s, strs[i], strl[i]);
+            s += strl[i];
+        }
+        w = len;
+        return apr_file_write(buf->handle, str, &w);
+    }
+
+    for (i = 0, s = &chunk->outbuf[chunk->outcnt]; i < nelts; ++i) {
+        memcpy(s, strs[i], strl[i]);
+        s += strl[i];
+    }
+    chunk->outcnt += len;
+    return APR_SUCCESS;
+}
+
+/* Stop the writer thread when the child exits, and write what the
+ * workers have not handed over yet. */
+static apr_status_t stop_log_writer(void *data)
+{
+    buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+    apr_status_t rv;
+    apr_uint32_t j;
+    int i;
+
+    apr_thread_mutex_lock(log_writer_mutex);
+    log_writer_stop = 1;
+    apr_thread_cond_signal(log_writer_cond);
+    apr_thread_mutex_unlock(log_writer_mutex);
+    apr_thread_join(&rv, log_writer);
+
+    for (i = 0; i < all_buffered_logs->nelts; i++) {
+        buffered_log *buf = array[i];
+        log_slot *slots = buf->slots;
+
+        buf->slots = NULL;
+        for (j = 0; j < log_slots; j++) {
+            log_chunk *chunk = slots[j].cur;
+
+            if (chunk->outcnt && !chunk->queued) {
+                apr_file_write(buf->handle, chunk->outbuf, &chunk->outcnt);
+                chunk->outcnt = 0;
+            }
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t start_log_writer(apr_pool_t *p, server_rec *s,
+                                     int threads)
+{
+    buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+    apr_uint32_t cells, j;
+    apr_status_t rv;
+    int i;
+
+    log_server = s;
+    log_slots = threads > 1 ? threads : 1;
+    log_slots_used = 0;
+
+    /* every buffer can be in the ring at most once */
+    cells = 1;
+    while (cells < 2 * log_slots * all_buffered_logs->nelts) {
+        cells <<= 1;
+    }
+    log_ring = apr_palloc(p, cells * sizeof(*log_ring));
+    for (j = 0; j < cells; j++) {
+        log_ring[j].seq = j;
+        log_ring[j].chunk = NULL;
+    }
+    log_ring_mask = cells - 1;
+    log_ring_head = log_ring_tail = 0;
+    log_writer_idle = 0;
+    log_writer_stop = 0;
+
+    if ((rv = apr_threadkey_private_create(&log_slot_key, NULL, p))
+            != APR_SUCCESS
+        || (rv = apr_thread_mutex_create(&log_writer_mutex,
+                                         APR_THREAD_MUTEX_DEFAULT, p))
+            != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&log_writer_cond, p))
+            != APR_SUCCESS
+        || (rv = apr_thread_create(&log_writer, NULL, log_writer_thread,
+                                   NULL, p)) != APR_SUCCESS) {
+        return rv;
+    }
+
+    for (i = 0; i < all_buffered_logs->nelts; i++) {
+        buffered_log *buf = array[i];
+        log_slot *slots = apr_pcalloc(p, log_slots * sizeof(*slots));
+
+        for (j = 0; j < log_slots; j++) {
+            slots[j].chunk[0].log = slots[j].chunk[1].log = buf;
+            slots[j].chunk[0].outbuf = apr_palloc(p, buf->chunk_size);
+            slots[j].chunk[1].outbuf = apr_palloc(p, buf->chunk_size);
+            slots[j].cur = &slots[j].chunk[0];
+        }
+        buf->slots = slots;
+    }
+
+    apr_pool_cleanup_register(p, NULL, stop_log_writer,
+                              apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+#endif /* APR_HAS_THREADS */
+
 
 static int config_log_transaction(request_rec *r, config_log_state *cls,
                                   apr_array_header_t *default_format)
@@ -1055,10 +2047,11 @@ static int config_log_transaction(request_rec *r, config_log_state *cls,
     const char **strs;
     int *strl;
     request_rec *orig;
-    int i;
+    int i, nops = 0;
     apr_size_t len = 0;
     apr_array_header_t *format;
     char *envar;
+    char *out;
     apr_status_t rv;
 
     if (cls->fname == NULL) {
@@ -1093,10 +2086,19 @@ static int config_log_transaction(request_rec *r, config_log_state *cls,
     }
 
     format = cls->format ? cls->format : default_format;
-
-    strs = apr_palloc(r->pool, sizeof(char *) * (format->nelts));
-    strl = apr_palloc(r->pool, sizeof(int) * (format->nelts));
     items = (log_format_item *) format->elts;
+    for (i = 0; i < format->nelts; ++i) {
+        if (items[i].op > LOG_OP_CONSTANT) {
+            ++nops;
+        }
+    }
+
+    /* One allocation for the pieces, their lengths, and what the ops
+     * render. */
+    strs = apr_palloc(r->pool, format->nelts * (sizeof(char *) + sizeof(int))
+                               + nops * LOG_OP_MAX_WIDTH);
+    strl = (int *)(strs + format->nelts);
+    out = (char *)(strl + format->nelts);
 
     orig = r;
     while (orig->prev) {
@@ -1107,17 +2109,37 @@ static int config_log_transaction(request_rec *r, config_log_state *cls,
     }
 
     for (i = 0; i < format->nelts; ++i) {
-        strs[i] = process_item(r, orig, &items[i]);
-    }
+        log_format_item *item = &items[i];
 
-    for (i = 0; i < format->nelts; ++i) {
-        len += strl[i] = strlen(strs[i]);
+        if (item->op == LOG_OP_CONSTANT) {
+            strs[i] = item->arg;
+            strl[i] = item->arg_len;
+        }
+        else if (item->op != LOG_OP_HANDLER && !item_excluded(r, item)) {
+            strs[i] = out;
+            strl[i] = render_item(item->want_orig ? orig : r, item, out);
+            out += strl[i];
+        }
+        else {
+            strs[i] = process_item(r, orig, item);
+            strl[i] = strlen(strs[i]);
+        }
+        len += strl[i];
     }
     if (!log_writer) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, APR_EGENERAL, r,
                 "log writer isn't correctly setup");
          return HTTP_INTERNAL_SERVER_ERROR;
     }
+    if (cls->record_format == LOG_RECORD_BINARY) {
+        write_log_schema(r, cls, format);
+    }
+    if (cls->record_format > LOG_RECORD_TEXT) {
+        strs[0] = encode_log_record(r, cls, format, strs, strl, &len);
+        strl[0] = len;
+        rv = log_writer(r, cls->log_writer, strs, strl, 1, len);
+        return OK;
+    }
     rv = log_writer(r, cls->log_writer, strs, strl, format->nelts, len);
     /* xxx: do we return an error on log_writer? */
     return OK;
@@ -1175,6 +2197,7 @@ static void *make_config_log_state(apr_pool_t *p, server_rec *s)
     mls->server_config_logs = NULL;
     mls->formats = apr_table_make(p, 4);
     apr_table_setn(mls->formats, "CLF", DEFAULT_LOG_FORMAT);
+    mls->record_format = LOG_RECORD_UNSET;
 
     return mls;
 }
@@ -1196,6 +2219,9 @@ static void *merge_config_log_state(apr_pool_t *p, void *basev, void *addv)
         add->default_format = base->default_format;
     }
     add->formats = apr_table_overlay(p, base->formats, add->formats);
+    if (add->record_format == LOG_RECORD_UNSET) {
+        add->record_format = base->record_format;
+    }
 
     return add;
 }
@@ -1273,10 +2299,33 @@ static const char *add_custom_log(cmd_parms *cmd, void *dummy, const char *fn,
         cls->format = parse_log_string(cmd->pool, fmt, &err_string);
     }
     cls->log_writer = NULL;
+    cls->record_format = LOG_RECORD_TEXT;
+    cls->schemas = NULL;
 
     return err_string;
 }
 
+static const char *set_record_format(cmd_parms *cmd, void *dummy,
+                                     const char *arg)
+{
+    multi_log_state *mls = ap_get_module_config(cmd->server->module_config,
+                                                &log_config_module);
+
+    if (!strcasecmp(arg, "text")) {
+        mls->record_format = LOG_RECORD_TEXT;
+    }
+    else if (!strcasecmp(arg, "json")) {
+        mls->record_format = LOG_RECORD_JSON;
+    }
+    else if (!strcasecmp(arg, "binary")) {
+        mls->record_format = LOG_RECORD_BINARY;
+    }
+    else {
+        return "LogRecordFormat must be Text, JSON or Binary";
+    }
+    return NULL;
+}
+
 static const char *set_transfer_log(cmd_parms *cmd, void *dummy,
                                     const char *fn)
 {
@@ -1301,6 +2350,35 @@ static const char *set_buffered_logs_on(cmd_parms *parms, void *dummy, int flag)
     }
     return NULL;
 }
+
+static const char *set_buffered_logs_size(cmd_parms *parms, void *dummy,
+                                          const char *arg)
+{
+    apr_off_t size;
+
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS
+        || size < 512 || size > 16 * 1024 * 1024) {
+        return "BufferedLogsSize must be between 512 and 16777216 bytes";
+    }
+    buffered_logs_size = (apr_size_t)size;
+    return NULL;
+}
+
+static const char *set_buffered_logs_overflow(cmd_parms *parms, void *dummy,
+                                              const char *arg)
+{
+    if (!strcasecmp(arg, "write")) {
+        buffered_logs_drop = 0;
+    }
+    else if (!strcasecmp(arg, "drop")) {
+        buffered_logs_drop = 1;
+    }
+    else {
+        return "BufferedLogsOverflow must be Write or Drop";
+    }
+    return NULL;
+}
+
 static const command_rec config_log_cmds[] =
 {
 AP_INIT_TAKE23("CustomLog", add_custom_log, NULL, RSRC_CONF,
@@ -1312,8 +2390,14 @@ AP_INIT_TAKE12("LogFormat", log_format, NULL, RSRC_CONF,
      "a log format string (see docs) and an optional format name"),
 AP_INIT_TAKE1("CookieLog", set_cookie_log, NULL, RSRC_CONF,
      "the filename of the cookie log"),
+AP_INIT_TAKE1("LogRecordFormat", set_record_format, NULL, RSRC_CONF,
+     "Text, JSON or Binary records in the logs of this server"),
 AP_INIT_FLAG("BufferedLogs", set_buffered_logs_on, NULL, RSRC_CONF,
                  "Enable Buffered Logging (experimental)"),
+AP_INIT_TAKE1("BufferedLogsSize", set_buffered_logs_size, NULL, RSRC_CONF,
+     "the size in bytes of the log buffers of each thread"),
+AP_INIT_TAKE1("BufferedLogsOverflow", set_buffered_logs_overflow, NULL,
+     RSRC_CONF, "Write or Drop entries when the log writer thread is behind"),
     {NULL}
 };
 
@@ -1336,6 +2420,41 @@ static config_log_state *open_config_log(server_rec *s, apr_pool_t *p,
     return cls;
 }
 
+static void add_log_schema(apr_pool_t *p, config_log_state *cls,
+                           apr_array_header_t *default_format)
+{
+    apr_array_header_t *format = cls->format ? cls->format : default_format;
+    log_schema_sent *state;
+    log_schema *schema;
+    int i;
+
+    if (cls->record_format != LOG_RECORD_BINARY) {
+        return;
+    }
+
+    schema = apr_hash_get(log_schemas, &format, sizeof(format));
+    if (!schema) {
+        apr_array_header_t **key = apr_palloc(p, sizeof(*key));
+
+        *key = format;
+        schema = make_log_schema(p, format);
+        apr_hash_set(log_schemas, key, sizeof(*key), schema);
+    }
+
+    if (!cls->schemas) {
+        cls->schemas = apr_array_make(p, 1, sizeof(log_schema_sent));
+    }
+    for (i = 0; i < cls->schemas->nelts; ++i) {
+        if (((log_schema_sent *)cls->schemas->elts)[i].format == format) {
+            return;
+        }
+    }
+    state = (log_schema_sent *)apr_array_push(cls->schemas);
+    state->format = format;
+    state->schema = schema;
+    state->sent = 0;
+}
+
 static int open_multi_logs(server_rec *s, apr_pool_t *p)
 {
     int i;
@@ -1367,6 +2486,10 @@ static int open_multi_logs(server_rec *s, apr_pool_t *p)
                     cls->format = parse_log_string(p, format, &dummy);
                 }
             }
+            if (mls->record_format != LOG_RECORD_UNSET) {
+                cls->record_format = mls->record_format;
+            }
+            add_log_schema(p, cls, mls->default_format);
 
             if (!open_config_log(s, p, cls, mls->default_format)) {
                 /* Failure already logged by open_config_log */
@@ -1385,6 +2508,7 @@ static int open_multi_logs(server_rec *s, apr_pool_t *p)
                     cls->format = parse_log_string(p, format, &dummy);
                 }
             }
+            add_log_schema(p, cls, mls->default_format);
 
             if (!open_config_log(s, p, cls, mls->default_format)) {
                 /* Failure already logged by open_config_log */
@@ -1438,6 +2562,7 @@ static int init_config_log(apr_pool_t *pc, apr_pool_t *p, apr_pool_t *pt, server
     if (buffered_logs) {
         all_buffered_logs = apr_array_make(p, 5, sizeof(buffered_log *));
     }
+    log_schemas = apr_hash_make(p);
 
     /* Next, do "physical" server, which gets default log fd and format
      * for the virtual servers, if they don't override...
@@ -1459,6 +2584,21 @@ static void init_child(apr_pool_t *p, server_rec *s)
 
     ap_mpm_query(AP_MPMQ_MAX_THREADS, &mpm_threads);
 
+#if APR_HAS_THREADS
+    log_schema_mutex = NULL;
+    if (mpm_threads > 1 && apr_hash_count(log_schemas)) {
+        apr_status_t rv = apr_thread_mutex_create(&log_schema_mutex,
+                                                  APR_THREAD_MUTEX_DEFAULT,
+                                                  p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s,
+                         "could not initialize the binary log mutex, "
+                         "rows may be logged before their schema");
+            log_schema_mutex = NULL;
+        }
+    }
+#endif
+
     /* Now register the last buffer flush with the cleanup engine */
     if (buffered_logs) {
         int i;
@@ -1466,6 +2606,20 @@ static void init_child(apr_pool_t *p, server_rec *s)
 
         apr_pool_cleanup_register(p, s, flush_all_logs, flush_all_logs);
 
+#if APR_HAS_THREADS
+        /* Single threaded children (prefork) exit from signal handlers,
+         * which must not lock or join the writer: they write directly. */
+        if (mpm_threads > 1 && all_buffered_logs->nelts) {
+            apr_status_t rv = start_log_writer(p, s, mpm_threads);
+
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                             "could not start the buffered log writer "
+                             "thread, logging from the worker threads");
+            }
+        }
+#endif
+
         for (i = 0; i < all_buffered_logs->nelts; i++) {
             buffered_log *this = array[i];
 
@@ -1579,6 +2733,13 @@ static void *ap_buffered_log_writer_init(apr_pool_t *p, server_rec *s,
     buffered_log *b;
     b = apr_pcalloc(p, sizeof(buffered_log));
     b->handle = ap_default_log_writer_init(p, s, name);
+    b->fname = name;
+    b->piped = (*name == '|');
+    b->chunk_size = buffered_logs_size ? buffered_logs_size : LOG_BUFSIZE;
+    if (b->piped && b->chunk_size > LOG_BUFSIZE) {
+        /* keep writes to the pipe atomic */
+        b->chunk_size = LOG_BUFSIZE;
+    }
 
     if (b->handle) {
         *(buffered_log **)apr_array_push(all_buffered_logs) = b;
@@ -1600,6 +2761,13 @@ static apr_status_t ap_buffered_log_writer(request_rec *r,
     int i;
     apr_status_t rv;
     buffered_log *buf = (buffered_log*)handle;
+#if APR_HAS_THREADS
+    log_slot *slot = get_log_slot(buf);
+
+    if (slot) {
+        return log_slot_write(r, buf, slot, strs, strl, nelts, len);
+    }
+#endif
 
     if ((rv = APR_ANYLOCK_LOCK(&buf->mutex)) != APR_SUCCESS) {
         return rv;
@@ -1676,6 +2844,8 @@ static int log_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
     ap_log_set_writer_init(ap_default_log_writer_init);
     ap_log_set_writer(ap_default_log_writer);
     buffered_logs = 0;
+    buffered_logs_size = 0;
+    buffered_logs_drop = 0;
 
     return OK;
 }
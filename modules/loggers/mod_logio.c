@@ -139,6 +139,10 @@ static apr_status_t logio_in_filter(ap_filter_t *f,
 
     status = ap_get_brigade(f->next, bb, mode, block, readbytes);
 
+    /* data peeked at is counted when it is read for real */
+    if (mode == AP_MODE_SPECULATIVE)
+        return status;
+
     apr_brigade_length (bb, 0, &length);
 
     if (length > 0)
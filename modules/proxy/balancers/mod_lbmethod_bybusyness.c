@@ -19,6 +19,7 @@
 #include "ap_mpm.h"
 #include "apr_version.h"
 #include "apr_hooks.h"
+#include "apr_atomic.h"
 
 module AP_MODULE_DECLARE_DATA lbmethod_bybusyness_module;
 
@@ -96,7 +97,7 @@ static proxy_worker *find_best_bybusyness(proxy_balancer *balancer,
     if (mycandidate) {
         mycandidate->s->lbstatus -= total_factor;
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                     "proxy: bybusyness selected worker \"%s\" : busy %" APR_SIZE_T_FMT " : lbstatus %d",
+                     "proxy: bybusyness selected worker \"%s\" : busy %u : lbstatus %d",
                      mycandidate->s->name, mycandidate->s->busy, mycandidate->s->lbstatus);
 
     }
@@ -105,6 +106,20 @@ static proxy_worker *find_best_bybusyness(proxy_balancer *balancer,
 
 }
 
+/*
+ * lockfree=On: elect whichever of the two has fewer pending requests
+ * relative to its lbfactor; the one elected less often wins a tie.
+ */
+static proxy_worker *choose(proxy_worker *a, proxy_worker *b)
+{
+    apr_uint64_t abusy = (apr_uint64_t)apr_atomic_read32(&a->s->busy) * b->s->lbfactor;
+    apr_uint64_t bbusy = (apr_uint64_t)apr_atomic_read32(&b->s->busy) * a->s->lbfactor;
+
+    if (abusy != bbusy)
+        return (bbusy < abusy) ? b : a;
+    return (b->s->elected < a->s->elected) ? b : a;
+}
+
 /* assumed to be mutex protected by caller */
 static apr_status_t reset(proxy_balancer *balancer, server_rec *s) {
     int i;
@@ -112,7 +127,7 @@ static apr_status_t reset(proxy_balancer *balancer, server_rec *s) {
     worker = (proxy_worker **)balancer->workers->elts;
     for (i = 0; i < balancer->workers->nelts; i++, worker++) {
         (*worker)->s->lbstatus = 0;
-        (*worker)->s->busy = 0;
+        apr_atomic_set32(&(*worker)->s->busy, 0);
     }
     return APR_SUCCESS;
 }
@@ -127,7 +142,9 @@ static const proxy_balancer_method bybusyness =
     &find_best_bybusyness,
     NULL,
     &reset,
-    &age
+    &age,
+    NULL,
+    &choose
 };
 
 
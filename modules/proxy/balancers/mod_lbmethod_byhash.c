@@ -0,0 +1,218 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mod_proxy.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "apr_version.h"
+#include "apr_hooks.h"
+#include "util_cookies.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_byhash_module;
+
+/*
+ * The find_best_byhash scheduler maps each request onto a worker by
+ * hashing a request attribute (the balancer's hashkey parameter), so
+ * that the same URL, client or session always lands on the same
+ * backend and that backend's local cache stays hot.
+ *
+ * We use rendezvous ("highest random weight") hashing: every usable
+ * worker gets a pseudo random score derived from the key and from the
+ * worker's name hash, and the worker with the highest score wins.  When
+ * a worker is added, removed, disabled or goes into error state, only
+ * the keys that were (or will be) won by that worker move; all other
+ * keys keep their worker.  No shared or per-child state is needed, so
+ * all children agree on the mapping without any coordination, and
+ * health changes through the balancer-manager take effect immediately.
+ *
+ * lbfactor is honoured by giving each worker lbfactor scores and taking
+ * the highest, so a worker with lbfactor 2 wins about twice as many
+ * keys as one with lbfactor 1.
+ *
+ * Supported hashkey values:
+ *
+ *   url           the request URI including the query string (default)
+ *   path          the request URI path only
+ *   client        the client IP address
+ *   header:NAME   the value of request header NAME
+ *   cookie:NAME   the value of cookie NAME
+ *   env:NAME      the value of environment variable NAME, which can be
+ *                 set by e.g. SetEnvIf or mod_rewrite for arbitrary keys
+ *
+ * If the attribute is missing from the request the URL is used instead.
+ */
+
+/* murmur3's 32 bit finalizer */
+static apr_uint32_t mix32(apr_uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static const char *get_hash_key(proxy_balancer *balancer, request_rec *r)
+{
+    const char *spec = balancer->s->hashkey;
+    const char *key = NULL;
+
+    if (!*spec || !strcasecmp(spec, "url")) {
+        /* fall through to the default below */
+    }
+    else if (!strcasecmp(spec, "path")) {
+        key = r->uri;
+    }
+    else if (!strcasecmp(spec, "client")) {
+        key = r->connection->remote_ip;
+    }
+    else if (!strncasecmp(spec, "header:", 7)) {
+        key = apr_table_get(r->headers_in, spec + 7);
+    }
+    else if (!strncasecmp(spec, "cookie:", 7)) {
+        if (ap_cookie_read(r, spec + 7, &key, 0) != APR_SUCCESS) {
+            key = NULL;
+        }
+    }
+    else if (!strncasecmp(spec, "env:", 4)) {
+        key = apr_table_get(r->subprocess_env, spec + 4);
+    }
+
+    if (!key) {
+        key = r->unparsed_uri ? r->unparsed_uri : r->uri;
+    }
+    return key;
+}
+
+static apr_uint32_t worker_score(proxy_worker *worker, apr_uint32_t keyhash)
+{
+    apr_uint32_t best = 0;
+    apr_uint32_t score;
+    int i;
+    int replicas = worker->s->lbfactor > 0 ? worker->s->lbfactor : 1;
+
+    for (i = 0; i < replicas; i++) {
+        score = mix32(keyhash ^ mix32(worker->s->hash + i * 0x9e3779b9U));
+        if (score > best)
+            best = score;
+    }
+    return best;
+}
+
+static proxy_worker *find_best_byhash(proxy_balancer *balancer,
+                                      request_rec *r)
+{
+    int i;
+    proxy_worker **worker;
+    proxy_worker *mycandidate = NULL;
+    apr_uint32_t myscore = 0;
+    apr_uint32_t score;
+    apr_uint32_t keyhash;
+    const char *key;
+    int cur_lbset = 0;
+    int max_lbset = 0;
+    int checking_standby;
+    int checked_standby;
+
+    key = get_hash_key(balancer, r);
+    keyhash = ap_proxy_hashfunc(key, PROXY_HASHFUNC_DEFAULT);
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                 "proxy: Entering byhash for BALANCER (%s), key (%s)",
+                 balancer->name, key);
+
+    /* First try to see if we have available candidate */
+    do {
+        checking_standby = checked_standby = 0;
+        while (!mycandidate && !checked_standby) {
+            worker = (proxy_worker **)balancer->workers->elts;
+            for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+                if (!checking_standby) {    /* first time through */
+                    if ((*worker)->s->lbset > max_lbset)
+                        max_lbset = (*worker)->s->lbset;
+                }
+                if ((*worker)->s->lbset != cur_lbset)
+                    continue;
+                if ( (checking_standby ? !PROXY_WORKER_IS_STANDBY(*worker) : PROXY_WORKER_IS_STANDBY(*worker)) )
+                    continue;
+                /* If the worker is in error state run
+                 * retry on that worker. It will be marked as
+                 * operational if the retry timeout is elapsed.
+                 * The worker might still be unusable, but we try
+                 * anyway.
+                 */
+                if (!PROXY_WORKER_IS_USABLE(*worker))
+                    ap_proxy_retry_worker("BALANCER", *worker, r->server);
+                /* Take into calculation only the workers that are
+                 * not in error state or not disabled.
+                 */
+                if (PROXY_WORKER_IS_USABLE(*worker)) {
+                    score = worker_score(*worker, keyhash);
+                    if (!mycandidate || score > myscore
+                        || (score == myscore
+                            && (*worker)->s->hash > mycandidate->s->hash)) {
+                        mycandidate = *worker;
+                        myscore = score;
+                    }
+                }
+            }
+            checked_standby = checking_standby++;
+        }
+        cur_lbset++;
+    } while (cur_lbset <= max_lbset && !mycandidate);
+
+    if (mycandidate) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                     "proxy: byhash selected worker \"%s\" : busy %u",
+                     mycandidate->s->name, mycandidate->s->busy);
+    }
+
+    return mycandidate;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s) {
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s) {
+        return APR_SUCCESS;
+}
+
+static const proxy_balancer_method byhash =
+{
+    "byhash",
+    &find_best_byhash,
+    NULL,
+    &reset,
+    &age
+};
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "byhash", "0", &byhash);
+}
+
+AP_DECLARE_MODULE(lbmethod_byhash) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,       /* create per-directory config structure */
+    NULL,       /* merge per-directory config structures */
+    NULL,       /* create per-server config structure */
+    NULL,       /* merge per-server config structures */
+    NULL,       /* command apr_table_t */
+    register_hook /* register hooks */
+};
@@ -0,0 +1,182 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mod_proxy.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "apr_version.h"
+#include "apr_hooks.h"
+#include "apr_atomic.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_bylatency_module;
+
+/*
+ * The find_best_bylatency scheduler routes requests away from slow
+ * backends.  mod_proxy_balancer keeps a moving average of each worker's
+ * time-to-first-byte in the shared worker slot (s->latency); here we
+ * use the "power of two choices" technique: pick two usable workers at
+ * random and send the request to the one with the lower cost, where
+ *
+ *     cost = (latency + 1) * (busy + 1) / lbfactor
+ *
+ * Comparing only two random candidates, instead of always choosing the
+ * single fastest worker, keeps every child from stampeding onto the same
+ * backend between latency updates, and still lets a slow worker be
+ * sampled (and so recover) once its queue has drained.  Workers which
+ * have not been measured yet have a latency of 0 and so are preferred
+ * until they have answered a request.
+ */
+
+static apr_uint64_t worker_cost(proxy_worker *worker)
+{
+    apr_uint64_t cost;
+
+    cost = (apr_uint64_t)apr_atomic_read32(&worker->s->latency) + 1;
+    cost *= (apr_uint64_t)apr_atomic_read32(&worker->s->busy) + 1;
+    /* lbfactor is 1..100; scale up so the division keeps precision */
+    return (cost * 100) / (worker->s->lbfactor > 0 ? worker->s->lbfactor : 1);
+}
+
+/* Also used directly for lockfree=On, where the balancer samples */
+static proxy_worker *choose(proxy_worker *a, proxy_worker *b)
+{
+    return (worker_cost(b) < worker_cost(a)) ? b : a;
+}
+
+static proxy_worker *find_best_bylatency(proxy_balancer *balancer,
+                                         request_rec *r)
+{
+    int i;
+    int n;
+    proxy_worker **worker;
+    proxy_worker **usable;
+    proxy_worker *mycandidate = NULL;
+    int cur_lbset = 0;
+    int max_lbset = 0;
+    int checking_standby;
+    int checked_standby;
+    apr_uint32_t seed;
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                 "proxy: Entering bylatency for BALANCER (%s)",
+                 balancer->name);
+
+    usable = apr_palloc(r->pool,
+                        balancer->workers->nelts * sizeof(proxy_worker *));
+    seed = (apr_uint32_t)apr_time_now() ^ (apr_uint32_t)(apr_uintptr_t)r;
+    if (!seed) {
+        seed = 1;
+    }
+
+    /* First try to see if we have available candidate */
+    do {
+        checking_standby = checked_standby = 0;
+        while (!mycandidate && !checked_standby) {
+            n = 0;
+            worker = (proxy_worker **)balancer->workers->elts;
+            for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+                if (!checking_standby) {    /* first time through */
+                    if ((*worker)->s->lbset > max_lbset)
+                        max_lbset = (*worker)->s->lbset;
+                }
+                if ((*worker)->s->lbset != cur_lbset)
+                    continue;
+                if ( (checking_standby ? !PROXY_WORKER_IS_STANDBY(*worker) : PROXY_WORKER_IS_STANDBY(*worker)) )
+                    continue;
+                /* If the worker is in error state run
+                 * retry on that worker. It will be marked as
+                 * operational if the retry timeout is elapsed.
+                 * The worker might still be unusable, but we try
+                 * anyway.
+                 */
+                if (!PROXY_WORKER_IS_USABLE(*worker))
+                    ap_proxy_retry_worker("BALANCER", *worker, r->server);
+                /* Take into calculation only the workers that are
+                 * not in error state or not disabled.
+                 */
+                if (PROXY_WORKER_IS_USABLE(*worker))
+                    usable[n++] = *worker;
+            }
+            if (n == 1) {
+                mycandidate = usable[0];
+            }
+            else if (n > 1) {
+                proxy_worker *a, *b;
+                apr_uint32_t j = ap_proxy_random(&seed) % n;
+                apr_uint32_t k = ap_proxy_random(&seed) % (n - 1);
+                /* k indexes the remaining n - 1 workers, so a != b */
+                if (k >= j)
+                    k++;
+                a = usable[j];
+                b = usable[k];
+                mycandidate = choose(a, b);
+            }
+            checked_standby = checking_standby++;
+        }
+        cur_lbset++;
+    } while (cur_lbset <= max_lbset && !mycandidate);
+
+    if (mycandidate) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                     "proxy: bylatency selected worker \"%s\" : busy %u : latency %uus",
+                     mycandidate->s->name, mycandidate->s->busy,
+                     mycandidate->s->latency);
+    }
+
+    return mycandidate;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s) {
+    int i;
+    proxy_worker **worker;
+    worker = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+        (*worker)->s->lbstatus = 0;
+        apr_atomic_set32(&(*worker)->s->latency, 0);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s) {
+        return APR_SUCCESS;
+}
+
+static const proxy_balancer_method bylatency =
+{
+    "bylatency",
+    &find_best_bylatency,
+    NULL,
+    &reset,
+    &age,
+    NULL,
+    &choose
+};
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "bylatency", "0", &bylatency);
+}
+
+AP_DECLARE_MODULE(lbmethod_bylatency) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,       /* create per-directory config structure */
+    NULL,       /* merge per-directory config structures */
+    NULL,       /* create per-server config structure */
+    NULL,       /* merge per-server config structures */
+    NULL,       /* command apr_table_t */
+    register_hook /* register hooks */
+};
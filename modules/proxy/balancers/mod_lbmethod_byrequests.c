@@ -124,7 +124,7 @@ static proxy_worker *find_best_byrequests(proxy_balancer *balancer,
     if (mycandidate) {
         mycandidate->s->lbstatus -= total_factor;
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                     "proxy: byrequests selected worker \"%s\" : busy %" APR_SIZE_T_FMT " : lbstatus %d",
+                     "proxy: byrequests selected worker \"%s\" : busy %u : lbstatus %d",
                      mycandidate->s->name, mycandidate->s->busy, mycandidate->s->lbstatus);
 
     }
@@ -132,6 +132,34 @@ static proxy_worker *find_best_byrequests(proxy_balancer *balancer,
     return mycandidate;
 }
 
+/* The lock free elections of a worker, halved for every second since */
+static apr_uint32_t recent_elected(proxy_worker *worker, apr_uint32_t now)
+{
+    apr_uint32_t age = now - worker->s->elected_sec;
+
+    return age < 32 ? worker->s->elected_recent >> age : 0;
+}
+
+/*
+ * lockfree=On: there is no lock to protect the lbstatus bookkeeping
+ * above, so instead elect whichever of the two has recently served
+ * fewer requests relative to its lbfactor.  The counts decay, so that
+ * a worker just added or reset doesn't take all the traffic until its
+ * total catches up with the others.
+ */
+static proxy_worker *choose(proxy_worker *a, proxy_worker *b)
+{
+    apr_uint32_t now = (apr_uint32_t)apr_time_sec(apr_time_now());
+    apr_uint64_t aelected = (apr_uint64_t)recent_elected(a, now) * b->s->lbfactor;
+    apr_uint64_t belected = (apr_uint64_t)recent_elected(b, now) * a->s->lbfactor;
+    proxy_worker *worker = (belected < aelected) ? b : a;
+
+    /* XXX: a lost update only skews the next few elections */
+    worker->s->elected_recent = recent_elected(worker, now) + 1;
+    worker->s->elected_sec = now;
+    return worker;
+}
+
 /* assumed to be mutex protected by caller */
 static apr_status_t reset(proxy_balancer *balancer, server_rec *s) {
     int i;
@@ -159,7 +187,9 @@ static const proxy_balancer_method byrequests =
     &find_best_byrequests,
     NULL,
     &reset,
-    &age
+    &age,
+    NULL,
+    &choose
 };
 
 static void register_hook(apr_pool_t *p)
@@ -19,6 +19,7 @@
 #include "ap_mpm.h"
 #include "apr_version.h"
 #include "apr_hooks.h"
+#include "apr_atomic.h"
 
 module AP_MODULE_DECLARE_DATA lbmethod_bytraffic_module;
 
@@ -97,7 +98,7 @@ static proxy_worker *find_best_bytraffic(proxy_balancer *balancer,
 
     if (mycandidate) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                     "proxy: bytraffic selected worker \"%s\" : busy %" APR_SIZE_T_FMT,
+                     "proxy: bytraffic selected worker \"%s\" : busy %u",
                      mycandidate->s->name, mycandidate->s->busy);
 
     }
@@ -105,6 +106,17 @@ static proxy_worker *find_best_bytraffic(proxy_balancer *balancer,
     return mycandidate;
 }
 
+/* lockfree=On: elect whichever of the two moved less traffic */
+static proxy_worker *choose(proxy_worker *a, proxy_worker *b)
+{
+    apr_off_t atraffic = (a->s->transferred/a->s->lbfactor) +
+                         (a->s->read/a->s->lbfactor);
+    apr_off_t btraffic = (b->s->transferred/b->s->lbfactor) +
+                         (b->s->read/b->s->lbfactor);
+
+    return (btraffic < atraffic) ? b : a;
+}
+
 /* assumed to be mutex protected by caller */
 static apr_status_t reset(proxy_balancer *balancer, server_rec *s) {
     int i;
@@ -112,7 +124,7 @@ static apr_status_t reset(proxy_balancer *balancer, server_rec *s) {
     worker = (proxy_worker **)balancer->workers->elts;
     for (i = 0; i < balancer->workers->nelts; i++, worker++) {
         (*worker)->s->lbstatus = 0;
-        (*worker)->s->busy = 0;
+        apr_atomic_set32(&(*worker)->s->busy, 0);
         (*worker)->s->transferred = 0;
         (*worker)->s->read = 0;
     }
@@ -129,7 +141,9 @@ static const proxy_balancer_method bytraffic =
     &find_best_bytraffic,
     NULL,
     &reset,
-    &age
+    &age,
+    NULL,
+    &choose
 };
 
 static void register_hook(apr_pool_t *p)
@@ -30,6 +30,7 @@ proxy_scgi_objs="mod_proxy_scgi.lo"
 proxy_fdpass_objs="mod_proxy_fdpass.lo"
 proxy_ajp_objs="mod_proxy_ajp.lo ajp_header.lo ajp_link.lo ajp_msg.lo ajp_utils.lo"
 proxy_balancer_objs="mod_proxy_balancer.lo"
+proxy_hcheck_objs="mod_proxy_hcheck.lo"
 
 case "$host" in
   *os2*)
@@ -43,6 +44,7 @@ case "$host" in
     proxy_fdpass_objs="$proxy_fdpass_objs mod_proxy.la"
     proxy_ajp_objs="$proxy_ajp_objs mod_proxy.la"
     proxy_balancer_objs="$proxy_balancer_objs mod_proxy.la"
+    proxy_hcheck_objs="$proxy_hcheck_objs mod_proxy.la ../core/mod_watchdog.la"
     ;;
 esac
 
@@ -58,6 +60,7 @@ APACHE_MODULE(proxy_fdpass, Apache proxy to Unix Daemon Socket module.  Requires
 ])
 APACHE_MODULE(proxy_ajp, Apache proxy AJP module.  Requires and is enabled by --enable-proxy., $proxy_ajp_objs, , $proxy_mods_enable)
 APACHE_MODULE(proxy_balancer, Apache proxy BALANCER module.  Requires and is enabled by --enable-proxy., $proxy_balancer_objs, , $proxy_mods_enable)
+APACHE_MODULE(proxy_hcheck, Apache proxy health check module.  Requires --enable-proxy and mod_watchdog., $proxy_hcheck_objs, , $proxy_mods_enable)
 
 APACHE_MODULE(serf, [Reverse proxy module using Serf], , , no, [
     APACHE_CHECK_SERF
@@ -252,6 +252,54 @@ static const char *set_worker_param(apr_pool_t *p,
         worker->s->conn_timeout = timeout;
         worker->s->conn_timeout_set = 1;
     }
+    else if (!strcasecmp(key, "hcmethod")) {
+        /* Active health check method, run by mod_proxy_hcheck.
+         */
+        if (!strcasecmp(val, "none"))
+            worker->s->hcmethod = PROXY_HC_NONE;
+        else if (!strcasecmp(val, "tcp"))
+            worker->s->hcmethod = PROXY_HC_TCP;
+        else if (!strcasecmp(val, "options"))
+            worker->s->hcmethod = PROXY_HC_OPTIONS;
+        else if (!strcasecmp(val, "head"))
+            worker->s->hcmethod = PROXY_HC_HEAD;
+        else if (!strcasecmp(val, "get"))
+            worker->s->hcmethod = PROXY_HC_GET;
+        else if (!strcasecmp(val, "cping"))
+            worker->s->hcmethod = PROXY_HC_CPING;
+        else if (!strcasecmp(val, "fcgi"))
+            worker->s->hcmethod = PROXY_HC_FCGI;
+        else
+            return "hcmethod must be None|TCP|OPTIONS|HEAD|GET|CPING|FCGI";
+    }
+    else if (!strcasecmp(key, "hcinterval")) {
+        /* Health check interval in given unit (default is second).
+         */
+        if (ap_timeout_parameter_parse(val, &timeout, "s") != APR_SUCCESS)
+            return "hcinterval has wrong format";
+        if (timeout < apr_time_from_sec(1))
+            return "hcinterval must be at least one second";
+        worker->s->hcinterval = timeout;
+    }
+    else if (!strcasecmp(key, "hcpasses")) {
+        ival = atoi(val);
+        if (ival < 1)
+            return "hcpasses must be at least one";
+        worker->s->hcpasses = ival;
+    }
+    else if (!strcasecmp(key, "hcfails")) {
+        ival = atoi(val);
+        if (ival < 1)
+            return "hcfails must be at least one";
+        worker->s->hcfails = ival;
+    }
+    else if (!strcasecmp(key, "hcuri")) {
+        if (strlen(val) >= PROXY_WORKER_MAX_ROUTE_SIZE)
+            return "hcuri length must be < 64 characters";
+        if (*val != '/')
+            return "hcuri must be an absolute path";
+        PROXY_STRNCPY(worker->s->hcuri, val);
+    }
     else if (!strcasecmp(key, "flusher")) {
         if (strlen(val) >= PROXY_WORKER_MAX_SCHEME_SIZE)
             return "flusher name length must be < 16 characters";
@@ -344,6 +392,32 @@ static const char *set_balancer_param(proxy_server_conf *conf,
         else
             return "scolonpathdelim must be On|Off";
     }
+    else if (!strcasecmp(key, "hashkey")) {
+        /* Request attribute used by hashing lbmethods
+         * (eg: byhash) to map requests onto workers.
+         */
+        if (strlen(val) > (PROXY_BALANCER_MAX_HASHKEY_SIZE-1))
+            return "hashkey length must be < 64 characters";
+        if (strcasecmp(val, "url") && strcasecmp(val, "path")
+            && strcasecmp(val, "client")
+            && !((!strncasecmp(val, "header:", 7)
+                  || !strncasecmp(val, "cookie:", 7)) && val[7])
+            && !(!strncasecmp(val, "env:", 4) && val[4]))
+            return "hashkey must be url|path|client|header:NAME|cookie:NAME|env:NAME";
+        PROXY_STRNCPY(balancer->s->hashkey, val);
+    }
+    else if (!strcasecmp(key, "lockfree")) {
+        /* If set to 'on' workers are elected by comparing
+         * two randomly sampled members, without taking
+         * the balancer lock, when the lbmethod allows it.
+         */
+        if (!strcasecmp(val, "on"))
+            balancer->s->lockfree = 1;
+        else if (!strcasecmp(val, "off"))
+            balancer->s->lockfree = 0;
+        else
+            return "lockfree must be On|Off";
+    }
     else if (!strcasecmp(key, "failonstatus")) {
         char *val_split;
         char *status;
@@ -1140,6 +1214,8 @@ static void * create_proxy_config(apr_pool_t *p, server_rec *s)
     ps->badopt_set = 0;
     ps->source_address = NULL;
     ps->source_address_set = 0;
+    ps->spool_dir = NULL;
+    ps->spool_dir_set = 0;
     ps->pool = p;
 
     return ps;
@@ -1181,6 +1257,8 @@ static void * merge_proxy_config(apr_pool_t *p, void *basev, void *overridesv)
     ps->proxy_status_set = overrides->proxy_status_set || base->proxy_status_set;
     ps->source_address = (overrides->source_address_set == 0) ? base->source_address : overrides->source_address;
     ps->source_address_set = overrides->source_address_set || base->source_address_set;
+    ps->spool_dir = (overrides->spool_dir_set == 0) ? base->spool_dir : overrides->spool_dir;
+    ps->spool_dir_set = overrides->spool_dir_set || base->spool_dir_set;
     ps->pool = p;
     return ps;
 }
@@ -1203,6 +1281,23 @@ static const char *set_source_address(cmd_parms *parms, void *dummy,
     return NULL;
 }
 
+static const char *set_spool_dir(cmd_parms *parms, void *dummy,
+                                 const char *arg)
+{
+    proxy_server_conf *psf =
+        ap_get_module_config(parms->server->module_config, &proxy_module);
+    const char *dir = ap_server_root_relative(parms->pool, arg);
+
+    if (!dir || !ap_is_directory(parms->temp_pool, dir)) {
+        return apr_pstrcat(parms->pool, "ProxySpoolDir ", arg,
+                           " is not a valid directory", NULL);
+    }
+    psf->spool_dir = dir;
+    psf->spool_dir_set = 1;
+
+    return NULL;
+}
+
 static void *create_proxy_dir_config(apr_pool_t *p, char *dummy)
 {
     proxy_dir_conf *new =
@@ -2209,6 +2304,8 @@ static const command_rec proxy_cmds[] =
      "A balancer or worker name with list of params"),
     AP_INIT_TAKE1("ProxySourceAddress", set_source_address, NULL, RSRC_CONF,
      "Configure local source IP used for request forward"),
+    AP_INIT_TAKE1("ProxySpoolDir", set_spool_dir, NULL, RSRC_CONF,
+     "Directory (preferably on tmpfs) where large request bodies are spooled"),
     AP_INIT_FLAG("ProxyAddHeaders", add_proxy_http_headers, NULL, RSRC_CONF|ACCESS_CONF,
      "on if X-Forwarded-* headers should be added or completed"),
     {NULL}
@@ -162,6 +162,7 @@ typedef struct {
     apr_global_mutex_t  *mutex; /* global lock (needed??) */
     ap_slotmem_instance_t *slot;  /* balancers shm data - runtime */
     ap_slotmem_provider_t *storage;
+    const char *spool_dir;      /* where to spool request bodies */
 
     unsigned int req_set:1;
     unsigned int viaopt_set:1;
@@ -172,6 +173,7 @@ typedef struct {
     unsigned int badopt_set:1;
     unsigned int proxy_status_set:1;
     unsigned int source_address_set:1;
+    unsigned int spool_dir_set:1;
 } proxy_server_conf;
 
 
@@ -266,6 +268,7 @@ struct proxy_conn_pool {
 #define PROXY_WORKER_IN_ERROR       0x0080
 #define PROXY_WORKER_HOT_STANDBY    0x0100
 #define PROXY_WORKER_FREE           0x0200
+#define PROXY_WORKER_HC_FAIL        0x0400
 
 /* worker status flags */
 #define PROXY_WORKER_INITIALIZED_FLAG    'O'
@@ -277,9 +280,11 @@ struct proxy_conn_pool {
 #define PROXY_WORKER_IN_ERROR_FLAG       'E'
 #define PROXY_WORKER_HOT_STANDBY_FLAG    'H'
 #define PROXY_WORKER_FREE_FLAG           'F'
+#define PROXY_WORKER_HC_FAIL_FLAG        'C'
 
 #define PROXY_WORKER_NOT_USABLE_BITMAP ( PROXY_WORKER_IN_SHUTDOWN | \
-PROXY_WORKER_DISABLED | PROXY_WORKER_STOPPED | PROXY_WORKER_IN_ERROR )
+PROXY_WORKER_DISABLED | PROXY_WORKER_STOPPED | PROXY_WORKER_IN_ERROR | \
+PROXY_WORKER_HC_FAIL )
 
 /* NOTE: these check the shared status */
 #define PROXY_WORKER_IS_INITIALIZED(f)  ( (f)->s->status &  PROXY_WORKER_INITIALIZED )
@@ -292,12 +297,27 @@ PROXY_WORKER_DISABLED | PROXY_WORKER_STOPPED | PROXY_WORKER_IN_ERROR )
 /* default worker retry timeout in seconds */
 #define PROXY_WORKER_DEFAULT_RETRY    60
 
+/* default health check interval in seconds */
+#define PROXY_WORKER_DEFAULT_HC_INTERVAL    30
+
+/* health check methods, see mod_proxy_hcheck */
+typedef enum {
+    PROXY_HC_NONE,      /* no active health checks */
+    PROXY_HC_TCP,       /* connect only */
+    PROXY_HC_OPTIONS,   /* HTTP OPTIONS request */
+    PROXY_HC_HEAD,      /* HTTP HEAD request */
+    PROXY_HC_GET,       /* HTTP GET request */
+    PROXY_HC_CPING,     /* AJP CPING/CPONG */
+    PROXY_HC_FCGI       /* FastCGI FCGI_GET_VALUES */
+} proxy_hcmethod_t;
+
 /* Some max char string sizes, for shm fields */
 #define PROXY_WORKER_MAX_SCHEME_SIZE    16
 #define PROXY_WORKER_MAX_ROUTE_SIZE     64
 #define PROXY_WORKER_MAX_NAME_SIZE      96
 #define PROXY_WORKER_MAX_HOSTNAME_SIZE  64
 #define PROXY_BALANCER_MAX_STICKY_SIZE  64
+#define PROXY_BALANCER_MAX_HASHKEY_SIZE 64
 
 #define PROXY_MAX_PROVIDER_NAME_SIZE    16
 
@@ -322,6 +342,7 @@ typedef struct {
     char      route[PROXY_WORKER_MAX_ROUTE_SIZE];     /* balancing route */
     char      redirect[PROXY_WORKER_MAX_ROUTE_SIZE];  /* temporary balancing redirection route */
     char      flusher[PROXY_WORKER_MAX_SCHEME_SIZE];  /* flush provider used by mod_proxy_fdpass */
+    char      hcuri[PROXY_WORKER_MAX_ROUTE_SIZE];     /* health check uri */
     int             lbset;      /* load balancer cluster set */
     int             retries;    /* number of retries on this worker */
     int             lbstatus;   /* Current lbstatus */
@@ -331,6 +352,11 @@ typedef struct {
     int             hmax;       /* Hard maximum on the total number of connections */
     int             flush_wait; /* poll wait time in microseconds if flush_auto */
     int             index;      /* shm array index */
+    int             hcpasses;   /* successful checks to mark worker up */
+    int             hcfails;    /* failed checks to mark worker down */
+    int             hcpcount;   /* current run of successful checks */
+    int             hcfcount;   /* current run of failed checks */
+    proxy_hcmethod_t hcmethod;  /* health check method */
     unsigned int    hash;       /* hash of worker name */
     unsigned int    status;     /* worker status bitfield */
     enum {
@@ -340,6 +366,8 @@ typedef struct {
     } flush_packets;           /* control AJP flushing */
     apr_time_t      updated;    /* timestamp of last update */
     apr_time_t      error_time; /* time of the last error */
+    apr_time_t      hcupdated;  /* time of the last health check */
+    apr_interval_time_t hcinterval; /* health check interval */
     apr_interval_time_t ttl;    /* maximum amount of time in seconds a connection
                                  * may be available while exceeding the soft limit */
     apr_interval_time_t retry;   /* retry interval */
@@ -350,7 +378,10 @@ typedef struct {
     apr_size_t      recv_buffer_size;
     apr_size_t      io_buffer_size;
     apr_size_t      elected;    /* Number of times the worker was elected */
-    apr_size_t      busy;       /* busyness factor */
+    apr_uint32_t    busy;       /* busyness factor (updated atomically) */
+    apr_uint32_t    latency;    /* moving average of time-to-first-byte (usec) */
+    apr_uint32_t    elected_recent; /* lock free elections, halved every second */
+    apr_uint32_t    elected_sec;    /* second elected_recent was last updated */
     apr_port_t      port;
     apr_off_t       transferred;/* Number of bytes transferred to remote */
     apr_off_t       read;       /* Number of bytes read from remote */
@@ -392,6 +423,7 @@ struct proxy_worker {
 typedef struct {
     char      sticky_path[PROXY_BALANCER_MAX_STICKY_SIZE];     /* URL sticky session identifier */
     char      sticky[PROXY_BALANCER_MAX_STICKY_SIZE];          /* sticky session identifier */
+    char      hashkey[PROXY_BALANCER_MAX_HASHKEY_SIZE];        /* request attribute hashed by lbmethod */
     char      lbpname[PROXY_MAX_PROVIDER_NAME_SIZE];  /* lbmethod provider name */
     char nonce[APR_UUID_FORMATTED_LENGTH + 1];
     apr_interval_time_t timeout;  /* Timeout for waiting on free connection */
@@ -403,6 +435,7 @@ typedef struct {
     unsigned int    max_attempts_set:1;
     unsigned int    was_malloced:1;
     unsigned int    need_reset:1;
+    unsigned int    lockfree:1;       /* elect workers without the balancer lock */
 } proxy_balancer_shared;
 
 #define ALIGNED_PROXY_BALANCER_SHARED_SIZE (APR_ALIGN_DEFAULT(sizeof(proxy_balancer_shared)))
@@ -432,8 +465,15 @@ struct proxy_balancer_method {
     apr_status_t (*reset)(proxy_balancer *balancer, server_rec *s);
     apr_status_t (*age)(proxy_balancer *balancer, server_rec *s);
     apr_status_t (*updatelbstatus)(proxy_balancer *balancer, proxy_worker *elected, server_rec *s);
+    /* Optional: given two usable workers return the one to elect.
+     * Must not need the balancer lock; used for lockfree=On.
+     */
+    proxy_worker *(*choose)(proxy_worker *a, proxy_worker *b);
 };
 
+#define PROXY_BALANCER_IS_LOCKFREE(b) ( (b)->s->lockfree && (b)->lbmethod \
+  && (b)->lbmethod->choose )
+
 #define PROXY_THREAD_LOCK(x)      ( (x) && (x)->tmutex ? apr_thread_mutex_lock((x)->tmutex) : APR_SUCCESS)
 #define PROXY_THREAD_UNLOCK(x)    ( (x) && (x)->tmutex ? apr_thread_mutex_unlock((x)->tmutex) : APR_SUCCESS)
 
@@ -843,6 +883,15 @@ typedef enum { PROXY_HASHFUNC_DEFAULT, PROXY_HASHFUNC_APR,  PROXY_HASHFUNC_FNV }
 
 PROXY_DECLARE(unsigned int) ap_proxy_hashfunc(const char *str, proxy_hash_t method);
 
+/**
+ * Return the next number of a cheap pseudo random sequence (xorshift32),
+ * for sampling workers; not for anything needing real randomness
+ * @param state  state of the sequence, seeded by the caller with a non
+ *               zero value and updated in place
+ * @return       the next number
+ */
+PROXY_DECLARE(apr_uint32_t) ap_proxy_random(apr_uint32_t *state);
+
 
 /**
  * Set/unset the worker status bitfield depending on flag
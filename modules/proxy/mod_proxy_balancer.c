@@ -22,6 +22,7 @@
 #include "apr_version.h"
 #include "apr_hooks.h"
 #include "apr_date.h"
+#include "apr_atomic.h"
 
 static const char *balancer_mutex_type = "proxy-balancer-shm";
 ap_slotmem_provider_t *storage = NULL;
@@ -319,26 +320,117 @@ static proxy_worker *find_session_route(proxy_balancer *balancer,
         return NULL;
 }
 
+/* Number of random probes before giving up on lock free election */
+#define LOCKFREE_PROBES 8
+
+/*
+ * Lock free election ("power of two choices"): probe random members of
+ * the first lbset until two usable, non standby workers are found and
+ * let the lbmethod choose between them.  This is O(1) in the number of
+ * workers and takes no lock, so with large balancers the children no
+ * longer serialize on the balancer mutex.  Returns NULL if no pair was
+ * found (most workers down, or lbsets and standbys in use), in which
+ * case the caller falls back to the locked full scan.
+ */
+static proxy_worker *find_best_lockfree(proxy_balancer *balancer,
+                                        request_rec *r)
+{
+    proxy_worker **workers;
+    proxy_worker *worker;
+    proxy_worker *pick[2];
+    int nelts;
+    int found = 0;
+    int i;
+    apr_uint32_t seed;
+
+    /* The member list may be growing under us (see
+     * ap_proxy_sync_balancer()); unused slots of the array are zeroed
+     * so a not yet filled in entry reads as NULL and is skipped.
+     */
+    nelts = balancer->workers->nelts;
+    workers = (proxy_worker **)balancer->workers->elts;
+    if (nelts < 1) {
+        return NULL;
+    }
+
+    seed = (apr_uint32_t)apr_time_now() ^ (apr_uint32_t)(apr_uintptr_t)r;
+    if (!seed) {
+        seed = 1;
+    }
+
+    for (i = 0; i < LOCKFREE_PROBES && found < 2; i++) {
+        worker = workers[ap_proxy_random(&seed) % nelts];
+        if (!worker || worker->s->lbset || PROXY_WORKER_IS_STANDBY(worker))
+            continue;
+        if (!PROXY_WORKER_IS_USABLE(worker)) {
+            /* Clearing the error state is a read-modify-write of the
+             * shared status, so only take the lock for it once the
+             * retry interval is over.
+             */
+            if ((worker->s->status & PROXY_WORKER_IN_ERROR)
+                && apr_time_now() > worker->s->error_time + worker->s->retry
+                && PROXY_THREAD_LOCK(balancer) == APR_SUCCESS) {
+                ap_proxy_retry_worker("BALANCER", worker, r->server);
+                PROXY_THREAD_UNLOCK(balancer);
+            }
+            if (!PROXY_WORKER_IS_USABLE(worker))
+                continue;
+        }
+        if (found && worker == pick[0]) {
+            /* with a single member we'll only ever see this one */
+            if (nelts == 1)
+                break;
+            continue;
+        }
+        pick[found++] = worker;
+    }
+
+    if (found == 2) {
+        worker = balancer->lbmethod->choose(pick[0], pick[1]);
+    }
+    else if (found == 1 && nelts == 1) {
+        worker = pick[0];
+    }
+    else {
+        return NULL;
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                 "proxy: BALANCER (%s) lock free election of worker (%s)",
+                 balancer->name, worker->s->name);
+    return worker;
+}
+
 static proxy_worker *find_best_worker(proxy_balancer *balancer,
                                       request_rec *r)
 {
     proxy_worker *candidate = NULL;
     apr_status_t rv;
 
-    if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
-        "proxy: BALANCER: (%s). Lock failed for find_best_worker()", balancer->name);
-        return NULL;
+    if (PROXY_BALANCER_IS_LOCKFREE(balancer)) {
+        candidate = find_best_lockfree(balancer, r);
     }
 
-    candidate = (*balancer->lbmethod->finder)(balancer, r);
-
-    if (candidate)
+    if (candidate) {
+        /* XXX: only a statistic, so we don't care about a lost update */
         candidate->s->elected++;
+    }
+    else {
+        if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
+            "proxy: BALANCER: (%s). Lock failed for find_best_worker()", balancer->name);
+            return NULL;
+        }
 
-    if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
-        "proxy: BALANCER: (%s). Unlock failed for find_best_worker()", balancer->name);
+        candidate = (*balancer->lbmethod->finder)(balancer, r);
+
+        if (candidate)
+            candidate->s->elected++;
+
+        if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
+            "proxy: BALANCER: (%s). Unlock failed for find_best_worker()", balancer->name);
+        }
     }
 
     if (candidate == NULL) {
@@ -399,6 +491,21 @@ static int rewrite_url(request_rec *r, proxy_worker *worker,
     return OK;
 }
 
+/* Whether no member of the balancer is out of the error state */
+static int all_in_error(proxy_balancer *balancer)
+{
+    int i;
+    proxy_worker **worker;
+
+    worker = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+        if (*worker && !((*worker)->s->status & PROXY_WORKER_IN_ERROR)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 static void force_recovery(proxy_balancer *balancer, server_rec *s)
 {
     int i;
@@ -444,6 +551,8 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
     char *route = NULL;
     const char *sticky = NULL;
     apr_status_t rv;
+    apr_time_t wupdated;
+    int locked = 0;
 
     *worker = NULL;
     /* Step 1: check if the url is for us
@@ -457,48 +566,63 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
 
     /* Step 2: Lock the LoadBalancer
      * XXX: perhaps we need the process lock here
+     * A lock free balancer only needs it when the member list
+     * has to be synced, decided on a single read of the shared
+     * timestamp, or when all the workers are in error and their
+     * recovery has to be forced.
      */
-    if ((rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
-                     "proxy: BALANCER: (%s). Lock failed for pre_request",
-                     (*balancer)->name);
-        return DECLINED;
+    wupdated = (*balancer)->s->wupdated;
+    if (!PROXY_BALANCER_IS_LOCKFREE(*balancer)
+        || wupdated > (*balancer)->wupdated
+        || all_in_error(*balancer)) {
+        if ((rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
+                         "proxy: BALANCER: (%s). Lock failed for pre_request",
+                         (*balancer)->name);
+            return DECLINED;
+        }
+        locked = 1;
     }
 
-    /* Step 3: force recovery */
-    force_recovery(*balancer, r->server);
+    if (locked) {
+        /* Step 3: force recovery */
+        force_recovery(*balancer, r->server);
 
-    /* Step 3.5: Update member list for the balancer */
-    /* TODO: Implement as provider! */
-    ap_proxy_sync_balancer(*balancer, r->server, conf);
+        /* Step 3.5: Update member list for the balancer */
+        /* TODO: Implement as provider! */
+        ap_proxy_sync_balancer(*balancer, r->server, conf);
+    }
 
     /* Step 4: find the session route */
     runtime = find_session_route(*balancer, r, &route, &sticky, url);
     if (runtime) {
-        if ((*balancer)->lbmethod && (*balancer)->lbmethod->updatelbstatus) {
-            /* Call the LB implementation */
-            (*balancer)->lbmethod->updatelbstatus(*balancer, runtime, r->server);
-        }
-        else { /* Use the default one */
-            int i, total_factor = 0;
-            proxy_worker **workers;
-            /* We have a sticky load balancer
-             * Update the workers status
-             * so that even session routes get
-             * into account.
-             */
-            workers = (proxy_worker **)(*balancer)->workers->elts;
-            for (i = 0; i < (*balancer)->workers->nelts; i++) {
-                /* Take into calculation only the workers that are
-                 * not in error state or not disabled.
+        /* Lock free lbmethods keep no lbstatus to update */
+        if (locked) {
+            if ((*balancer)->lbmethod && (*balancer)->lbmethod->updatelbstatus) {
+                /* Call the LB implementation */
+                (*balancer)->lbmethod->updatelbstatus(*balancer, runtime, r->server);
+            }
+            else { /* Use the default one */
+                int i, total_factor = 0;
+                proxy_worker **workers;
+                /* We have a sticky load balancer
+                 * Update the workers status
+                 * so that even session routes get
+                 * into account.
                  */
-                if (PROXY_WORKER_IS_USABLE(*workers)) {
-                    (*workers)->s->lbstatus += (*workers)->s->lbfactor;
-                    total_factor += (*workers)->s->lbfactor;
+                workers = (proxy_worker **)(*balancer)->workers->elts;
+                for (i = 0; i < (*balancer)->workers->nelts; i++) {
+                    /* Take into calculation only the workers that are
+                     * not in error state or not disabled.
+                     */
+                    if (PROXY_WORKER_IS_USABLE(*workers)) {
+                        (*workers)->s->lbstatus += (*workers)->s->lbfactor;
+                        total_factor += (*workers)->s->lbfactor;
+                    }
+                    workers++;
                 }
-                workers++;
+                runtime->s->lbstatus -= total_factor;
             }
-            runtime->s->lbstatus -= total_factor;
         }
         runtime->s->elected++;
 
@@ -524,7 +648,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
             ap_log_error(APLOG_MARK, APLOG_ERR, 0, r->server,
                          "proxy: BALANCER: (%s). All workers are in error state for route (%s)",
                          (*balancer)->name, route);
-            if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+            if (locked && (rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
                 ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
                              "proxy: BALANCER: (%s). Unlock failed for pre_request",
                              (*balancer)->name);
@@ -533,7 +657,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         }
     }
 
-    if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
                      "proxy: BALANCER: (%s). Unlock failed for pre_request",
                      (*balancer)->name);
@@ -567,7 +691,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         *worker = runtime;
     }
 
-    (*worker)->s->busy++;
+    apr_atomic_inc32(&(*worker)->s->busy);
 
     /* Add balancer/worker info to env. */
     apr_table_setn(r->subprocess_env,
@@ -601,46 +725,95 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
     return access_status;
 }
 
+/*
+ * Fold a new time-to-first-byte sample into the worker's moving
+ * average (weight 1/8, as with TCP's smoothed RTT).  The slot is
+ * shared by all children, so it is updated with a CAS loop instead
+ * of taking the balancer lock.
+ */
+static void update_latency(proxy_worker *worker, apr_interval_time_t sample)
+{
+    apr_uint32_t prev, next;
+
+    if (sample < 0) {
+        return;
+    }
+    if (sample > APR_UINT32_MAX) {
+        sample = APR_UINT32_MAX;
+    }
+    do {
+        prev = apr_atomic_read32(&worker->s->latency);
+        if (prev == 0) {
+            /* first sample; keep zero to mean "not measured yet" */
+            next = sample ? (apr_uint32_t)sample : 1;
+        }
+        else {
+            next = prev - (prev >> 3) + ((apr_uint32_t)sample >> 3);
+        }
+    } while (apr_atomic_cas32(&worker->s->latency, next, prev) != prev);
+}
+
 static int proxy_balancer_post_request(proxy_worker *worker,
                                        proxy_balancer *balancer,
                                        request_rec *r,
                                        proxy_server_conf *conf)
 {
 
-    apr_status_t rv;
-
-    if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
-            "proxy: BALANCER: (%s). Lock failed for post_request",
-            balancer->name);
-        return HTTP_INTERNAL_SERVER_ERROR;
-    }
+    apr_status_t rv = APR_SUCCESS;
+    int i, val = 0;
 
     if (!apr_is_empty_array(balancer->errstatuses)) {
-        int i;
         for (i = 0; i < balancer->errstatuses->nelts; i++) {
-            int val = ((int *)balancer->errstatuses->elts)[i];
-            if (r->status == val) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
-                             "proxy: BALANCER: (%s).  Forcing recovery for worker (%s), failonstatus %d",
-                             balancer->name, worker->s->name, val);
-                worker->s->status |= PROXY_WORKER_IN_ERROR;
-                worker->s->error_time = apr_time_now();
+            if (r->status == ((int *)balancer->errstatuses->elts)[i]) {
+                val = r->status;
                 break;
             }
         }
     }
 
-    if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
-            "proxy: BALANCER: (%s). Unlock failed for post_request",
-            balancer->name);
+    /* Setting the error state is a read-modify-write of the shared
+     * status, so a lock free balancer takes the lock too, but only
+     * when the response status asks for it.
+     */
+    if (val || !PROXY_BALANCER_IS_LOCKFREE(balancer)) {
+        if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
+                "proxy: BALANCER: (%s). Lock failed for post_request",
+                balancer->name);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (val) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
+                         "proxy: BALANCER: (%s).  Forcing recovery for worker (%s), failonstatus %d",
+                         balancer->name, worker->s->name, val);
+            worker->s->status |= PROXY_WORKER_IN_ERROR;
+            worker->s->error_time = apr_time_now();
+        }
+
+        if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, r->server,
+                "proxy: BALANCER: (%s). Unlock failed for post_request",
+                balancer->name);
+        }
     }
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
                  "proxy_balancer_post_request for (%s)", balancer->name);
 
-    if (worker && worker->s->busy)
-        worker->s->busy--;
+    if (worker) {
+        const char *ttfb;
+        apr_uint32_t busy;
+
+        do {
+            busy = apr_atomic_read32(&worker->s->busy);
+        } while (busy
+                 && apr_atomic_cas32(&worker->s->busy, busy - 1, busy) != busy);
+
+        ttfb = apr_table_get(r->notes, "proxy-ttfb");
+        if (ttfb) {
+            update_latency(worker, apr_atoi64(ttfb));
+        }
+    }
 
     return OK;
 
@@ -1168,6 +1341,8 @@ static int balancer_handler(request_rec *r)
                           "</httpd:hostname>\n", NULL);
                 ap_rprintf(r, "          <httpd:loadfactor>%d</httpd:loadfactor>\n",
                           worker->s->lbfactor);
+                ap_rprintf(r, "          <httpd:latency>%u</httpd:latency>\n",
+                          worker->s->latency);
                 ap_rputs("        </httpd:worker>\n", r);
                 ++workers;
             }
@@ -1228,7 +1403,8 @@ static int balancer_handler(request_rec *r)
                 "<th>Worker URL</th>"
                 "<th>Route</th><th>RouteRedir</th>"
                 "<th>Factor</th><th>Set</th><th align='center'>Status</th>"
-                "<th>Elected</th><th>Busy</th><th>Load</th><th>To</th><th>From</th>"
+                "<th>Elected</th><th>Busy</th><th>Load</th><th>Latency</th>"
+                "<th>To</th><th>From</th>"
                 "</tr>\n", r);
 
             workers = (proxy_worker **)balancer->workers->elts;
@@ -1250,8 +1426,10 @@ static int balancer_handler(request_rec *r)
                 ap_rvputs(r, ap_proxy_parse_wstatus(r->pool, worker), NULL);
                 ap_rputs("</td>", r);
                 ap_rprintf(r, "<td align='center'>%" APR_SIZE_T_FMT "</td>", worker->s->elected);
-                ap_rprintf(r, "<td align='center'>%" APR_SIZE_T_FMT "</td>", worker->s->busy);
-                ap_rprintf(r, "<td align='center'>%d</td><td align='center'>", worker->s->lbstatus);
+                ap_rprintf(r, "<td align='center'>%u</td>", worker->s->busy);
+                ap_rprintf(r, "<td align='center'>%d</td>", worker->s->lbstatus);
+                ap_rprintf(r, "<td align='center'>%u.%03ums</td><td align='center'>",
+                           worker->s->latency / 1000, worker->s->latency % 1000);
                 ap_rputs(apr_strfsize(worker->s->transferred, fbuf), r);
                 ap_rputs("</td><td align='center'>", r);
                 ap_rputs(apr_strfsize(worker->s->read, fbuf), r);
@@ -354,8 +354,10 @@ static int proxy_connect_handler(request_rec *r, proxy_worker *worker,
      * Send the HTTP/1.1 CONNECT request to the remote server
      */
 
+    /* Like the backend connections of proxy_util.c, this one has no
+     * scoreboard handle: it must not report into the client's slot. */
     backconn = ap_run_create_connection(c->pool, r->server, sock,
-                                        c->id, c->sbh, c->bucket_alloc);
+                                        c->id, NULL, c->bucket_alloc);
     if (!backconn) {
         /* peer reset */
         ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r,
@@ -1861,9 +1861,10 @@ static int proxy_ftp_handler(request_rec *r, proxy_worker *worker,
         }
     }
 
-    /* the transfer socket is now open, create a new connection */
+    /* the transfer socket is now open, create a new connection; without
+     * a scoreboard handle, as it must not report into the client's slot */
     data = ap_run_create_connection(p, r->server, data_sock, r->connection->id,
-                                    r->connection->sbh, c->bucket_alloc);
+                                    NULL, c->bucket_alloc);
     if (!data) {
         /*
          * the peer reset the connection already; ap_run_create_connection() closed
@@ -0,0 +1,561 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Active health checks for balancer members.
+ *
+ * A singleton watchdog callback (so one child at a time, whichever holds
+ * the watchdog mutex) walks all balancer members which have an hcmethod
+ * set, and probes those whose hcinterval has elapsed.  The probes run in
+ * parallel in a thread pool.  The time of the last check lives in the
+ * shared worker slot, so each member is checked once per interval no
+ * matter how many children there are, and the result (the
+ * PROXY_WORKER_HC_FAIL status bit) is seen by all children before any
+ * client request is sent to a dead backend.
+ */
+
+#include "mod_proxy.h"
+#include "mod_watchdog.h"
+#include "fcgi_protocol.h"
+#include "apr_atomic.h"
+#if APR_HAS_THREADS
+#include "apr_thread_pool.h"
+#endif
+
+module AP_MODULE_DECLARE_DATA proxy_hcheck_module;
+
+#define HC_WATCHDOG_NAME      "_proxy_hcheck_"
+#define HC_DEFAULT_TPSIZE     16
+#define HC_DEFAULT_TIMEOUT    apr_time_from_sec(5)
+#define HC_MAX_STATUS_LINE    256
+
+typedef struct {
+    proxy_worker *worker;
+    server_rec *s;
+    volatile apr_uint32_t busy;  /* a probe is queued or running */
+} hc_baton_t;
+
+typedef struct {
+    int tpsize;                  /* 0 means probe sequentially */
+    apr_pool_t *p;               /* child lifetime pool, thread safe */
+    apr_hash_t *batons;          /* proxy_worker * -> hc_baton_t */
+    server_rec *s;
+    ap_watchdog_t *watchdog;
+#if APR_HAS_THREADS
+    apr_thread_pool_t *tp;
+#endif
+} hc_ctx_t;
+
+static hc_ctx_t *ctx = NULL;
+static int tpsize = HC_DEFAULT_TPSIZE;
+
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *hc_watchdog_get_instance;
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *hc_watchdog_register_callback;
+
+static apr_interval_time_t hc_timeout(proxy_worker *worker)
+{
+    if (worker->s->conn_timeout_set)
+        return worker->s->conn_timeout;
+    if (worker->s->timeout_set)
+        return worker->s->timeout;
+    return HC_DEFAULT_TIMEOUT;
+}
+
+static apr_status_t hc_connect(proxy_worker *worker, apr_socket_t **sock,
+                               apr_pool_t *p)
+{
+    apr_sockaddr_t *addr;
+    apr_port_t port;
+    apr_status_t rv;
+
+    port = worker->s->port ? worker->s->port
+                           : apr_uri_port_of_scheme(worker->s->scheme);
+    rv = apr_sockaddr_info_get(&addr, worker->s->hostname, APR_UNSPEC,
+                               port, 0, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_socket_create(sock, addr->family, SOCK_STREAM, APR_PROTO_TCP, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    apr_socket_timeout_set(*sock, hc_timeout(worker));
+    return apr_socket_connect(*sock, addr);
+}
+
+static apr_status_t hc_send(apr_socket_t *sock, const char *buf,
+                            apr_size_t len)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t n;
+
+    while (len && rv == APR_SUCCESS) {
+        n = len;
+        rv = apr_socket_send(sock, buf, &n);
+        buf += n;
+        len -= n;
+    }
+    return rv;
+}
+
+/* Read exactly len bytes */
+static apr_status_t hc_recv(apr_socket_t *sock, char *buf, apr_size_t len)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t n;
+
+    while (len && rv == APR_SUCCESS) {
+        n = len;
+        rv = apr_socket_recv(sock, buf, &n);
+        buf += n;
+        len -= n;
+    }
+    return rv;
+}
+
+/* Send a request and check the status line: 2xx and 3xx are healthy */
+static apr_status_t hc_check_http(proxy_worker *worker, apr_socket_t *sock,
+                                  const char *method, apr_pool_t *p)
+{
+    char buf[HC_MAX_STATUS_LINE];
+    const char *req;
+    apr_size_t len = 0;
+    apr_size_t n;
+    apr_status_t rv;
+    int status;
+
+    req = apr_pstrcat(p, method, " ",
+                      *worker->s->hcuri ? worker->s->hcuri : "/",
+                      " HTTP/1.0" CRLF "Host: ", worker->s->hostname,
+                      worker->s->port
+                          ? apr_psprintf(p, ":%u", worker->s->port) : "",
+                      CRLF "User-Agent: ", ap_get_server_banner(),
+                      " (health check)" CRLF "Connection: close" CRLF CRLF,
+                      NULL);
+    rv = hc_send(sock, req, strlen(req));
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    /* We only care about the status line */
+    do {
+        n = sizeof(buf) - 1 - len;
+        rv = apr_socket_recv(sock, buf + len, &n);
+        len += n;
+        buf[len] = '\0';
+    } while (rv == APR_SUCCESS && len < 12 && len < sizeof(buf) - 1);
+
+    if (len < 12 || !apr_date_checkmask(buf, "HTTP/#.# ###*")) {
+        return (rv != APR_SUCCESS) ? rv : APR_EGENERAL;
+    }
+    status = atoi(buf + 9);
+    return (status >= 200 && status < 400) ? APR_SUCCESS : APR_EGENERAL;
+}
+
+/* AJP13 CPING; a live container answers with CPONG */
+static apr_status_t hc_check_cping(apr_socket_t *sock)
+{
+    static const char cping[] = { 0x12, 0x34, 0x00, 0x01, 0x0A };
+    static const char cpong[] = { 'A', 'B', 0x00, 0x01, 0x09 };
+    char buf[sizeof(cpong)];
+    apr_status_t rv;
+
+    rv = hc_send(sock, cping, sizeof(cping));
+    if (rv == APR_SUCCESS) {
+        rv = hc_recv(sock, buf, sizeof(buf));
+    }
+    if (rv == APR_SUCCESS && memcmp(buf, cpong, sizeof(cpong))) {
+        rv = APR_EGENERAL;
+    }
+    return rv;
+}
+
+/*
+ * FastCGI management record FCGI_GET_VALUES; an application answers
+ * with FCGI_GET_VALUES_RESULT, or FCGI_UNKNOWN_TYPE if it doesn't
+ * implement it, either of which shows it is alive.
+ */
+static apr_status_t hc_check_fcgi(apr_socket_t *sock)
+{
+    unsigned char req[FCGI_HEADER_LEN];
+    unsigned char resp[FCGI_HEADER_LEN];
+    apr_status_t rv;
+
+    memset(req, 0, sizeof(req));
+    req[FCGI_HDR_VERSION_OFFSET] = FCGI_VERSION;
+    req[FCGI_HDR_TYPE_OFFSET] = FCGI_GET_VALUES;
+
+    rv = hc_send(sock, (const char *)req, sizeof(req));
+    if (rv == APR_SUCCESS) {
+        rv = hc_recv(sock, (char *)resp, sizeof(resp));
+    }
+    if (rv == APR_SUCCESS
+        && (resp[FCGI_HDR_VERSION_OFFSET] != FCGI_VERSION
+            || (resp[FCGI_HDR_TYPE_OFFSET] != FCGI_GET_VALUES_RESULT
+                && resp[FCGI_HDR_TYPE_OFFSET] != FCGI_UNKNOWN_TYPE))) {
+        rv = APR_EGENERAL;
+    }
+    return rv;
+}
+
+static apr_status_t hc_check(proxy_worker *worker, apr_pool_t *p)
+{
+    apr_socket_t *sock;
+    apr_status_t rv;
+    proxy_hcmethod_t method = worker->s->hcmethod;
+
+    /* We don't speak SSL here; just see if the port is open */
+    if (!strcasecmp(worker->s->scheme, "https")) {
+        method = PROXY_HC_TCP;
+    }
+
+    rv = hc_connect(worker, &sock, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    switch (method) {
+    case PROXY_HC_OPTIONS:
+        rv = hc_check_http(worker, sock, "OPTIONS", p);
+        break;
+    case PROXY_HC_HEAD:
+        rv = hc_check_http(worker, sock, "HEAD", p);
+        break;
+    case PROXY_HC_GET:
+        rv = hc_check_http(worker, sock, "GET", p);
+        break;
+    case PROXY_HC_CPING:
+        rv = hc_check_cping(sock);
+        break;
+    case PROXY_HC_FCGI:
+        rv = hc_check_fcgi(sock);
+        break;
+    default:
+        break;
+    }
+    apr_socket_close(sock);
+    return rv;
+}
+
+/* Apply the result of a check to the shared worker status */
+static void hc_result(proxy_worker *worker, apr_status_t rv, server_rec *s)
+{
+    if (rv == APR_SUCCESS) {
+        worker->s->hcfcount = 0;
+        if (worker->s->status & PROXY_WORKER_HC_FAIL) {
+            if (++worker->s->hcpcount >= worker->s->hcpasses) {
+                worker->s->hcpcount = 0;
+                worker->s->status &= ~(PROXY_WORKER_HC_FAIL
+                                       | PROXY_WORKER_IN_ERROR);
+                ap_log_error(APLOG_MARK, APLOG_INFO, 0, s,
+                             "proxy: health check: worker %s is up",
+                             worker->s->name);
+            }
+        }
+        else if (worker->s->status & PROXY_WORKER_IN_ERROR) {
+            /* No need to wait for the retry timeout, it's back */
+            worker->s->status &= ~PROXY_WORKER_IN_ERROR;
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, s,
+                         "proxy: health check: worker %s recovered",
+                         worker->s->name);
+        }
+    }
+    else {
+        worker->s->hcpcount = 0;
+        if (!(worker->s->status & PROXY_WORKER_HC_FAIL)
+            && ++worker->s->hcfcount >= worker->s->hcfails) {
+            worker->s->hcfcount = 0;
+            worker->s->status |= PROXY_WORKER_HC_FAIL;
+            worker->s->error_time = apr_time_now();
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                         "proxy: health check: worker %s is down",
+                         worker->s->name);
+        }
+    }
+}
+
+static void hc_probe(hc_baton_t *baton)
+{
+    apr_pool_t *p;
+    apr_status_t rv;
+
+    apr_pool_create(&p, ctx->p);
+    rv = hc_check(baton->worker, p);
+    ap_log_error(APLOG_MARK, APLOG_TRACE1, rv, baton->s,
+                 "proxy: health check of %s %s", baton->worker->s->name,
+                 rv == APR_SUCCESS ? "passed" : "failed");
+    hc_result(baton->worker, rv, baton->s);
+    apr_pool_destroy(p);
+    apr_atomic_set32(&baton->busy, 0);
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC hc_probe_thread(apr_thread_t *thd, void *data)
+{
+    hc_probe((hc_baton_t *)data);
+    return NULL;
+}
+#endif
+
+static hc_baton_t *hc_get_baton(proxy_worker *worker, server_rec *s)
+{
+    hc_baton_t *baton;
+
+    baton = apr_hash_get(ctx->batons, &worker, sizeof(worker));
+    if (!baton) {
+        baton = apr_pcalloc(ctx->p, sizeof(hc_baton_t));
+        baton->worker = worker;
+        baton->s = s;
+        apr_hash_set(ctx->batons, &baton->worker, sizeof(worker), baton);
+    }
+    return baton;
+}
+
+static void hc_check_balancer(proxy_balancer *balancer, server_rec *s,
+                              proxy_server_conf *conf, apr_time_t now)
+{
+    proxy_worker **workers;
+    proxy_worker *worker;
+    hc_baton_t *baton;
+    int i;
+
+    /* Pick up members added through the balancer-manager */
+    if (balancer->s->wupdated > balancer->wupdated
+        && PROXY_THREAD_LOCK(balancer) == APR_SUCCESS) {
+        ap_proxy_sync_balancer(balancer, s, conf);
+        PROXY_THREAD_UNLOCK(balancer);
+    }
+
+    workers = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        worker = workers[i];
+        if (worker->s->hcmethod == PROXY_HC_NONE
+            || (worker->s->status & (PROXY_WORKER_DISABLED
+                                     | PROXY_WORKER_STOPPED))
+            || now < worker->s->hcupdated + worker->s->hcinterval) {
+            continue;
+        }
+        baton = hc_get_baton(worker, s);
+        if (apr_atomic_cas32(&baton->busy, 1, 0) != 0) {
+            /* the previous probe hasn't finished yet */
+            continue;
+        }
+        worker->s->hcupdated = now;
+#if APR_HAS_THREADS
+        if (ctx->tp) {
+            if (apr_thread_pool_push(ctx->tp, hc_probe_thread, baton,
+                                     APR_THREAD_TASK_PRIORITY_NORMAL,
+                                     NULL) == APR_SUCCESS) {
+                continue;
+            }
+        }
+#endif
+        hc_probe(baton);
+    }
+}
+
+static apr_status_t hc_watchdog_callback(int state, void *data,
+                                         apr_pool_t *pool)
+{
+    apr_status_t rv = APR_SUCCESS;
+    server_rec *s;
+    proxy_server_conf *conf;
+    proxy_balancer *balancer;
+    apr_time_t now;
+    int i;
+
+    switch (state) {
+        case AP_WATCHDOG_STATE_STARTING:
+#if APR_HAS_THREADS
+            if (ctx->tpsize) {
+                rv = apr_thread_pool_create(&ctx->tp, 1, ctx->tpsize, ctx->p);
+                if (rv != APR_SUCCESS) {
+                    ap_log_error(APLOG_MARK, APLOG_ERR, rv, ctx->s,
+                                 "proxy: health check: unable to create "
+                                 "thread pool, probing sequentially");
+                    ctx->tp = NULL;
+                    rv = APR_SUCCESS;
+                }
+            }
+#endif
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->s,
+                         "proxy: health check watchdog started");
+        break;
+
+        case AP_WATCHDOG_STATE_RUNNING:
+            now = apr_time_now();
+            for (s = ctx->s; s; s = s->next) {
+                conf = ap_get_module_config(s->module_config, &proxy_module);
+                balancer = (proxy_balancer *)conf->balancers->elts;
+                for (i = 0; i < conf->balancers->nelts; i++, balancer++) {
+                    hc_check_balancer(balancer, s, conf, now);
+                }
+            }
+        break;
+
+        case AP_WATCHDOG_STATE_STOPPING:
+#if APR_HAS_THREADS
+            if (ctx->tp) {
+                /* waits for the running probes */
+                apr_thread_pool_destroy(ctx->tp);
+                ctx->tp = NULL;
+            }
+#endif
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->s,
+                         "proxy: health check watchdog stopping");
+        break;
+    }
+    return rv;
+}
+
+static int hc_post_config(apr_pool_t *p, apr_pool_t *plog,
+                          apr_pool_t *ptemp, server_rec *main_s)
+{
+    apr_status_t rv;
+    server_rec *s;
+    proxy_server_conf *conf;
+    proxy_balancer *balancer;
+    proxy_worker **workers;
+    int i, n;
+    int needed = 0;
+
+    ctx = NULL;
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+
+    /* Is there anything to check at all? */
+    for (s = main_s; s && !needed; s = s->next) {
+        conf = ap_get_module_config(s->module_config, &proxy_module);
+        balancer = (proxy_balancer *)conf->balancers->elts;
+        for (i = 0; i < conf->balancers->nelts && !needed; i++, balancer++) {
+            workers = (proxy_worker **)balancer->workers->elts;
+            for (n = 0; n < balancer->workers->nelts; n++) {
+                if (workers[n]->s->hcmethod != PROXY_HC_NONE) {
+                    needed = 1;
+                    break;
+                }
+            }
+        }
+    }
+    if (!needed) {
+        return OK;
+    }
+
+    hc_watchdog_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    hc_watchdog_register_callback = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (!hc_watchdog_get_instance || !hc_watchdog_register_callback) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, main_s,
+                     "proxy: health check: mod_watchdog is required");
+        return !OK;
+    }
+
+    ctx = apr_pcalloc(p, sizeof(hc_ctx_t));
+    ctx->s = main_s;
+    ctx->tpsize = tpsize;
+
+    /* Singleton: only one child at a time runs the checks */
+    rv = hc_watchdog_get_instance(&ctx->watchdog, HC_WATCHDOG_NAME, 0, 1, p);
+    if (rv) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, main_s,
+                     "proxy: health check: Failed to create watchdog "
+                     "instance (%s)", HC_WATCHDOG_NAME);
+        return !OK;
+    }
+    rv = hc_watchdog_register_callback(ctx->watchdog, AP_WD_TM_INTERVAL,
+                                       ctx, hc_watchdog_callback);
+    if (rv) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, main_s,
+                     "proxy: health check: Failed to register watchdog "
+                     "callback (%s)", HC_WATCHDOG_NAME);
+        return !OK;
+    }
+    return OK;
+}
+
+static int hc_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
+{
+    tpsize = HC_DEFAULT_TPSIZE;
+    return OK;
+}
+
+static void hc_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_allocator_t *allocator;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+
+    if (!ctx) {
+        return;
+    }
+
+    /* Probes create their pools from ctx->p concurrently, so it
+     * gets its own allocator guarded by a mutex.
+     */
+    apr_allocator_create(&allocator);
+    apr_pool_create_ex(&ctx->p, p, NULL, allocator);
+    apr_allocator_owner_set(allocator, ctx->p);
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT, ctx->p);
+    apr_allocator_mutex_set(allocator, mutex);
+#endif
+    apr_pool_tag(ctx->p, "proxy_hcheck");
+    ctx->batons = apr_hash_make(ctx->p);
+}
+
+static const char *set_hc_tpsize(cmd_parms *cmd, void *dummy,
+                                 const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+    tpsize = atoi(arg);
+    if (tpsize < 0) {
+        return "ProxyHCTPsize must be >= 0";
+    }
+    return NULL;
+}
+
+static const command_rec hcheck_cmds[] =
+{
+    AP_INIT_TAKE1("ProxyHCTPsize", set_hc_tpsize, NULL, RSRC_CONF,
+                  "Number of threads probing in parallel (0 for none)"),
+    {NULL}
+};
+
+static void hc_register_hooks(apr_pool_t *p)
+{
+    static const char *const aszPre[] = { "mod_proxy_balancer.c", NULL};
+    /* The callback must be registered before mod_watchdog sets up its
+     * instances, and ctx->p created before the watchdog thread starts.
+     */
+    static const char *const aszSucc[] = { "mod_watchdog.c", NULL};
+
+    ap_hook_pre_config(hc_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(hc_post_config, aszPre, aszSucc, APR_HOOK_LAST);
+    ap_hook_child_init(hc_child_init, NULL, aszSucc, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(proxy_hcheck) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,              /* create per-directory config structure */
+    NULL,              /* merge per-directory config structures */
+    NULL,              /* create per-server config structure */
+    NULL,              /* merge per-server config structures */
+    hcheck_cmds,       /* command apr_table_t */
+    hc_register_hooks  /* register hooks */
+};
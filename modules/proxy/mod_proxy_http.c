@@ -548,13 +548,59 @@ static int stream_reqbody_cl(apr_pool_t *p,
     return OK;
 }
 
-static int spool_reqbody_cl(apr_pool_t *p,
-                                     request_rec *r,
-                                     proxy_conn_rec *p_conn,
-                                     conn_rec *origin,
-                                     apr_bucket_brigade *header_brigade,
-                                     apr_bucket_brigade *input_brigade,
-                                     int force_cl)
+/*
+ * A request body read completely before it is sent, kept in the
+ * request_config so that it can be sent again when the request is
+ * retried on another connection or balancer member.
+ */
+typedef struct {
+    apr_bucket_brigade *mem;    /* first part of the body, in memory */
+    apr_file_t *tmpfile;        /* the rest of it, spooled to disk */
+    apr_off_t fsize;            /* bytes in tmpfile */
+    apr_off_t length;           /* total body length */
+} proxy_http_spool_t;
+
+static apr_status_t spool_create_tmpfile(request_rec *r, apr_pool_t *p,
+                                         apr_file_t **tmpfile)
+{
+    proxy_server_conf *conf = ap_get_module_config(r->server->module_config,
+                                                   &proxy_module);
+    const char *temp_dir = conf->spool_dir;
+    char *template;
+    apr_int32_t flags = APR_CREATE | APR_READ | APR_WRITE | APR_EXCL
+                        | APR_DELONCLOSE | APR_BUFFERED;
+    apr_status_t status;
+#ifdef APR_SENDFILE_ENABLED
+    core_dir_config *coreconf = ap_get_module_config(r->per_dir_config,
+                                                     &core_module);
+
+    /* So that the core output filter can sendfile() it to the backend */
+    flags |= AP_SENDFILE_ENABLED(coreconf->enable_sendfile);
+#endif
+
+    if (!temp_dir) {
+        status = apr_temp_dir_get(&temp_dir, p);
+        if (status != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, status, r->server,
+                         "proxy: search for temporary directory failed");
+            return status;
+        }
+    }
+    apr_filepath_merge(&template, temp_dir, "modproxy.tmp.XXXXXX",
+                       APR_FILEPATH_NATIVE, p);
+    status = apr_file_mktemp(tmpfile, template, flags, p);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, status, r->server,
+                     "proxy: creation of temporary file in directory %s failed",
+                     temp_dir);
+    }
+    return status;
+}
+
+/* Read the whole request body, into memory as long as it is small */
+static int spool_reqbody(apr_pool_t *p, request_rec *r,
+                         apr_bucket_brigade *input_brigade,
+                         proxy_http_spool_t **spool_ptr)
 {
     int seen_eos = 0;
     apr_status_t status;
@@ -564,6 +610,7 @@ static int spool_reqbody_cl(apr_pool_t *p,
     apr_off_t bytes, bytes_spooled = 0, fsize = 0;
     apr_file_t *tmpfile = NULL;
     apr_off_t limit;
+    proxy_http_spool_t *spool;
 
     body_brigade = apr_brigade_create(p, bucket_alloc);
 
@@ -597,23 +644,7 @@ static int spool_reqbody_cl(apr_pool_t *p,
             }
             /* can't spool any more in memory; write latest brigade to disk */
             if (tmpfile == NULL) {
-                const char *temp_dir;
-                char *template;
-
-                status = apr_temp_dir_get(&temp_dir, p);
-                if (status != APR_SUCCESS) {
-                    ap_log_error(APLOG_MARK, APLOG_ERR, status, r->server,
-                                 "proxy: search for temporary directory failed");
-                    return HTTP_INTERNAL_SERVER_ERROR;
-                }
-                apr_filepath_merge(&template, temp_dir,
-                                   "modproxy.tmp.XXXXXX",
-                                   APR_FILEPATH_NATIVE, p);
-                status = apr_file_mktemp(&tmpfile, template, 0, p);
-                if (status != APR_SUCCESS) {
-                    ap_log_error(APLOG_MARK, APLOG_ERR, status, r->server,
-                                 "proxy: creation of temporary file in directory %s failed",
-                                 temp_dir);
+                if (spool_create_tmpfile(r, p, &tmpfile) != APR_SUCCESS) {
                     return HTTP_INTERNAL_SERVER_ERROR;
                 }
             }
@@ -674,13 +705,67 @@ static int spool_reqbody_cl(apr_pool_t *p,
         }
     }
 
-    if (bytes_spooled || force_cl) {
-        add_cl(p, bucket_alloc, header_brigade, apr_off_t_toa(p, bytes_spooled));
+    /* sendfile() and file bucket reads bypass the file buffer */
+    if (tmpfile && (status = apr_file_flush(tmpfile)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, status, r->server,
+                     "proxy: write to temporary file failed");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    spool = apr_palloc(p, sizeof(proxy_http_spool_t));
+    spool->mem = body_brigade;
+    spool->tmpfile = tmpfile;
+    spool->fsize = fsize;
+    spool->length = bytes_spooled;
+    *spool_ptr = spool;
+
+    return OK;
+}
+
+static int spool_reqbody_cl(apr_pool_t *p,
+                                     request_rec *r,
+                                     proxy_conn_rec *p_conn,
+                                     conn_rec *origin,
+                                     apr_bucket_brigade *header_brigade,
+                                     apr_bucket_brigade *input_brigade,
+                                     int force_cl)
+{
+    apr_bucket_alloc_t *bucket_alloc = r->connection->bucket_alloc;
+    apr_bucket *e, *copy;
+    proxy_http_spool_t *spool;
+    apr_status_t status;
+    int rv;
+
+    /* A previous attempt may already have read the body */
+    spool = ap_get_module_config(r->request_config, &proxy_http_module);
+    if (!spool) {
+        if ((rv = spool_reqbody(p, r, input_brigade, &spool)) != OK) {
+            return rv;
+        }
+        ap_set_module_config(r->request_config, &proxy_http_module, spool);
+    }
+
+    if (spool->length || force_cl) {
+        add_cl(p, bucket_alloc, header_brigade,
+               apr_off_t_toa(p, spool->length));
     }
     terminate_headers(bucket_alloc, header_brigade);
-    APR_BRIGADE_CONCAT(header_brigade, body_brigade);
-    if (tmpfile) {
-        apr_brigade_insert_file(header_brigade, tmpfile, 0, fsize, p);
+
+    /* Send copies, keeping the spooled body for a retry */
+    for (e = APR_BRIGADE_FIRST(spool->mem);
+         e != APR_BRIGADE_SENTINEL(spool->mem);
+         e = APR_BUCKET_NEXT(e)) {
+        status = apr_bucket_copy(e, &copy);
+        if (status != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, status, r->server,
+                         "proxy: copying spooled request body failed");
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        APR_BRIGADE_INSERT_TAIL(header_brigade, copy);
+    }
+    if (spool->tmpfile) {
+        apr_brigade_insert_file(header_brigade, spool->tmpfile, 0,
+                                spool->fsize, p);
     }
     if (apr_table_get(r->subprocess_env, "proxy-sendextracrlf")) {
         e = apr_bucket_immortal_create(ASCII_CRLF, 2, bucket_alloc);
@@ -690,6 +775,32 @@ static int spool_reqbody_cl(apr_pool_t *p,
     return(pass_brigade(bucket_alloc, r, p_conn, origin, header_brigade, 1));
 }
 
+/* Is the request idempotent, so that it may be sent more than once? */
+static int proxy_http_idempotent(request_rec *r)
+{
+    switch (r->method_number) {
+    case M_GET:
+    case M_PUT:
+    case M_DELETE:
+    case M_OPTIONS:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Can the request be sent once more after the backend failed to answer?
+ * Only if it is idempotent, and any body it has was spooled.
+ */
+static int proxy_http_can_retry(request_rec *r)
+{
+    return proxy_http_idempotent(r)
+           && (!ap_request_has_body(r)
+               || ap_get_module_config(r->request_config,
+                                       &proxy_http_module) != NULL);
+}
+
 static
 int ap_proxy_http_request(apr_pool_t *p, request_rec *r,
                                    proxy_conn_rec *p_conn, proxy_worker *worker,
@@ -1013,6 +1124,12 @@ int ap_proxy_http_request(apr_pool_t *p, request_rec *r,
         p_conn->close++;
     }
 
+    /* The body was spooled by a previous attempt, send it again */
+    if (ap_get_module_config(r->request_config, &proxy_http_module)) {
+        rb_method = RB_SPOOL_CL;
+        goto skip_body;
+    }
+
     /* Prefetch MAX_MEM_SPOOL bytes
      *
      * This helps us avoid any election of C-L v.s. T-E
@@ -1081,6 +1198,10 @@ int ap_proxy_http_request(apr_pool_t *p, request_rec *r,
      *   The client sent a T-E body, and the administrator has
      *   setenv proxy-sendcl, and not setenv proxy-sendchunked
      *
+     *   The administrator has configured a ProxySpoolDir, and not
+     *   setenv proxy-sendchunked; the spooled body can then be sent
+     *   again if the backend fails and the request is retried
+     *
      * If both proxy-sendcl and proxy-sendchunked are set, the
      * behavior is the same as if neither were set, large bodies
      * that can't be read will be forwarded in their original
@@ -1111,10 +1232,16 @@ int ap_proxy_http_request(apr_pool_t *p, request_rec *r,
         if (old_cl_val || old_te_val || bytes_read) {
             old_cl_val = apr_off_t_toa(r->pool, bytes_read);
         }
-        rb_method = RB_STREAM_CL;
+        /* Keep a non-empty body around in case we have to retry, which
+         * is never done for a request that is not idempotent */
+        rb_method = (bytes_read && proxy_http_idempotent(r)) ? RB_SPOOL_CL
+                                                              : RB_STREAM_CL;
     }
     else if (old_te_val) {
         if (force10
+             || (conf->spool_dir
+                  && !apr_table_get(r->subprocess_env, "proxy-sendchunks")
+                  && !apr_table_get(r->subprocess_env, "proxy-sendchunked"))
              || (apr_table_get(r->subprocess_env, "proxy-sendcl")
                   && !apr_table_get(r->subprocess_env, "proxy-sendchunks")
                   && !apr_table_get(r->subprocess_env, "proxy-sendchunked"))) {
@@ -1125,7 +1252,7 @@ int ap_proxy_http_request(apr_pool_t *p, request_rec *r,
         }
     }
     else if (old_cl_val) {
-        if (r->input_filters == r->proto_input_filters) {
+        if (r->input_filters == r->proto_input_filters && !conf->spool_dir) {
             rb_method = RB_STREAM_CL;
         }
         else if (!force10
@@ -1395,7 +1522,8 @@ apr_status_t ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                                             proxy_conn_rec **backend_ptr,
                                             proxy_worker *worker,
                                             proxy_server_conf *conf,
-                                            char *server_portstr) {
+                                            char *server_portstr,
+                                            int *resend) {
     conn_rec *c = r->connection;
     char buffer[HUGE_STRING_LEN];
     const char *buf;
@@ -1406,6 +1534,8 @@ apr_status_t ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
     int len, backasswards;
     int interim_response = 0; /* non-zero whilst interim 1xx responses
                                * are being read. */
+    int status_lines = 0;     /* response lines read from the backend */
+    int may_resend = *resend;
     int pread_len = 0;
     apr_table_t *save_table;
     int backend_broke = 0;
@@ -1422,7 +1552,9 @@ apr_status_t ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
     apr_interval_time_t old_timeout = 0;
     proxy_dir_conf *dconf;
     int do_100_continue;
+    apr_time_t request_sent = apr_time_now();
 
+    *resend = 0;
     dconf = ap_get_module_config(r->per_dir_config, &proxy_module);
 
     do_100_continue = (worker->s->ping_timeout_set
@@ -1477,6 +1609,16 @@ apr_status_t ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                     return ap_proxyerror(r, HTTP_SERVICE_UNAVAILABLE, "Timeout on 100-Continue");
                 }
             }
+            /*
+             * The backend closed the connection without a word, as
+             * happens with a keepalive connection it has just timed out:
+             * let the handler send the request again if that's safe.
+             */
+            if (may_resend && !status_lines && !APR_STATUS_IS_TIMEUP(rc)) {
+                backend->close = 1;
+                *resend = 1;
+                return HTTP_SERVICE_UNAVAILABLE;
+            }
             /*
              * If we are a reverse proxy request shutdown the connection
              * WITHOUT ANY response to trigger a retry by the client
@@ -1538,6 +1680,14 @@ apr_status_t ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
         }
         /* XXX: Is this a real headers length send from remote? */
         backend->worker->s->read += len;
+        status_lines++;
+
+        /* Let the balancer know how long the backend took to answer */
+        if (!interim_response) {
+            apr_table_setn(r->notes, "proxy-ttfb",
+                           apr_psprintf(r->pool, "%" APR_TIME_T_FMT,
+                                        apr_time_now() - request_sent));
+        }
 
         /* Is it an HTTP/1 response?
          * This is buggy if we ever see an HTTP/1.10
@@ -2040,6 +2190,7 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
     int is_ssl = 0;
     conn_rec *c = r->connection;
     int retry = 0;
+    int reused, resend;
     /*
      * Use a shorter-lived pool to reduce memory usage
      * and avoid a memory leak
@@ -2127,6 +2278,7 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
         }
 
         /* Step Three: Create conn_rec */
+        reused = (backend->connection != NULL);
         if (!backend->connection) {
             if ((status = ap_proxy_connection_create(proxy_function, backend,
                                                      c, r->server)) != OK)
@@ -2155,6 +2307,25 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
                              worker->cp->addr, worker->s->hostname);
                 retry++;
                 continue;
+            }
+            else if (status == HTTP_BAD_GATEWAY && backend->connection
+                     && backend->connection->aborted
+                     && proxy_http_can_retry(r)) {
+                /* Nothing was answered, so the request can be resent */
+                if (reused && !retry) {
+                    backend->close = 1;
+                    ap_log_error(APLOG_MARK, APLOG_INFO, 0, r->server,
+                                 "proxy: HTTP: resending request to %pI (%s)"
+                                 " on a new connection",
+                                 worker->cp->addr, worker->s->hostname);
+                    retry++;
+                    continue;
+                }
+                if (worker->balancer) {
+                    /* let mod_proxy fail over to another member */
+                    status = HTTP_SERVICE_UNAVAILABLE;
+                }
+                break;
             } else {
                 break;
             }
@@ -2162,8 +2333,22 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
         }
 
         /* Step Five: Receive the Response... Fall thru to cleanup */
+        resend = proxy_http_can_retry(r)
+                 && ((reused && !retry) || worker->balancer);
         status = ap_proxy_http_process_response(p, r, &backend, worker,
-                                                conf, server_portstr);
+                                                conf, server_portstr,
+                                                &resend);
+        if (resend && reused && !retry) {
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, r->server,
+                         "proxy: HTTP: resending request to %pI (%s)"
+                         " on a new connection",
+                         worker->cp->addr, worker->s->hostname);
+            /* its pool goes away with the old socket */
+            apr_pool_destroy(backend->r->pool);
+            backend->r = NULL;
+            retry++;
+            continue;
+        }
 
         break;
     }
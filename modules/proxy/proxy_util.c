@@ -59,6 +59,7 @@ static struct wstat {
     {PROXY_WORKER_IN_ERROR,      PROXY_WORKER_IN_ERROR_FLAG,      "Err "},
     {PROXY_WORKER_HOT_STANDBY,   PROXY_WORKER_HOT_STANDBY_FLAG,   "Stby "},
     {PROXY_WORKER_FREE,          PROXY_WORKER_FREE_FLAG,          "Free "},
+    {PROXY_WORKER_HC_FAIL,       PROXY_WORKER_HC_FAIL_FLAG,       "HcFl "},
     {0x0, '\0', NULL}
 };
 
@@ -1813,6 +1814,9 @@ PROXY_DECLARE(char *) ap_proxy_define_worker(apr_pool_t *p,
     wshared->is_address_reusable = 1;
     wshared->lbfactor = 1;
     wshared->smax = -1;
+    wshared->hcinterval = apr_time_from_sec(PROXY_WORKER_DEFAULT_HC_INTERVAL);
+    wshared->hcpasses = 1;
+    wshared->hcfails = 1;
     wshared->hash = ap_proxy_hashfunc(wshared->name, PROXY_HASHFUNC_DEFAULT);
     wshared->was_malloced = (do_malloc != 0);
 
@@ -2906,6 +2910,16 @@ ap_proxy_hashfunc(const char *str, proxy_hash_t method)
     }
 }
 
+/* xorshift32; only needs to be cheap and thread safe, not strong */
+PROXY_DECLARE(apr_uint32_t) ap_proxy_random(apr_uint32_t *state)
+{
+    apr_uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
 PROXY_DECLARE(apr_status_t) ap_proxy_set_wstatus(char c, int set, proxy_worker *w)
 {
     unsigned int *status = &w->s->status;
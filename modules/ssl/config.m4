@@ -29,6 +29,8 @@ ssl_engine_config.lo dnl
 ssl_engine_dh.lo dnl
 ssl_engine_init.lo dnl
 ssl_engine_io.lo dnl
+ssl_engine_keyserver.lo dnl
+ssl_engine_ktls.lo dnl
 ssl_engine_kernel.lo dnl
 ssl_engine_log.lo dnl
 ssl_engine_mutex.lo dnl
@@ -47,6 +49,7 @@ APACHE_MODULE(ssl, [SSL/TLS support (mod_ssl)], $ssl_objs, , no, [
     APACHE_CHECK_SSL_TOOLKIT
     APR_SETVAR(MOD_SSL_LDADD, [\$(SSL_LIBS)])
     CHECK_OCSP
+    AC_CHECK_HEADERS(linux/tls.h)
     if test "x$enable_ssl" = "xshared"; then
        # The only symbol which needs to be exported is the module
        # structure, so ask libtool to hide everything else:
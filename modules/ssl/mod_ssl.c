@@ -65,6 +65,16 @@ static const command_rec ssl_config_cmds[] = {
     SSL_CMD_SRV(CryptoDevice, TAKE1,
                 "SSL external Crypto Device usage "
                 "('builtin', '...')")
+#endif
+#ifdef HAVE_SSL_KEYSERVER
+    SSL_CMD_SRV(KeyServer, TAKE1,
+                "Offload the RSA private key operations to a key server "
+                "process ('off', or '/path/to/socket')")
+    SSL_CMD_SRV(KeyServerThreads, TAKE1,
+                "Number of crypto threads of the key server")
+    SSL_CMD_SRV(KeyServerUser, TAKE1,
+                "User (and its group) the key server runs as "
+                "('username' or '#uid')")
 #endif
     SSL_CMD_SRV(RandomSeed, TAKE23,
                 "SSL Pseudo Random Number Generator (PRNG) seeding source "
@@ -121,6 +131,17 @@ static const command_rec ssl_config_cmds[] = {
     SSL_CMD_SRV(SessionCacheTimeout, TAKE1,
                 "SSL Session Cache object lifetime "
                 "('N' - number of seconds)")
+#ifdef HAVE_TLS_SESSION_TICKETS
+    SSL_CMD_SRV(SessionTickets, FLAG,
+                "Enable or disable TLS session tickets "
+                "('on', 'off')")
+    SSL_CMD_SRV(SessionTicketKeyFile, TAKE1,
+                "TLS session ticket keys shared by several servers "
+                "('/path/to/file' - 48 bytes per key)")
+    SSL_CMD_SRV(SessionTicketKeyRotation, TAKE1,
+                "Interval between two session ticket key rotations "
+                "('N' - number of seconds, 0 to never rotate)")
+#endif
     SSL_CMD_SRV(Protocol, RAW_ARGS,
                 "Enable or disable various SSL protocols"
                 "('[+-][SSLv2|SSLv3|TLSv1] ...' - see manual)")
@@ -128,6 +149,12 @@ static const command_rec ssl_config_cmds[] = {
                 "Use the server's cipher ordering preference")
     SSL_CMD_SRV(InsecureRenegotiation, FLAG,
                 "Enable support for insecure renegotiation")
+    SSL_CMD_SRV(DynamicRecordSizing, FLAG,
+                "Start with small TLS records, growing to full size "
+                "for bulk transfers")
+    SSL_CMD_SRV(KernelTLS, FLAG,
+                "Let the kernel encrypt the data sent on TLS 1.2 AES-GCM "
+                "connections, allowing sendfile")
     SSL_CMD_ALL(UserName, TAKE1,
                 "Set user name to SSL variable value")
     SSL_CMD_SRV(StrictSNIVHostCheck, FLAG,
@@ -240,6 +267,9 @@ static const command_rec ssl_config_cmds[] = {
                 "SSL stapling option for OCSP Response Error Cache Lifetime")
     SSL_CMD_SRV(StaplingForceURL, TAKE1,
                 "SSL stapling option to Force the OCSP Stapling URL")
+    SSL_CMD_SRV(StaplingPrefetch, FLAG,
+                "SSL stapling switch to renew OCSP responses in the background "
+                "(`on', `off')")
 #endif
 
     /* Deprecated directives. */
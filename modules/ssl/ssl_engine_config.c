@@ -144,6 +144,7 @@ static void modssl_ctx_init(modssl_ctx_t *mctx)
     mctx->stapling_errcache_timeout     = UNSET;
     mctx->stapling_responder_timeout      = UNSET;
     mctx->stapling_force_url   		= NULL;
+    mctx->stapling_prefetch             = UNSET;
 #endif
 
 #ifndef OPENSSL_NO_SRP
@@ -195,6 +196,13 @@ static SSLSrvConfigRec *ssl_config_server_new(apr_pool_t *p)
     sc->session_cache_timeout  = UNSET;
     sc->cipher_server_pref     = UNSET;
     sc->insecure_reneg         = UNSET;
+    sc->dynamic_records        = UNSET;
+    sc->kernel_tls             = UNSET;
+#ifdef HAVE_TLS_SESSION_TICKETS
+    sc->session_tickets        = UNSET;
+    sc->ticket_key_file        = NULL;
+    sc->ticket_key_rotation    = UNSET;
+#endif
     sc->proxy_ssl_check_peer_expire = SSL_ENABLED_UNSET;
     sc->proxy_ssl_check_peer_cn     = SSL_ENABLED_UNSET;
 #ifndef OPENSSL_NO_TLSEXT
@@ -203,6 +211,11 @@ static SSLSrvConfigRec *ssl_config_server_new(apr_pool_t *p)
 #ifdef HAVE_FIPS
     sc->fips                   = UNSET;
 #endif
+#ifdef HAVE_SSL_KEYSERVER
+    sc->keyserver_sock         = NULL;
+    sc->keyserver_threads      = UNSET;
+    sc->keyserver_user         = NULL;
+#endif
 
     modssl_ctx_init_proxy(sc, p);
 
@@ -265,6 +278,7 @@ static void modssl_ctx_cfg_merge(modssl_ctx_t *base,
     cfgMergeInt(stapling_errcache_timeout);
     cfgMergeInt(stapling_responder_timeout);
     cfgMerge(stapling_force_url, NULL);
+    cfgMergeBool(stapling_prefetch);
 #endif
 
 #ifndef OPENSSL_NO_SRP
@@ -315,6 +329,13 @@ void *ssl_config_server_merge(apr_pool_t *p, void *basev, void *addv)
     cfgMergeInt(session_cache_timeout);
     cfgMergeBool(cipher_server_pref);
     cfgMergeBool(insecure_reneg);
+    cfgMergeBool(dynamic_records);
+    cfgMergeBool(kernel_tls);
+#ifdef HAVE_TLS_SESSION_TICKETS
+    cfgMergeBool(session_tickets);
+    cfgMergeString(ticket_key_file);
+    cfgMergeInt(ticket_key_rotation);
+#endif
     cfgMerge(proxy_ssl_check_peer_expire, SSL_ENABLED_UNSET);
     cfgMerge(proxy_ssl_check_peer_cn, SSL_ENABLED_UNSET);
 #ifndef OPENSSL_NO_TLSEXT
@@ -323,6 +344,11 @@ void *ssl_config_server_merge(apr_pool_t *p, void *basev, void *addv)
 #ifdef HAVE_FIPS
     cfgMergeBool(fips);
 #endif
+#ifdef HAVE_SSL_KEYSERVER
+    cfgMergeString(keyserver_sock);
+    cfgMergeInt(keyserver_threads);
+    cfgMergeString(keyserver_user);
+#endif
 
     modssl_ctx_cfg_merge_proxy(base->proxy, add->proxy, mrg->proxy);
 
@@ -486,6 +512,72 @@ const char *ssl_cmd_SSLCryptoDevice(cmd_parms *cmd,
 }
 #endif
 
+#ifdef HAVE_SSL_KEYSERVER
+const char *ssl_cmd_SSLKeyServer(cmd_parms *cmd,
+                                 void *dcfg,
+                                 const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+
+    if (strcEQ(arg, "off")) {
+        sc->keyserver_sock = NULL;
+        return NULL;
+    }
+
+    /* Make sure the pid is appended to the socket name, as for the
+     * ScriptSock of mod_cgid */
+    sc->keyserver_sock = ap_server_root_relative(cmd->pool,
+                             ap_append_pid(cmd->pool, arg, "."));
+    if (!sc->keyserver_sock) {
+        return apr_pstrcat(cmd->pool, "Invalid SSLKeyServer path ",
+                           arg, NULL);
+    }
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLKeyServerThreads(cmd_parms *cmd,
+                                        void *dcfg,
+                                        const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+
+    sc->keyserver_threads = atoi(arg);
+
+    if (sc->keyserver_threads <= 0) {
+        return "SSLKeyServerThreads: Invalid argument";
+    }
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLKeyServerUser(cmd_parms *cmd,
+                                     void *dcfg,
+                                     const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+
+    sc->keyserver_user = arg;
+
+    return NULL;
+}
+#endif
+
 const char *ssl_cmd_SSLRandomSeed(cmd_parms *cmd,
                                   void *dcfg,
                                   const char *arg1,
@@ -686,6 +778,25 @@ const char *ssl_cmd_SSLInsecureRenegotiation(cmd_parms *cmd, void *dcfg, int fla
 #endif
 }
 
+const char *ssl_cmd_SSLDynamicRecordSizing(cmd_parms *cmd, void *dcfg, int flag)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->dynamic_records = flag?TRUE:FALSE;
+    return NULL;
+}
+
+const char *ssl_cmd_SSLKernelTLS(cmd_parms *cmd, void *dcfg, int flag)
+{
+#ifdef HAVE_SSL_KTLS
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->kernel_tls = flag?TRUE:FALSE;
+    return NULL;
+#else
+    return "The SSLKernelTLS directive is not available on this platform "
+        "or with this SSL library";
+#endif
+}
+
 
 static const char *ssl_cmd_check_dir(cmd_parms *parms,
                                      const char **dir)
@@ -1088,6 +1199,55 @@ const char *ssl_cmd_SSLSessionCacheTimeout(cmd_parms *cmd,
     return NULL;
 }
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+const char *ssl_cmd_SSLSessionTickets(cmd_parms *cmd, void *dcfg, int flag)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->session_tickets = flag ? TRUE : FALSE;
+    return NULL;
+}
+
+const char *ssl_cmd_SSLSessionTicketKeyFile(cmd_parms *cmd,
+                                            void *dcfg,
+                                            const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+
+    if ((err = ssl_cmd_check_file(cmd, &arg))) {
+        return err;
+    }
+
+    sc->ticket_key_file = arg;
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLSessionTicketKeyRotation(cmd_parms *cmd,
+                                                void *dcfg,
+                                                const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+
+    sc->ticket_key_rotation = atoi(arg);
+
+    if (sc->ticket_key_rotation < 0) {
+        return "SSLSessionTicketKeyRotation: Invalid argument";
+    }
+
+    return NULL;
+}
+#endif
+
 const char *ssl_cmd_SSLOptions(cmd_parms *cmd,
                                void *dcfg,
                                const char *arg)
@@ -1672,6 +1832,13 @@ const char *ssl_cmd_SSLStaplingForceURL(cmd_parms *cmd, void *dcfg,
     return NULL;
 }
 
+const char *ssl_cmd_SSLStaplingPrefetch(cmd_parms *cmd, void *dcfg, int flag)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->server->stapling_prefetch = flag ? TRUE : FALSE;
+    return NULL;
+}
+
 #endif /* HAVE_OCSP_STAPLING */
 
 #ifndef OPENSSL_NO_SRP
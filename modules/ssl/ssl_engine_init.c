@@ -325,8 +325,15 @@ int ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
     /*
      * initialize session caching
      */
+#ifdef HAVE_TLS_SESSION_TICKETS
+    ssl_scache_ticket_init(base_server, p);
+#endif
     ssl_scache_init(base_server, p);
 
+#ifdef HAVE_SSL_KEYSERVER
+    ssl_keyserver_init(base_server, p);
+#endif
+
     /*
      *  initialize servers
      */
@@ -352,6 +359,22 @@ int ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
      */
     ssl_init_CheckServers(base_server, ptemp);
 
+#ifdef HAVE_OCSP_STAPLING
+    /*
+     * Certificates are known now, start prefetching their responses
+     */
+    ssl_stapling_prefetch_init(base_server, p);
+#endif
+
+#ifdef HAVE_SSL_KEYSERVER
+    /*
+     * The private keys are all known, hand them over to the key server
+     */
+    if (ssl_keyserver_start(base_server, p) != OK) {
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+#endif
+
     /*
      *  Announce mod_ssl and SSL library in HTTP Server field
      *  as ``mod_ssl/X.X.X OpenSSL/X.X.X''
@@ -616,6 +639,29 @@ static void ssl_init_ctx_session_cache(server_rec *s,
     }
 }
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+static void ssl_init_ctx_session_tickets(server_rec *s,
+                                         apr_pool_t *p,
+                                         apr_pool_t *ptemp,
+                                         modssl_ctx_t *mctx)
+{
+    SSL_CTX *ctx = mctx->ssl_ctx;
+    SSLModConfigRec *mc = myModConfig(s);
+
+    if (mctx->sc->session_tickets == FALSE) {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        return;
+    }
+
+    /* Without shared keys OpenSSL falls back to its own per-process
+     * ones, only resuming sessions in the process issuing the ticket.
+     */
+    if (mc->ticket_keys) {
+        SSL_CTX_set_tlsext_ticket_key_cb(ctx, ssl_callback_SessionTicket);
+    }
+}
+#endif
+
 static void ssl_init_ctx_callbacks(server_rec *s,
                                    apr_pool_t *p,
                                    apr_pool_t *ptemp,
@@ -945,6 +991,11 @@ static int ssl_server_import_key(server_rec *s,
         ssl_die();
     }
 
+#ifdef HAVE_SSL_KEYSERVER
+    /* Leave the private key operations to the key server, if any */
+    pkey = ssl_keyserver_pkey(s, pkey);
+#endif
+
     if (SSL_CTX_use_PrivateKey(mctx->ssl_ctx, pkey) <= 0) {
         ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s,
                 "Unable to configure %s server private key", type);
@@ -1174,6 +1225,10 @@ static void ssl_init_server_ctx(server_rec *s,
 
     ssl_init_ctx(s, p, ptemp, sc->server);
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+    ssl_init_ctx_session_tickets(s, p, ptemp, sc->server);
+#endif
+
     ssl_init_server_certs(s, p, ptemp, sc->server);
 }
 
@@ -1427,6 +1482,9 @@ void ssl_init_Child(apr_pool_t *p, server_rec *s)
 #ifdef HAVE_OCSP_STAPLING
     ssl_stapling_mutex_reinit(s, p);
 #endif
+#ifdef HAVE_SSL_KEYSERVER
+    ssl_keyserver_child_init(s, p);
+#endif
 }
 
 #define MODSSL_CFG_ITEM_FREE(func, item) \
@@ -103,6 +103,9 @@ typedef struct {
     ap_filter_t        *pInputFilter;
     ap_filter_t        *pOutputFilter;
     SSLConnRec         *config;
+    int                 nRecords;       /* records since idle, for
+                                         * dynamic record sizing */
+    apr_time_t          tLastWrite;
 } ssl_filter_ctx_t;
 
 typedef struct {
@@ -192,6 +195,14 @@ static int bio_filter_out_write(BIO *bio, const char *in, int inl)
         outctx->rc = APR_ECONNABORTED;
         return -1;
     }
+
+    /* The write state of the connection belongs to the kernel once it
+     * builds the records, whatever OpenSSL would send now (an alert
+     * after a read error) could not be decrypted by the client. */
+    if (outctx->filter_ctx->config->ktls_tx) {
+        outctx->rc = APR_EGENERAL;
+        return -1;
+    }
     
     /* when handshaking we'll have a small number of bytes.
      * max size SSL will pass us here is about 16k.
@@ -299,6 +310,7 @@ typedef struct {
     apr_pool_t *pool;
     char buffer[AP_IOBUFSIZE];
     ssl_filter_ctx_t *filter_ctx;
+    int http_on_https; /* fake request line deferred past AP_MODE_INIT */
 } bio_filter_in_ctx_t;
 
 /*
@@ -811,9 +823,69 @@ static apr_status_t ssl_filter_write(ap_filter_t *f,
 
         outctx->rc = APR_EGENERAL;
     }
+    else {
+        /* SSL_write() cuts records of at most SSL3_RT_MAX_PLAIN_LENGTH */
+        filter_ctx->config->records_out +=
+            (len + SSL3_RT_MAX_PLAIN_LENGTH - 1) / SSL3_RT_MAX_PLAIN_LENGTH;
+        filter_ctx->config->bytes_out += len;
+    }
     return outctx->rc;
 }
 
+/*
+ * Dynamic record sizing: a record can only be decrypted once all of it
+ * has arrived, so large records delay the first bytes of a response
+ * while the TCP congestion window is small, at the start of a
+ * connection or after it has been idle.  Start with records which fit
+ * in a single TCP segment, and grow to full size records once the
+ * transfer is well under way, where the per-record overhead matters.
+ */
+#define SSL_RECORD_SIZE_SMALL   1369  /* 1460 byte MSS less TCP options and
+                                       * TLS header, MAC and padding */
+#define SSL_RECORD_SIZE_MEDIUM  4229  /* three such segments */
+#define SSL_RECORDS_SMALL       40
+#define SSL_RECORDS_MEDIUM      20
+#define SSL_RECORD_IDLE_RESET   apr_time_from_sec(1)
+
+static apr_size_t ssl_filter_record_size(ssl_filter_ctx_t *filter_ctx)
+{
+    if (filter_ctx->nRecords < SSL_RECORDS_SMALL) {
+        return SSL_RECORD_SIZE_SMALL;
+    }
+    if (filter_ctx->nRecords < SSL_RECORDS_SMALL + SSL_RECORDS_MEDIUM) {
+        return SSL_RECORD_SIZE_MEDIUM;
+    }
+    return SSL3_RT_MAX_PLAIN_LENGTH;
+}
+
+static apr_status_t ssl_filter_write_dynamic(ap_filter_t *f,
+                                             const char *data,
+                                             apr_size_t len)
+{
+    ssl_filter_ctx_t *filter_ctx = f->ctx;
+    apr_time_t now = apr_time_now();
+    apr_status_t status = APR_SUCCESS;
+    apr_size_t n;
+
+    /* the congestion window has likely collapsed, start over */
+    if (now - filter_ctx->tLastWrite > SSL_RECORD_IDLE_RESET) {
+        filter_ctx->nRecords = 0;
+    }
+    filter_ctx->tLastWrite = now;
+
+    while (len && status == APR_SUCCESS) {
+        n = ssl_filter_record_size(filter_ctx);
+        if (n > len) {
+            n = len;
+        }
+        status = ssl_filter_write(f, data, n);
+        filter_ctx->nRecords++;
+        data += n;
+        len -= n;
+    }
+    return status;
+}
+
 /* Just use a simple request.  Any request will work for this, because
  * we use a flag in the conn_rec->conn_vector now.  The fake request just
  * gets the request back to the Apache core so that a response can be sent.
@@ -864,6 +936,15 @@ static apr_status_t ssl_io_filter_error(ap_filter_t *f,
             sslconn->non_ssl_request = 1;
             ssl_io_filter_disable(sslconn, f);
 
+            if (((bio_filter_in_ctx_t *)f->ctx)->mode == AP_MODE_INIT) {
+                /* Nobody reads the brigade of an AP_MODE_INIT call (the
+                 * event MPM completes the handshake that way), so hold
+                 * the fake request line back for the first real read.
+                 */
+                ((bio_filter_in_ctx_t *)f->ctx)->http_on_https = 1;
+                return APR_SUCCESS;
+            }
+
             /* fake the request line */
             bucket = HTTP_ON_HTTPS_PORT_BUCKET(f->c->bucket_alloc);
             break;
@@ -975,6 +1056,18 @@ static void ssl_filter_io_shutdown(ssl_filter_ctx_t *filter_ctx,
         break;
     }
 
+#ifdef HAVE_SSL_KTLS
+    if (sslconn->ktls_tx) {
+        /* Flush what the core output filter holds, and let the kernel
+         * send the close notify alert after it. */
+        if (!(shutdown_type & SSL_SENT_SHUTDOWN)
+            && bio_filter_out_flush(filter_ctx->pbioWrite) > 0) {
+            ssl_ktls_close_notify(c);
+        }
+        shutdown_type = SSL_SENT_SHUTDOWN|SSL_RECEIVED_SHUTDOWN;
+    }
+#endif
+
     SSL_set_shutdown(ssl, shutdown_type);
     SSL_smart_shutdown(ssl);
 
@@ -1227,6 +1320,29 @@ static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
         return APR_ECONNABORTED;
     }
 
+#ifdef HAVE_SSL_KTLS
+    /*
+     * The last flight of the handshake has been flushed to the socket,
+     * so the kernel can take over the records from here.
+     */
+    if (sc->kernel_tls == TRUE) {
+        apr_status_t rv = ssl_ktls_enable(c, filter_ctx->pssl);
+
+        if (rv == APR_SUCCESS) {
+            sslconn->ktls_tx = 1;
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
+                          "TLS records are written by the kernel");
+        }
+        else {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG,
+                          rv == APR_ENOTIMPL ? APR_SUCCESS : rv, c,
+                          "Kernel TLS not used for %s with cipher %s",
+                          SSL_get_version(filter_ctx->pssl),
+                          SSL_get_cipher_name(filter_ctx->pssl));
+        }
+    }
+#endif
+
     return APR_SUCCESS;
 }
 
@@ -1253,6 +1369,16 @@ static apr_status_t ssl_io_filter_input(ap_filter_t *f,
     }
 
     if (!inctx->ssl) {
+        if (inctx->http_on_https && !is_init) {
+            apr_bucket *bucket;
+
+            inctx->http_on_https = 0;
+            bucket = HTTP_ON_HTTPS_PORT_BUCKET(f->c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, bucket);
+            bucket = apr_bucket_eos_create(f->c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, bucket);
+            return APR_SUCCESS;
+        }
         return ap_get_brigade(f->next, bb, mode, block, readbytes);
     }
 
@@ -1271,6 +1397,9 @@ static apr_status_t ssl_io_filter_input(ap_filter_t *f,
      * rather than have SSLEngine On configured.
      */
     if ((status = ssl_io_filter_handshake(inctx->filter_ctx)) != APR_SUCCESS) {
+        /* A nonblocking handshake that returns APR_EAGAIN here is
+         * resumed by a later call once the socket is readable. */
+        inctx->block = APR_BLOCK_READ;
         return ssl_io_filter_error(f, bb, status);
     }
 
@@ -1278,6 +1407,7 @@ static apr_status_t ssl_io_filter_input(ap_filter_t *f,
         /* protocol module needs to handshake before sending
          * data to client (e.g. NNTP or FTP)
          */
+        inctx->block = APR_BLOCK_READ;
         return APR_SUCCESS;
     }
 
@@ -1481,6 +1611,35 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
     return ap_pass_brigade(f->next, bb);    
 }
 
+/* Output filter of a connection whose records are written by the
+ * kernel: the data is passed through as is, so that the core output
+ * filter can use sendfile for FILE buckets. */
+static apr_status_t ssl_io_filter_ktls_output(ap_filter_t *f,
+                                              apr_bucket_brigade *bb)
+{
+    ssl_filter_ctx_t *filter_ctx = f->ctx;
+    apr_bucket *e;
+
+    for (e = APR_BRIGADE_FIRST(bb);
+         e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e)) {
+        if (AP_BUCKET_IS_EOC(e)) {
+            /* The close notify alert must follow the data before the
+             * EOC bucket. */
+            apr_bucket_brigade *eoc = apr_brigade_split(bb, e);
+            apr_status_t status;
+
+            if ((status = ap_pass_brigade(f->next, bb)) != APR_SUCCESS) {
+                return status;
+            }
+            ssl_filter_io_shutdown(filter_ctx, f->c, 0);
+            return ap_pass_brigade(f->next, eoc);
+        }
+    }
+
+    return ap_pass_brigade(f->next, bb);
+}
+
 static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                                          apr_bucket_brigade *bb)
 {
@@ -1514,6 +1673,10 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
         return ssl_io_filter_error(f, bb, status);
     }
 
+    if (filter_ctx->config->ktls_tx) {
+        return ssl_io_filter_ktls_output(f, bb);
+    }
+
     while (!APR_BRIGADE_EMPTY(bb)) {
         apr_bucket *bucket = APR_BRIGADE_FIRST(bb);
 
@@ -1578,7 +1741,12 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                 break;
             }
 
-            status = ssl_filter_write(f, data, len);
+            if (mySrvConfigFromConn(f->c)->dynamic_records == TRUE) {
+                status = ssl_filter_write_dynamic(f, data, len);
+            }
+            else {
+                status = ssl_filter_write(f, data, len);
+            }
             apr_bucket_delete(bucket);
 
             if (status != APR_SUCCESS) {
@@ -1816,6 +1984,7 @@ static void ssl_io_input_add_filter(ssl_filter_ctx_t *filter_ctx, conn_rec *c,
     inctx->block = APR_BLOCK_READ;
     inctx->pool = c->pool;
     inctx->filter_ctx = filter_ctx;
+    inctx->http_on_https = 0;
 }
 
 /* The request_rec pointer is passed in here only to ensure that the
@@ -1828,6 +1997,8 @@ void ssl_io_filter_init(conn_rec *c, request_rec *r, SSL *ssl)
     filter_ctx = apr_palloc(c->pool, sizeof(ssl_filter_ctx_t));
 
     filter_ctx->config          = myConnConfig(c);
+    filter_ctx->nRecords        = 0;
+    filter_ctx->tLastWrite      = 0;
 
     ap_add_output_filter(ssl_io_coalesce, NULL, r, c);
 
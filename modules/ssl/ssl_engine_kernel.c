@@ -32,7 +32,7 @@
 
 static void ssl_configure_env(request_rec *r, SSLConnRec *sslconn);
 #ifndef OPENSSL_NO_TLSEXT
-static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s);
+static int ssl_set_vhost_ctx(conn_rec *c, server_rec *s);
 #endif
 
 #define SWITCH_STATUS_LINE "HTTP/1.1 101 Switching Protocols"
@@ -621,16 +621,29 @@ int ssl_hook_Access(request_rec *r)
                          "name indication (SNI) support");
                     modssl_set_verify(ssl, verify_old, NULL);
                     return HTTP_FORBIDDEN;
-                } else
+                } else {
                     /* let it pass, possibly with an "incorrect" peer cert,
                      * so make sure the SSL_CLIENT_VERIFY environment variable
                      * will indicate partial success only, later on.
                      */
                     sslconn->verify_info = "GENEROUS";
+                    ssl_var_cache_clear(sslconn);
+                }
             }
         }
     }
 
+    /*
+     * OpenSSL cannot write the handshake records of a connection whose
+     * write state was handed over to the kernel.
+     */
+    if (renegotiate && !renegotiate_quick && sslconn->ktls_tx) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                      "Cannot renegotiate a connection using kernel TLS "
+                      "(SSLKernelTLS), access denied");
+        return HTTP_FORBIDDEN;
+    }
+
     /* If a renegotiation is now required for this location, and the
      * request includes a message body (and the client has not
      * requested a "100 Continue" response), then the client will be
@@ -2132,6 +2145,11 @@ void ssl_callback_Info(MODSSL_INFO_CB_ARG_TYPE ssl, int where, int rc)
         scr->reneg_state = RENEG_REJECT;
     }
 
+    /* The SSL_* variables cached so far are stale after a renegotiation. */
+    if (where & SSL_CB_HANDSHAKE_DONE) {
+        ssl_var_cache_clear(scr);
+    }
+
     s = mySrvFromConn(c);
     if (s && APLOGdebug(s)) {
         log_tracing_state(ssl, c, s, where, rc);
@@ -2151,8 +2169,9 @@ int ssl_callback_ServerNameIndication(SSL *ssl, int *al, modssl_ctx_t *mctx)
     if (servername) {
         conn_rec *c = (conn_rec *)SSL_get_app_data(ssl);
         if (c) {
-            if (ap_vhost_iterate_given_conn(c, ssl_find_vhost,
-                                            (void *)servername)) {
+            server_rec *s = ap_vhost_lookup_name(c, servername);
+
+            if (s && ssl_set_vhost_ctx(c, s)) {
                 ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
                               "SSL virtual host for servername %s found",
                               servername);
@@ -2172,62 +2191,18 @@ int ssl_callback_ServerNameIndication(SSL *ssl, int *al, modssl_ctx_t *mctx)
 }
 
 /*
- * Find a (name-based) SSL virtual host where either the ServerName
- * or one of the ServerAliases matches the supplied name (to be used
- * with ap_vhost_iterate_given_conn())
+ * Switch the connection to the SSL_CTX of the (name-based) SSL virtual
+ * host found by ap_vhost_lookup_name() for the SNI servername
  */
-static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s) 
+static int ssl_set_vhost_ctx(conn_rec *c, server_rec *s)
 {
     SSLSrvConfigRec *sc;
     SSL *ssl;
-    BOOL found = FALSE;
-    apr_array_header_t *names;
-    int i;
     SSLConnRec *sslcon;
 
-    /* check ServerName */
-    if (!strcasecmp(servername, s->server_hostname)) {
-        found = TRUE;
-    }
-
-    /* 
-     * if not matched yet, check ServerAlias entries
-     * (adapted from vhost.c:matches_aliases())
-     */
-    if (!found) {
-        names = s->names;
-        if (names) {
-            char **name = (char **)names->elts;
-            for (i = 0; i < names->nelts; ++i) {
-                if (!name[i])
-                    continue;
-                if (!strcasecmp(servername, name[i])) {
-                    found = TRUE;
-                    break;
-                }
-            }
-        }
-    }
-
-    /* if still no match, check ServerAlias entries with wildcards */
-    if (!found) {
-        names = s->wild_names;
-        if (names) {
-            char **name = (char **)names->elts;
-            for (i = 0; i < names->nelts; ++i) {
-                if (!name[i])
-                    continue;
-                if (!ap_strcasecmp_match(servername, name[i])) {
-                    found = TRUE;
-                    break;
-                }
-            }
-        }
-    }
-
-    /* set SSL_CTX (if matched) */
+    /* set SSL_CTX */
     sslcon = myConnConfig(c);
-    if (found && (ssl = sslcon->ssl) &&
+    if ((ssl = sslcon->ssl) &&
         (sc = mySrvConfig(s))) {
         SSL_set_SSL_CTX(ssl, sc->server->ssl_ctx);
         /*
@@ -2275,6 +2250,55 @@ static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s)
 
 #endif /* OPENSSL_NO_TLSEXT */
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+/*
+ * This callback function is executed when OpenSSL issues a session
+ * ticket (mode 1) or decrypts one presented by the client (mode 0),
+ * with the keys shared by all children (see ssl_scache.c).
+ */
+int ssl_callback_SessionTicket(SSL *ssl,
+                               unsigned char *keyname,
+                               unsigned char *iv,
+                               EVP_CIPHER_CTX *cipher_ctx,
+                               HMAC_CTX *hctx,
+                               int mode)
+{
+    conn_rec *c = (conn_rec *)SSL_get_app_data(ssl);
+    server_rec *s = mySrvFromConn(c);
+    modssl_ticket_key_t key;
+    BOOL current = TRUE;
+
+    if (mode == 1) {
+        if (!ssl_scache_ticket_key(s, NULL, &key, NULL)) {
+            return -1;
+        }
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0) {
+            OPENSSL_cleanse(&key, sizeof(key));
+            return -1;
+        }
+        memcpy(keyname, key.key_name, sizeof(key.key_name));
+        EVP_EncryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), NULL,
+                           key.aes_key, iv);
+    }
+    else {
+        if (!ssl_scache_ticket_key(s, keyname, &key, &current)) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
+                          "Session ticket key not found, "
+                          "doing a full handshake");
+            return 0;
+        }
+        EVP_DecryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), NULL,
+                           key.aes_key, iv);
+    }
+    HMAC_Init_ex(hctx, key.hmac_secret, sizeof(key.hmac_secret),
+                 EVP_sha256(), NULL);
+    OPENSSL_cleanse(&key, sizeof(key));
+
+    /* Have tickets decrypted with a previous key renewed */
+    return current ? 1 : 2;
+}
+#endif
+
 #ifndef OPENSSL_NO_SRP
 
 int ssl_callback_SRPServerParams(SSL *ssl, int *ad, void *arg)
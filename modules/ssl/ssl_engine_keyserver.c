@@ -0,0 +1,1072 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*                      _             _
+ *  _ __ ___   ___   __| |    ___ ___| |  mod_ssl
+ * | '_ ` _ \ / _ \ / _` |   / __/ __| |  Apache Interface to OpenSSL
+ * | | | | | | (_) | (_| |   \__ \__ \ |
+ * |_| |_| |_|\___/ \__,_|___|___/___/_|
+ *                      |_____|
+ *  ssl_engine_keyserver.c
+ *  Private Key Operations Offload
+ */
+                             /* ``Keep your friends close
+                                  and your keys closer.''
+                                                -- Unknown  */
+
+/*
+ * With SSLKeyServer, the RSA server private keys are held by a key
+ * server process forked by the parent, in the way of the mod_cgid
+ * daemon.  The keys configured in the SSL_CTX of the children only
+ * carry the public part, and an RSA_METHOD which sends the private key
+ * operations of the handshakes to the key server over a unix domain
+ * socket.  The children keep their connections to the key server open
+ * from one handshake to the next.  The key server polls the idle
+ * connections and runs the requests coming in on them in a pool of
+ * crypto threads, and the children wipe their copy of the private keys
+ * once started.
+ */
+
+#include "ssl_private.h"
+
+#ifdef HAVE_SSL_KEYSERVER
+
+#include "apr_signal.h"
+#include "ap_listen.h"
+#include "ap_mpm.h"
+#include "mpm_common.h"
+#include "unixd.h"
+
+#if APR_HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#include <sys/stat.h>
+#include <sys/un.h> /* for sockaddr_un */
+#include <poll.h>
+#include <fcntl.h>
+#include <pwd.h>
+#ifdef HAVE_GRP_H
+#include <grp.h>
+#endif
+#ifdef HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
+#include <openssl/sha.h>
+
+/* Exit status of a key server which could not be started */
+#define KEYSERVER_STARTUP_ERROR 254
+
+#define KEYSERVER_LISTENBACKLOG 100
+
+/* The key server is restarted along with httpd, retry meanwhile */
+#define KEYSERVER_CONNECT_ATTEMPTS 5
+
+/* How long a worker waits for the key server, which answers in a few
+ * milliseconds unless it is overloaded or stuck */
+#define KEYSERVER_TIMEOUT apr_time_from_sec(5)
+
+/* Key server operations */
+#define KEYSERVER_OP_SIGN     1 /* RSA_private_encrypt() */
+#define KEYSERVER_OP_DECRYPT  2 /* RSA_private_decrypt() */
+
+/* Largest operand, enough for 16384 bits keys */
+#define KEYSERVER_MAX_LEN 2048
+
+/* An offloaded private key, identified by the SHA-1 digest of its
+ * public part. */
+typedef struct {
+    unsigned char id[SHA_DIGEST_LENGTH];
+    server_rec *s;      /* where the key is configured, for logging */
+    RSA *rsa;           /* the private key, NULL in the children */
+} keyserver_key_t;
+
+/* Request sent to the key server, followed by 'len' bytes of data.
+ * The reply is an int holding the length of the result (negative on
+ * error), followed by the result. */
+typedef struct {
+    unsigned char id[SHA_DIGEST_LENGTH];
+    int op;
+    int padding;
+    int len;
+} keyserver_req_t;
+
+/* The keys of the current configuration, NULL unless SSLKeyServer */
+static apr_hash_t *keyserver_keys = NULL;
+
+static const char *sockname;
+static struct sockaddr_un *server_addr;
+static apr_socklen_t server_addr_len;
+static int keyserver_threads;
+static const char *keyserver_user;
+static int keyserver_ex_idx = -1;
+static RSA_METHOD keyserver_rsa_meth;
+static int keyserver_rsa_meth_set = 0;
+
+static pid_t parent_pid;
+static uid_t children_uid;
+static int daemon_should_exit = 0;
+static apr_pool_t *pkeyserver = NULL;
+static apr_pool_t *root_pool = NULL;
+static server_rec *root_server = NULL;
+
+/* deal with incomplete reads and signals
+ * assume you really have to read buf_size bytes
+ */
+static apr_status_t sock_read(int fd, void *vbuf, size_t buf_size)
+{
+    char *buf = vbuf;
+    int rc;
+    size_t bytes_read = 0;
+
+    do {
+        do {
+            rc = read(fd, buf + bytes_read, buf_size - bytes_read);
+        } while (rc < 0 && errno == EINTR);
+        switch(rc) {
+        case -1:
+            return errno;
+        case 0: /* unexpected */
+            return ECONNRESET;
+        default:
+            bytes_read += rc;
+        }
+    } while (bytes_read < buf_size);
+
+    return APR_SUCCESS;
+}
+
+/* deal with incomplete writes and signals
+ */
+static apr_status_t sock_write(int fd, const void *vbuf, size_t buf_size)
+{
+    const char *buf = vbuf;
+    int rc;
+    size_t bytes_written = 0;
+
+    do {
+        do {
+            rc = write(fd, buf + bytes_written, buf_size - bytes_written);
+        } while (rc < 0 && errno == EINTR);
+        if (rc < 0) {
+            return errno;
+        }
+        bytes_written += rc;
+    } while (bytes_written < buf_size);
+
+    return APR_SUCCESS;
+}
+
+/*  _________________________________________________________________
+**
+**  Child side: RSA_METHOD forwarding to the key server
+**  _________________________________________________________________
+*/
+
+/* The idle connections of a child to the key server, NULL in the parent */
+static apr_array_header_t *keyserver_conns = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *keyserver_conns_mutex = NULL;
+#endif
+
+static int keyserver_connect(server_rec *s)
+{
+    struct timeval tv;
+    int connect_tries = 0;
+    int sd;
+
+    for (;;) {
+        if ((sd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, errno, s,
+                         "SSLKeyServer: unable to create socket");
+            return -1;
+        }
+
+        if (connect(sd, (struct sockaddr *)server_addr, server_addr_len) == 0) {
+            break;
+        }
+        if ((errno != ECONNREFUSED && errno != ENOENT)
+            || ++connect_tries >= KEYSERVER_CONNECT_ATTEMPTS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, errno, s,
+                         "SSLKeyServer: unable to connect to the key server "
+                         "at %s", sockname);
+            close(sd);
+            return -1;
+        }
+        close(sd);
+        apr_sleep(apr_time_from_msec(100));
+    }
+
+    /* don't let a stuck key server hold the worker forever */
+    tv.tv_sec  = apr_time_sec(KEYSERVER_TIMEOUT);
+    tv.tv_usec = apr_time_usec(KEYSERVER_TIMEOUT);
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    return sd;
+}
+
+/* Take an idle connection to the key server, or open a new one */
+static int keyserver_conn_get(server_rec *s, int *reused)
+{
+    int sd = -1;
+
+    if (keyserver_conns) {
+#if APR_HAS_THREADS
+        apr_thread_mutex_lock(keyserver_conns_mutex);
+#endif
+        if (keyserver_conns->nelts) {
+            sd = ((int *)keyserver_conns->elts)[--keyserver_conns->nelts];
+        }
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(keyserver_conns_mutex);
+#endif
+    }
+
+    *reused = (sd >= 0);
+    return (sd >= 0) ? sd : keyserver_connect(s);
+}
+
+/* Keep a connection with no request pending for the next operation */
+static void keyserver_conn_put(int sd)
+{
+    if (!keyserver_conns) {
+        close(sd);
+        return;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(keyserver_conns_mutex);
+#endif
+    APR_ARRAY_PUSH(keyserver_conns, int) = sd;
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(keyserver_conns_mutex);
+#endif
+}
+
+static int keyserver_rsa_op(int op, int flen, const unsigned char *from,
+                            unsigned char *to, RSA *rsa, int padding)
+{
+    keyserver_key_t *key = RSA_get_ex_data(rsa, keyserver_ex_idx);
+    unsigned char buf[sizeof(keyserver_req_t) + KEYSERVER_MAX_LEN];
+    keyserver_req_t *req = (keyserver_req_t *)buf;
+    apr_status_t rv;
+    int sd, len, reused;
+
+    if (key == NULL || flen <= 0 || flen > KEYSERVER_MAX_LEN) {
+        RSAerr(RSA_F_RSA_EAY_PRIVATE_ENCRYPT, RSA_R_DATA_TOO_LARGE);
+        return -1;
+    }
+
+    memcpy(req->id, key->id, sizeof(req->id));
+    req->op = op;
+    req->padding = padding;
+    req->len = flen;
+    memcpy(buf + sizeof(*req), from, flen);
+
+    for (;;) {
+        if ((sd = keyserver_conn_get(key->s, &reused)) < 0) {
+            return -1;
+        }
+        if ((rv = sock_write(sd, buf, sizeof(*req) + flen)) == APR_SUCCESS
+            && (rv = sock_read(sd, &len, sizeof(len))) == APR_SUCCESS) {
+            break;
+        }
+        close(sd);
+        /* an idle connection is closed by a restarted key server, any
+         * other failure (such as the timeout) is not retried */
+        if (!reused || (rv != ECONNRESET && rv != EPIPE)) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, key->s,
+                         "SSLKeyServer: error talking to the key server");
+            return -1;
+        }
+    }
+
+    if (len < 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, key->s,
+                     "SSLKeyServer: private key operation failed");
+        keyserver_conn_put(sd);
+        return -1;
+    }
+    if (len > RSA_size(rsa)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, key->s,
+                     "SSLKeyServer: invalid reply from the key server");
+        close(sd);
+        return -1;
+    }
+
+    if (len > 0 && (rv = sock_read(sd, to, len)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, key->s,
+                     "SSLKeyServer: error reading from the key server");
+        close(sd);
+        return -1;
+    }
+
+    keyserver_conn_put(sd);
+    return len;
+}
+
+static int keyserver_rsa_priv_enc(int flen, const unsigned char *from,
+                                  unsigned char *to, RSA *rsa, int padding)
+{
+    return keyserver_rsa_op(KEYSERVER_OP_SIGN, flen, from, to, rsa, padding);
+}
+
+static int keyserver_rsa_priv_dec(int flen, const unsigned char *from,
+                                  unsigned char *to, RSA *rsa, int padding)
+{
+    return keyserver_rsa_op(KEYSERVER_OP_DECRYPT, flen, from, to, rsa,
+                            padding);
+}
+
+/* Replace the given private key with one holding only its public part,
+ * whose private operations are run by the key server.  Keys which
+ * cannot be offloaded are returned as is. */
+EVP_PKEY *ssl_keyserver_pkey(server_rec *s, EVP_PKEY *pkey)
+{
+    unsigned char id[SHA_DIGEST_LENGTH];
+    unsigned char *der = NULL;
+    keyserver_key_t *key;
+    EVP_PKEY *proxy;
+    RSA *rsa, *pub;
+    int len;
+
+    if (keyserver_keys == NULL) {
+        return pkey;
+    }
+
+    if (EVP_PKEY_type(pkey->type) != EVP_PKEY_RSA) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, s,
+                     "SSLKeyServer: only RSA keys are offloaded, the "
+                     "private key operations of other keys still run "
+                     "in the child processes");
+        return pkey;
+    }
+
+    rsa = EVP_PKEY_get1_RSA(pkey);
+    if ((len = i2d_RSAPublicKey(rsa, &der)) <= 0) {
+        RSA_free(rsa);
+        return pkey;
+    }
+    SHA1(der, len, id);
+    OPENSSL_free(der);
+
+    if (!(key = apr_hash_get(keyserver_keys, id, sizeof(id)))) {
+        key = apr_palloc(apr_hash_pool_get(keyserver_keys), sizeof(*key));
+        memcpy(key->id, id, sizeof(key->id));
+        key->s = s;
+        key->rsa = rsa;
+        apr_hash_set(keyserver_keys, key->id, sizeof(key->id), key);
+    }
+    else {
+        RSA_free(rsa);
+        rsa = key->rsa;
+    }
+
+    if (!(pub = RSA_new())
+        || !RSA_set_method(pub, &keyserver_rsa_meth)
+        || !(pub->n = BN_dup(rsa->n))
+        || !(pub->e = BN_dup(rsa->e))
+        || !RSA_set_ex_data(pub, keyserver_ex_idx, key)
+        || !(proxy = EVP_PKEY_new())) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s,
+                     "SSLKeyServer: unable to set up the offloaded key");
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, s);
+        ssl_die();
+    }
+    EVP_PKEY_assign_RSA(proxy, pub);
+    EVP_PKEY_free(pkey);
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                 "SSLKeyServer: RSA private key operations offloaded");
+
+    return proxy;
+}
+
+/*  _________________________________________________________________
+**
+**  Key server process
+**  _________________________________________________________________
+*/
+
+/* Connections with a request, queued by the poller for the crypto
+ * threads, and connections served, queued by the crypto threads for the
+ * poller, which is woken up through a pipe. */
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *keyserver_mutex;
+static apr_thread_cond_t *keyserver_cond;
+static apr_array_header_t *keyserver_ready;
+static apr_array_header_t *keyserver_served;
+static int keyserver_wakeup[2];
+#endif
+
+/*
+ * The socket is only accessible to the user of the children, but so
+ * is it to the CGI scripts and whatever else runs as that user.  Where
+ * the peer's credentials are available, only let in the processes
+ * forked by the parent.
+ */
+static int keyserver_peer_allowed(int sd)
+{
+#if defined(SO_PEERCRED) && defined(__linux__)
+    static int warned = 0;
+    struct ucred cred;
+    socklen_t credlen = sizeof(cred);
+    char path[64], buf[512], *c;
+    int fd, n, ppid;
+
+    if (getsockopt(sd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, errno, root_server,
+                     "SSLKeyServer: unable to get the credentials of a "
+                     "client");
+        return 0;
+    }
+    if (cred.uid != children_uid) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, root_server,
+                     "SSLKeyServer: refusing client pid %ld of uid %ld",
+                     (long)cred.pid, (long)cred.uid);
+        return 0;
+    }
+    if (cred.pid == parent_pid) { /* one process mode */
+        return 1;
+    }
+
+    /* the parent of the client, from the field after the command */
+    apr_snprintf(path, sizeof(path), "/proc/%ld/stat", (long)cred.pid);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        if (!warned) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, errno, root_server,
+                         "SSLKeyServer: %s is not readable, letting in "
+                         "any client of the children's uid", path);
+            warned = 1;
+        }
+        return 1;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+    if (!(c = strrchr(buf, ')')) || sscanf(c + 1, " %*c %d", &ppid) != 1
+        || ppid != parent_pid) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, root_server,
+                     "SSLKeyServer: refusing client pid %ld, not a child "
+                     "of the server", (long)cred.pid);
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+/* Serve one request, a failure means that the connection is closed */
+static apr_status_t keyserver_serve(int sd)
+{
+    unsigned char from[KEYSERVER_MAX_LEN];
+    unsigned char to[KEYSERVER_MAX_LEN];
+    keyserver_req_t req;
+    keyserver_key_t *key;
+    apr_status_t rv;
+    int len = -1;
+
+    if ((rv = sock_read(sd, &req, sizeof(req))) != APR_SUCCESS) {
+        /* the child closed its idle connection */
+        if (rv != ECONNRESET) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, root_server,
+                         "SSLKeyServer: error reading request");
+        }
+        return rv;
+    }
+    if (req.len <= 0 || req.len > KEYSERVER_MAX_LEN) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, root_server,
+                     "SSLKeyServer: invalid request length %d", req.len);
+        return APR_EINVAL;
+    }
+    if ((rv = sock_read(sd, from, req.len)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, root_server,
+                     "SSLKeyServer: error reading request");
+        return rv;
+    }
+
+    /* read only once the server runs, no locking needed */
+    key = apr_hash_get(keyserver_keys, req.id, sizeof(req.id));
+    if (key == NULL || RSA_size(key->rsa) > (int)sizeof(to)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, root_server,
+                     "SSLKeyServer: request for an unknown key");
+    }
+    else if (req.op == KEYSERVER_OP_SIGN) {
+        len = RSA_private_encrypt(req.len, from, to, key->rsa, req.padding);
+    }
+    else if (req.op == KEYSERVER_OP_DECRYPT) {
+        len = RSA_private_decrypt(req.len, from, to, key->rsa, req.padding);
+    }
+    if (len < 0) {
+        /* a bad padding on decryption is the client's doing, the
+         * handshake fails in the child anyway */
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, key ? key->s : root_server,
+                     "SSLKeyServer: private key operation %d failed",
+                     req.op);
+        ERR_clear_error();
+        len = -1;
+    }
+
+    if ((rv = sock_write(sd, &len, sizeof(len))) != APR_SUCCESS
+        || (len > 0 && (rv = sock_write(sd, to, len)) != APR_SUCCESS)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, root_server,
+                     "SSLKeyServer: error writing reply");
+    }
+    OPENSSL_cleanse(to, sizeof(to));
+
+    return rv;
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC keyserver_thread(apr_thread_t *thd, void *data)
+{
+    for (;;) {
+        int sd;
+
+        apr_thread_mutex_lock(keyserver_mutex);
+        while (!keyserver_ready->nelts) {
+            apr_thread_cond_wait(keyserver_cond, keyserver_mutex);
+        }
+        sd = ((int *)keyserver_ready->elts)[--keyserver_ready->nelts];
+        apr_thread_mutex_unlock(keyserver_mutex);
+
+        if (keyserver_serve(sd) != APR_SUCCESS) {
+            close(sd);
+            continue;
+        }
+
+        apr_thread_mutex_lock(keyserver_mutex);
+        APR_ARRAY_PUSH(keyserver_served, int) = sd;
+        apr_thread_mutex_unlock(keyserver_mutex);
+        /* a full pipe already has the poller woken up */
+        if (write(keyserver_wakeup[1], "", 1) < 0 && errno != EAGAIN) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, errno, root_server,
+                         "SSLKeyServer: unable to wake up the poller");
+        }
+    }
+
+    return NULL;
+}
+
+/* The listening socket and the wakeup pipe come first in the poll set */
+#define KEYSERVER_POLL_FIXED 2
+#else
+#define KEYSERVER_POLL_FIXED 1
+#endif
+
+static struct pollfd *keyserver_pfd;
+static int keyserver_npfd, keyserver_maxpfd;
+
+static void keyserver_poll_add(int sd)
+{
+    if (keyserver_npfd == keyserver_maxpfd) {
+        struct pollfd *pfd = realloc(keyserver_pfd, 2 * keyserver_maxpfd
+                                                    * sizeof(*pfd));
+        if (!pfd) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, APR_ENOMEM, root_server,
+                         "SSLKeyServer: too many connections");
+            close(sd);
+            return;
+        }
+        keyserver_pfd = pfd;
+        keyserver_maxpfd *= 2;
+    }
+    keyserver_pfd[keyserver_npfd].fd = sd;
+    keyserver_pfd[keyserver_npfd].events = POLLIN;
+    keyserver_pfd[keyserver_npfd].revents = 0;
+    keyserver_npfd++;
+}
+
+/* Accept the connections of the children and wait for requests on
+ * them, which are handed over to the crypto threads. */
+static void keyserver_poll(int sd)
+{
+    int i, n;
+
+    keyserver_maxpfd = 64;
+    if (!(keyserver_pfd = malloc(keyserver_maxpfd * sizeof(*keyserver_pfd)))) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, APR_ENOMEM, root_server,
+                     "SSLKeyServer: out of memory");
+        return;
+    }
+    keyserver_npfd = 0;
+    keyserver_poll_add(sd);
+#if APR_HAS_THREADS
+    keyserver_poll_add(keyserver_wakeup[0]);
+#endif
+
+    while (!daemon_should_exit) {
+        if ((n = poll(keyserver_pfd, keyserver_npfd, 1000)) <= 0) {
+            if (n < 0 && errno != EINTR) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, errno, root_server,
+                             "SSLKeyServer: poll failed");
+                apr_sleep(apr_time_from_msec(100));
+            }
+            continue;
+        }
+
+        /* from the end, so that the entry moved to a free slot has
+         * already been looked at */
+        for (i = keyserver_npfd - 1; i >= KEYSERVER_POLL_FIXED; i--) {
+            int sd2 = keyserver_pfd[i].fd;
+
+            if (!keyserver_pfd[i].revents) {
+                continue;
+            }
+            keyserver_pfd[i] = keyserver_pfd[--keyserver_npfd];
+#if APR_HAS_THREADS
+            apr_thread_mutex_lock(keyserver_mutex);
+            APR_ARRAY_PUSH(keyserver_ready, int) = sd2;
+            apr_thread_cond_signal(keyserver_cond);
+            apr_thread_mutex_unlock(keyserver_mutex);
+#else
+            if (keyserver_serve(sd2) == APR_SUCCESS) {
+                keyserver_poll_add(sd2);
+            }
+            else {
+                close(sd2);
+            }
+#endif
+        }
+
+#if APR_HAS_THREADS
+        if (keyserver_pfd[1].revents) {
+            char buf[64];
+
+            while (read(keyserver_wakeup[0], buf, sizeof(buf)) > 0)
+                ;
+            apr_thread_mutex_lock(keyserver_mutex);
+            for (i = 0; i < keyserver_served->nelts; i++) {
+                keyserver_poll_add(((int *)keyserver_served->elts)[i]);
+            }
+            keyserver_served->nelts = 0;
+            apr_thread_mutex_unlock(keyserver_mutex);
+        }
+#endif
+
+        if (keyserver_pfd[0].revents) {
+            int sd2 = accept(sd, NULL, NULL);
+
+            if (sd2 < 0) {
+                if (errno != EINTR && errno != ECONNABORTED
+                    && errno != EAGAIN) {
+                    ap_log_error(APLOG_MARK, APLOG_ERR, errno, root_server,
+                                 "SSLKeyServer: error accepting on the key "
+                                 "server socket");
+                    apr_sleep(apr_time_from_msec(100));
+                }
+            }
+            else if (!keyserver_peer_allowed(sd2)) {
+                close(sd2);
+            }
+            else {
+                /* some systems pass on O_NONBLOCK from the listener */
+                fcntl(sd2, F_SETFL, fcntl(sd2, F_GETFL) & ~O_NONBLOCK);
+                keyserver_poll_add(sd2);
+            }
+        }
+    }
+}
+
+static void daemon_signal_handler(int sig)
+{
+    if (sig == SIGHUP) {
+        ++daemon_should_exit;
+    }
+}
+
+static int keyserver_run(server_rec *s)
+{
+    int sd, rc;
+#if APR_HAS_THREADS
+    int i;
+#endif
+    mode_t omask;
+    apr_status_t rv;
+
+    apr_signal(SIGCHLD, SIG_IGN);
+    apr_signal(SIGHUP, daemon_signal_handler);
+
+    /* Close our copy of the listening sockets */
+    ap_close_listeners();
+
+    if ((sd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, errno, s,
+                     "SSLKeyServer: Couldn't create unix domain socket");
+        return errno;
+    }
+
+    omask = umask(0077); /* so that only Apache can use socket */
+    rc = bind(sd, (struct sockaddr *)server_addr, server_addr_len);
+    umask(omask); /* can't fail, so can't clobber errno */
+    if (rc < 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, errno, s,
+                     "SSLKeyServer: Couldn't bind unix domain socket %s",
+                     sockname);
+        return errno;
+    }
+
+    /* Not all flavors of unix use the current umask for AF_UNIX perms */
+    rv = apr_file_perms_set(sockname,
+                            APR_FPROT_UREAD|APR_FPROT_UWRITE|APR_FPROT_UEXECUTE);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s,
+                     "SSLKeyServer: Couldn't set permissions on unix domain "
+                     "socket %s", sockname);
+        return rv;
+    }
+
+    if (listen(sd, KEYSERVER_LISTENBACKLOG) < 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, errno, s,
+                     "SSLKeyServer: Couldn't listen on unix domain socket");
+        return errno;
+    }
+
+    /* don't block in accept() on a client gone since poll() */
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+
+    children_uid = geteuid() ? geteuid() : ap_unixd_config.user_id;
+    if (!geteuid()) {
+        if (chown(sockname, ap_unixd_config.user_id, -1) < 0) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, errno, s,
+                         "SSLKeyServer: Couldn't change owner of unix domain "
+                         "socket %s", sockname);
+            return errno;
+        }
+    }
+
+    /* if running as root, switch to SSLKeyServerUser, or else to the
+     * configured user/group */
+    if (keyserver_user && !geteuid()) {
+        struct passwd *pw;
+
+        if (keyserver_user[0] == '#') {
+            pw = getpwuid((uid_t)atol(keyserver_user + 1));
+        }
+        else {
+            pw = getpwnam(keyserver_user);
+        }
+        if (!pw) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s,
+                         "SSLKeyServer: unknown SSLKeyServerUser %s",
+                         keyserver_user);
+            return APR_EINVAL;
+        }
+        /* setgid() before initgroups(), see mod_unixd */
+        if (setgid(pw->pw_gid) == -1
+            || initgroups(pw->pw_name, pw->pw_gid) == -1
+            || setuid(pw->pw_uid) == -1) {
+            rv = errno;
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s,
+                         "SSLKeyServer: unable to switch to user %s",
+                         keyserver_user);
+            return rv;
+        }
+    }
+    else if ((rc = ap_run_drop_privileges(pkeyserver, ap_server_conf)) != 0) {
+        return rc;
+    }
+
+#if defined(HAVE_PRCTL) && defined(PR_SET_DUMPABLE)
+    /* Keep the keys out of core dumps, and the process out of reach of
+     * ptrace() by a child running as the same user */
+    if (prctl(PR_SET_DUMPABLE, 0)) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, errno, s,
+                     "SSLKeyServer: unable to make the key server "
+                     "undumpable");
+    }
+#endif
+
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, s,
+                 "SSLKeyServer: serving %u private key(s) with %d thread(s)",
+                 apr_hash_count(keyserver_keys), keyserver_threads);
+
+#if APR_HAS_THREADS
+    if (pipe(keyserver_wakeup) < 0) {
+        rv = errno;
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "SSLKeyServer: Couldn't create the wakeup pipe");
+        return rv;
+    }
+    fcntl(keyserver_wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(keyserver_wakeup[1], F_SETFL, O_NONBLOCK);
+    keyserver_ready = apr_array_make(pkeyserver, 64, sizeof(int));
+    keyserver_served = apr_array_make(pkeyserver, 64, sizeof(int));
+    if ((rv = apr_thread_mutex_create(&keyserver_mutex,
+                                      APR_THREAD_MUTEX_DEFAULT,
+                                      pkeyserver)) != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&keyserver_cond,
+                                        pkeyserver)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "SSLKeyServer: Couldn't create the crypto queue");
+        return rv;
+    }
+
+    for (i = 0; i < keyserver_threads; i++) {
+        apr_thread_t *thd;
+
+        if ((rv = apr_thread_create(&thd, NULL, keyserver_thread, NULL,
+                                    pkeyserver)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                         "SSLKeyServer: Couldn't create crypto thread");
+            return rv;
+        }
+    }
+#endif
+
+    keyserver_poll(sd);
+
+    return -1; /* should be <= 0 to distinguish from startup errors */
+}
+
+static int keyserver_start(apr_pool_t *p, server_rec *s, apr_proc_t *procnew);
+
+#if APR_HAS_OTHER_CHILD
+static void keyserver_maint(int reason, void *data, apr_wait_t status)
+{
+    apr_proc_t *proc = data;
+    int mpm_state;
+    int stopping;
+
+    switch (reason) {
+        case APR_OC_REASON_DEATH:
+            apr_proc_other_child_unregister(data);
+            /* If apache is not terminating or restarting,
+             * restart the key server
+             */
+            stopping = 1; /* if MPM doesn't support query,
+                           * assume we shouldn't restart daemon
+                           */
+            if (ap_mpm_query(AP_MPMQ_MPM_STATE, &mpm_state) == APR_SUCCESS &&
+                mpm_state != AP_MPMQ_STOPPING) {
+                stopping = 0;
+            }
+            if (!stopping) {
+                if (status == KEYSERVER_STARTUP_ERROR) {
+                    ap_log_error(APLOG_MARK, APLOG_CRIT, 0, ap_server_conf,
+                                 "SSLKeyServer: key server failed to "
+                                 "initialize");
+                }
+                else {
+                    ap_log_error(APLOG_MARK, APLOG_ERR, 0, ap_server_conf,
+                                 "SSLKeyServer: key server process died, "
+                                 "restarting");
+                    keyserver_start(root_pool, root_server, proc);
+                }
+            }
+            break;
+        case APR_OC_REASON_RESTART:
+            /* don't do anything; server is stopping or restarting */
+            apr_proc_other_child_unregister(data);
+            break;
+        case APR_OC_REASON_LOST:
+            /* Restart the key server */
+            apr_proc_other_child_unregister(data);
+            keyserver_start(root_pool, root_server, proc);
+            break;
+        case APR_OC_REASON_UNREGISTER:
+            /* we get here when pconf gets cleaned up */
+            kill(proc->pid, SIGHUP); /* send signal to daemon telling it to die */
+
+            /* Remove the socket, we must do it here in order to try and
+             * guarantee the same permissions as when it was created.
+             */
+            if (unlink(sockname) < 0 && errno != ENOENT) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, errno, ap_server_conf,
+                             "Couldn't unlink unix domain socket %s",
+                             sockname);
+            }
+            break;
+    }
+}
+#endif
+
+static int keyserver_start(apr_pool_t *p, server_rec *s, apr_proc_t *procnew)
+{
+    pid_t pid;
+
+    daemon_should_exit = 0; /* clear setting from previous generation */
+    if ((pid = fork()) < 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, errno, s,
+                     "SSLKeyServer: Couldn't spawn the key server process");
+        return DECLINED;
+    }
+    else if (pid == 0) {
+        if (pkeyserver == NULL) {
+            apr_pool_create(&pkeyserver, p);
+        }
+        exit(keyserver_run(s) > 0 ? KEYSERVER_STARTUP_ERROR : -1);
+    }
+    procnew->pid = pid;
+    procnew->err = procnew->in = procnew->out = NULL;
+    apr_pool_note_subprocess(p, procnew, APR_KILL_AFTER_TIMEOUT);
+#if APR_HAS_OTHER_CHILD
+    apr_proc_other_child_register(procnew, keyserver_maint, procnew, NULL, p);
+#endif
+    return OK;
+}
+
+/*  _________________________________________________________________
+**
+**  Module initialization
+**  _________________________________________________________________
+*/
+
+static apr_status_t keyserver_keys_cleanup(void *data)
+{
+    apr_hash_index_t *hi;
+
+    for (hi = apr_hash_first(NULL, keyserver_keys); hi;
+         hi = apr_hash_next(hi)) {
+        keyserver_key_t *key;
+
+        apr_hash_this(hi, NULL, NULL, (void **)&key);
+        if (key->rsa) {
+            RSA_free(key->rsa);
+        }
+    }
+    keyserver_keys = NULL;
+
+    return APR_SUCCESS;
+}
+
+/* Set up the offload of the private keys, before the SSL_CTXs are
+ * configured. */
+void ssl_keyserver_init(server_rec *s, apr_pool_t *p)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(s);
+    char *path;
+
+    if (!sc->keyserver_sock) {
+        return;
+    }
+
+    if (keyserver_ex_idx == -1) {
+        keyserver_ex_idx = RSA_get_ex_new_index(0, "mod_ssl key server",
+                                                NULL, NULL, NULL);
+    }
+    if (!keyserver_rsa_meth_set) {
+        keyserver_rsa_meth = *RSA_PKCS1_SSLeay();
+        keyserver_rsa_meth.name = "mod_ssl key server";
+        keyserver_rsa_meth.rsa_priv_enc = keyserver_rsa_priv_enc;
+        keyserver_rsa_meth.rsa_priv_dec = keyserver_rsa_priv_dec;
+        keyserver_rsa_meth.flags |= RSA_METHOD_FLAG_NO_CHECK;
+        keyserver_rsa_meth_set = 1;
+    }
+
+    keyserver_threads = (sc->keyserver_threads == UNSET)
+                        ? SSL_KEYSERVER_THREADS : sc->keyserver_threads;
+    keyserver_user = sc->keyserver_user;
+
+    path = apr_pstrdup(p, sc->keyserver_sock);
+    if (strlen(path) > sizeof(server_addr->sun_path) - 1) {
+        path[sizeof(server_addr->sun_path) - 1] = '\0';
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "The length of the SSLKeyServer path exceeds maximum, "
+                     "truncating to %s", path);
+    }
+    sockname = path;
+
+    server_addr_len = APR_OFFSETOF(struct sockaddr_un, sun_path)
+                      + strlen(sockname);
+    server_addr = (struct sockaddr_un *)apr_pcalloc(p, server_addr_len + 1);
+    server_addr->sun_family = AF_UNIX;
+    strcpy(server_addr->sun_path, sockname);
+
+    keyserver_keys = apr_hash_make(p);
+    apr_pool_cleanup_register(p, NULL, keyserver_keys_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+/* Fork the key server, once the private keys have been offloaded. */
+int ssl_keyserver_start(server_rec *s, apr_pool_t *p)
+{
+    const char *userdata_key = "ssl_keyserver_init";
+    apr_proc_t *procnew;
+    void *data;
+
+    if (!keyserver_keys || !apr_hash_count(keyserver_keys)) {
+        return OK;
+    }
+
+    /* As for the other daemons, skip the first post_config run. */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+
+    root_server = s;
+    root_pool = p;
+    parent_pid = getpid();
+
+    apr_pool_userdata_get(&data, userdata_key, s->process->pool);
+    if (!data) {
+        procnew = apr_pcalloc(s->process->pool, sizeof(*procnew));
+        procnew->pid = -1;
+        procnew->err = procnew->in = procnew->out = NULL;
+        apr_pool_userdata_set((const void *)procnew, userdata_key,
+                              apr_pool_cleanup_null, s->process->pool);
+    }
+    else {
+        procnew = data;
+    }
+
+    return keyserver_start(p, s, procnew);
+}
+
+/* Wipe the private keys from the memory of a child process, they are
+ * only used by the key server. */
+void ssl_keyserver_child_init(server_rec *s, apr_pool_t *p)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    apr_hash_index_t *hi;
+
+    if (!keyserver_keys) {
+        return;
+    }
+
+    keyserver_conns = apr_array_make(p, 16, sizeof(int));
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&keyserver_conns_mutex,
+                                APR_THREAD_MUTEX_DEFAULT, p) != APR_SUCCESS) {
+        /* connect for every operation then */
+        keyserver_conns = NULL;
+    }
+#endif
+
+    if (getpid() == parent_pid) {
+        return;
+    }
+
+    for (hi = apr_hash_first(NULL, keyserver_keys); hi;
+         hi = apr_hash_next(hi)) {
+        keyserver_key_t *key;
+
+        apr_hash_this(hi, NULL, NULL, (void **)&key);
+        if (key->rsa) {
+            RSA_free(key->rsa); /* clears the private components */
+            key->rsa = NULL;
+        }
+    }
+
+    /* the DER copies kept for restarts by ssl_pphrase_Handle() */
+    for (hi = apr_hash_first(NULL, mc->tPrivateKey); hi;
+         hi = apr_hash_next(hi)) {
+        ssl_asn1_t *asn1;
+
+        apr_hash_this(hi, NULL, NULL, (void **)&asn1);
+        OPENSSL_cleanse(asn1->cpData, asn1->nData);
+    }
+}
+
+#endif /* HAVE_SSL_KEYSERVER */
@@ -0,0 +1,278 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*                      _             _
+ *  _ __ ___   ___   __| |    ___ ___| |  mod_ssl
+ * | '_ ` _ \ / _ \ / _` |   / __/ __| |  Apache Interface to OpenSSL
+ * | | | | | | (_) | (_| |   \__ \__ \ |
+ * |_| |_| |_|\___/ \__,_|___|___/___/_|
+ *                      |_____|
+ *  ssl_engine_ktls.c
+ *  Kernel TLS Transmit Offload
+ */
+
+/*
+ * With SSLKernelTLS, once the handshake of a connection is complete the
+ * keys and sequence number of the server's write direction are installed
+ * in the TLS layer of the Linux kernel (TCP_ULP "tls", TLS_TX).  From
+ * then on the SSL output filter passes the plaintext brigades down to
+ * the core output filter unchanged, and the kernel builds the records of
+ * whatever is written to the socket, including the FILE buckets sent with
+ * sendfile().  Reading stays with OpenSSL.
+ *
+ * The kernel only implements the AEAD ciphers; this supports the AES-GCM
+ * suites of TLS 1.2, for which the write key and implicit nonce are
+ * derived from the master secret as in RFC 5246 section 6.3.
+ */
+
+#include "ssl_private.h"
+
+#ifdef HAVE_SSL_KTLS
+
+#if APR_HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#if APR_HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+#include <linux/tls.h>
+#include <openssl/hmac.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+#define KTLS_LABEL          "key expansion"
+#define KTLS_LABEL_LEN      (sizeof(KTLS_LABEL) - 1)
+#define KTLS_SEED_LEN       (KTLS_LABEL_LEN + 2 * SSL3_RANDOM_SIZE)
+
+/* fixed part of the GCM nonce (client_write_IV, server_write_IV) */
+#define KTLS_SALT_LEN       4
+
+#define KTLS_MAX_KEY_LEN    32
+#define KTLS_MAX_BLOCK_LEN  (2 * KTLS_MAX_KEY_LEN + 2 * KTLS_SALT_LEN)
+
+/* TLS record content type of alerts */
+#define KTLS_CONTENT_ALERT  21
+
+/*
+ * P_hash() of the TLS 1.2 PRF (RFC 5246 section 5)
+ */
+static int ktls_p_hash(const EVP_MD *md,
+                       const unsigned char *secret, int secret_len,
+                       const unsigned char *seed, int seed_len,
+                       unsigned char *out, int out_len)
+{
+    unsigned char a[EVP_MAX_MD_SIZE + KTLS_SEED_LEN];
+    unsigned char chunk[EVP_MAX_MD_SIZE];
+    unsigned int a_len, n;
+
+    /* A(1) */
+    if (!HMAC(md, secret, secret_len, seed, seed_len, a, &a_len)) {
+        return FALSE;
+    }
+
+    while (out_len > 0) {
+        /* HMAC(secret, A(i) + seed) */
+        memcpy(a + a_len, seed, seed_len);
+        if (!HMAC(md, secret, secret_len, a, a_len + seed_len, chunk, &n)) {
+            return FALSE;
+        }
+        if ((int)n > out_len) {
+            n = out_len;
+        }
+        memcpy(out, chunk, n);
+        out += n;
+        out_len -= n;
+
+        /* A(i+1) */
+        if (!HMAC(md, secret, secret_len, a, a_len, chunk, &a_len)) {
+            return FALSE;
+        }
+        memcpy(a, chunk, a_len);
+    }
+
+    OPENSSL_cleanse(chunk, sizeof(chunk));
+    OPENSSL_cleanse(a, sizeof(a));
+    return TRUE;
+}
+
+/*
+ * Derive the key block of the connection: client_write_key,
+ * server_write_key, client_write_IV, server_write_IV (there are no MAC
+ * keys with the AEAD ciphers).
+ */
+static int ktls_key_block(SSL *ssl, const EVP_MD *md,
+                          unsigned char *block, int len)
+{
+    unsigned char seed[KTLS_SEED_LEN];
+    SSL_SESSION *session = SSL_get_session(ssl);
+
+    if (!session) {
+        return FALSE;
+    }
+
+    memcpy(seed, KTLS_LABEL, KTLS_LABEL_LEN);
+    memcpy(seed + KTLS_LABEL_LEN, ssl->s3->server_random, SSL3_RANDOM_SIZE);
+    memcpy(seed + KTLS_LABEL_LEN + SSL3_RANDOM_SIZE,
+           ssl->s3->client_random, SSL3_RANDOM_SIZE);
+
+    return ktls_p_hash(md, session->master_key, session->master_key_length,
+                       seed, sizeof(seed), block, len);
+}
+
+static int ktls_socket(conn_rec *c, int *fd)
+{
+    apr_socket_t *csd = ap_get_module_config(c->conn_config, &core_module);
+    apr_os_sock_t sd;
+
+    if (!csd || apr_os_sock_get(&sd, csd) != APR_SUCCESS) {
+        return FALSE;
+    }
+    *fd = sd;
+    return TRUE;
+}
+
+/*
+ * Hand the write direction of a connection over to the kernel, right
+ * after the handshake.  Returns APR_ENOTIMPL if the negotiated protocol
+ * or cipher cannot be offloaded, or the error of the kernel (for
+ * instance ENOENT when the "tls" module is not loaded).
+ */
+apr_status_t ssl_ktls_enable(conn_rec *c, SSL *ssl)
+{
+    const SSL_CIPHER *cipher = SSL_get_current_cipher(ssl);
+    const char *name;
+    const EVP_MD *md;
+    unsigned char block[KTLS_MAX_BLOCK_LEN];
+    unsigned char *key, *salt;
+    int key_len, fd;
+    apr_size_t len;
+    apr_status_t rv = APR_SUCCESS;
+    union {
+        struct tls12_crypto_info_aes_gcm_128 gcm128;
+#ifdef TLS_CIPHER_AES_GCM_256
+        struct tls12_crypto_info_aes_gcm_256 gcm256;
+#endif
+    } ci;
+    socklen_t ci_len;
+
+    if (SSL_version(ssl) != TLS1_2_VERSION || !cipher
+        || SSL_get_current_compression(ssl) != NULL) {
+        return APR_ENOTIMPL;
+    }
+
+    name = SSL_CIPHER_get_name(cipher);
+    len = strlen(name);
+    if (len >= 17 && strEQ(name + len - 17, "AES128-GCM-SHA256")) {
+        key_len = 16;
+        md = EVP_sha256();
+    }
+#ifdef TLS_CIPHER_AES_GCM_256
+    else if (len >= 17 && strEQ(name + len - 17, "AES256-GCM-SHA384")) {
+        key_len = 32;
+        md = EVP_sha384();
+    }
+#endif
+    else {
+        return APR_ENOTIMPL;
+    }
+
+    if (!ktls_socket(c, &fd)) {
+        return APR_ENOTSOCK;
+    }
+
+    if (!ktls_key_block(ssl, md, block, 2 * key_len + 2 * KTLS_SALT_LEN)) {
+        return APR_EGENERAL;
+    }
+    key = block + key_len;
+    salt = block + 2 * key_len + KTLS_SALT_LEN;
+
+    /* The explicit part of the nonce only has to be unique, start it
+     * with the sequence number as OpenSSL does. */
+    memset(&ci, 0, sizeof(ci));
+#define KTLS_CRYPTO_INFO(info, type) \
+    info.info.version = TLS_1_2_VERSION; \
+    info.info.cipher_type = type; \
+    memcpy(info.key, key, key_len); \
+    memcpy(info.salt, salt, KTLS_SALT_LEN); \
+    memcpy(info.iv, ssl->s3->write_sequence, sizeof(info.iv)); \
+    memcpy(info.rec_seq, ssl->s3->write_sequence, sizeof(info.rec_seq)); \
+    ci_len = sizeof(info)
+    if (key_len == 16) {
+        KTLS_CRYPTO_INFO(ci.gcm128, TLS_CIPHER_AES_GCM_128);
+    }
+#ifdef TLS_CIPHER_AES_GCM_256
+    else {
+        KTLS_CRYPTO_INFO(ci.gcm256, TLS_CIPHER_AES_GCM_256);
+    }
+#endif
+#undef KTLS_CRYPTO_INFO
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0
+        || setsockopt(fd, SOL_TLS, TLS_TX, &ci, ci_len) < 0) {
+        rv = errno;
+    }
+
+    OPENSSL_cleanse(&ci, sizeof(ci));
+    OPENSSL_cleanse(block, sizeof(block));
+    return rv;
+}
+
+/*
+ * Send the close notify alert of a connection whose records are built
+ * by the kernel; everything written before must have been flushed to
+ * the socket.
+ */
+apr_status_t ssl_ktls_close_notify(conn_rec *c)
+{
+    unsigned char alert[2] = { 1 /* warning */, 0 /* close_notify */ };
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    int fd;
+
+    if (!ktls_socket(c, &fd)) {
+        return APR_ENOTSOCK;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg) = KTLS_CONTENT_ALERT;
+    msg.msg_controllen = cmsg->cmsg_len;
+
+    iov.iov_base = alert;
+    iov.iov_len = sizeof(alert);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    /* best effort, like SSL_shutdown() on a nonblocking socket */
+    if (sendmsg(fd, &msg, MSG_DONTWAIT) < 0) {
+        return errno;
+    }
+    return APR_SUCCESS;
+}
+
+#endif /* HAVE_SSL_KTLS */
@@ -40,6 +40,7 @@
 */
 
 static char *ssl_var_lookup_ssl(apr_pool_t *p, conn_rec *c, request_rec *r, char *var);
+static char *ssl_var_lookup_ssl_nocache(apr_pool_t *p, conn_rec *c, request_rec *r, char *var);
 static char *ssl_var_lookup_ssl_cert(apr_pool_t *p, request_rec *r, X509 *xs, char *var);
 static char *ssl_var_lookup_ssl_cert_dn(apr_pool_t *p, X509_NAME *xsname, char *var);
 static char *ssl_var_lookup_ssl_cert_valid(apr_pool_t *p, ASN1_UTCTIME *tm);
@@ -313,11 +314,80 @@ char *ssl_var_lookup(apr_pool_t *p, server_rec *s, conn_rec *c, request_rec *r,
     return (char *)result;
 }
 
+/*
+ * The SSL_* variables describe the handshake, so they stay the same for
+ * every request on a connection until the next renegotiation.  Cache
+ * them in the SSLConnRec rather than recomputing them (including the
+ * certificate DN and PEM encodings) for every request which exports
+ * them via SSLOptions +StdEnvVars/+ExportCertData or checks them in
+ * SSLRequire.
+ */
+
+/* marks a variable which is known to be unset */
+static char var_cache_unset[] = "";
+
+static int ssl_var_cacheable(request_rec *r, const char *var)
+{
+    apr_size_t len = strlen(var);
+
+    /* record counters and certificate validity change over time */
+    if (strcEQn(var, "RECORD", 6)
+        || (len > 8 && strcEQ(var + len - 8, "V_REMAIN"))) {
+        return FALSE;
+    }
+
+    /* the DN format depends on the per-directory SSLOptions */
+    if (r && (myDirConfig(r)->nOptions & SSL_OPT_LEGACYDNFORMAT)
+        && strstr(var, "_DN")) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static char *ssl_var_lookup_ssl(apr_pool_t *p, conn_rec *c, request_rec *r,
                                 char *var)
 {
     SSLConnRec *sslconn = myConnConfig(c);
     char *result;
+
+    if (sslconn->ssl == NULL || !ssl_var_cacheable(r, var)) {
+        return ssl_var_lookup_ssl_nocache(p, c, r, var);
+    }
+
+    if (sslconn->var_cache == NULL) {
+        sslconn->var_cache = apr_hash_make(c->pool);
+    }
+    else if ((result = apr_hash_get(sslconn->var_cache, var,
+                                    APR_HASH_KEY_STRING)) != NULL) {
+        return result == var_cache_unset ? NULL : result;
+    }
+
+    /* computed out of the connection pool, so that it lives as long as
+     * the cache entry */
+    result = ssl_var_lookup_ssl_nocache(c->pool, c, r, var);
+    apr_hash_set(sslconn->var_cache, apr_pstrdup(c->pool, var),
+                 APR_HASH_KEY_STRING, result ? result : var_cache_unset);
+
+    return result;
+}
+
+/*
+ * Forget the cached SSL_* variables, after a (re)negotiation or when the
+ * verification result of the connection has been changed.
+ */
+void ssl_var_cache_clear(SSLConnRec *sslconn)
+{
+    if (sslconn->var_cache) {
+        apr_hash_clear(sslconn->var_cache);
+    }
+}
+
+static char *ssl_var_lookup_ssl_nocache(apr_pool_t *p, conn_rec *c,
+                                        request_rec *r, char *var)
+{
+    SSLConnRec *sslconn = myConnConfig(c);
+    char *result;
     X509 *xs;
     STACK_OF(X509) *sk;
     SSL *ssl;
@@ -387,6 +457,14 @@ static char *ssl_var_lookup_ssl(apr_pool_t *p, conn_rec *c, request_rec *r,
 #endif
         result = apr_pstrdup(p, flag ? "true" : "false");
     }
+    else if (ssl != NULL && strcEQ(var, "RECORDS_OUT")) {
+        result = apr_psprintf(p, "%" APR_UINT64_T_FMT, sslconn->records_out);
+    }
+    else if (ssl != NULL && strcEQ(var, "RECORD_SIZE_AVG")) {
+        result = apr_psprintf(p, "%" APR_UINT64_T_FMT,
+                              sslconn->records_out
+                              ? sslconn->bytes_out / sslconn->records_out : 0);
+    }
 #ifndef OPENSSL_NO_SRP
     else if (ssl != NULL && strcEQ(var, "SRP_USER")) {
         if ((result = SSL_get_srp_username(ssl)) != NULL) {
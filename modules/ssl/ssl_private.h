@@ -50,6 +50,7 @@
 #include "apr_fnmatch.h"
 #include "apr_strings.h"
 #include "apr_global_mutex.h"
+#include "apr_shm.h"
 #include "apr_optional.h"
 #include "ap_socache.h"
 #include "mod_auth.h"
@@ -160,6 +161,16 @@ ap_set_module_config(c->conn_config, &ssl_module, val)
 #define SSL_SESSION_CACHE_TIMEOUT  300
 #endif
 
+/* Default interval between two session ticket key rotations. */
+#ifndef SSL_TICKET_KEY_ROTATION
+#define SSL_TICKET_KEY_ROTATION  3600
+#endif
+
+/* Default number of crypto threads of the key server. */
+#ifndef SSL_KEYSERVER_THREADS
+#define SSL_KEYSERVER_THREADS  4
+#endif
+
 /* Default setting for per-dir reneg buffer. */
 #ifndef DEFAULT_RENEG_BUFFER_SIZE
 #define DEFAULT_RENEG_BUFFER_SIZE (128 * 1024)
@@ -372,6 +383,14 @@ typedef struct {
     } reneg_state;
     
     server_rec *server;
+
+    apr_uint64_t records_out;   /* TLS records written */
+    apr_uint64_t bytes_out;     /* plaintext bytes written */
+
+    apr_hash_t *var_cache;      /* SSL_* variables, see ssl_var_lookup() */
+
+    int ktls_tx;                /* records are written by the kernel,
+                                 * see SSLKernelTLS */
 } SSLConnRec;
 
 /* BIG FAT WARNING: SSLModConfigRec has unusual memory lifetime: it is
@@ -402,6 +421,41 @@ typedef struct {
  * the random seed), and have that structure be strictly ABI-versioned
  * for safety.
  */
+#ifdef HAVE_TLS_SESSION_TICKETS
+/** Number of session ticket keys kept: the one issuing new tickets
+ * and the previous ones, still accepted for resumption. */
+#define MODSSL_TICKET_KEYS 3
+
+/** A session ticket key; SSLSessionTicketKeyFile holds a sequence of
+ * these, 48 bytes each. */
+typedef struct {
+    unsigned char key_name[16];
+    unsigned char hmac_secret[16];
+    unsigned char aes_key[16];
+} modssl_ticket_key_t;
+
+/** The session ticket keys, in shared memory created by the parent.
+ * Slots are rewritten by a single writer (the parent at startup, then
+ * the mod_watchdog singleton) and read without any lock; seq is odd
+ * while a slot is being rewritten. */
+typedef struct {
+    apr_uint32_t seq;
+    apr_uint32_t valid;
+    modssl_ticket_key_t key;
+} modssl_ticket_slot_t;
+
+typedef struct {
+    apr_uint32_t current;       /* slot issuing new tickets */
+    apr_time_t   rotated;       /* when the current key was installed */
+    apr_time_t   file_mtime;    /* of the loaded key file, if any */
+    apr_uint32_t issued;
+    apr_uint32_t hits;
+    apr_uint32_t renewed;
+    apr_uint32_t misses;
+    modssl_ticket_slot_t slot[MODSSL_TICKET_KEYS];
+} modssl_ticket_keys_t;
+#endif
+
 typedef struct {
     pid_t           pid;
     apr_pool_t     *pPool;
@@ -439,6 +493,13 @@ typedef struct {
     apr_global_mutex_t   *stapling_mutex;
 #endif
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+    /* Survive restarts along with this structure, so that tickets
+     * issued before a graceful restart can still be resumed. */
+    apr_shm_t      *ticket_shm;
+    modssl_ticket_keys_t *ticket_keys;
+#endif
+
     struct {
         void *pV1, *pV2, *pV3, *pV4, *pV5, *pV6, *pV7, *pV8, *pV9, *pV10;
     } rCtx;
@@ -521,6 +582,7 @@ typedef struct {
     int         stapling_errcache_timeout;
     apr_interval_time_t stapling_responder_timeout;
     const char *stapling_force_url;
+    BOOL        stapling_prefetch;
 #endif
 
 #ifndef OPENSSL_NO_SRP
@@ -550,6 +612,13 @@ struct SSLSrvConfigRec {
     int              session_cache_timeout;
     BOOL             cipher_server_pref;
     BOOL             insecure_reneg;
+    BOOL             dynamic_records;
+    BOOL             kernel_tls;
+#ifdef HAVE_TLS_SESSION_TICKETS
+    BOOL             session_tickets;
+    const char      *ticket_key_file;      /* global */
+    int              ticket_key_rotation;  /* global */
+#endif
     modssl_ctx_t    *server;
     modssl_ctx_t    *proxy;
     ssl_enabled_t    proxy_ssl_check_peer_expire;
@@ -560,6 +629,11 @@ struct SSLSrvConfigRec {
 #ifdef HAVE_FIPS
     BOOL             fips;
 #endif
+#ifdef HAVE_SSL_KEYSERVER
+    const char      *keyserver_sock;       /* global */
+    int              keyserver_threads;    /* global */
+    const char      *keyserver_user;       /* global */
+#endif
 };
 
 /**
@@ -599,6 +673,11 @@ void        *ssl_config_perdir_create(apr_pool_t *, char *);
 void        *ssl_config_perdir_merge(apr_pool_t *, void *, void *);
 const char  *ssl_cmd_SSLPassPhraseDialog(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLCryptoDevice(cmd_parms *, void *, const char *);
+#ifdef HAVE_SSL_KEYSERVER
+const char  *ssl_cmd_SSLKeyServer(cmd_parms *, void *, const char *);
+const char  *ssl_cmd_SSLKeyServerThreads(cmd_parms *, void *, const char *);
+const char  *ssl_cmd_SSLKeyServerUser(cmd_parms *, void *, const char *);
+#endif
 const char  *ssl_cmd_SSLRandomSeed(cmd_parms *, void *, const char *, const char *, const char *);
 const char  *ssl_cmd_SSLEngine(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLCipherSuite(cmd_parms *, void *, const char *);
@@ -625,6 +704,13 @@ const char  *ssl_cmd_SSLUserName(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLRenegBufferSize(cmd_parms *cmd, void *dcfg, const char *arg);
 const char  *ssl_cmd_SSLStrictSNIVHostCheck(cmd_parms *cmd, void *dcfg, int flag);
 const char *ssl_cmd_SSLInsecureRenegotiation(cmd_parms *cmd, void *dcfg, int flag);
+const char *ssl_cmd_SSLDynamicRecordSizing(cmd_parms *cmd, void *dcfg, int flag);
+const char *ssl_cmd_SSLKernelTLS(cmd_parms *cmd, void *dcfg, int flag);
+#ifdef HAVE_TLS_SESSION_TICKETS
+const char *ssl_cmd_SSLSessionTickets(cmd_parms *cmd, void *dcfg, int flag);
+const char *ssl_cmd_SSLSessionTicketKeyFile(cmd_parms *cmd, void *dcfg, const char *arg);
+const char *ssl_cmd_SSLSessionTicketKeyRotation(cmd_parms *cmd, void *dcfg, const char *arg);
+#endif
 
 const char  *ssl_cmd_SSLProxyEngine(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLProxyProtocol(cmd_parms *, void *, const char *);
@@ -696,6 +782,10 @@ int          ssl_callback_ServerNameIndication(SSL *, int *, modssl_ctx_t *);
 #ifndef OPENSSL_NO_SRP
 int          ssl_callback_SRPServerParams(SSL *, int *, void *);
 #endif
+#ifdef HAVE_TLS_SESSION_TICKETS
+int          ssl_callback_SessionTicket(SSL *, unsigned char *, unsigned char *,
+                                        EVP_CIPHER_CTX *, HMAC_CTX *, int);
+#endif
 
 /**  Session Cache Support  */
 void         ssl_scache_init(server_rec *, apr_pool_t *);
@@ -706,6 +796,25 @@ BOOL         ssl_scache_store(server_rec *, UCHAR *, int,
 SSL_SESSION *ssl_scache_retrieve(server_rec *, UCHAR *, int, apr_pool_t *);
 void         ssl_scache_remove(server_rec *, UCHAR *, int,
                                apr_pool_t *);
+#ifdef HAVE_TLS_SESSION_TICKETS
+void         ssl_scache_ticket_init(server_rec *, apr_pool_t *);
+BOOL         ssl_scache_ticket_key(server_rec *, const unsigned char *,
+                                   modssl_ticket_key_t *, BOOL *);
+#endif
+
+/** Private Key Operations Offload */
+#ifdef HAVE_SSL_KEYSERVER
+void         ssl_keyserver_init(server_rec *, apr_pool_t *);
+int          ssl_keyserver_start(server_rec *, apr_pool_t *);
+void         ssl_keyserver_child_init(server_rec *, apr_pool_t *);
+EVP_PKEY    *ssl_keyserver_pkey(server_rec *, EVP_PKEY *);
+#endif
+
+/** Kernel TLS Transmit Offload */
+#ifdef HAVE_SSL_KTLS
+apr_status_t ssl_ktls_enable(conn_rec *, SSL *);
+apr_status_t ssl_ktls_close_notify(conn_rec *);
+#endif
 
 /** Proxy Support */
 int ssl_proxy_enable(conn_rec *c);
@@ -723,9 +832,11 @@ const char *ssl_cmd_SSLStaplingReturnResponderErrors(cmd_parms *, void *, int);
 const char *ssl_cmd_SSLStaplingFakeTryLater(cmd_parms *, void *, int);
 const char *ssl_cmd_SSLStaplingResponderTimeout(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLStaplingForceURL(cmd_parms *, void *, const char *);
+const char  *ssl_cmd_SSLStaplingPrefetch(cmd_parms *, void *, int);
 void         modssl_init_stapling(server_rec *, apr_pool_t *, apr_pool_t *, modssl_ctx_t *);
 void         ssl_stapling_ex_init(void);
 int          ssl_stapling_init_cert(server_rec *s, modssl_ctx_t *mctx, X509 *x);
+void         ssl_stapling_prefetch_init(server_rec *, apr_pool_t *);
 #endif
 
 /**  I/O  */
@@ -810,6 +921,7 @@ void ssl_log_cxerror(const char *file, int line, int level,
 /* Register variables for the lifetime of the process pool 'p'. */
 void         ssl_var_register(apr_pool_t *p);
 char        *ssl_var_lookup(apr_pool_t *, server_rec *, conn_rec *, request_rec *, char *);
+void         ssl_var_cache_clear(SSLConnRec *);
 apr_array_header_t *ssl_ext_list(apr_pool_t *p, conn_rec *c, int peer, const char *extension);
 
 void         ssl_var_log_config_register(apr_pool_t *p);
@@ -832,7 +944,9 @@ int modssl_verify_ocsp(X509_STORE_CTX *ctx, SSLSrvConfigRec *sc,
 OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
                                             apr_interval_time_t timeout,
                                             OCSP_REQUEST *request,
-                                            conn_rec *c, apr_pool_t *p);
+                                            server_rec *s,
+                                            apr_bucket_alloc_t *ba,
+                                            apr_pool_t *p);
 #endif
 
 #endif /* SSL_PRIVATE_H */
@@ -30,6 +30,10 @@
                                                  -- Unknown         */
 #include "ssl_private.h"
 #include "mod_status.h"
+#ifdef HAVE_TLS_SESSION_TICKETS
+#include "mod_watchdog.h"
+#include "apr_atomic.h"
+#endif
 
 /*  _________________________________________________________________
 **
@@ -70,9 +74,15 @@ void ssl_scache_init(server_rec *s, apr_pool_t *p)
 
     /*
      * Warn the user that he should use the session cache.
-     * But we can operate without it, of course.
+     * But we can operate without it, of course, and session
+     * tickets with shared keys need none.
      */
     if (mc->sesscache == NULL) {
+#ifdef HAVE_TLS_SESSION_TICKETS
+        if (mc->ticket_keys) {
+            return;
+        }
+#endif
         ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
                      "Init: Session Cache is not configured "
                      "[hint: SSLSessionCache]");
@@ -187,6 +197,326 @@ void ssl_scache_remove(server_rec *s, UCHAR *id, int idlen,
     }
 }
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+/*  _________________________________________________________________
+**
+**  Session Tickets: Keys Shared by all Children
+**  _________________________________________________________________
+*/
+
+/* The keys live in shared memory created by the parent.  There is a
+ * single writer at any time (the parent during startup, then the
+ * mod_watchdog singleton), so readers only have to make sure they did
+ * not copy a slot while it was being rewritten.  The atomic additions
+ * of zero are there for their memory barrier. */
+
+static void ssl_ticket_slot_set(modssl_ticket_slot_t *slot,
+                                const modssl_ticket_key_t *key)
+{
+    apr_atomic_inc32(&slot->seq);
+    memcpy(&slot->key, key, sizeof(*key));
+    slot->valid = 1;
+    apr_atomic_inc32(&slot->seq);
+}
+
+static BOOL ssl_ticket_slot_get(modssl_ticket_slot_t *slot,
+                                modssl_ticket_key_t *key)
+{
+    apr_uint32_t seq, valid;
+
+    do {
+        seq = apr_atomic_add32(&slot->seq, 0);
+        valid = slot->valid;
+        memcpy(key, &slot->key, sizeof(*key));
+    } while ((seq & 1) || seq != apr_atomic_add32(&slot->seq, 0));
+
+    return valid ? TRUE : FALSE;
+}
+
+/* Install a key in the oldest slot and make it the one issuing new
+ * tickets; the previous keys still decrypt the tickets they issued. */
+static void ssl_ticket_key_install(modssl_ticket_keys_t *keys,
+                                   const modssl_ticket_key_t *key,
+                                   apr_time_t now)
+{
+    apr_uint32_t next = (keys->current + 1) % MODSSL_TICKET_KEYS;
+
+    ssl_ticket_slot_set(&keys->slot[next], key);
+    apr_atomic_xchg32(&keys->current, next);
+    keys->rotated = now;
+}
+
+static BOOL ssl_ticket_key_generate(server_rec *s,
+                                    modssl_ticket_keys_t *keys,
+                                    apr_time_t now)
+{
+    modssl_ticket_key_t key;
+
+    if (RAND_bytes((unsigned char *)&key, sizeof(key)) <= 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "Unable to generate a session ticket key");
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, s);
+        return FALSE;
+    }
+    ssl_ticket_key_install(keys, &key, now);
+    keys->file_mtime = 0;
+    OPENSSL_cleanse(&key, sizeof(key));
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                 "Generated a new session ticket key");
+    return TRUE;
+}
+
+/* The key file holds up to MODSSL_TICKET_KEYS keys of 48 bytes each;
+ * the first one issues new tickets, the others are only used to
+ * decrypt tickets they issued, e.g. on other cluster nodes which
+ * have not yet been given the new file. */
+static BOOL ssl_ticket_key_load(server_rec *s,
+                                modssl_ticket_keys_t *keys,
+                                const char *path, apr_time_t mtime,
+                                apr_time_t now, apr_pool_t *p)
+{
+    unsigned char buf[MODSSL_TICKET_KEYS * sizeof(modssl_ticket_key_t) + 1];
+    apr_size_t len = 0;
+    apr_file_t *fp;
+    apr_status_t rv;
+    int n;
+
+    rv = apr_file_open(&fp, path, APR_READ | APR_BINARY, APR_OS_DEFAULT, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_read_full(fp, buf, sizeof(buf), &len);
+        apr_file_close(fp);
+        if (APR_STATUS_IS_EOF(rv)) {
+            rv = APR_SUCCESS;
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "Unable to read session ticket keys from %s", path);
+        return FALSE;
+    }
+
+    if (len == 0 || len >= sizeof(buf)
+        || len % sizeof(modssl_ticket_key_t)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "Invalid session ticket key file %s: expected "
+                     "1 to %d keys of %" APR_SIZE_T_FMT " bytes",
+                     path, MODSSL_TICKET_KEYS,
+                     sizeof(modssl_ticket_key_t));
+        OPENSSL_cleanse(buf, sizeof(buf));
+        return FALSE;
+    }
+
+    /* Install the first key last, so that it ends up current. */
+    for (n = len / sizeof(modssl_ticket_key_t) - 1; n >= 0; n--) {
+        modssl_ticket_key_t key;
+
+        memcpy(&key, buf + n * sizeof(key), sizeof(key));
+        ssl_ticket_key_install(keys, &key, now);
+        OPENSSL_cleanse(&key, sizeof(key));
+    }
+    keys->file_mtime = mtime;
+    OPENSSL_cleanse(buf, sizeof(buf));
+
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, s,
+                 "Loaded %" APR_SIZE_T_FMT " session ticket key(s) from %s",
+                 len / sizeof(modssl_ticket_key_t), path);
+    return TRUE;
+}
+
+/* Reload the key file when it changed, or rotate the generated keys
+ * when they are due. */
+static BOOL ssl_ticket_keys_update(server_rec *s, apr_pool_t *p,
+                                   BOOL startup)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    SSLSrvConfigRec *sc = mySrvConfig(s);
+    modssl_ticket_keys_t *keys = mc->ticket_keys;
+    apr_time_t now = apr_time_now();
+
+    if (sc->ticket_key_file) {
+        apr_finfo_t finfo;
+        apr_status_t rv;
+
+        rv = apr_stat(&finfo, sc->ticket_key_file, APR_FINFO_MTIME, p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                         "Unable to stat session ticket key file %s",
+                         sc->ticket_key_file);
+            return FALSE;
+        }
+        if (startup || finfo.mtime != keys->file_mtime) {
+            return ssl_ticket_key_load(s, keys, sc->ticket_key_file,
+                                       finfo.mtime, now, p);
+        }
+    }
+    else if (startup) {
+        /* Keep the generated keys across restarts, but not the ones
+         * of a key file which is no longer configured. */
+        if (!keys->rotated || keys->file_mtime) {
+            return ssl_ticket_key_generate(s, keys, now);
+        }
+    }
+    else if (sc->ticket_key_rotation > 0
+             && now - keys->rotated
+                >= apr_time_from_sec(sc->ticket_key_rotation)) {
+        return ssl_ticket_key_generate(s, keys, now);
+    }
+
+    return TRUE;
+}
+
+static apr_status_t ssl_ticket_watchdog_callback(int state, void *data,
+                                                 apr_pool_t *pool)
+{
+    if (state == AP_WATCHDOG_STATE_RUNNING) {
+        ssl_ticket_keys_update((server_rec *)data, pool, FALSE);
+    }
+    return APR_SUCCESS;
+}
+
+void ssl_scache_ticket_init(server_rec *s, apr_pool_t *p)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    SSLSrvConfigRec *sc = mySrvConfig(s);
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
+    ap_watchdog_t *wd;
+    apr_status_t rv;
+
+    /* As for the session cache, skip the first post_config run. */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG)
+        return;
+
+    if (sc->ticket_key_rotation == UNSET) {
+        sc->ticket_key_rotation = SSL_TICKET_KEY_ROTATION;
+    }
+
+    if (!mc->ticket_keys) {
+        rv = apr_shm_create(&mc->ticket_shm, sizeof(modssl_ticket_keys_t),
+                            NULL, mc->pPool);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                         "Init: Cannot create shared memory for the "
+                         "session ticket keys; tickets will only be "
+                         "resumed by the process which issued them");
+            return;
+        }
+        mc->ticket_keys = apr_shm_baseaddr_get(mc->ticket_shm);
+        memset(mc->ticket_keys, 0, sizeof(*mc->ticket_keys));
+    }
+
+    if (!ssl_ticket_keys_update(s, p, TRUE)) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s,
+                     "Init: Unable to set up the session ticket keys");
+        ssl_die();
+    }
+
+    if (!sc->ticket_key_file && !sc->ticket_key_rotation) {
+        return;
+    }
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register_callback =
+        APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (!wd_get_instance || !wd_register_callback) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "Init: mod_watchdog is not loaded, session ticket "
+                     "keys will only be %s on restart",
+                     sc->ticket_key_file ? "reloaded" : "rotated");
+        return;
+    }
+
+    /* Singleton: one child at a time reloads or rotates the keys */
+    if ((rv = wd_get_instance(&wd, AP_WATCHDOG_SINGLETON, 0, 1, p))
+            != APR_SUCCESS
+        || (rv = wd_register_callback(wd, AP_WD_TM_INTERVAL, s,
+                                      ssl_ticket_watchdog_callback))
+            != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "Init: Unable to register the session ticket key "
+                     "watchdog callback");
+    }
+}
+
+/* Look up the key issuing new tickets (name is NULL) or the one which
+ * issued a ticket, counting the outcome for mod_status. */
+BOOL ssl_scache_ticket_key(server_rec *s, const unsigned char *name,
+                           modssl_ticket_key_t *key, BOOL *current)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    modssl_ticket_keys_t *keys = mc->ticket_keys;
+    apr_uint32_t cur, i;
+
+    if (keys == NULL) {
+        return FALSE;
+    }
+
+    cur = apr_atomic_read32(&keys->current);
+
+    if (name == NULL) {
+        if (!ssl_ticket_slot_get(&keys->slot[cur], key)) {
+            return FALSE;
+        }
+        apr_atomic_inc32(&keys->issued);
+        return TRUE;
+    }
+
+    /* newest first */
+    for (i = 0; i < MODSSL_TICKET_KEYS; i++) {
+        modssl_ticket_slot_t *slot;
+
+        slot = &keys->slot[(cur + MODSSL_TICKET_KEYS - i) % MODSSL_TICKET_KEYS];
+        if (ssl_ticket_slot_get(slot, key)
+            && !memcmp(key->key_name, name, sizeof(key->key_name))) {
+            *current = (i == 0) ? TRUE : FALSE;
+            apr_atomic_inc32(*current ? &keys->hits : &keys->renewed);
+            return TRUE;
+        }
+    }
+
+    apr_atomic_inc32(&keys->misses);
+    OPENSSL_cleanse(key, sizeof(*key));
+    return FALSE;
+}
+
+static void ssl_ticket_status(request_rec *r, int flags)
+{
+    SSLModConfigRec *mc = myModConfig(r->server);
+    modssl_ticket_keys_t *keys = mc->ticket_keys;
+    apr_uint32_t issued, hits, renewed, misses;
+
+    issued  = apr_atomic_read32(&keys->issued);
+    hits    = apr_atomic_read32(&keys->hits);
+    renewed = apr_atomic_read32(&keys->renewed);
+    misses  = apr_atomic_read32(&keys->misses);
+
+    if (flags & AP_STATUS_SHORT) {
+        ap_rprintf(r, "SSLTicketsIssued: %u\n", issued);
+        ap_rprintf(r, "SSLTicketHits: %u\n", hits);
+        ap_rprintf(r, "SSLTicketRenewals: %u\n", renewed);
+        ap_rprintf(r, "SSLTicketMisses: %u\n", misses);
+        return;
+    }
+
+    ap_rputs("<hr>\n", r);
+    ap_rputs("<table cellspacing=0 cellpadding=0>\n", r);
+    ap_rputs("<tr><td bgcolor=\"#000000\">\n", r);
+    ap_rputs("<b><font color=\"#ffffff\" face=\"Arial,Helvetica\">SSL/TLS Session Tickets Status:</font></b>\r", r);
+    ap_rputs("</td></tr>\n", r);
+    ap_rputs("<tr><td bgcolor=\"#ffffff\">\n", r);
+    ap_rprintf(r, "key source: <b>%s</b>, last key change: <b>%s</b><br>",
+               keys->file_mtime ? "file" : "generated",
+               ap_ht_time(r->pool, keys->rotated, "%d-%b-%Y %H:%M:%S %Z", 0));
+    ap_rprintf(r, "tickets issued: <b>%u</b>, resumed: <b>%u</b>, "
+               "resumed with a previous key: <b>%u</b>, "
+               "unknown key: <b>%u</b><br>",
+               issued, hits, renewed, misses);
+    ap_rputs("</td></tr>\n", r);
+    ap_rputs("</table>\n", r);
+}
+#endif
+
 /*  _________________________________________________________________
 **
 **  SSL Extension to mod_status
@@ -196,6 +526,12 @@ static int ssl_ext_status_hook(request_rec *r, int flags)
 {
     SSLModConfigRec *mc = myModConfig(r->server);
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+    if (mc && mc->ticket_keys) {
+        ssl_ticket_status(r, flags);
+    }
+#endif
+
     if (mc == NULL || flags & AP_STATUS_SHORT || mc->sesscache == NULL)
         return OK;
 
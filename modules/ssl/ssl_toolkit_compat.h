@@ -178,10 +178,28 @@ typedef int (modssl_read_bio_cb_fn)(char*,int,int,void*);
 #endif
 #endif
 
+#if defined(SSL_CTX_set_tlsext_ticket_key_cb) && !defined(OPENSSL_NO_TLSEXT)
+#define HAVE_TLS_SESSION_TICKETS
+#include <openssl/hmac.h>
+#endif
+
 #if (OPENSSL_VERSION_NUMBER >= 0x009080a0) && defined(OPENSSL_FIPS)
 #define HAVE_FIPS
 #endif
 
+/* The key server is a forked daemon listening on a unix domain socket;
+ * ECDSA_METHOD is private in the supported OpenSSL versions, so only
+ * RSA keys can be offloaded. */
+#if APR_HAS_FORK && APR_HAVE_SYS_UN_H && !defined(OPENSSL_NO_RSA)
+#define HAVE_SSL_KEYSERVER
+#endif
+
+/* Linux kernel TLS transmit offload of the TLS 1.2 AES-GCM suites,
+ * which OpenSSL supports as of 1.0.1 */
+#if defined(HAVE_LINUX_TLS_H) && (OPENSSL_VERSION_NUMBER >= 0x10001000)
+#define HAVE_SSL_KTLS
+#endif
+
 #ifndef PEM_F_DEF_CALLBACK
 #ifdef PEM_F_PEM_DEF_CALLBACK
 /** In OpenSSL 0.9.8 PEM_F_DEF_CALLBACK was renamed */
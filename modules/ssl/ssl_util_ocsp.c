@@ -58,7 +58,7 @@ static BIO *serialize_request(OCSP_REQUEST *req, const apr_uri_t *uri)
  * NULL on error. */
 static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri, 
                                   apr_interval_time_t timeout,
-                                  conn_rec *c, apr_pool_t *p)
+                                  server_rec *s, apr_pool_t *p)
 {
     apr_status_t rv;
     apr_sockaddr_t *sa;
@@ -68,15 +68,15 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
 
     rv = apr_sockaddr_info_get(&sa, uri->hostname, APR_UNSPEC, uri->port, 0, p);
     if (rv) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c,
-                      "could not resolve address of OCSP responder %s", 
-                      uri->hostinfo);
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "could not resolve address of OCSP responder %s", 
+                     uri->hostinfo);
         return NULL;
     }
     
     /* establish a connection to the OCSP responder */ 
-    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, 
-                  "connecting to OCSP responder '%s'", uri->hostinfo);
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, 
+                 "connecting to OCSP responder '%s'", uri->hostinfo);
 
     /* Cycle through address until a connect() succeeds. */
     for (; sa; sa = sa->next) {
@@ -93,16 +93,16 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
     }
 
     if (sa == NULL) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c,
-                      "could not connect to OCSP responder '%s'",
-                      uri->hostinfo);
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "could not connect to OCSP responder '%s'",
+                     uri->hostinfo);
         apr_socket_close(sd);
         return NULL;
     }
 
     /* send the request and get a response */ 
-    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, 
-                 "sending request to OCSP responder");
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, 
+                "sending request to OCSP responder");
 
     while ((len = BIO_read(request, buf, sizeof buf)) > 0) {
         char *wbuf = buf;
@@ -118,9 +118,9 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
 
         if (rv) {
             apr_socket_close(sd);
-            ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c,
-                          "failed to send request to OCSP responder '%s'",
-                          uri->hostinfo);
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                         "failed to send request to OCSP responder '%s'",
+                         uri->hostinfo);
             return NULL;
         }
     }
@@ -131,7 +131,7 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
 /* Return a pool-allocated NUL-terminated line, with CRLF stripped,
  * read from brigade 'bbin' using 'bbout' as temporary storage. */
 static char *get_line(apr_bucket_brigade *bbout, apr_bucket_brigade *bbin,
-                      conn_rec *c, apr_pool_t *p)
+                      server_rec *s, apr_pool_t *p)
 {
     apr_status_t rv;
     apr_size_t len;
@@ -141,21 +141,21 @@ static char *get_line(apr_bucket_brigade *bbout, apr_bucket_brigade *bbin,
 
     rv = apr_brigade_split_line(bbout, bbin, APR_BLOCK_READ, 8192);
     if (rv) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c,
-                      "failed reading line from OCSP server");
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "failed reading line from OCSP server");
         return NULL;
     }
     
     rv = apr_brigade_pflatten(bbout, &line, &len, p);
     if (rv) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c,
-                      "failed reading line from OCSP server");
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "failed reading line from OCSP server");
         return NULL;
     }
 
     if (len && line[len-1] != APR_ASCII_LF) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c,
-                      "response header line too long from OCSP server");
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "response header line too long from OCSP server");
         return NULL;
     }
 
@@ -174,7 +174,8 @@ static char *get_line(apr_bucket_brigade *bbout, apr_bucket_brigade *bbin,
 /* Read the OCSP response from the socket 'sd', using temporary memory
  * BIO 'bio', and return the decoded OCSP response object, or NULL on
  * error. */
-static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
+static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio,
+                                    server_rec *s, apr_bucket_alloc_t *ba,
                                     apr_pool_t *p)
 {
     apr_bucket_brigade *bb, *tmpbb;
@@ -185,17 +186,17 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
 
     /* Using brigades for response parsing is much simpler than using
      * apr_socket_* directly. */
-    bb = apr_brigade_create(p, c->bucket_alloc);
-    tmpbb = apr_brigade_create(p, c->bucket_alloc);
-    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_socket_create(sd, c->bucket_alloc));
+    bb = apr_brigade_create(p, ba);
+    tmpbb = apr_brigade_create(p, ba);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_socket_create(sd, ba));
 
-    line = get_line(tmpbb, bb, c, p);
+    line = get_line(tmpbb, bb, s, p);
     if (!line || strncmp(line, "HTTP/", 5)
         || (line = ap_strchr(line, ' ')) == NULL
         || (code = apr_atoi64(++line)) < 200 || code > 299) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c,
-                      "bad response from OCSP server: %s",
-                      line ? line : "(none)");
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "bad response from OCSP server: %s",
+                     line ? line : "(none)");
         return NULL;
     }
 
@@ -203,21 +204,21 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
      * Content-Length since the server is obliged to close the
      * connection after the response anyway for HTTP/1.0. */
     count = 0;
-    while ((line = get_line(tmpbb, bb, c, p)) != NULL && line[0]
+    while ((line = get_line(tmpbb, bb, s, p)) != NULL && line[0]
            && ++count < MAX_HEADERS) {
-        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
-                      "OCSP response header: %s", line);
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                     "OCSP response header: %s", line);
     }
 
     if (count == MAX_HEADERS) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c,
-                      "could not read response headers from OCSP server, "
-                      "exceeded maximum count (%u)", MAX_HEADERS);
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "could not read response headers from OCSP server, "
+                     "exceeded maximum count (%u)", MAX_HEADERS);
         return NULL;
     }
     else if (!line) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c,
-                      "could not read response header from OCSP server");
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "could not read response header from OCSP server");
         return NULL;
     }
 
@@ -231,25 +232,25 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
 
         rv = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
         if (rv == APR_EOF || (rv == APR_SUCCESS && len == 0)) {
-            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
-                          "OCSP response: got EOF");
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                         "OCSP response: got EOF");
             break;
         }
         if (rv != APR_SUCCESS) {
-            ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c,
-                          "error reading response from OCSP server");
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                         "error reading response from OCSP server");
             return NULL;
         }
         count += len;
         if (count > MAX_CONTENT) {
-            ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c,
-                          "OCSP response size exceeds %u byte limit",
-                          MAX_CONTENT);
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                         "OCSP response size exceeds %u byte limit",
+                         MAX_CONTENT);
             return NULL;
         }
-        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
-                      "OCSP response: got %" APR_SIZE_T_FMT 
-                      " bytes, %" APR_SIZE_T_FMT " total", len, count);
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                     "OCSP response: got %" APR_SIZE_T_FMT 
+                     " bytes, %" APR_SIZE_T_FMT " total", len, count);
 
         BIO_write(bio, data, (int)len);
         apr_bucket_delete(e);
@@ -262,9 +263,9 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
      * bio. */
     response = d2i_OCSP_RESPONSE_bio(bio, NULL);
     if (response == NULL) {
-        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, mySrvFromConn(c));
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c,
-                      "failed to decode OCSP response data");
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, s);
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "failed to decode OCSP response data");
     }
 
     return response;
@@ -273,7 +274,9 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
 OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
                                             apr_interval_time_t timeout,
                                             OCSP_REQUEST *request,
-                                            conn_rec *c, apr_pool_t *p) 
+                                            server_rec *s,
+                                            apr_bucket_alloc_t *ba,
+                                            apr_pool_t *p)
 {
     OCSP_RESPONSE *response = NULL;
     apr_socket_t *sd;
@@ -281,13 +284,13 @@ OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
 
     bio = serialize_request(request, uri);
     if (bio == NULL) {
-        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, mySrvFromConn(c));
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c,
-                      "could not serialize OCSP request");
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, s);
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "could not serialize OCSP request");
         return NULL;
     }
     
-    sd = send_request(bio, uri, timeout, c, p);
+    sd = send_request(bio, uri, timeout, s, p);
     if (sd == NULL) {
         /* Errors already logged. */
         BIO_free(bio);
@@ -297,7 +300,7 @@ OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
     /* Clear the BIO contents, ready for the response. */
     (void)BIO_reset(bio);
 
-    response = read_response(sd, bio, c, p);
+    response = read_response(sd, bio, s, ba, p);
 
     apr_socket_close(sd);
     BIO_free(bio);
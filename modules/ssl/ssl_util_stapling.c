@@ -31,6 +31,7 @@
 #include "ssl_private.h"
 #include "ap_mpm.h"
 #include "apr_thread_mutex.h"
+#include "mod_watchdog.h"
 
 #ifdef HAVE_OCSP_STAPLING
 
@@ -43,6 +44,12 @@
 
 #define MAX_STAPLING_DER 10240
 
+/**
+ * Seconds before a failed background query is retried, unless the
+ * error cache timeout is shorter.
+ */
+#define STAPLING_PREFETCH_RETRY 60
+
 /* Cached info stored in certificate ex_info. */
 typedef struct {
     /* Index in session cache SHA1 hash of certificate */
@@ -53,6 +60,18 @@ typedef struct {
     char *uri;
 } certinfo;
 
+/* Certificate whose response is prefetched by the watchdog. */
+typedef struct {
+    server_rec *s;
+    modssl_ctx_t *mctx;
+    certinfo *cinf;
+    /* When the response is due to be renewed */
+    apr_time_t next;
+} stapling_prefetch_t;
+
+/* The certificates of the current configuration with SSLStaplingPrefetch */
+static apr_array_header_t *stapling_prefetch_certs = NULL;
+
 static void certinfo_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
                                         int idx, long argl, void *argp)
 {
@@ -146,6 +165,14 @@ int ssl_stapling_init_cert(server_rec *s, modssl_ctx_t *mctx, X509 *x)
     }
     if (aia)
         X509_email_free(aia);
+
+    if (mctx->stapling_prefetch == TRUE && stapling_prefetch_certs) {
+        stapling_prefetch_t *pf = apr_array_push(stapling_prefetch_certs);
+        pf->s = s;
+        pf->mctx = mctx;
+        pf->cinf = cinf;
+        pf->next = 0;
+    }
     return 1;
 }
 
@@ -354,15 +381,19 @@ static int stapling_check_response(server_rec *s, modssl_ctx_t *mctx,
     return SSL_TLSEXT_ERR_OK;
 }
 
-static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
-                                    certinfo *cinf, OCSP_RESPONSE **prsp,
-                                    apr_pool_t *pool)
+/* Query the responder for a fresh response to the given certificate,
+ * adding the request extensions 'exts' (if any).  '*pok' is set if
+ * the response received is valid.  Returns FALSE on fatal errors. */
+static BOOL stapling_query_responder(server_rec *s, modssl_ctx_t *mctx,
+                                     certinfo *cinf,
+                                     STACK_OF(X509_EXTENSION) *exts,
+                                     OCSP_RESPONSE **prsp, BOOL *pok,
+                                     apr_bucket_alloc_t *ba,
+                                     apr_pool_t *pool)
 {
-    conn_rec *conn      = (conn_rec *)SSL_get_app_data(ssl);
     apr_pool_t *vpool;
     OCSP_REQUEST *req = NULL;
     OCSP_CERTID *id = NULL;
-    STACK_OF(X509_EXTENSION) *exts;
     int i;
     BOOL ok = FALSE;
     BOOL rv = TRUE;
@@ -370,6 +401,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     apr_uri_t uri;
 
     *prsp = NULL;
+    *pok = FALSE;
     /* Build up OCSP query from server certificate info */
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
                  "stapling_renew_response: querying responder");
@@ -384,7 +416,6 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
         goto err;
     id = NULL;
     /* Add any extensions to the request */
-    SSL_get_tlsext_status_exts(ssl, &exts);
     for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
         X509_EXTENSION *ext = sk_X509_EXTENSION_value(exts, i);
         if (!OCSP_REQUEST_add_ext(req, ext, -1))
@@ -397,7 +428,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
         ocspuri = cinf->uri;
 
     /* Create a temporary pool to constrain memory use */
-    apr_pool_create(&vpool, conn->pool);
+    apr_pool_create(&vpool, pool);
 
     ok = apr_uri_parse(vpool, ocspuri, &uri);
     if (ok != APR_SUCCESS) {
@@ -419,7 +450,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     }
 
     *prsp = modssl_dispatch_ocsp_request(&uri, mctx->stapling_responder_timeout,
-                                         req, conn, vpool);
+                                         req, s, ba, vpool);
 
     apr_pool_destroy(vpool);
 
@@ -439,8 +470,8 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
         if (response_status == OCSP_RESPONSE_STATUS_SUCCESSFUL) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
                         "stapling_renew_response: query response received");
-            stapling_check_response(s, mctx, cinf, *prsp, &ok);
-            if (ok == FALSE) {
+            stapling_check_response(s, mctx, cinf, *prsp, pok);
+            if (*pok == FALSE) {
                 ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
                              "stapling_renew_response: error in retreived response!");
             }
@@ -451,10 +482,6 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
                          OCSP_response_status_str(response_status));
         }
     }
-    if (stapling_cache_response(s, mctx, *prsp, cinf, ok, pool) == FALSE) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
-                     "stapling_renew_response: error caching response!");
-    }
 
 done:
     if (id)
@@ -467,6 +494,29 @@ err:
     goto done;
 }
 
+static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
+                                    certinfo *cinf, OCSP_RESPONSE **prsp,
+                                    apr_pool_t *pool)
+{
+    conn_rec *conn      = (conn_rec *)SSL_get_app_data(ssl);
+    STACK_OF(X509_EXTENSION) *exts;
+    BOOL ok;
+
+    SSL_get_tlsext_status_exts(ssl, &exts);
+    if (stapling_query_responder(s, mctx, cinf, exts, prsp, &ok,
+                                 conn->bucket_alloc, pool) == FALSE) {
+        return FALSE;
+    }
+
+    if (*prsp && stapling_cache_response(s, mctx, *prsp, cinf,
+                                         ok, pool) == FALSE) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "stapling_renew_response: error caching response!");
+    }
+
+    return TRUE;
+}
+
 /*
  * SSLStaplingMutex operations. Similar to SSL mutex except a mutex is
  * mandatory if stapling is enabled.
@@ -543,6 +593,44 @@ static int stapling_mutex_off(server_rec *s)
     return TRUE;
 }
 
+/* Certificate Status callback for SSLStaplingPrefetch: the watchdog keeps
+ * the cache current, so only send back what is cached and never query
+ * the responder from the handshake. */
+static int stapling_cb_prefetched(SSL *ssl, server_rec *s, modssl_ctx_t *mctx,
+                                  certinfo *cinf, apr_pool_t *pool)
+{
+    OCSP_RESPONSE *rsp = NULL;
+    int rv;
+    BOOL ok = FALSE;
+
+    stapling_mutex_on(s);
+    rv = stapling_get_cached_response(s, &rsp, &ok, cinf, pool);
+    stapling_mutex_off(s);
+    if (rv == FALSE) {
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+    if (rsp == NULL) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                     "stapling_cb: no prefetched response available");
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    rv = stapling_check_response(s, mctx, cinf, rsp, NULL);
+    if (rv == SSL_TLSEXT_ERR_NOACK && !ok && mctx->stapling_return_errors) {
+        /* stored as an error, pass it on as stapling_cb does */
+        rv = SSL_TLSEXT_ERR_OK;
+    }
+    if (rv == SSL_TLSEXT_ERR_OK) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                     "stapling_cb: setting prefetched response");
+        if (!stapling_set_response(ssl, rsp))
+            rv = SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+    OCSP_RESPONSE_free(rsp);
+
+    return rv;
+}
+
 /* Certificate Status callback. This is called when a client includes a
  * certificate status request extension.
  *
@@ -578,6 +666,10 @@ static int stapling_cb(SSL *ssl, void *arg)
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
                  "stapling_cb: retrieved cached certificate data");
 
+    if (mctx->stapling_prefetch == TRUE) {
+        return stapling_cb_prefetched(ssl, s, mctx, cinf, conn->pool);
+    }
+
     /* Check to see if we already have a response for this certificate */
     stapling_mutex_on(s);
 
@@ -646,6 +738,151 @@ static int stapling_cb(SSL *ssl, void *arg)
 
 }
 
+/* Renew the response of a prefetched certificate.  A response which
+ * could not be validated does not replace a cached one which still is
+ * valid, handshakes keep getting the latter until it expires. */
+static BOOL stapling_prefetch_response(stapling_prefetch_t *pf,
+                                       apr_pool_t *pool)
+{
+    server_rec *s = pf->s;
+    OCSP_RESPONSE *rsp, *cached = NULL;
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(pool);
+    BOOL ok, cached_ok = FALSE;
+
+    if (stapling_query_responder(s, pf->mctx, pf->cinf, NULL, &rsp, &ok,
+                                 ba, pool) == FALSE || rsp == NULL) {
+        return FALSE;
+    }
+
+    stapling_mutex_on(s);
+    if (ok == FALSE) {
+        stapling_get_cached_response(s, &cached, &cached_ok, pf->cinf, pool);
+        if (cached) {
+            if (cached_ok == TRUE
+                && stapling_check_response(s, pf->mctx, pf->cinf, cached,
+                                           NULL) != SSL_TLSEXT_ERR_OK) {
+                cached_ok = FALSE;
+            }
+            OCSP_RESPONSE_free(cached);
+        }
+    }
+    if (ok == FALSE && cached_ok == TRUE) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "stapling_prefetch: keeping the cached response until "
+                     "the responder returns a valid one");
+    }
+    else if (stapling_cache_response(s, pf->mctx, rsp, pf->cinf,
+                                     ok, pool) == FALSE) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "stapling_prefetch: error caching response!");
+        ok = FALSE;
+    }
+    stapling_mutex_off(s);
+
+    OCSP_RESPONSE_free(rsp);
+
+    return ok;
+}
+
+static apr_status_t stapling_watchdog_callback(int state, void *data,
+                                               apr_pool_t *pool)
+{
+    apr_array_header_t *certs = data;
+    stapling_prefetch_t *pf = (stapling_prefetch_t *)certs->elts;
+    apr_time_t now;
+    int i;
+
+    if (state != AP_WATCHDOG_STATE_RUNNING) {
+        return APR_SUCCESS;
+    }
+
+    now = apr_time_now();
+    for (i = 0; i < certs->nelts; i++, pf++) {
+        modssl_ctx_t *mctx = pf->mctx;
+        apr_pool_t *ptemp;
+        int retry;
+
+        if (pf->next > now) {
+            continue;
+        }
+
+        apr_pool_create(&ptemp, pool);
+        if (stapling_prefetch_response(pf, ptemp)) {
+            /* renew half way through the cache lifetime, so handshakes
+             * never see it expire */
+            pf->next = apr_time_now()
+                       + apr_time_from_sec(mctx->stapling_cache_timeout) / 2;
+        }
+        else {
+            retry = STAPLING_PREFETCH_RETRY;
+            if (mctx->stapling_errcache_timeout < retry) {
+                retry = mctx->stapling_errcache_timeout;
+            }
+            pf->next = apr_time_now() + apr_time_from_sec(retry);
+        }
+        apr_pool_destroy(ptemp);
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t stapling_prefetch_cleanup(void *data)
+{
+    stapling_prefetch_certs = NULL;
+    return APR_SUCCESS;
+}
+
+/* Start renewing the responses of the SSLStaplingPrefetch certificates
+ * in the background, once they have all been initialized. */
+void ssl_stapling_prefetch_init(server_rec *s, apr_pool_t *p)
+{
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
+    ap_watchdog_t *wd;
+    apr_status_t rv;
+    int i;
+
+    if (!stapling_prefetch_certs || apr_is_empty_array(stapling_prefetch_certs))
+        return;
+
+    /* As for the session cache, skip the first post_config run. */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG)
+        return;
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register_callback =
+        APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (wd_get_instance && wd_register_callback) {
+        /* A dedicated singleton, queries block for up to the
+         * SSLStaplingResponderTimeout of each certificate. */
+        if ((rv = wd_get_instance(&wd, "_ssl_stapling_", 0, 1, p))
+                == APR_SUCCESS
+            && (rv = wd_register_callback(wd, AP_WD_TM_INTERVAL,
+                                          stapling_prefetch_certs,
+                                          stapling_watchdog_callback))
+                == APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                         "OCSP stapling: prefetching responses for %d "
+                         "certificate(s)", stapling_prefetch_certs->nelts);
+            return;
+        }
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                     "Init: Unable to register the OCSP stapling "
+                     "watchdog callback");
+    }
+    else {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "Init: mod_watchdog is not loaded, SSLStaplingPrefetch "
+                     "is ignored");
+    }
+
+    /* No watchdog: fall back to querying the responder on handshake */
+    for (i = 0; i < stapling_prefetch_certs->nelts; i++) {
+        APR_ARRAY_IDX(stapling_prefetch_certs, i,
+                      stapling_prefetch_t).mctx->stapling_prefetch = FALSE;
+    }
+}
+
 void modssl_init_stapling(server_rec *s, apr_pool_t *p, apr_pool_t *ptemp,
                           modssl_ctx_t *mctx)
 {
@@ -681,6 +918,15 @@ void modssl_init_stapling(server_rec *s, apr_pool_t *p, apr_pool_t *ptemp,
     if (mctx->stapling_responder_timeout == UNSET) {
         mctx->stapling_responder_timeout = 10 * APR_USEC_PER_SEC;
     }
+    if (mctx->stapling_prefetch == UNSET) {
+        mctx->stapling_prefetch = FALSE;
+    }
+    if (mctx->stapling_prefetch == TRUE && !stapling_prefetch_certs) {
+        stapling_prefetch_certs = apr_array_make(p, 4,
+                                                 sizeof(stapling_prefetch_t));
+        apr_pool_cleanup_register(p, NULL, stapling_prefetch_cleanup,
+                                  apr_pool_cleanup_null);
+    }
     SSL_CTX_set_tlsext_status_cb(ctx, stapling_cb);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, "OCSP stapling initialized");
 }
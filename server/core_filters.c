@@ -54,6 +54,10 @@
 
 #include "mod_so.h" /* for ap_find_loaded_module_symbol */
 
+#if APR_HAVE_NETINET_TCP_H
+#include <netinet/tcp.h> /* for TCP_INFO */
+#endif
+
 #define AP_MIN_SENDFILE_BYTES           (256)
 
 /**
@@ -246,6 +250,26 @@ int ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
             return APR_SUCCESS;
         }
 
+        /* A peek that the first bucket satisfies (the read-ahead of
+         * pipelined requests, typically) is served from a trimmed copy,
+         * without splitting up the buffered data for the GETLINE reads
+         * that follow.
+         */
+        if (mode == AP_MODE_SPECULATIVE && len >= readbytes) {
+            apr_bucket *copy_bucket;
+
+            rv = apr_bucket_copy(e, &copy_bucket);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+            APR_BRIGADE_INSERT_TAIL(b, copy_bucket);
+            if (len > readbytes) {
+                apr_bucket_split(copy_bucket, (apr_size_t)readbytes);
+                apr_bucket_delete(APR_BUCKET_NEXT(copy_bucket));
+            }
+            return APR_SUCCESS;
+        }
+
         /* Have we read as much data as we wanted (be greedy)? */
         if (len < readbytes) {
             apr_size_t bucket_len;
@@ -321,34 +345,46 @@ static void setaside_remaining_output(ap_filter_t *f,
 
 static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                                              apr_bucket_brigade *bb,
-                                             apr_size_t *bytes_written,
+                                             core_output_filter_ctx_t *ctx,
                                              conn_rec *c);
 
 static void remove_empty_buckets(apr_bucket_brigade *bb);
 
 static apr_status_t send_brigade_blocking(apr_socket_t *s,
                                           apr_bucket_brigade *bb,
-                                          apr_size_t *bytes_written,
+                                          core_output_filter_ctx_t *ctx,
                                           conn_rec *c);
 
 static apr_status_t writev_nonblocking(apr_socket_t *s,
                                        struct iovec *vec, apr_size_t nvec,
                                        apr_bucket_brigade *bb,
-                                       apr_size_t *cumulative_bytes_written,
+                                       core_output_filter_ctx_t *ctx,
                                        conn_rec *c);
 
 #if APR_HAS_SENDFILE
 static apr_status_t sendfile_nonblocking(apr_socket_t *s,
                                          apr_bucket *bucket,
-                                         apr_size_t *cumulative_bytes_written,
+                                         core_output_filter_ctx_t *ctx,
                                          conn_rec *c);
 #endif
 
-/* XXX: Should these be configurable parameters? */
+static void adapt_thresholds(apr_socket_t *s,
+                             core_output_filter_ctx_t *ctx);
+
+static void update_output_status(conn_rec *c,
+                                 core_output_filter_ctx_t *ctx);
+
+/* Initial values of the per-connection write thresholds.  Where TCP_INFO
+ * is available they are adapted to what the connection can send per
+ * round trip, up to the _LIMIT values; see adapt_thresholds().
+ */
 #define THRESHOLD_MIN_WRITE 4096
 #define THRESHOLD_MAX_BUFFER 65536
 #define MAX_REQUESTS_IN_PIPELINE 5
 
+#define THRESHOLD_MIN_WRITE_LIMIT 65536
+#define THRESHOLD_MAX_BUFFER_LIMIT (1024 * 1024)
+
 /* Optional function coming from mod_logio, used for logging of output
  * traffic
  */
@@ -388,6 +424,8 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
         ctx->tmp_flush_bb = apr_brigade_create(c->pool, c->bucket_alloc);
         /* same for buffered_bb and ap_save_brigade */
         ctx->buffered_bb = apr_brigade_create(c->pool, c->bucket_alloc);
+        ctx->min_write = THRESHOLD_MIN_WRITE;
+        ctx->max_buffer = THRESHOLD_MAX_BUFFER;
     }
 
     if (new_bb != NULL) {
@@ -427,9 +465,9 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
      *     of everything up that point.
      *
      *  3) The request is in CONN_STATE_HANDLER state, and the brigade
-     *     contains at least THRESHOLD_MAX_BUFFER bytes in non-file
+     *     contains at least ctx->max_buffer bytes in non-file
      *     buckets: Do blocking writes until the amount of data in the
-     *     buffer is less than THRESHOLD_MAX_BUFFER.  (The point of this
+     *     buffer is less than ctx->max_buffer.  (The point of this
      *     rule is to provide flow control, in case a handler is
      *     streaming out lots of data faster than the data can be
      *     sent to the client.)
@@ -441,14 +479,17 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
      *     FDs being kept open by pipelined requests, possibly allowing a
      *     DoS).
      *
-     *  5) The brigade contains at least THRESHOLD_MIN_WRITE
+     *  5) The brigade contains at least ctx->min_write
      *     bytes: Do a nonblocking write of as much data as possible,
      *     then save the rest in ctx->buffered_bb.
+     *
+     * ctx->max_buffer and ctx->min_write start at THRESHOLD_MAX_BUFFER
+     * and THRESHOLD_MIN_WRITE, and follow the throughput of the
+     * connection (see adapt_thresholds()).
      */
 
     if (new_bb == NULL) {
-        rv = send_brigade_nonblocking(net->client_socket, bb,
-                                      &(ctx->bytes_written), c);
+        rv = send_brigade_nonblocking(net->client_socket, bb, ctx, c);
         if (APR_STATUS_IS_EAGAIN(rv)) {
             rv = APR_SUCCESS;
         }
@@ -460,6 +501,8 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
         return rv;
     }
 
+    adapt_thresholds(net->client_socket, ctx);
+
     bytes_in_brigade = 0;
     non_file_bytes_in_brigade = 0;
     eor_buckets_in_brigade = 0;
@@ -489,13 +532,13 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
         }
 
         if (APR_BUCKET_IS_FLUSH(bucket)                         ||
-            (non_file_bytes_in_brigade >= THRESHOLD_MAX_BUFFER) ||
+            (non_file_bytes_in_brigade >= ctx->max_buffer)      ||
             (eor_buckets_in_brigade > MAX_REQUESTS_IN_PIPELINE) )
         {
             if (APLOGctrace6(c)) {
                 char *reason = APR_BUCKET_IS_FLUSH(bucket) ?
                                "FLUSH bucket" :
-                               (non_file_bytes_in_brigade >= THRESHOLD_MAX_BUFFER) ?
+                               (non_file_bytes_in_brigade >= ctx->max_buffer) ?
                                "THRESHOLD_MAX_BUFFER" :
                                "MAX_REQUESTS_IN_PIPELINE";
                 ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, c,
@@ -516,8 +559,7 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
     if (flush_upto != NULL) {
         ctx->tmp_flush_bb = apr_brigade_split_ex(bb, flush_upto,
                                                  ctx->tmp_flush_bb);
-        rv = send_brigade_blocking(net->client_socket, bb,
-                                   &(ctx->bytes_written), c);
+        rv = send_brigade_blocking(net->client_socket, bb, ctx, c);
         if (rv != APR_SUCCESS) {
             /* The client has aborted the connection */
             c->aborted = 1;
@@ -526,9 +568,8 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
         APR_BRIGADE_CONCAT(bb, ctx->tmp_flush_bb);
     }
 
-    if (bytes_in_brigade >= THRESHOLD_MIN_WRITE) {
-        rv = send_brigade_nonblocking(net->client_socket, bb,
-                                      &(ctx->bytes_written), c);
+    if (bytes_in_brigade >= ctx->min_write) {
+        rv = send_brigade_nonblocking(net->client_socket, bb, ctx, c);
         if ((rv != APR_SUCCESS) && (!APR_STATUS_IS_EAGAIN(rv))) {
             /* The client has aborted the connection */
             c->aborted = 1;
@@ -586,7 +627,7 @@ static void setaside_remaining_output(ap_filter_t *f,
 
 static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                                              apr_bucket_brigade *bb,
-                                             apr_size_t *bytes_written,
+                                             core_output_filter_ctx_t *ctx,
                                              conn_rec *c)
 {
     apr_bucket *bucket, *next;
@@ -616,14 +657,14 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                 did_sendfile = 1;
                 if (nvec > 0) {
                     (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 1);
-                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+                    rv = writev_nonblocking(s, vec, nvec, bb, ctx, c);
                     nvec = 0;
                     if (rv != APR_SUCCESS) {
                         (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 0);
                         return rv;
                     }
                 }
-                rv = sendfile_nonblocking(s, bucket, bytes_written, c);
+                rv = sendfile_nonblocking(s, bucket, ctx, c);
                 if (nvec > 0) {
                     (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 0);
                 }
@@ -647,7 +688,7 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
             vec[nvec].iov_len = length;
             nvec++;
             if (nvec == MAX_IOVEC_TO_WRITE) {
-                rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+                rv = writev_nonblocking(s, vec, nvec, bb, ctx, c);
                 nvec = 0;
                 if (rv != APR_SUCCESS) {
                     return rv;
@@ -658,7 +699,7 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
     }
 
     if (nvec > 0) {
-        rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+        rv = writev_nonblocking(s, vec, nvec, bb, ctx, c);
         if (rv != APR_SUCCESS) {
             return rv;
         }
@@ -681,14 +722,14 @@ static void remove_empty_buckets(apr_bucket_brigade *bb)
 
 static apr_status_t send_brigade_blocking(apr_socket_t *s,
                                           apr_bucket_brigade *bb,
-                                          apr_size_t *bytes_written,
+                                          core_output_filter_ctx_t *ctx,
                                           conn_rec *c)
 {
     apr_status_t rv;
 
     rv = APR_SUCCESS;
     while (!APR_BRIGADE_EMPTY(bb)) {
-        rv = send_brigade_nonblocking(s, bb, bytes_written, c);
+        rv = send_brigade_nonblocking(s, bb, ctx, c);
         if (rv != APR_SUCCESS) {
             if (APR_STATUS_IS_EAGAIN(rv)) {
                 /* Wait until we can send more data */
@@ -717,7 +758,7 @@ static apr_status_t send_brigade_blocking(apr_socket_t *s,
 static apr_status_t writev_nonblocking(apr_socket_t *s,
                                        struct iovec *vec, apr_size_t nvec,
                                        apr_bucket_brigade *bb,
-                                       apr_size_t *cumulative_bytes_written,
+                                       core_output_filter_ctx_t *ctx,
                                        conn_rec *c)
 {
     apr_status_t rv = APR_SUCCESS, arv;
@@ -741,6 +782,7 @@ static apr_status_t writev_nonblocking(apr_socket_t *s,
     while (bytes_written < bytes_to_write) {
         apr_size_t n = 0;
         rv = apr_socket_sendv(s, vec + offset, nvec - offset, &n);
+        ctx->writev_calls++;
         if (n > 0) {
             bytes_written += n;
             for (i = offset; i < nvec; ) {
@@ -766,13 +808,17 @@ static apr_status_t writev_nonblocking(apr_socket_t *s,
             }
         }
         if (rv != APR_SUCCESS) {
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                ctx->eagain_count++;
+            }
             break;
         }
     }
     if ((ap__logio_add_bytes_out != NULL) && (bytes_written > 0)) {
         ap__logio_add_bytes_out(c, bytes_written);
     }
-    *cumulative_bytes_written += bytes_written;
+    ctx->bytes_written += bytes_written;
+    update_output_status(c, ctx);
 
     arv = apr_socket_timeout_set(s, old_timeout);
     if ((arv != APR_SUCCESS) && (rv == APR_SUCCESS)) {
@@ -787,7 +833,7 @@ static apr_status_t writev_nonblocking(apr_socket_t *s,
 
 static apr_status_t sendfile_nonblocking(apr_socket_t *s,
                                          apr_bucket *bucket,
-                                         apr_size_t *cumulative_bytes_written,
+                                         core_output_filter_ctx_t *ctx,
                                          conn_rec *c)
 {
     apr_status_t rv = APR_SUCCESS;
@@ -822,10 +868,14 @@ static apr_status_t sendfile_nonblocking(apr_socket_t *s,
             return arv;
         }
         rv = apr_socket_sendfile(s, fd, NULL, &file_offset, &n, 0);
+        ctx->sendfile_calls++;
         if (rv == APR_SUCCESS) {
             bytes_written += n;
             file_offset += n;
         }
+        else if (APR_STATUS_IS_EAGAIN(rv)) {
+            ctx->eagain_count++;
+        }
         arv = apr_socket_timeout_set(s, old_timeout);
         if ((arv != APR_SUCCESS) && (rv == APR_SUCCESS)) {
             rv = arv;
@@ -834,7 +884,8 @@ static apr_status_t sendfile_nonblocking(apr_socket_t *s,
     if ((ap__logio_add_bytes_out != NULL) && (bytes_written > 0)) {
         ap__logio_add_bytes_out(c, bytes_written);
     }
-    *cumulative_bytes_written += bytes_written;
+    ctx->bytes_written += bytes_written;
+    update_output_status(c, ctx);
     if ((bytes_written < file_length) && (bytes_written > 0)) {
         apr_bucket_split(bucket, bytes_written);
         APR_BUCKET_REMOVE(bucket);
@@ -848,3 +899,73 @@ static apr_status_t sendfile_nonblocking(apr_socket_t *s,
 }
 
 #endif
+
+/*
+ * Adapt the write thresholds of a connection to the amount of data it
+ * can have in flight, i.e. what drains from the socket buffer in one
+ * round trip: the congestion window times the segment size, as seen by
+ * TCP_INFO.  A connection able to send more per round trip than
+ * THRESHOLD_MAX_BUFFER may buffer up to that much before the handler
+ * is blocked, and writes in larger chunks; slow or short connections
+ * keep the defaults.  This is sampled each time the connection has
+ * written ctx->max_buffer bytes, so small responses never pay for it.
+ */
+static void adapt_thresholds(apr_socket_t *s,
+                             core_output_filter_ctx_t *ctx)
+{
+#if defined(TCP_INFO) && defined(__linux__)
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    apr_os_sock_t sd;
+    apr_size_t in_flight;
+
+    if (ctx->bytes_written - ctx->sampled_at < ctx->max_buffer) {
+        return;
+    }
+    ctx->sampled_at = ctx->bytes_written;
+
+    if (apr_os_sock_get(&sd, s) != APR_SUCCESS
+        || getsockopt(sd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) {
+        return;
+    }
+
+    in_flight = (apr_size_t)ti.tcpi_snd_cwnd * ti.tcpi_snd_mss;
+
+    ctx->max_buffer = in_flight;
+    if (ctx->max_buffer < THRESHOLD_MAX_BUFFER) {
+        ctx->max_buffer = THRESHOLD_MAX_BUFFER;
+    }
+    else if (ctx->max_buffer > THRESHOLD_MAX_BUFFER_LIMIT) {
+        ctx->max_buffer = THRESHOLD_MAX_BUFFER_LIMIT;
+    }
+
+    ctx->min_write = in_flight / 16;
+    if (ctx->min_write < THRESHOLD_MIN_WRITE) {
+        ctx->min_write = THRESHOLD_MIN_WRITE;
+    }
+    else if (ctx->min_write > THRESHOLD_MIN_WRITE_LIMIT) {
+        ctx->min_write = THRESHOLD_MIN_WRITE_LIMIT;
+    }
+#endif
+}
+
+/*
+ * Publish the output counters of the connection in the scoreboard, for
+ * mod_status.
+ */
+/* Backend connections are created without a scoreboard handle, so only
+ * the client connection of a worker shows up here. */
+static void update_output_status(conn_rec *c,
+                                 core_output_filter_ctx_t *ctx)
+{
+    worker_score *ws;
+
+    if (!ap_extended_status || !(ws = ap_get_scoreboard_worker(c->sbh))) {
+        return;
+    }
+
+    ws->conn_writev = ctx->writev_calls;
+    ws->conn_sendfile = ctx->sendfile_calls;
+    ws->conn_eagain = ctx->eagain_count;
+    ws->conn_written = ctx->bytes_written;
+}
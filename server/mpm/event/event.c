@@ -665,6 +665,14 @@ static int process_socket(apr_thread_t *thd, apr_pool_t * p, apr_socket_t * sock
          */
         cs->state = CONN_STATE_READ_REQUEST_LINE;
 
+        /* A clogging input filter such as mod_ssl has to complete its
+         * own handshake before any request data can be read.  Drive it
+         * with nonblocking AP_MODE_INIT reads so that a slow client does
+         * not tie up a worker for the round trips of the handshake.
+         */
+        if (c->clogging_input_filters && !c->aborted) {
+            cs->state = CONN_STATE_HANDSHAKE;
+        }
     }
     else {
         c = cs->c;
@@ -673,6 +681,48 @@ static int process_socket(apr_thread_t *thd, apr_pool_t * p, apr_socket_t * sock
         c->current_thread = thd;
     }
 
+    if (cs->state == CONN_STATE_HANDSHAKE) {
+        apr_status_t rv = APR_ECONNABORTED;
+
+        if (!c->aborted) {
+            apr_bucket_brigade *bb;
+
+            bb = apr_brigade_create(c->pool, c->bucket_alloc);
+            rv = ap_get_brigade(c->input_filters, bb, AP_MODE_INIT,
+                                APR_NONBLOCK_READ, 0);
+            apr_brigade_destroy(bb);
+        }
+
+        if (APR_STATUS_IS_EAGAIN(rv)) {
+            /* Handshake is waiting on the client: let the event thread
+             * poll for readability and hand the connection to the next
+             * idle worker, subject to the regular I/O timeout.
+             */
+            cs->expiration_time = ap_server_conf->timeout + apr_time_now();
+            apr_thread_mutex_lock(timeout_mutex);
+            APR_RING_INSERT_TAIL(&timeout_head, cs, conn_state_t, timeout_list);
+            apr_thread_mutex_unlock(timeout_mutex);
+            pt->bypass_push = 0;
+            cs->pfd.reqevents = APR_POLLIN;
+            rc = apr_pollset_add(event_pollset, &cs->pfd);
+            if (rc != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
+                             "process_socket: apr_pollset_add failure");
+                AP_DEBUG_ASSERT(rc == APR_SUCCESS);
+            }
+            return 1;
+        }
+        else if (rv != APR_SUCCESS || c->aborted) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ap_server_conf,
+                         "process_socket: connection handshake failed");
+            c->aborted = 1;
+            cs->state = CONN_STATE_LINGER;
+        }
+        else {
+            cs->state = CONN_STATE_READ_REQUEST_LINE;
+        }
+    }
+
     if (c->clogging_input_filters && !c->aborted) {
         /* Since we have an input filter which 'cloggs' the input stream,
          * like mod_ssl, lets just do the normal read from input filters,
@@ -1145,6 +1195,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     cs->state = CONN_STATE_READ_REQUEST_LINE;
                     break;
                 case CONN_STATE_WRITE_COMPLETION:
+                case CONN_STATE_HANDSHAKE:
                     break;
                 default:
                     ap_log_error(APLOG_MARK, APLOG_ERR, rc,
@@ -1281,11 +1332,16 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             cs = APR_RING_FIRST(&keepalive_timeout_head);
         }
 
-        /* Step 2: write completion timeouts */
+        /* Step 2: write completion and handshake timeouts */
         cs = APR_RING_FIRST(&timeout_head);
         while (!APR_RING_EMPTY(&timeout_head, conn_state_t, timeout_list)
                && cs->expiration_time < timeout_time) {
 
+            if (cs->state == CONN_STATE_HANDSHAKE) {
+                /* Nothing useful can be flushed to a client that never
+                 * finished the handshake; skip the lingering close. */
+                cs->c->aborted = 1;
+            }
             cs->state = CONN_STATE_LINGER;
             APR_RING_REMOVE(cs, timeout_list);
             apr_thread_mutex_unlock(timeout_mutex);
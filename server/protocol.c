@@ -686,6 +686,132 @@ static int read_request_line(request_rec *r, apr_bucket_brigade *bb)
     return 1;
 }
 
+#if !APR_CHARSET_EBCDIC
+/*
+ * Pipelined clients send many request heads per packet, so once the
+ * request line has been read the rest of the head is usually buffered in
+ * the input filters already.  Peek at what is there and, if it holds the
+ * complete header block, parse all of its fields in one pass and consume
+ * the block with a single read instead of one GETLINE call per line.
+ *
+ * Returns 0 without consuming anything when the block is not buffered in
+ * full or needs the line by line path (folded or oversized fields, too
+ * many of them, lines without a colon), which reports the errors.
+ *
+ * The block is parsed as it comes off the wire, so EBCDIC builds, which
+ * translate every line in ap_rgetline(), only have the line by line path.
+ */
+static int get_mime_headers_buffered(request_rec *r, apr_bucket_brigade *bb)
+{
+    apr_size_t limit = r->server->limit_req_fieldsize + 2;
+    int fields_read = 0;
+    char *buf, *end, *line, *eol;
+    apr_size_t len;
+    apr_off_t used;
+    apr_status_t rv;
+
+    apr_brigade_cleanup(bb);
+    rv = ap_get_brigade(r->input_filters, bb, AP_MODE_SPECULATIVE,
+                        APR_NONBLOCK_READ, HUGE_STRING_LEN);
+    if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(bb)) {
+        apr_brigade_cleanup(bb);
+        return 0;
+    }
+    rv = apr_brigade_pflatten(bb, &buf, &len, r->pool);
+    apr_brigade_cleanup(bb);
+    if (rv != APR_SUCCESS) {
+        return 0;
+    }
+    end = buf + len;
+
+    /* Find the blank line ending the block, and check every field on the
+     * way so that nothing has to be undone if we have to back out. */
+    for (line = buf; ; line = eol + 1) {
+        eol = memchr(line, APR_ASCII_LF, end - line);
+        if (!eol || (apr_size_t)(eol - line) + 1 > limit) {
+            return 0;
+        }
+        if (eol == line || (eol == line + 1 && *line == APR_ASCII_CR)) {
+            break;
+        }
+        if (*line == ' ' || *line == '\t'
+            || !memchr(line, ':', eol - line)
+            || memchr(line, '\0', eol - line)
+            || (r->server->limit_req_fields
+                && ++fields_read > r->server->limit_req_fields)) {
+            return 0;
+        }
+    }
+    used = eol + 1 - buf;
+
+    for (line = buf; ; line = eol + 1) {
+        char *value, *tmp_field;
+
+        eol = memchr(line, APR_ASCII_LF, end - line);
+        len = eol - line;
+        if (len && line[len - 1] == APR_ASCII_CR) {
+            --len;
+        }
+        line[len] = '\0';
+        if (len == 0) {
+            break;
+        }
+
+        value = strchr(line, ':');
+        tmp_field = value - 1; /* last character of field-name */
+
+        *value++ = '\0'; /* NUL-terminate at colon */
+
+        while (*value == ' ' || *value == '\t') {
+            ++value;            /* Skip to start of value   */
+        }
+
+        /* Strip LWS after field-name: */
+        while (tmp_field > line
+               && (*tmp_field == ' ' || *tmp_field == '\t')) {
+            *tmp_field-- = '\0';
+        }
+
+        /* Strip LWS after field-value: */
+        tmp_field = line + len - 1;
+        while (tmp_field > value
+               && (*tmp_field == ' ' || *tmp_field == '\t')) {
+            *tmp_field-- = '\0';
+        }
+
+        apr_table_addn(r->headers_in, line, value);
+    }
+
+    /* Now consume what was parsed from the input filters. */
+    while (used > 0) {
+        apr_off_t got;
+
+        rv = ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES,
+                            APR_BLOCK_READ, used);
+        if (rv == APR_SUCCESS) {
+            apr_brigade_length(bb, 1, &got);
+            apr_brigade_cleanup(bb);
+            if (got == 0) {
+                rv = APR_EOF;
+            }
+        }
+        if (rv != APR_SUCCESS) {
+            if (rv == APR_TIMEUP) {
+                r->status = HTTP_REQUEST_TIME_OUT;
+            }
+            else {
+                r->status = HTTP_BAD_REQUEST;
+            }
+            return 1;
+        }
+        used -= got;
+    }
+
+    apr_table_compress(r->headers_in, APR_OVERLAP_TABLES_MERGE);
+    return 1;
+}
+#endif /* !APR_CHARSET_EBCDIC */
+
 AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb)
 {
     char *last_field = NULL;
@@ -697,6 +823,12 @@ AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb
     int fields_read = 0;
     char *tmp_field;
 
+#if !APR_CHARSET_EBCDIC
+    if (get_mime_headers_buffered(r, bb)) {
+        return;
+    }
+#endif
+
     /*
      * Read header lines until we get the empty separator line, a read error,
      * the connection closes (EOF), reach the server limit, or we timeout.
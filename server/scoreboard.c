@@ -18,6 +18,7 @@
 #include "apr_strings.h"
 #include "apr_portable.h"
 #include "apr_lib.h"
+#include "apr_atomic.h"
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -108,6 +109,19 @@ struct ap_sb_handle_t {
 static int server_limit, thread_limit;
 static apr_size_t scoreboard_size;
 
+/* states of a histogram_key */
+#define HISTOGRAM_KEY_FREE      0
+#define HISTOGRAM_KEY_CLAIMED   1
+#define HISTOGRAM_KEY_READY     2
+
+/* entries of its table looked at for a histogram_key */
+#define HISTOGRAM_KEY_PROBES    8
+
+/* values of worker_score.counted_as */
+#define COUNTED_AS_NONE         0
+#define COUNTED_AS_READY        1
+#define COUNTED_AS_BUSY         2
+
 /*
  * ToDo:
  * This function should be renamed to cleanup_shared
@@ -134,6 +148,9 @@ AP_DECLARE(int) ap_calc_scoreboard_size(void)
     scoreboard_size = sizeof(global_score);
     scoreboard_size += sizeof(process_score) * server_limit;
     scoreboard_size += sizeof(worker_score) * server_limit * thread_limit;
+    scoreboard_size += sizeof(histogram_key) * AP_HISTOGRAM_KEYS;
+    scoreboard_size += sizeof(histogram_score) * AP_HISTOGRAM_KEYS
+                       * AP_HISTOGRAM_STRIPES;
 
     pfn_ap_logio_get_last_bytes = APR_RETRIEVE_OPTIONAL_FN(ap_logio_get_last_bytes);
 
@@ -159,6 +176,11 @@ void ap_init_scoreboard(void *shared_score)
         ap_scoreboard_image->servers[i] = (worker_score *)more_storage;
         more_storage += thread_limit * sizeof(worker_score);
     }
+    ap_scoreboard_image->histogram_keys = (histogram_key *)more_storage;
+    more_storage += sizeof(histogram_key) * AP_HISTOGRAM_KEYS;
+    ap_scoreboard_image->histograms = (histogram_score *)more_storage;
+    more_storage += sizeof(histogram_score) * AP_HISTOGRAM_KEYS
+                    * AP_HISTOGRAM_STRIPES;
     ap_assert(more_storage == (char*)shared_score + scoreboard_size);
     ap_scoreboard_image->global->server_limit = server_limit;
     ap_scoreboard_image->global->thread_limit = thread_limit;
@@ -299,12 +321,19 @@ int ap_create_scoreboard(apr_pool_t *p, ap_scoreboard_e sb_type)
 
     if (ap_scoreboard_image) {
         ap_scoreboard_image->global->restart_time = apr_time_now();
+        memset((void *)ap_scoreboard_image->global->histogram_overflow, 0,
+               sizeof(ap_scoreboard_image->global->histogram_overflow));
         memset(ap_scoreboard_image->parent, 0,
                sizeof(process_score) * server_limit);
         for (i = 0; i < server_limit; i++) {
             memset(ap_scoreboard_image->servers[i], 0,
                    sizeof(worker_score) * thread_limit);
         }
+        memset(ap_scoreboard_image->histogram_keys, 0,
+               sizeof(histogram_key) * AP_HISTOGRAM_KEYS);
+        memset(ap_scoreboard_image->histograms, 0,
+               sizeof(histogram_score) * AP_HISTOGRAM_KEYS
+               * AP_HISTOGRAM_STRIPES);
         return OK;
     }
 
@@ -358,10 +387,135 @@ AP_DECLARE(int) ap_exists_scoreboard_image(void)
     return (ap_scoreboard_image ? 1 : 0);
 }
 
+AP_DECLARE(int) ap_histogram_bucket(apr_uint64_t value)
+{
+    int msb;
+
+    if (value < 4) {
+        return (int)value;
+    }
+    if (value >> 33) {
+        return AP_HISTOGRAM_BUCKETS - 1;
+    }
+    for (msb = 2; value >> (msb + 1); msb++)
+        ;
+    /* four buckets per power of two, told apart by the two bits below
+     * the highest one */
+    return ((msb - 1) << 2) + (int)((value >> (msb - 2)) & 3);
+}
+
+AP_DECLARE(apr_uint64_t) ap_histogram_bucket_max(int bucket)
+{
+    int msb;
+
+    if (bucket < 4) {
+        return bucket;
+    }
+    if (bucket >= AP_HISTOGRAM_BUCKETS - 1) {
+        return ~(apr_uint64_t)0;
+    }
+    msb = (bucket >> 2) + 1;
+    return ((apr_uint64_t)(5 + (bucket & 3)) << (msb - 2)) - 1;
+}
+
+/* FNV-1a of the kind and the (possibly truncated) name of a key */
+static apr_uint32_t histogram_hash(int kind, const char *name)
+{
+    apr_uint32_t hash = 2166136261U ^ (apr_uint32_t)kind;
+    int i;
+
+    hash *= 16777619;
+    for (i = 0; name[i] && i < AP_HISTOGRAM_NAME_LEN - 1; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/*
+ * Find the key of a histogram in the open addressed table of its kind in
+ * the scoreboard, or claim a free entry for it.  Entries are never
+ * released until the next restart, so once a key is READY its name stays
+ * put.  An entry which another thread is claiming is passed over; should
+ * that one be for the same name, the two keys are simply summed up by the
+ * readers.  Only HISTOGRAM_KEY_PROBES entries are looked at, so that a
+ * (nearly) full table costs every request a few compares rather than a
+ * walk over all of it.  Returns -1 when there is no room.
+ */
+static int histogram_key_find(int kind, const char *name)
+{
+    apr_uint32_t hash = histogram_hash(kind, name);
+    int first, nkeys, i, n;
+
+    if (kind == AP_HISTOGRAM_VHOST) {
+        first = 0;
+        nkeys = AP_HISTOGRAM_VHOST_KEYS;
+    }
+    else {
+        first = AP_HISTOGRAM_VHOST_KEYS;
+        nkeys = AP_HISTOGRAM_HANDLER_KEYS;
+    }
+
+    for (n = 0, i = first + hash % nkeys; n < HISTOGRAM_KEY_PROBES;
+         n++, i = first + (i - first + 1) % nkeys) {
+        histogram_key *key = &ap_scoreboard_image->histogram_keys[i];
+        apr_uint32_t state = apr_atomic_read32(&key->state);
+
+        if (state == HISTOGRAM_KEY_FREE) {
+            if (apr_atomic_cas32(&key->state, HISTOGRAM_KEY_CLAIMED,
+                                 HISTOGRAM_KEY_FREE) == HISTOGRAM_KEY_FREE) {
+                key->hash = hash;
+                key->kind = kind;
+                apr_cpystrn(key->name, name, sizeof(key->name));
+                /* the cas is a full barrier: the name is visible first */
+                apr_atomic_cas32(&key->state, HISTOGRAM_KEY_READY,
+                                 HISTOGRAM_KEY_CLAIMED);
+                return i;
+            }
+            state = apr_atomic_read32(&key->state);
+        }
+        if (state == HISTOGRAM_KEY_READY && key->hash == hash
+            && key->kind == kind
+            && !strncmp(key->name, name, sizeof(key->name) - 1)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void histogram_count(int stripe, int kind, const char *name,
+                            apr_interval_time_t usecs, apr_off_t bytes)
+{
+    histogram_score *hs;
+    int key = histogram_key_find(kind, name);
+
+    if (key < 0) {
+        global_score *gs = ap_scoreboard_image->global;
+
+        /* log the first one after a restart */
+        if (apr_atomic_inc32(&gs->histogram_overflow[kind - 1]) == 0) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, ap_server_conf,
+                         "no room for the %s %s in the request histograms, "
+                         "its requests are only counted as overflow",
+                         kind == AP_HISTOGRAM_VHOST ? "virtual host"
+                                                    : "handler", name);
+        }
+        return;
+    }
+    hs = &ap_scoreboard_image->histograms[key * AP_HISTOGRAM_STRIPES
+                                          + stripe];
+    apr_atomic_inc32(&hs->time[ap_histogram_bucket(usecs > 0 ? usecs : 0)]);
+    apr_atomic_inc32(&hs->size[ap_histogram_bucket(bytes > 0 ? bytes : 0)]);
+}
+
 AP_DECLARE(void) ap_increment_counts(ap_sb_handle_t *sb, request_rec *r)
 {
     worker_score *ws;
+    process_score *ps;
     apr_off_t bytes;
+    apr_interval_time_t usecs;
+    char vhost[AP_HISTOGRAM_NAME_LEN];
+    int stripe;
 
     if (!sb)
         return;
@@ -380,12 +534,30 @@ AP_DECLARE(void) ap_increment_counts(ap_sb_handle_t *sb, request_rec *r)
 #ifdef HAVE_TIMES
     times(&ws->times);
 #endif
+    ps = &ap_scoreboard_image->parent[sb->child_num];
+    apr_atomic_inc32(&ps->access_count);
+    apr_atomic_add32(&ps->kbytes_served,
+                     (apr_uint32_t)(((ws->bytes_served + bytes) >> 10)
+                                    - (ws->bytes_served >> 10)));
+
     ws->access_count++;
     ws->my_access_count++;
     ws->conn_count++;
     ws->bytes_served += bytes;
     ws->my_bytes_served += bytes;
     ws->conn_bytes += bytes;
+
+    /* neighbouring slots land in different stripes */
+    stripe = (sb->child_num * thread_limit + sb->thread_num)
+             % AP_HISTOGRAM_STRIPES;
+    usecs = apr_time_now() - r->request_time;
+    apr_snprintf(vhost, sizeof(vhost), "%s:%u",
+                 r->server->server_hostname ? r->server->server_hostname : "",
+                 (unsigned)r->connection->local_addr->port);
+    histogram_count(stripe, AP_HISTOGRAM_VHOST, vhost, usecs, bytes);
+    histogram_count(stripe, AP_HISTOGRAM_HANDLER,
+                    r->handler ? r->handler : "default-handler",
+                    usecs, bytes);
 }
 
 AP_DECLARE(int) ap_find_child_by_pid(apr_proc_t *pid)
@@ -448,6 +620,22 @@ static void copy_request(char *rbuf, apr_size_t rbuflen, request_rec *r)
     }
 }
 
+/* How a worker in the given state is counted in its process_score, the
+ * same way as mod_status counts the workers of the scoreboard */
+static apr_uint32_t counted_as(int status)
+{
+    switch (status) {
+    case SERVER_DEAD:
+    case SERVER_STARTING:
+    case SERVER_IDLE_KILL:
+        return COUNTED_AS_NONE;
+    case SERVER_READY:
+        return COUNTED_AS_READY;
+    default:
+        return COUNTED_AS_BUSY;
+    }
+}
+
 static int update_child_status_internal(int child_num,
                                         int thread_num,
                                         int status,
@@ -458,6 +646,7 @@ static int update_child_status_internal(int child_num,
     worker_score *ws;
     process_score *ps;
     int mpm_generation;
+    apr_uint32_t as, old_as;
 
     ws = &ap_scoreboard_image->servers[child_num][thread_num];
     old_status = ws->status;
@@ -465,6 +654,26 @@ static int update_child_status_internal(int child_num,
 
     ps = &ap_scoreboard_image->parent[child_num];
 
+    /* The exchange orders concurrent updates of the slot (the parent
+     * marking a worker of a dead child, say), so the counts of the
+     * process always add up to the workers counted as ready or busy. */
+    as = counted_as(status);
+    old_as = apr_atomic_xchg32(&ws->counted_as, as);
+    if (as != old_as) {
+        if (old_as == COUNTED_AS_READY) {
+            apr_atomic_dec32(&ps->ready);
+        }
+        else if (old_as == COUNTED_AS_BUSY) {
+            apr_atomic_dec32(&ps->busy);
+        }
+        if (as == COUNTED_AS_READY) {
+            apr_atomic_inc32(&ps->ready);
+        }
+        else if (as == COUNTED_AS_BUSY) {
+            apr_atomic_inc32(&ps->busy);
+        }
+    }
+
     if (status == SERVER_READY
         && old_status == SERVER_STARTING) {
         ws->thread_num = child_num * thread_limit + thread_num;
@@ -484,6 +693,10 @@ static int update_child_status_internal(int child_num,
             }
             ws->conn_count = 0;
             ws->conn_bytes = 0;
+            ws->conn_writev = 0;
+            ws->conn_sendfile = 0;
+            ws->conn_eagain = 0;
+            ws->conn_written = 0;
         }
         if (r) {
             apr_cpystrn(ws->client, ap_get_remote_host(c, r->per_dir_config,
@@ -592,3 +805,26 @@ AP_DECLARE(global_score *) ap_get_scoreboard_global()
 {
     return ap_scoreboard_image->global;
 }
+
+AP_DECLARE(histogram_key *) ap_get_scoreboard_histogram_key(int x)
+{
+    histogram_key *key;
+
+    if ((x < 0) || (x >= AP_HISTOGRAM_KEYS)) {
+        return(NULL); /* Out of range */
+    }
+    key = &ap_scoreboard_image->histogram_keys[x];
+    if (apr_atomic_read32(&key->state) != HISTOGRAM_KEY_READY) {
+        return NULL;
+    }
+    return key;
+}
+
+AP_DECLARE(histogram_score *) ap_get_scoreboard_histogram(int x, int y)
+{
+    if (((x < 0) || (x >= AP_HISTOGRAM_KEYS)) ||
+        ((y < 0) || (y >= AP_HISTOGRAM_STRIPES))) {
+        return(NULL); /* Out of range */
+    }
+    return &ap_scoreboard_image->histograms[x * AP_HISTOGRAM_STRIPES + y];
+}
@@ -23,6 +23,7 @@
 #include "apr.h"
 #include "apr_strings.h"
 #include "apr_lib.h"
+#include "apr_hash.h"
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -50,13 +51,38 @@ APLOG_USE_MODULE(core);
  * lists of name-vhosts.
  */
 typedef struct name_chain name_chain;
+typedef struct name_index name_index;
 struct name_chain {
     name_chain *next;
     server_addr_rec *sar;       /* the record causing it to be in
                                  * this chain (needed for port comparisons) */
     server_rec *server;         /* the server to use on a match */
+    name_index *index;          /* names of all the servers in the chain */
+    int pos;                    /* position in the chain */
 };
 
+/* Index of the names of the servers of a name_chain, so that the run-time
+ * lookup doesn't have to compare the host with every ServerName and
+ * ServerAlias in turn.  Each name maps to the list of chain entries
+ * having it, in chain order; as a name may match more than one entry
+ * the one with the lowest position (and a matching port) wins, exactly
+ * as when walking the chain.
+ */
+typedef struct {
+    name_chain *nc;
+    const char *pattern;        /* wildcard alias, for the complex list */
+    int virthost;               /* name comes from the <VirtualHost> line */
+} name_entry;
+
+struct name_index {
+    apr_hash_t *names;          /* lowercase name -> array of name_entry */
+    apr_hash_t *wild;           /* "*.domain" aliases, keyed by ".domain" */
+    apr_array_header_t *complex; /* other wildcard aliases (name_entry) */
+};
+
+/* longest host name looked up in the index, else we walk the chain */
+#define VHOST_INDEX_MAX_NAME 256
+
 /* meta-list of ip addresses.  Each server_rec can be in possibly multiple
  * hash chains since it can have multiple ips.
  */
@@ -369,6 +395,8 @@ static name_chain *new_name_chain(apr_pool_t *p,
     new->server = s;
     new->sar = sar;
     new->next = NULL;
+    new->index = NULL;
+    new->pos = 0;
     return new;
 }
 
@@ -540,6 +568,95 @@ static void add_name_vhost_config(apr_pool_t *p, server_rec *main_s,
    }
 }
 
+static void index_add(apr_pool_t *p, apr_hash_t *h, const char *name,
+                      name_chain *nc, int virthost)
+{
+    apr_array_header_t *arr;
+    name_entry *e;
+    char *key = apr_pstrdup(p, name);
+
+    ap_str_tolower(key);
+    arr = apr_hash_get(h, key, APR_HASH_KEY_STRING);
+    if (!arr) {
+        arr = apr_array_make(p, 1, sizeof(name_entry));
+        apr_hash_set(h, key, APR_HASH_KEY_STRING, arr);
+    }
+    else {
+        /* The addresses of a server are adjacent in the chain, and only
+         * the first one with a given port can ever match.
+         */
+        e = &APR_ARRAY_IDX(arr, arr->nelts - 1, name_entry);
+        if (e->nc->server == nc->server && e->virthost == virthost
+            && e->nc->sar->host_port == nc->sar->host_port) {
+            return;
+        }
+    }
+    e = (name_entry *)apr_array_push(arr);
+    e->nc = nc;
+    e->pattern = NULL;
+    e->virthost = virthost;
+}
+
+static void index_add_names(apr_pool_t *p, name_index *ni, name_chain *nc)
+{
+    server_rec *s = nc->server;
+    apr_array_header_t *names;
+    char **name;
+    int i;
+
+    index_add(p, ni->names, nc->sar->virthost, nc, 1);
+    index_add(p, ni->names, s->server_hostname, nc, 0);
+
+    if ((names = s->names)) {
+        name = (char **)names->elts;
+        for (i = 0; i < names->nelts; ++i) {
+            if (name[i]) {
+                index_add(p, ni->names, name[i], nc, 0);
+            }
+        }
+    }
+    if ((names = s->wild_names)) {
+        name = (char **)names->elts;
+        for (i = 0; i < names->nelts; ++i) {
+            if (!name[i]) {
+                continue;
+            }
+            /* "*.domain" is the common case and hashes on ".domain" */
+            if (name[i][0] == '*' && name[i][1] == '.'
+                && !ap_strchr_c(name[i] + 1, '*')
+                && !ap_strchr_c(name[i] + 1, '?')) {
+                index_add(p, ni->wild, name[i] + 1, nc, 0);
+            }
+            else {
+                name_entry *e = (name_entry *)apr_array_push(ni->complex);
+                e->nc = nc;
+                e->pattern = name[i];
+                e->virthost = 0;
+            }
+        }
+    }
+}
+
+static void build_name_index(apr_pool_t *p, ipaddr_chain *ic)
+{
+    name_index *ni;
+    name_chain *nc;
+    int pos = 0;
+
+    if (!ic->names) {
+        return;
+    }
+    ni = apr_palloc(p, sizeof(*ni));
+    ni->names = apr_hash_make(p);
+    ni->wild = apr_hash_make(p);
+    ni->complex = apr_array_make(p, 0, sizeof(name_entry));
+    for (nc = ic->names; nc; nc = nc->next) {
+        nc->pos = pos++;
+        nc->index = ni;
+        index_add_names(p, ni, nc);
+    }
+}
+
 /* compile the tables and such we need to do the run-time vhost lookups */
 AP_DECLARE(void) ap_fini_vhost_config(apr_pool_t *p, server_rec *main_s)
 {
@@ -646,6 +763,20 @@ AP_DECLARE(void) ap_fini_vhost_config(apr_pool_t *p, server_rec *main_s)
         }
     }
 
+    /* index the names of the name-vhosts of each address */
+    for (i = 0; i < IPHASH_TABLE_SIZE; ++i) {
+        ipaddr_chain *ic;
+        for (ic = iphash_table[i]; ic; ic = ic->next) {
+            build_name_index(p, ic);
+        }
+    }
+    {
+        ipaddr_chain *ic;
+        for (ic = default_list; ic; ic = ic->next) {
+            build_name_index(p, ic);
+        }
+    }
+
 #ifdef IPHASH_STATISTICS
     dump_iphash_statistics(main_s);
 #endif
@@ -785,6 +916,105 @@ static int matches_aliases(server_rec *s, const char *host)
 }
 
 
+/* first entry of arr (in chain order) usable on port, or best */
+static name_chain *index_best(apr_array_header_t *arr, apr_port_t port,
+                              int virthost, name_chain *best)
+{
+    int i;
+
+    for (i = 0; arr && i < arr->nelts; ++i) {
+        name_entry *e = &APR_ARRAY_IDX(arr, i, name_entry);
+        server_addr_rec *sar = e->nc->sar;
+
+        if (best && e->nc->pos >= best->pos) {
+            break;
+        }
+        if ((e->virthost && !virthost)
+            || (sar->host_port != 0 && port != sar->host_port)) {
+            continue;
+        }
+        return e->nc;
+    }
+    return best;
+}
+
+/* Find the first server of the chain nc whose ServerName or ServerAlias
+ * (or, with virthost, <VirtualHost> address) matches host, as walking the
+ * chain and calling matches_aliases() would.
+ */
+static server_rec *find_name_vhost(name_chain *nc, const char *host,
+                                   apr_port_t port, int virthost)
+{
+    name_index *ni = nc->index;
+    name_chain *best;
+    char key[VHOST_INDEX_MAX_NAME];
+    const char *dot;
+    apr_size_t len = strlen(host);
+    int i;
+
+    if (!ni || len >= sizeof(key)) {
+        server_rec *last_s = NULL;
+
+        for (; nc; nc = nc->next) {
+            if (nc->sar->host_port != 0 && port != nc->sar->host_port) {
+                continue;
+            }
+            if (virthost && !strcasecmp(host, nc->sar->virthost)) {
+                return nc->server;
+            }
+            if (nc->server == last_s) {
+                continue;
+            }
+            last_s = nc->server;
+            if (matches_aliases(nc->server, host)) {
+                return nc->server;
+            }
+        }
+        return NULL;
+    }
+
+    for (i = 0; host[i]; ++i) {
+        key[i] = apr_tolower(host[i]);
+    }
+    key[i] = '\0';
+
+    best = index_best(apr_hash_get(ni->names, key, len), port, virthost, NULL);
+
+    /* "*.domain" aliases, for each domain host belongs to */
+    for (dot = strchr(key, '.'); dot; dot = strchr(dot + 1, '.')) {
+        best = index_best(apr_hash_get(ni->wild, dot, APR_HASH_KEY_STRING),
+                          port, 0, best);
+    }
+
+    for (i = 0; i < ni->complex->nelts; ++i) {
+        name_entry *e = &APR_ARRAY_IDX(ni->complex, i, name_entry);
+        server_addr_rec *sar = e->nc->sar;
+
+        if (best && e->nc->pos >= best->pos) {
+            break;
+        }
+        if ((sar->host_port == 0 || port == sar->host_port)
+            && !ap_strcasecmp_match(host, e->pattern)) {
+            best = e->nc;
+            break;
+        }
+    }
+
+    return best ? best->server : NULL;
+}
+
+AP_DECLARE(server_rec *) ap_vhost_lookup_name(conn_rec *conn,
+                                              const char *host)
+{
+    name_chain *nc = conn->vhost_lookup_data;
+
+    if (!nc) {
+        return matches_aliases(conn->base_server, host)
+               ? conn->base_server : NULL;
+    }
+    return find_name_vhost(nc, host, conn->local_addr->port, 0);
+}
+
 /* Suppose a request came in on the same socket as this r, and included
  * a header "Host: host:port", would it map to r->server?  It's more
  * than just that though.  When we do the normal matches for each request
@@ -848,60 +1078,17 @@ static void check_hostalias(request_rec *r)
      * - except for the addresses from the VirtualHost line, none of the other
      *   names we'll match have ports associated with them
      */
-    const char *host = r->hostname;
-    apr_port_t port;
     server_rec *s;
-    server_rec *last_s;
-    name_chain *src;
-
-    last_s = NULL;
-
-    port = r->connection->local_addr->port;
 
     /* Recall that the name_chain is a list of server_addr_recs, some of
-     * whose ports may not match.  Also each server may appear more than
-     * once in the chain -- specifically, it will appear once for each
-     * address from its VirtualHost line which matched.  We only want to
-     * do the full ServerName/ServerAlias comparisons once for each
-     * server, fortunately we know that all the VirtualHost addresses for
-     * a single server are adjacent to each other.
+     * whose ports may not match.  find_name_vhost() looks the name up in
+     * the index of the chain, and returns the first matching server.
      */
-
-    for (src = r->connection->vhost_lookup_data; src; src = src->next) {
-        server_addr_rec *sar;
-
-        /* We only consider addresses on the name_chain which have a matching
-         * port
-         */
-        sar = src->sar;
-        if (sar->host_port != 0 && port != sar->host_port) {
-            continue;
-        }
-
-        s = src->server;
-
-        /* does it match the virthost from the sar? */
-        if (!strcasecmp(host, sar->virthost)) {
-            goto found;
-        }
-
-        if (s == last_s) {
-            /* we've already done ServerName and ServerAlias checks for this
-             * vhost
-             */
-            continue;
-        }
-        last_s = s;
-
-        if (matches_aliases(s, host)) {
-            goto found;
-        }
+    s = find_name_vhost(r->connection->vhost_lookup_data, r->hostname,
+                        r->connection->local_addr->port, 1);
+    if (s) {
+        r->server = s;
     }
-    return;
-
-found:
-    /* s is the first matching server, we're done */
-    r->server = s;
 }
 
 
@@ -2,6 +2,7 @@ htpasswd_LTFLAGS=""
 htdigest_LTFLAGS=""
 rotatelogs_LTFLAGS=""
 logresolve_LTFLAGS=""
+logdecode_LTFLAGS=""
 htdbm_LTFLAGS=""
 ab_LTFLAGS=""
 checkgid_LTFLAGS=""
@@ -15,6 +16,7 @@ if test "$enableval" = "yes" ; then
   APR_ADDTO(htdigest_LTFLAGS, [-static])
   APR_ADDTO(rotatelogs_LTFLAGS, [-static])
   APR_ADDTO(logresolve_LTFLAGS, [-static])
+  APR_ADDTO(logdecode_LTFLAGS, [-static])
   APR_ADDTO(htdbm_LTFLAGS, [-static])
   APR_ADDTO(ab_LTFLAGS, [-static])
   APR_ADDTO(checkgid_LTFLAGS, [-static])
@@ -60,6 +62,15 @@ fi
 ])
 APACHE_SUBST(logresolve_LTFLAGS)
 
+AC_ARG_ENABLE(static-logdecode,APACHE_HELP_STRING(--enable-static-logdecode,Build a statically linked version of logdecode),[
+if test "$enableval" = "yes" ; then
+  APR_ADDTO(logdecode_LTFLAGS, [-static])
+else
+  APR_REMOVEFROM(logdecode_LTFLAGS, [-static])
+fi
+])
+APACHE_SUBST(logdecode_LTFLAGS)
+
 AC_ARG_ENABLE(static-htdbm,APACHE_HELP_STRING(--enable-static-htdbm,Build a statically linked version of htdbm),[
 if test "$enableval" = "yes" ; then
   APR_ADDTO(htdbm_LTFLAGS, [-static])
@@ -0,0 +1,384 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * logdecode -- Decode the binary access logs of mod_log_config
+ *
+ * Usage: logdecode [-t] [logfile ...] > decoded_log
+ *
+ * Reads the records written with "LogRecordFormat Binary" from the
+ * logfiles, in turn, (or stdin) and prints one line per logged request:
+ * a JSON object, as written with "LogRecordFormat JSON", or with -t the
+ * fields separated by tabs, preceded by a line with the field names
+ * whenever the schema changes.
+ *
+ * Each child of the server writes the schema of its rows once, before
+ * the first of them, so a file started by rotatelogs may have rows whose
+ * schema is in an earlier file: give the files in the order they were
+ * written.
+ *
+ * Every record starts with its length (4 bytes, big endian, not counting
+ * itself) and its kind:
+ *
+ *   schema:  'S' id(4) nfields(2) { type(1) namelen(2) name } ...
+ *   row:     'R' id(4) { field } ...
+ *   string field: len(4) bytes, or 0xffffffff for a missing value
+ *   number field: 1 and the value (8 bytes, two's complement), or 0
+ */
+
+#include "apr.h"
+#include "apr_lib.h"
+#include "apr_hash.h"
+#include "apr_getopt.h"
+#include "apr_strings.h"
+#include "apr_file_io.h"
+
+#if APR_HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#define NL APR_EOL_STR
+
+#define RECORD_SCHEMA   'S'
+#define RECORD_ROW      'R'
+#define FIELD_NUMBER    1
+#define FIELD_NULL      0xffffffff
+
+/* no sane log entry comes anywhere near this */
+#define MAX_RECORD_LEN  (16 * 1024 * 1024)
+
+typedef struct {
+    int nfields;
+    unsigned char *types;
+    const char **names;
+} schema_t;
+
+static apr_file_t *errfile;
+static apr_file_t *outfile;
+static const char *shortname = "logdecode";
+static apr_hash_t *schemas;
+static schema_t *last_schema;
+static int tabs = 0;
+
+static void usage(void)
+{
+    apr_file_printf(errfile,
+    "%s -- Decode binary Apache access logs."                                NL
+    "Usage: %s [-t] [LOGFILE ...]"                                           NL
+                                                                             NL
+    "Options:"                                                               NL
+    "  -t   Print the fields separated by tabs instead of as JSON objects."  NL
+                                                                             NL
+    "The log is read from standard input when no LOGFILE is given.  Give"    NL
+    "the files of a rotated log in the order they were written, as rows"     NL
+    "may be preceded by their schema only in an earlier file."               NL,
+    shortname, shortname);
+
+    exit(1);
+}
+
+static void corrupt(const char *what)
+{
+    apr_file_printf(errfile, "%s: corrupt log: %s" NL, shortname, what);
+    exit(1);
+}
+
+static apr_uint32_t get16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static apr_uint32_t get32(const unsigned char *p)
+{
+    return ((apr_uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void print_string(const char *s, apr_size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *c = (const unsigned char *)s;
+
+    for (; len; --len, ++c) {
+        if (tabs) {
+            if (*c == '\t') {
+                apr_file_puts("\\t", outfile);
+            }
+            else if (*c == '\n') {
+                apr_file_puts("\\n", outfile);
+            }
+            else {
+                apr_file_putc(*c, outfile);
+            }
+        }
+        else if (*c == '"' || *c == '\\') {
+            apr_file_putc('\\', outfile);
+            apr_file_putc(*c, outfile);
+        }
+        else if (*c < 0x20 || *c >= 0x7f) {
+            apr_file_printf(outfile, "\\u00%c%c", hex[*c >> 4], hex[*c & 0xf]);
+        }
+        else {
+            apr_file_putc(*c, outfile);
+        }
+    }
+}
+
+static void read_schema(apr_pool_t *p, const unsigned char *rec,
+                        apr_size_t len)
+{
+    const unsigned char *end = rec + len;
+    schema_t *schema;
+    apr_uint32_t *id, known;
+    int i;
+
+    if (len < 6) {
+        corrupt("short schema record");
+    }
+    known = get32(rec);
+    rec += 4;
+
+    /* every row repeats its schema */
+    if (apr_hash_get(schemas, &known, sizeof(known))) {
+        return;
+    }
+    id = apr_palloc(p, sizeof(*id));
+    *id = known;
+
+    schema = apr_palloc(p, sizeof(*schema));
+    schema->nfields = get16(rec);
+    rec += 2;
+    schema->types = apr_palloc(p, schema->nfields + 1);
+    schema->names = apr_palloc(p, (schema->nfields + 1) * sizeof(char *));
+
+    for (i = 0; i < schema->nfields; i++) {
+        apr_uint32_t l;
+
+        if (end - rec < 3) {
+            corrupt("short schema record");
+        }
+        schema->types[i] = rec[0];
+        l = get16(rec + 1);
+        rec += 3;
+        if ((apr_uint32_t)(end - rec) < l) {
+            corrupt("short schema record");
+        }
+        schema->names[i] = apr_pstrmemdup(p, (const char *)rec, l);
+        rec += l;
+    }
+
+    apr_hash_set(schemas, id, sizeof(*id), schema);
+}
+
+static void print_row(const unsigned char *rec, apr_size_t len)
+{
+    const unsigned char *end = rec + len;
+    schema_t *schema;
+    apr_uint32_t id;
+    int i;
+
+    if (len < 4) {
+        corrupt("short row record");
+    }
+    id = get32(rec);
+    rec += 4;
+
+    schema = apr_hash_get(schemas, &id, sizeof(id));
+    if (!schema) {
+        apr_file_printf(errfile, "%s: skipping a row of unknown schema %08x"
+                        NL, shortname, id);
+        return;
+    }
+
+    if (tabs && schema != last_schema) {
+        for (i = 0; i < schema->nfields; i++) {
+            apr_file_printf(outfile, "%s%s", i ? "\t" : "",
+                            schema->names[i]);
+        }
+        apr_file_puts(NL, outfile);
+    }
+    last_schema = schema;
+
+    if (!tabs) {
+        apr_file_putc('{', outfile);
+    }
+    for (i = 0; i < schema->nfields; i++) {
+        if (tabs) {
+            if (i) {
+                apr_file_putc('\t', outfile);
+            }
+        }
+        else {
+            apr_file_printf(outfile, "%s\"", i ? "," : "");
+            print_string(schema->names[i], strlen(schema->names[i]));
+            apr_file_puts("\":", outfile);
+        }
+
+        if (schema->types[i] == FIELD_NUMBER) {
+            if (end - rec < 9) {
+                corrupt("short row record");
+            }
+            if (rec[0]) {
+                apr_int64_t n = (apr_int64_t)(((apr_uint64_t)get32(rec + 1)
+                                               << 32) | get32(rec + 5));
+
+                apr_file_printf(outfile, "%" APR_INT64_T_FMT, n);
+            }
+            else {
+                apr_file_puts(tabs ? "-" : "null", outfile);
+            }
+            rec += 9;
+        }
+        else {
+            apr_uint32_t l;
+
+            if (end - rec < 4) {
+                corrupt("short row record");
+            }
+            l = get32(rec);
+            rec += 4;
+            if (l == FIELD_NULL) {
+                apr_file_puts(tabs ? "-" : "null", outfile);
+                continue;
+            }
+            if ((apr_uint32_t)(end - rec) < l) {
+                corrupt("short row record");
+            }
+            if (!tabs) {
+                apr_file_putc('"', outfile);
+            }
+            print_string((const char *)rec, l);
+            if (!tabs) {
+                apr_file_putc('"', outfile);
+            }
+            rec += l;
+        }
+    }
+    if (!tabs) {
+        apr_file_putc('}', outfile);
+    }
+    apr_file_puts(NL, outfile);
+}
+
+/* The schemas are kept from one file to the next, for the rows of the
+ * children that wrote their schema to an earlier file of a rotated log. */
+static void decode_file(apr_pool_t *p, apr_file_t *infile)
+{
+    static unsigned char *rec = NULL;
+    static apr_size_t alloc = 0;
+    apr_status_t status;
+
+    for (;;) {
+        unsigned char head[4];
+        apr_size_t len;
+
+        status = apr_file_read_full(infile, head, sizeof(head), &len);
+        if (status == APR_EOF && len == 0) {
+            break;
+        }
+        if (status != APR_SUCCESS) {
+            corrupt("truncated record");
+        }
+
+        len = get32(head);
+        if (len < 1 || len > MAX_RECORD_LEN) {
+            corrupt("bad record length");
+        }
+        if (len > alloc) {
+            alloc = len > 4096 ? len : 4096;
+            rec = apr_palloc(p, alloc);
+        }
+        if (apr_file_read_full(infile, rec, len, NULL) != APR_SUCCESS) {
+            corrupt("truncated record");
+        }
+
+        if (rec[0] == RECORD_SCHEMA) {
+            read_schema(p, rec + 1, len - 1);
+        }
+        else if (rec[0] == RECORD_ROW) {
+            print_row(rec + 1, len - 1);
+        }
+        else {
+            corrupt("unknown record kind");
+        }
+    }
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_file_t *infile;
+    apr_getopt_t *o;
+    apr_pool_t *pool;
+    apr_status_t status;
+    const char *arg;
+    char opt;
+
+    if (apr_app_initialize(&argc, &argv, NULL) != APR_SUCCESS) {
+        return 1;
+    }
+    atexit(apr_terminate);
+
+    if (argc) {
+        shortname = apr_filepath_name_get(argv[0]);
+    }
+
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+        return 1;
+    }
+    apr_file_open_stderr(&errfile, pool);
+    apr_getopt_init(&o, pool, argc, argv);
+
+    while (1) {
+        status = apr_getopt(o, "t", &opt, &arg);
+        if (status == APR_EOF) {
+            break;
+        }
+        else if (status != APR_SUCCESS) {
+            usage();
+        }
+        else {
+            switch (opt) {
+            case 't':
+                tabs = 1;
+                break;
+            } /* switch */
+        } /* else */
+    } /* while */
+
+    apr_file_open_stdout(&outfile, pool);
+    apr_file_buffer_set(outfile, apr_palloc(pool, 65536), 65536);
+
+    schemas = apr_hash_make(pool);
+
+    if (o->ind == argc) {
+        apr_file_open_stdin(&infile, pool);
+        decode_file(pool, infile);
+    }
+    for (; o->ind < argc; o->ind++) {
+        status = apr_file_open(&infile, argv[o->ind],
+                               APR_READ | APR_BINARY | APR_BUFFERED,
+                               APR_OS_DEFAULT, pool);
+        if (status != APR_SUCCESS) {
+            apr_file_printf(errfile, "%s: could not open %s" NL, shortname,
+                            argv[o->ind]);
+            return 1;
+        }
+        decode_file(pool, infile);
+        apr_file_close(infile);
+    }
+
+    apr_file_flush(outfile);
+    return 0;
+}
@@ -0,0 +1,195 @@
+#!/bin/sh
+#
+# Licensed to the Apache Software Foundation (ASF) under one or more
+# contributor license agreements.  See the NOTICE file distributed with
+# this work for additional information regarding copyright ownership.
+# The ASF licenses this file to You under the Apache License, Version 2.0
+# (the "License"); you may not use this file except in compliance with
+# the License.  You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# This script tests the background refresh of stapled OCSP responses
+# (SSLStaplingPrefetch) against a local stand-in for an OCSP responder,
+# "openssl ocsp -port".  It populates a directory 'stapling' with a CA,
+# a server certificate naming the local responder and an httpd.conf,
+# starts the responder and httpd, and checks that
+#
+#  1. the response is fetched at startup, before any handshake,
+#  2. handshakes get the response stapled,
+#  3. handshakes still get it stapled once the responder is gone.
+#
+# httpd must have been built with mod_ssl, mod_watchdog and
+# mod_socache_shmcb, statically or as modules found in MODDIR.
+#
+# $Id$
+#
+#
+OPENSSL=${OPENSSL:-openssl}
+DIR=${DIR:-$PWD/stapling}
+PORT=${PORT:-8443}
+OCSP_PORT=${OCSP_PORT:-8888}
+
+args=`getopt fd:p:o: $*`
+if [ $? != 0 -o $# -lt 1 ]; then
+    echo "Syntax: $0 [-f] [-d outdir] [-p port] [-o ocspport] path/to/httpd"
+    echo "    -f        Force overwriting of outdir (default is $DIR)"
+    echo "    -d dir    Directory to create the test server in (default is $DIR)"
+    echo "    -p port   Port of the test server (default is $PORT)"
+    echo "    -o port   Port of the OCSP responder (default is $OCSP_PORT)"
+    exit 1
+fi
+set -- $args
+for i
+do
+    case "$i"
+    in
+        -f)
+            FORCE=1
+            shift;;
+        -d)
+            DIR=$2; shift
+            shift;;
+        -p)
+            PORT=$2; shift
+            shift;;
+        -o)
+            OCSP_PORT=$2; shift
+            shift;;
+        --)
+            shift; break;
+    esac
+done
+
+HTTPD=$1
+MODDIR=${MODDIR:-`dirname $HTTPD`/../modules}
+
+if [ ! -x "$HTTPD" ]; then
+    echo "Aborted - $HTTPD is not an executable."
+    exit 1
+fi
+
+if test -d ${DIR} -a "x$FORCE" != "x1"; then
+    echo Aborted - already an ${DIR} directory. Use the -f flag to overwrite.
+    exit 1
+fi
+
+rm -rf ${DIR}
+mkdir -p ${DIR}/logs ${DIR}/htdocs || exit 1
+echo stapled > ${DIR}/htdocs/index.html
+
+# A CA that also signs the OCSP responses, and a database of the
+# certificates it issued for the responder to answer from.
+#
+cat > ${DIR}/ca.cnf << EOM
+[ ca ]
+default_ca = testca
+
+[ testca ]
+database = ${DIR}/index.txt
+new_certs_dir = ${DIR}
+serial = ${DIR}/serial
+certificate = ${DIR}/ca.pem
+private_key = ${DIR}/ca.key
+default_md = sha256
+default_days = 10
+policy = policy_any
+x509_extensions = server_ext
+
+[ policy_any ]
+commonName = supplied
+
+[ server_ext ]
+basicConstraints = CA:FALSE
+authorityInfoAccess = OCSP;URI:http://127.0.0.1:${OCSP_PORT}/
+EOM
+: > ${DIR}/index.txt
+echo 01 > ${DIR}/serial
+
+$OPENSSL req -new -x509 -nodes -batch -days 10 \
+    -subj '/CN=Stapling Test CA/' \
+    -keyout ${DIR}/ca.key -out ${DIR}/ca.pem \
+    || exit 2
+
+$OPENSSL req -new -nodes -batch -subj '/CN=localhost/' \
+    -keyout ${DIR}/server.key -out ${DIR}/server.req \
+    || exit 3
+
+$OPENSSL ca -batch -notext -config ${DIR}/ca.cnf \
+    -in ${DIR}/server.req -out ${DIR}/server.pem \
+    || exit 4
+
+# Load whatever the server was not built with statically.
+#
+for m in mpm_prefork unixd authz_core log_config watchdog \
+         socache_shmcb ssl
+do
+    if [ -f ${MODDIR}/mod_$m.so ]; then
+        echo "LoadModule ${m}_module ${MODDIR}/mod_$m.so"
+    fi
+done > ${DIR}/httpd.conf
+
+cat >> ${DIR}/httpd.conf << EOM
+ServerRoot ${DIR}
+Listen 127.0.0.1:${PORT}
+PidFile ${DIR}/logs/httpd.pid
+ErrorLog ${DIR}/logs/error_log
+LogLevel debug
+DocumentRoot ${DIR}/htdocs
+
+SSLStaplingCache shmcb:${DIR}/logs/stapling(32768)
+SSLSessionCache none
+
+<VirtualHost 127.0.0.1:${PORT}>
+    ServerName localhost
+    SSLEngine on
+    SSLCertificateFile ${DIR}/server.pem
+    SSLCertificateKeyFile ${DIR}/server.key
+    SSLCertificateChainFile ${DIR}/ca.pem
+    SSLUseStapling on
+    SSLStaplingPrefetch on
+</VirtualHost>
+EOM
+
+stapled() {
+    echo | $OPENSSL s_client -connect 127.0.0.1:${PORT} \
+        -servername localhost -status 2>&1 \
+        | grep -q "OCSP Response Status: successful"
+}
+
+fail() {
+    echo "FAILED: $*"
+    echo "See ${DIR}/logs/error_log and ${DIR}/logs/ocsp_log."
+    exit 1
+}
+
+$OPENSSL ocsp -index ${DIR}/index.txt -port ${OCSP_PORT} \
+    -rsigner ${DIR}/ca.pem -rkey ${DIR}/ca.key -CA ${DIR}/ca.pem \
+    -nmin 5 -text > ${DIR}/logs/ocsp_log 2>&1 &
+OCSP_PID=$!
+trap '$HTTPD -d ${DIR} -f ${DIR}/httpd.conf -k stop 2>/dev/null;
+      kill $OCSP_PID 2>/dev/null' 0
+sleep 1
+
+$HTTPD -d ${DIR} -f ${DIR}/httpd.conf -k start || fail "httpd did not start"
+sleep 3
+
+grep -q "OCSP Request Data" ${DIR}/logs/ocsp_log \
+    || fail "no OCSP query at startup"
+echo "ok 1 - response fetched at startup"
+
+stapled || fail "no response stapled"
+echo "ok 2 - response stapled"
+
+kill $OCSP_PID
+wait $OCSP_PID 2>/dev/null
+stapled || fail "no response stapled without the responder"
+echo "ok 3 - cached response stapled without the responder"
+
+exit 0
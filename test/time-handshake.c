@@ -0,0 +1,173 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+time-handshake: full TLS handshakes per second against a server, for
+comparing the cost of the server's private key operations, e.g. with and
+without SSLKeyServer, or with a different SSLKeyServerThreads.
+
+Every handshake is a new connection without session resumption, so that
+each one costs the server a private key operation; the connection is
+closed once the handshake is done.  argv[1] and argv[2] are the address
+and port of the server, argv[3] the number of concurrent client
+processes, argv[4] the number of handshakes per process.  The optional
+argv[5] is the cipher list, e.g. "AES128-SHA" for an RSA key exchange
+(a private key decryption) rather than an ECDHE one (a signature).
+
+Run the client on another box than the server, or at least with fewer
+processes than the server has cores, and choose the number of
+handshakes such that the run lasts for some seconds.
+
+compile with:
+
+gcc -o time-handshake -Wall -O time-handshake.c -lssl -lcrypto
+*/
+
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static struct sockaddr_in server_addr;
+
+static int handshake(SSL_CTX *ctx)
+{
+    const int just_say_no = 1;
+    SSL *ssl;
+    int s, ok;
+
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return 0;
+    }
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *)&just_say_no,
+               sizeof(just_say_no));
+    if (connect(s, (struct sockaddr *)&server_addr,
+                sizeof(server_addr)) < 0) {
+        perror("connect");
+        close(s);
+        return 0;
+    }
+
+    ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, s);
+    ok = (SSL_connect(ssl) == 1);
+    if (!ok) {
+        ERR_print_errors_fp(stderr);
+    }
+    else {
+        SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    close(s);
+
+    return ok;
+}
+
+static int client(int iterations, const char *ciphers)
+{
+    SSL_CTX *ctx;
+    int i, failed = 0;
+
+    ctx = SSL_CTX_new(SSLv23_client_method());
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    if (ciphers && !SSL_CTX_set_cipher_list(ctx, ciphers)) {
+        fprintf(stderr, "no usable cipher in %s\n", ciphers);
+        return 1;
+    }
+
+    for (i = 0; i < iterations; ++i) {
+        if (!handshake(ctx)) {
+            ++failed;
+        }
+    }
+
+    SSL_CTX_free(ctx);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct timeval first, last;
+    double ms;
+    int num_child, num_iter, i, status, failed = 0;
+
+    if (argc != 5 && argc != 6) {
+        fprintf(stderr, "usage: time-handshake a.b.c.d port #children "
+                        "#handshakes-per-child [ciphers]\n");
+        exit(1);
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(argv[1]);
+    server_addr.sin_port = htons(atoi(argv[2]));
+    num_child = atoi(argv[3]);
+    num_iter = atoi(argv[4]);
+    if (server_addr.sin_addr.s_addr == INADDR_NONE || num_child < 1
+        || num_iter < 1) {
+        fprintf(stderr, "bad arguments\n");
+        exit(1);
+    }
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    SSL_library_init();
+    SSL_load_error_strings();
+#endif
+
+    gettimeofday(&first, NULL);
+    for (i = 0; i < num_child; ++i) {
+        pid_t pid = fork();
+
+        if (pid == -1) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            exit(client(num_iter, argc == 6 ? argv[5] : NULL));
+        }
+    }
+    for (i = 0; i < num_child; ++i) {
+        if (wait(&status) < 0 || !WIFEXITED(status)
+            || WEXITSTATUS(status)) {
+            ++failed;
+        }
+    }
+    gettimeofday(&last, NULL);
+
+    ms = (last.tv_sec - first.tv_sec) * 1000.0
+         + (last.tv_usec - first.tv_usec) / 1000.0;
+    printf("%d handshakes in %.0f ms: %.1f handshakes/s, %.3f ms each\n",
+           num_child * num_iter, ms, num_child * num_iter * 1000.0 / ms,
+           ms / num_iter);
+    if (failed) {
+        printf("%d client(s) saw failed handshakes\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,480 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+time-logformat: nanoseconds and pool allocations per access log line,
+for the two ways mod_log_config has rendered the combined log format
+
+    %h %l %u %t "%r" %>s %b "%{Referer}i" "%{User-Agent}i"
+
+"handlers" is how config_log_transaction() used to work: every item,
+constant strings included, goes through its handler, the numbers and
+the time are formatted into strings allocated from the request pool,
+and the length of each piece is taken with strlen().  "compiled" is how
+it works now: constants come with their length, and %t, %>s and %b are
+rendered by their op into a single area allocated together with the
+piece and length arrays.  The string items (%h, %r, %{...}i) go through
+the same handler in both.  Both then join the pieces as the default
+log writer does.
+
+The code follows mod_log_config.c, with a bump allocator counting the
+apr_palloc() calls, cleared for every line as the request pool is.  Both
+renderers must give the same line, which is checked before timing.
+
+argv[1] is the number of lines to render, e.g. 10000000.
+
+compile with:
+
+gcc -o time-logformat -Wall -O2 time-logformat.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define POOL_SIZE 8192
+#define DEFAULT_REQUEST_TIME_SIZE 32
+#define LOG_OP_MAX_WIDTH DEFAULT_REQUEST_TIME_SIZE
+
+struct pool {
+    char *base;
+    size_t used;
+    long allocs;
+    long bytes;
+};
+
+static void *palloc(struct pool *p, size_t size)
+{
+    void *mem;
+
+    size = (size + 7) & ~(size_t)7;
+    if (p->used + size > POOL_SIZE) {
+        fprintf(stderr, "pool exhausted\n");
+        exit(1);
+    }
+    mem = p->base + p->used;
+    p->used += size;
+    p->allocs++;
+    p->bytes += size;
+    return mem;
+}
+
+struct request {
+    struct pool *pool;
+    const char *remote_host;
+    const char *remote_logname;
+    const char *user;
+    const char *the_request;
+    const char *referer;
+    const char *user_agent;
+    int status;
+    long bytes_sent;
+    time_t request_time;
+};
+
+typedef const char *item_fn(struct request *r, const char *arg);
+
+enum {
+    LOG_OP_HANDLER, LOG_OP_CONSTANT, LOG_OP_STATUS, LOG_OP_BYTES_CLF,
+    LOG_OP_TIME_BEGIN
+};
+
+struct item {
+    item_fn *func;
+    const char *arg;
+    int op;
+    int arg_len;
+};
+
+/* ap_escape_logitem() without the escapes, which the test data has none
+ * of: it allocates for every call */
+static char *escape_logitem(struct pool *p, const char *str)
+{
+    char *ret;
+
+    if (!str) {
+        return NULL;
+    }
+    ret = palloc(p, 4 * strlen(str) + 1);
+    strcpy(ret, str);
+    return ret;
+}
+
+static const char *constant_item(struct request *r, const char *arg)
+{
+    return arg;
+}
+
+static const char *log_remote_host(struct request *r, const char *arg)
+{
+    return escape_logitem(r->pool, r->remote_host);
+}
+
+static const char *log_remote_logname(struct request *r, const char *arg)
+{
+    return escape_logitem(r->pool, r->remote_logname);
+}
+
+static const char *log_remote_user(struct request *r, const char *arg)
+{
+    return r->user ? escape_logitem(r->pool, r->user) : "-";
+}
+
+static const char *log_request_line(struct request *r, const char *arg)
+{
+    return escape_logitem(r->pool, r->the_request);
+}
+
+static const char *log_header_in(struct request *r, const char *arg)
+{
+    return escape_logitem(r->pool, strcmp(arg, "Referer") ? r->user_agent
+                                                          : r->referer);
+}
+
+static const char *log_status(struct request *r, const char *arg)
+{
+    /* pfmt(), i.e. apr_psprintf(p, "%d") */
+    char buf[16];
+    int len = snprintf(buf, sizeof(buf), "%d", r->status);
+
+    return memcpy(palloc(r->pool, len + 1), buf, len + 1);
+}
+
+static const char *clf_log_bytes_sent(struct request *r, const char *arg)
+{
+    /* apr_off_t_toa() */
+    char buf[24], *p = buf + sizeof(buf);
+    long n = r->bytes_sent;
+
+    if (!n) {
+        return "-";
+    }
+    *--p = '\0';
+    do {
+        *--p = '0' + (char)(n % 10);
+        n /= 10;
+    } while (n);
+    return memcpy(palloc(r->pool, buf + sizeof(buf) - p), p,
+                  buf + sizeof(buf) - p);
+}
+
+typedef struct {
+    unsigned t;
+    char timestr[DEFAULT_REQUEST_TIME_SIZE];
+    unsigned t_validate;
+} cached_request_time;
+
+#define TIME_CACHE_SIZE 4
+#define TIME_CACHE_MASK 3
+static cached_request_time request_time_cache[TIME_CACHE_SIZE];
+
+static const char *month_snames[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static void fill_time_cache(cached_request_time *cached_time, time_t t)
+{
+    struct tm xt;
+    int timz;
+    char sign;
+
+    localtime_r(&t, &xt);
+    timz = (int)xt.tm_gmtoff;
+    if (timz < 0) {
+        timz = -timz;
+        sign = '-';
+    }
+    else {
+        sign = '+';
+    }
+    cached_time->t = (unsigned)t;
+    snprintf(cached_time->timestr, DEFAULT_REQUEST_TIME_SIZE,
+             "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
+             xt.tm_mday, month_snames[xt.tm_mon], (xt.tm_year + 1900) % 10000,
+             xt.tm_hour, xt.tm_min, xt.tm_sec,
+             sign, timz / (60*60) % 100, (timz % (60*60)) / 60);
+    cached_time->t_validate = (unsigned)t;
+}
+
+/* The former CLF branch of log_request_time(): a pool copy of the cache
+ * entry */
+static const char *log_request_time(struct request *r, const char *arg)
+{
+    cached_request_time *cached_time = palloc(r->pool, sizeof(*cached_time));
+    unsigned t_seconds = (unsigned)r->request_time;
+    unsigned i = t_seconds & TIME_CACHE_MASK;
+
+    *cached_time = request_time_cache[i];
+    if ((t_seconds != cached_time->t) ||
+        (t_seconds != cached_time->t_validate)) {
+        fill_time_cache(cached_time, r->request_time);
+        request_time_cache[i] = *cached_time;
+    }
+    return cached_time->timestr;
+}
+
+/* render_request_time_clf() */
+static int render_request_time_clf(char *buf, time_t request_time)
+{
+    cached_request_time cached_time;
+    unsigned t_seconds = (unsigned)request_time;
+    unsigned i = t_seconds & TIME_CACHE_MASK;
+    int len;
+
+    cached_time = request_time_cache[i];
+    if ((t_seconds != cached_time.t) ||
+        (t_seconds != cached_time.t_validate)) {
+        fill_time_cache(&cached_time, request_time);
+        request_time_cache[i] = cached_time;
+    }
+
+    len = strlen(cached_time.timestr);
+    memcpy(buf, cached_time.timestr, len + 1);
+    return len;
+}
+
+static int render_number(char *buf, long n)
+{
+    char digits[20];
+    unsigned long u = n < 0 ? -(unsigned long)n : (unsigned long)n;
+    int i = 0, len = 0;
+
+    do {
+        digits[i++] = '0' + (char)(u % 10);
+        u /= 10;
+    } while (u);
+
+    if (n < 0) {
+        buf[len++] = '-';
+    }
+    while (i) {
+        buf[len++] = digits[--i];
+    }
+    return len;
+}
+
+static int render_item(struct request *r, struct item *item, char *buf)
+{
+    switch (item->op) {
+    case LOG_OP_STATUS:
+        return render_number(buf, r->status);
+    case LOG_OP_BYTES_CLF:
+        if (r->bytes_sent) {
+            return render_number(buf, r->bytes_sent);
+        }
+        break;
+    case LOG_OP_TIME_BEGIN:
+        return render_request_time_clf(buf, r->request_time);
+    }
+
+    *buf = '-';
+    return 1;
+}
+
+/* The combined format as parse_log_string() used to leave it, and as
+ * it is compiled now (the last constant merged with the newline) */
+static struct item handler_items[] = {
+    { log_remote_host, NULL },
+    { constant_item, " " },
+    { log_remote_logname, NULL },
+    { constant_item, " " },
+    { log_remote_user, NULL },
+    { constant_item, " " },
+    { log_request_time, "" },
+    { constant_item, " \"" },
+    { log_request_line, NULL },
+    { constant_item, "\" " },
+    { log_status, NULL },
+    { constant_item, " " },
+    { clf_log_bytes_sent, NULL },
+    { constant_item, " \"" },
+    { log_header_in, "Referer" },
+    { constant_item, "\" \"" },
+    { log_header_in, "User-Agent" },
+    { constant_item, "\"" },
+    { constant_item, "\n" }
+};
+
+static struct item compiled_items[] = {
+    { log_remote_host, NULL, LOG_OP_HANDLER },
+    { constant_item, " ", LOG_OP_CONSTANT, 1 },
+    { log_remote_logname, NULL, LOG_OP_HANDLER },
+    { constant_item, " ", LOG_OP_CONSTANT, 1 },
+    { log_remote_user, NULL, LOG_OP_HANDLER },
+    { constant_item, " ", LOG_OP_CONSTANT, 1 },
+    { log_request_time, "", LOG_OP_TIME_BEGIN },
+    { constant_item, " \"", LOG_OP_CONSTANT, 2 },
+    { log_request_line, NULL, LOG_OP_HANDLER },
+    { constant_item, "\" ", LOG_OP_CONSTANT, 2 },
+    { log_status, NULL, LOG_OP_STATUS },
+    { constant_item, " ", LOG_OP_CONSTANT, 1 },
+    { clf_log_bytes_sent, NULL, LOG_OP_BYTES_CLF },
+    { constant_item, " \"", LOG_OP_CONSTANT, 2 },
+    { log_header_in, "Referer", LOG_OP_HANDLER },
+    { constant_item, "\" \"", LOG_OP_CONSTANT, 3 },
+    { log_header_in, "User-Agent", LOG_OP_HANDLER },
+    { constant_item, "\"\n", LOG_OP_CONSTANT, 2 }
+};
+
+#define NELTS(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+/* ap_default_log_writer() joins the pieces in one pool buffer */
+static char *log_writer(struct pool *p, const char **strs, int *strl,
+                        int nelts, size_t len)
+{
+    char *str = palloc(p, len + 1), *s = str;
+    int i;
+
+    for (i = 0; i < nelts; ++i) {
+        memcpy(s, strs[i], strl[i]);
+        s += strl[i];
+    }
+    *s = '\0';
+    return str;
+}
+
+static const char *process_item(struct request *r, struct item *item)
+{
+    const char *cp = item->func(r, (char *)item->arg);
+
+    return cp ? cp : "-";
+}
+
+static char *render_handlers(struct request *r)
+{
+    int nelts = NELTS(handler_items), i;
+    const char **strs = palloc(r->pool, sizeof(char *) * nelts);
+    int *strl = palloc(r->pool, sizeof(int) * nelts);
+    size_t len = 0;
+
+    for (i = 0; i < nelts; ++i) {
+        strs[i] = process_item(r, &handler_items[i]);
+        len += strl[i] = strlen(strs[i]);
+    }
+    return log_writer(r->pool, strs, strl, nelts, len);
+}
+
+static char *render_compiled(struct request *r)
+{
+    int nelts = NELTS(compiled_items), nops = 0, i;
+    const char **strs;
+    int *strl;
+    char *out;
+    size_t len = 0;
+
+    for (i = 0; i < nelts; ++i) {
+        if (compiled_items[i].op > LOG_OP_CONSTANT) {
+            ++nops;
+        }
+    }
+    strs = palloc(r->pool, nelts * (sizeof(char *) + sizeof(int))
+                           + nops * LOG_OP_MAX_WIDTH);
+    strl = (int *)(strs + nelts);
+    out = (char *)(strl + nelts);
+
+    for (i = 0; i < nelts; ++i) {
+        struct item *item = &compiled_items[i];
+
+        if (item->op == LOG_OP_CONSTANT) {
+            strs[i] = item->arg;
+            strl[i] = item->arg_len;
+        }
+        else if (item->op != LOG_OP_HANDLER) {
+            strs[i] = out;
+            strl[i] = render_item(r, item, out);
+            out += strl[i];
+        }
+        else {
+            strs[i] = process_item(r, item);
+            strl[i] = strlen(strs[i]);
+        }
+        len += strl[i];
+    }
+    return log_writer(r->pool, strs, strl, nelts, len);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, char *(*render)(struct request *),
+                struct request *r, long lines)
+{
+    double start, ns;
+    long i, allocs, bytes;
+    size_t total = 0;
+
+    r->pool->allocs = r->pool->bytes = 0;
+    start = now_ns();
+    for (i = 0; i < lines; ++i) {
+        r->pool->used = 0;
+        total += strlen(render(r));
+    }
+    ns = now_ns() - start;
+    allocs = r->pool->allocs;
+    bytes = r->pool->bytes;
+
+    printf("%-9s %7.1f ns/line, %4.1f allocations and %5.1f bytes "
+           "per line (%lu bytes logged)\n", name, ns / lines,
+           (double)allocs / lines, (double)bytes / lines,
+           (unsigned long)total);
+}
+
+int main(int argc, char **argv)
+{
+    struct pool pool;
+    struct request r;
+    char *a, *b;
+    long lines;
+
+    if (argc != 2 || (lines = atol(argv[1])) < 1) {
+        fprintf(stderr, "usage: time-logformat #lines\n");
+        exit(1);
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pool.base = malloc(POOL_SIZE);
+    r.pool = &pool;
+    r.remote_host = "192.0.2.17";
+    r.remote_logname = NULL;
+    r.user = NULL;
+    r.the_request = "GET /images/logo.png?v=20110329 HTTP/1.1";
+    r.referer = "http://www.example.com/index.html";
+    r.user_agent = "Mozilla/5.0 (X11; Linux x86_64; rv:4.0) "
+                   "Gecko/20100101 Firefox/4.0";
+    r.status = 200;
+    r.bytes_sent = 23456;
+    r.request_time = time(NULL);
+
+    a = strdup(render_handlers(&r));
+    b = render_compiled(&r);
+    if (strcmp(a, b)) {
+        fprintf(stderr, "the renderers differ:\n%s%s", a, b);
+        exit(1);
+    }
+    printf("%s", a);
+
+    run("handlers", render_handlers, &r, lines);
+    run("compiled", render_compiled, &r, lines);
+
+    return 0;
+}
@@ -0,0 +1,547 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+time-requests: requests per second over keep-alive connections, for
+comparing the per-request cost of the server's protocol handling, e.g.
+the response header serialization, between two builds.
+
+The request is read from a file and sent as is, so it must be a complete
+HTTP/1.1 request with CRLF line ends, e.g.
+
+    GET /index.html HTTP/1.1
+    Host: localhost
+
+argv[1] and argv[2] are the address and port of the server, argv[3] the
+number of concurrent client processes, each with its own connection,
+argv[4] the number of requests per process and argv[5] the request file.
+A connection closed by the server (MaxKeepAliveRequests, errors) is
+reopened.  Responses are read up to their end (Content-Length, chunked,
+or none for HEAD, 1xx, 204 and 304), and the number of responses per
+status and the average size of the response header are printed.
+
+Small responses with many header fields stress the header code; give
+the resource some with mod_headers, e.g.
+
+    Header add X-Test-1 "some value"
+    ...
+
+With the optional argv[6] and argv[7], a chunked request body of that
+many chunks of that many bytes each is appended to the request, whose
+file then holds the header only, e.g.
+
+    POST /upload HTTP/1.1
+    Host: localhost
+    Transfer-Encoding: chunked
+
+Many small chunks stress the chunked body decoding; the resource must
+read the body, e.g. a CGI script or a proxied backend.
+
+With "conditional" as argv[6] instead, the validators of the first
+response (ETag and Last-Modified) are added to the request as
+If-None-Match and If-Modified-Since, as a browser revalidating its
+cache would, so that all later responses should be 304 Not Modified.
+
+Run the client on another box than the server, or at least with fewer
+processes than the server has cores, and choose the number of requests
+such that the run lasts for some seconds.
+
+compile with:
+
+gcc -o time-requests -Wall -O time-requests.c
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAX_STATUS 600
+
+struct stats {
+    long responses[MAX_STATUS];
+    long header_bytes;
+    long connections;
+    long errors;
+};
+
+struct conn {
+    int s;
+    int pos, len;
+    char buf[65536];
+};
+
+static struct sockaddr_in server_addr;
+static char *request;
+static size_t request_len;
+static int is_head;
+static int conditional;
+static char etag[256], last_modified[64];
+
+/* Case-blind search for a token in a header field value */
+static int has_token(const char *value, const char *token)
+{
+    size_t len = strlen(token);
+
+    for (; *value; ++value) {
+        if (!strncasecmp(value, token, len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int conn_open(struct conn *c)
+{
+    const int just_say_no = 1;
+
+    if ((c->s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return 0;
+    }
+    setsockopt(c->s, IPPROTO_TCP, TCP_NODELAY, (char *)&just_say_no,
+               sizeof(just_say_no));
+    if (connect(c->s, (struct sockaddr *)&server_addr,
+                sizeof(server_addr)) < 0) {
+        perror("connect");
+        close(c->s);
+        c->s = -1;
+        return 0;
+    }
+    c->pos = c->len = 0;
+    return 1;
+}
+
+static void conn_close(struct conn *c)
+{
+    if (c->s >= 0) {
+        close(c->s);
+        c->s = -1;
+    }
+}
+
+/* Read more data into the buffer, after moving what is left to the
+ * front; returns the number of bytes read, 0 at the end. */
+static int conn_fill(struct conn *c)
+{
+    int n;
+
+    if (c->pos) {
+        memmove(c->buf, c->buf + c->pos, c->len - c->pos);
+        c->len -= c->pos;
+        c->pos = 0;
+    }
+    if (c->len == sizeof(c->buf)) {
+        fprintf(stderr, "response line or header too long\n");
+        return 0;
+    }
+    do {
+        n = read(c->s, c->buf + c->len, sizeof(c->buf) - c->len);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        perror("read");
+        return 0;
+    }
+    c->len += n;
+    return n;
+}
+
+/* Returns the line at the read position, without its CRLF */
+static char *conn_line(struct conn *c)
+{
+    char *line, *end;
+
+    while (!(end = memchr(c->buf + c->pos, '\n', c->len - c->pos))) {
+        if (!conn_fill(c)) {
+            return NULL;
+        }
+    }
+    line = c->buf + c->pos;
+    c->pos = end + 1 - c->buf;
+    if (end > line && end[-1] == '\r') {
+        --end;
+    }
+    *end = '\0';
+    return line;
+}
+
+static int conn_skip(struct conn *c, long n)
+{
+    while (n > 0) {
+        int avail = c->len - c->pos;
+
+        if (!avail && !conn_fill(c)) {
+            return 0;
+        }
+        avail = c->len - c->pos;
+        if (avail > n) {
+            avail = n;
+        }
+        c->pos += avail;
+        n -= avail;
+    }
+    return 1;
+}
+
+static int skip_chunked(struct conn *c)
+{
+    char *line;
+    long size;
+
+    do {
+        if (!(line = conn_line(c))) {
+            return 0;
+        }
+        size = strtol(line, NULL, 16);
+        if (size && !conn_skip(c, size)) {
+            return 0;
+        }
+        if (size && (!(line = conn_line(c)) || *line)) {
+            return 0;
+        }
+    } while (size);
+
+    /* trailers */
+    do {
+        if (!(line = conn_line(c))) {
+            return 0;
+        }
+    } while (*line);
+
+    return 1;
+}
+
+/* Reads one response; returns its status, 0 when the connection was
+ * closed before the response and -1 on errors.  *keepalive is cleared
+ * when the server closes the connection after it. */
+static int read_response(struct conn *c, struct stats *st, int *keepalive)
+{
+    char *line;
+    int status, header_len = 0, chunked = 0;
+    long length = -1;
+
+    if (!(line = conn_line(c))) {
+        return 0;
+    }
+    if (strncmp(line, "HTTP/1.", 7) || strlen(line) < 12) {
+        fprintf(stderr, "bad status line: %s\n", line);
+        return -1;
+    }
+    status = atoi(line + 9);
+    *keepalive = (line[7] == '1');
+    header_len += c->pos - (line - c->buf);
+
+    while ((line = conn_line(c)) && *line) {
+        header_len += c->pos - (line - c->buf);
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            length = atol(line + 15);
+        }
+        else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+            chunked = has_token(line + 18, "chunked");
+        }
+        else if (!strncasecmp(line, "Connection:", 11)) {
+            if (has_token(line + 11, "close")) {
+                *keepalive = 0;
+            }
+            else if (has_token(line + 11, "keep-alive")) {
+                *keepalive = 1;
+            }
+        }
+        else if (conditional && !strncasecmp(line, "ETag:", 5)) {
+            snprintf(etag, sizeof(etag), "%s",
+                     line + 5 + strspn(line + 5, " "));
+        }
+        else if (conditional && !strncasecmp(line, "Last-Modified:", 14)) {
+            snprintf(last_modified, sizeof(last_modified), "%s",
+                     line + 14 + strspn(line + 14, " "));
+        }
+    }
+    if (!line) {
+        return -1;
+    }
+    header_len += c->pos - (line - c->buf);
+    st->header_bytes += header_len;
+
+    if (is_head || status < 200 || status == 204 || status == 304) {
+        return status;
+    }
+    if (chunked) {
+        return skip_chunked(c) ? status : -1;
+    }
+    if (length >= 0) {
+        return conn_skip(c, length) ? status : -1;
+    }
+    /* body up to the end of the connection */
+    while (conn_fill(c) > 0) {
+        c->pos = c->len;
+    }
+    *keepalive = 0;
+    return status;
+}
+
+static int send_request(struct conn *c)
+{
+    size_t sent = 0;
+
+    while (sent < request_len) {
+        ssize_t n = write(c->s, request + sent, request_len - sent);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        sent += n;
+    }
+    return 1;
+}
+
+/* Adds the validators of the response to the end of the request header */
+static void make_conditional(void)
+{
+    char *end, *req;
+    size_t head_len;
+
+    for (end = request; end + 4 <= request + request_len; ++end) {
+        if (!memcmp(end, "\r\n\r\n", 4)) {
+            break;
+        }
+    }
+    if (end + 4 > request + request_len) {
+        return;
+    }
+    head_len = end + 2 - request;
+    req = malloc(request_len + sizeof(etag) + sizeof(last_modified) + 64);
+    memcpy(req, request, head_len);
+    if (*etag) {
+        head_len += sprintf(req + head_len, "If-None-Match: %s\r\n", etag);
+    }
+    if (*last_modified) {
+        head_len += sprintf(req + head_len, "If-Modified-Since: %s\r\n",
+                            last_modified);
+    }
+    memcpy(req + head_len, end + 2, request_len - (end + 2 - request));
+    request_len += head_len - (end + 2 - request);
+    free(request);
+    request = req;
+}
+
+static void client(int iterations, struct stats *st)
+{
+    struct conn *c = malloc(sizeof(*c));
+    int i, keepalive = 0, status, retried = 0;
+
+    c->s = -1;
+    for (i = 0; i < iterations; ) {
+        if (c->s < 0) {
+            if (!conn_open(c)) {
+                ++st->errors;
+                return;
+            }
+            ++st->connections;
+        }
+        if (!send_request(c)) {
+            status = 0;
+        }
+        else {
+            status = read_response(c, st, &keepalive);
+        }
+        if (status <= 0) {
+            /* a keep-alive connection may have timed out: retry once */
+            conn_close(c);
+            if (status < 0 || retried++) {
+                ++st->errors;
+                return;
+            }
+            continue;
+        }
+        retried = 0;
+        ++st->responses[status < MAX_STATUS ? status : 0];
+        if (conditional && i == 0) {
+            make_conditional();
+        }
+        ++i;
+        if (!keepalive) {
+            conn_close(c);
+        }
+    }
+    conn_close(c);
+}
+
+static int read_request(const char *fname)
+{
+    int fd, n;
+    size_t size = 4096;
+
+    if ((fd = open(fname, O_RDONLY)) < 0) {
+        perror(fname);
+        return 0;
+    }
+    request = malloc(size);
+    while ((n = read(fd, request + request_len, size - request_len)) > 0) {
+        request_len += n;
+        if (request_len == size) {
+            request = realloc(request, size *= 2);
+        }
+    }
+    close(fd);
+    if (n < 0 || !request_len) {
+        fprintf(stderr, "%s: unable to read the request\n", fname);
+        return 0;
+    }
+    is_head = !strncmp(request, "HEAD ", 5);
+    return 1;
+}
+
+static void append_chunked_body(int chunks, int size)
+{
+    size_t need = request_len + chunks * (size + 16) + 8;
+    char *p;
+    int i;
+
+    request = realloc(request, need);
+    p = request + request_len;
+    for (i = 0; i < chunks; ++i) {
+        p += sprintf(p, "%x\r\n", size);
+        memset(p, 'x', size);
+        p += size;
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    p += sprintf(p, "0\r\n\r\n");
+    request_len = p - request;
+}
+
+int main(int argc, char **argv)
+{
+    struct timeval first, last;
+    struct stats total, st;
+    int fds[2];
+    double ms;
+    long count = 0;
+    int num_child, num_iter, i, status, failed = 0;
+
+    if (argc < 6 || argc > 8
+        || (argc == 7 && strcmp(argv[6], "conditional"))) {
+        fprintf(stderr, "usage: time-requests a.b.c.d port #children "
+                        "#requests-per-child request-file "
+                        "[#chunks chunk-size | conditional]\n");
+        exit(1);
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(argv[1]);
+    server_addr.sin_port = htons(atoi(argv[2]));
+    num_child = atoi(argv[3]);
+    num_iter = atoi(argv[4]);
+    if (server_addr.sin_addr.s_addr == INADDR_NONE || num_child < 1
+        || num_iter < 1) {
+        fprintf(stderr, "bad arguments\n");
+        exit(1);
+    }
+    if (!read_request(argv[5]) || pipe(fds) < 0) {
+        exit(1);
+    }
+    if (argc == 7) {
+        conditional = 1;
+    }
+    else if (argc == 8) {
+        int chunks = atoi(argv[6]), size = atoi(argv[7]);
+
+        if (chunks < 1 || size < 1) {
+            fprintf(stderr, "bad arguments\n");
+            exit(1);
+        }
+        append_chunked_body(chunks, size);
+    }
+
+    gettimeofday(&first, NULL);
+    for (i = 0; i < num_child; ++i) {
+        pid_t pid = fork();
+
+        if (pid == -1) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            memset(&st, 0, sizeof(st));
+            client(num_iter, &st);
+            /* less than PIPE_BUF would be atomic, but only the parent
+             * reads and it waits for everybody first */
+            if (write(fds[1], &st, sizeof(st)) != sizeof(st)) {
+                exit(1);
+            }
+            exit(st.errors ? 1 : 0);
+        }
+    }
+    close(fds[1]);
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < num_child; ++i) {
+        int j;
+
+        if (read(fds[0], &st, sizeof(st)) == sizeof(st)) {
+            for (j = 0; j < MAX_STATUS; ++j) {
+                total.responses[j] += st.responses[j];
+            }
+            total.header_bytes += st.header_bytes;
+            total.connections += st.connections;
+            total.errors += st.errors;
+        }
+    }
+    for (i = 0; i < num_child; ++i) {
+        if (wait(&status) < 0 || !WIFEXITED(status)
+            || WEXITSTATUS(status)) {
+            ++failed;
+        }
+    }
+    gettimeofday(&last, NULL);
+
+    for (i = 0; i < MAX_STATUS; ++i) {
+        count += total.responses[i];
+    }
+    ms = (last.tv_sec - first.tv_sec) * 1000.0
+         + (last.tv_usec - first.tv_usec) / 1000.0;
+    printf("%ld responses in %.0f ms over %ld connections: "
+           "%.1f requests/s, %.3f ms each\n",
+           count, ms, total.connections, count * 1000.0 / ms,
+           ms / num_iter);
+    if (count) {
+        printf("average response header: %ld bytes\n",
+               total.header_bytes / count);
+    }
+    for (i = 0; i < MAX_STATUS; ++i) {
+        if (total.responses[i]) {
+            printf("  %3d: %ld\n", i, total.responses[i]);
+        }
+    }
+    if (failed) {
+        printf("%d client(s) saw errors\n", failed);
+        return 1;
+    }
+    return 0;
+}